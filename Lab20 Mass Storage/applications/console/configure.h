@@ -55,6 +55,7 @@
 #define   CONSOLE_X_ORIENTATION 0   /* in number of characters */
 #define   CONSOLE_Y_ORIENTATION 0   /* in number of lines */
 #define ENABLE_USB         TRUE  /* enable Universtal Serial Bus Host */
+#define ENABLE_EMMC        FALSE /* SD card host instead of USB storage */
 #define ENABLE_XMODEM      TRUE  /* enable xmodem receiver */
 #define ENABLE_BOOTLOADER  FALSE /* enable boot loader */
 #define   MAX_BOOT_LENGTH  (1024 * 1024 * 16) /* 16 MB boot image max */
@@ -66,14 +67,15 @@
 /* USB Specific configuration */
 #define ENABLE_USB_HID     (TRUE && ENABLE_USB)  /* for keyboard/mouse*/
 #define ENABLE_USB_ETHER   (TRUE && ENABLE_USB)  /* enable Ethernet */
-#define ENABLE_USB_STORAGE (TRUE && ENABLE_USB)  /*enable Mass Storage*/
+#define ENABLE_USB_STORAGE (TRUE && ENABLE_USB && !ENABLE_EMMC) /*MSC*/
 #define ENABLE_USB_TASK    (FALSE && ENABLE_USB) /* USB intr task */
-#define ENABLE_FAT         (TRUE && ENABLE_USB_STORAGE) /* file system*/
+#define ENABLE_FAT         (TRUE && (ENABLE_USB_STORAGE || \
+                                     ENABLE_EMMC)) /* file system */
 
 /* DO NOT EDIT BELOW : Derived configurations */
 #define ENABLE_ETHER       ENABLE_USB_ETHER  /* enable Ethernet */
 #define MAX_TASKS          (10 + ENABLE_UART0 + ENABLE_UART1 + \
                             ENABLE_VIDEO + ENABLE_USB_TASK + \
-                            ENABLE_ETHER)
+                            ENABLE_ETHER + ENABLE_EMMC)
 
 #endif /* _CONFIGURE_H */
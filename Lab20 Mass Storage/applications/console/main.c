@@ -47,7 +47,7 @@
 /* Global variables                                                  */
 /*...................................................................*/
 extern int OgSp;
-int ScreenUp, UsbUp, NetUp;
+int ScreenUp, UsbUp, NetUp, EmmcUp;
 
 #if ENABLE_USB_HID
 
@@ -100,7 +100,29 @@ int UsbHostStart(char *command)
 
 #endif /* ENABLE_USB */
 
-#if ENABLE_USB_STORAGE
+#if ENABLE_EMMC
+int EmmcStart(char *command)
+{
+  if (!EmmcUp)
+  {
+    if (EmmcInit())
+    {
+      puts("Cannot initialize SD card host");
+      return TASK_FINISHED;
+    }
+
+    // Complete the mass storage commands from a task
+    TaskNew(2, EmmcPoll, NULL);
+    EmmcUp = TRUE;
+  }
+  else
+    puts("SD card host already initialized");
+
+  return TASK_FINISHED;
+}
+#endif /* ENABLE_EMMC */
+
+#if ENABLE_USB_STORAGE || ENABLE_EMMC
 
 struct partition
 {
@@ -118,9 +140,11 @@ u8 ReadSector[SECTOR_SIZE];
 i8 MountedPartition = 0;
 i8 PartitionToMount = -1;
 struct partition partitions[4];
+static u32 NextBlock; // block after the last read
 
-static void read_sector_callback(u8 *buffer, int buffLen, void *unused)
+static void read_sector_callback(u8 *buffer, int buffLen, void *payload)
 {
+  u32 block = (uintptr_t)payload;
   int i;
 
   // Output error and return if read failed
@@ -132,8 +156,8 @@ static void read_sector_callback(u8 *buffer, int buffLen, void *unused)
   else if (buffLen < SECTOR_SIZE)
     puts("read_sector_callback: short read, but parsing anyway... ");
 
-  // If we read the boot sector (offset 0)
-  if (MassStorageOffset() == 0)
+  // If we read the boot sector (block 0)
+  if (block == 0)
   {
     // Check boot signature
     if ((buffer[510] != 0x55) || (buffer[511] != 0xAA))
@@ -195,7 +219,7 @@ static void read_sector_callback(u8 *buffer, int buffLen, void *unused)
   else
   {
     // Otherwise we read a normal sector
-    u64 offset = MassStorageOffset();
+    u32 offset = block * SECTOR_SIZE;
 
     // Display the sector read
     printf("  Read bytes from offset %d:\n", (int)offset);
@@ -212,7 +236,7 @@ static void read_sector_callback(u8 *buffer, int buffLen, void *unused)
 
 int MountFilesystem(char *command)
 {
-  if (UsbUp)
+  if (MassStorageUp)
   {
     const char *arg1 = strchr(command, ' ');
     
@@ -222,50 +246,171 @@ int MountFilesystem(char *command)
     else
       PartitionToMount = 0;
 
-    // Seek to first block, the MBR
-    MassStorageSeek(0);
-
-    // Read the Master Boot Record (MBR)
-    if (MassStorageRead(ReadSector, 512, read_sector_callback, NULL) <= 0)
+    // Read the Master Boot Record (MBR), the first block
+    if (MassStorageRead(0, ReadSector, 512, read_sector_callback,
+                        (void *)0) <= 0)
       puts("MassStorageRead failed");
   }
   else
-    puts("USB not initialized");
+    puts("Storage not initialized");
 
   return TASK_FINISHED;
 }
 
 int ReadBlock(const char *command)
 {
-  if (UsbUp)
+  if (MassStorageUp)
   {
     const char *arg1 = strchr(command, ' ');
-    u32 block;
+    u32 block = NextBlock;
     
     if (arg1 != NULL)
     {
       block = atoi(++arg1); // skip past space
-      printf("Seeking to block %d (%s)\n", (int)block, arg1);
-      u64 offset = block * SECTOR_SIZE;
-
-      // Seek to the user specific offset
-      if (MassStorageSeek(offset) != offset)
-      {
-        puts("Seek failed");
-        return TASK_FINISHED;
-      }
+      printf("Reading block %d (%s)\n", (int)block, arg1);
     }
 
     // Read the sector
-    if (MassStorageRead(ReadSector, 512, read_sector_callback, NULL) <= 0)
+    NextBlock = block + 1;
+    if (MassStorageRead(block, ReadSector, 512, read_sector_callback,
+                        (void *)(uintptr_t)block) <= 0)
       puts("MassStorageRead failed");
   }
   else
-    puts("USB not initialized");
+    puts("Storage not initialized");
 
   return TASK_FINISHED;
 }
 
+
+/*...................................................................*/
+/* Mass storage benchmark                                            */
+/*...................................................................*/
+#define BENCH_BYTES     (4 * 1024 * 1024)
+#define BENCH_MAX_DEPTH 8
+
+static struct
+{
+  u8 *buffer;
+  u32 depth, blocks, next, done, total;
+  u64 start, latency, maxLatency;
+  u64 issued[BENCH_MAX_DEPTH];
+  int failed;
+} Bench;
+
+static void bench_issue(uintptr_t slot);
+
+static void bench_callback(u8 *buffer, int buffLen, void *payload)
+{
+  uintptr_t slot = (uintptr_t)payload;
+  u64 latency = TimerNow() - Bench.issued[slot];
+
+  if (buffLen != Bench.blocks * SECTOR_SIZE)
+    Bench.failed = TRUE;
+  Bench.latency += latency;
+  if (latency > Bench.maxLatency)
+    Bench.maxLatency = latency;
+  ++Bench.done;
+
+  // Keep the queue depth by issuing the next request into this slot
+  bench_issue(slot);
+}
+
+static void bench_issue(uintptr_t slot)
+{
+  if (Bench.failed || (Bench.next >= Bench.total))
+    return;
+
+  Bench.issued[slot] = TimerNow();
+  if (MassStorageRead(Bench.next * Bench.blocks,
+                      &Bench.buffer[slot * Bench.blocks * SECTOR_SIZE],
+                      Bench.blocks * SECTOR_SIZE, bench_callback,
+                      (void *)slot) < 0)
+    Bench.failed = TRUE;
+  else
+    ++Bench.next;
+}
+
+// Return the decimal number at *arg and advance past it and a space
+static u32 bench_arg(const char **arg, u32 defaultValue)
+{
+  u32 value = 0;
+
+  if ((*arg == NULL) || (**arg < '0') || (**arg > '9'))
+    return defaultValue;
+  for (; (**arg >= '0') && (**arg <= '9'); ++*arg)
+    value = value * 10 + **arg - '0';
+  if (**arg == ' ')
+    ++*arg;
+  return value;
+}
+
+/*...................................................................*/
+/* MassStorageBench: Read 4 MB from block zero with up to 'depth'    */
+/*                   requests of 'blocks' queued, 'bench depth       */
+/*                   blocks', and report throughput and latency      */
+/*                                                                   */
+/*   input: command = the entire command                             */
+/*                                                                   */
+/*  return: TASK_IDLE until complete/error, then TASK_FINISHED       */
+/*...................................................................*/
+int MassStorageBench(const char *command)
+{
+  uintptr_t slot;
+  u32 ms;
+
+  if (!MassStorageUp)
+  {
+    puts("Storage not initialized");
+    return TASK_FINISHED;
+  }
+
+  // Start the benchmark if not already running
+  if (Bench.buffer == NULL)
+  {
+    const char *arg = strchr(command, ' ');
+
+    if (arg)
+      ++arg;
+    memset(&Bench, 0, sizeof(Bench));
+    Bench.depth = bench_arg(&arg, 1);
+    Bench.blocks = bench_arg(&arg, 8);
+    if ((Bench.depth < 1) || (Bench.depth > BENCH_MAX_DEPTH) ||
+        (Bench.blocks < 1) || (Bench.blocks > 128))
+    {
+      puts("bench [depth 1 to 8] [blocks per request 1 to 128]");
+      return TASK_FINISHED;
+    }
+    Bench.total = BENCH_BYTES / (Bench.blocks * SECTOR_SIZE);
+    Bench.buffer = malloc(Bench.depth * Bench.blocks * SECTOR_SIZE);
+    if (Bench.buffer == NULL)
+    {
+      puts("bench out of memory");
+      return TASK_FINISHED;
+    }
+
+    Bench.start = TimerNow();
+    for (slot = 0; slot < Bench.depth; ++slot)
+      bench_issue(slot);
+  }
+
+  // Wait for the issued requests to complete
+  if (Bench.done < Bench.next)
+    return TASK_IDLE;
+
+  ms = (u32)(TimerNow() - Bench.start) / MICROS_PER_MILLISECOND;
+  if (Bench.failed)
+    puts("bench read failed");
+  else if (Bench.done)
+    printf("%u KB in %u ms, %u KB/s, depth %u of %u blocks, latency "
+           "%u us average, %u us max\n", (Bench.done * Bench.blocks) / 2,
+           ms, ms ? (Bench.done * Bench.blocks * SECTOR_SIZE) / ms : 0,
+           Bench.depth, Bench.blocks, (u32)Bench.latency / Bench.done,
+           (u32)Bench.maxLatency);
+  free(Bench.buffer);
+  Bench.buffer = NULL;
+  return TASK_FINISHED;
+}
 #endif
 
 /*...................................................................*/
@@ -276,7 +421,7 @@ int ReadBlock(const char *command)
 int main(void)
 {
   // Initialize global variables
-  NetUp = UsbUp = ScreenUp = FALSE;
+  NetUp = UsbUp = ScreenUp = EmmcUp = FALSE;
 
   /* Initialize the hardware. */
   BoardInit();
@@ -312,6 +457,10 @@ int main(void)
   // Start the USB host
   UsbHostStart(NULL);
 #endif
+#if ENABLE_EMMC
+  // Start the SD card host
+  EmmcStart(NULL);
+#endif
 #endif
 
   /* Display the introductory splash. */
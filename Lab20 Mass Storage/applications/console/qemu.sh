@@ -0,0 +1,81 @@
+#!/bin/sh
+#
+# Run the console application with the Arasan SD card host driver
+# under QEMU, with an SD card image in place of USB mass storage.
+#
+# Build first with ENABLE_EMMC TRUE in configure.h and the RPI 3
+# EXTRAS and ASFLAGS of the Makefile, then run from this directory:
+#   ./qemu.sh          interactive, UART0 on this terminal
+#   ./qemu.sh test     scripted start, mount, read and benchmarks,
+#                      logged to qemu.log and checked for errors
+# If this QEMU cannot start the 32 bit console.elf on the raspi3b
+# cores, build for RPI 2 and run with
+#   MACHINE=raspi2b QEMU=qemu-system-arm ./qemu.sh test
+# as both machines model the same BCM2835 SD host and DMA controller.
+#
+# QEMU ignores the DMA data requests (DREQ) and copies all at once,
+# so the benchmarks measure the driver and file system overhead, not
+# SD card speed. Compare with a USB storage build on hardware with the
+# same 'bench' and 'cat <file> time' commands.
+#
+# The image is created once, 256 MB (QEMU needs a power of two) with
+# a FAT32 partition, which requires sfdisk, mkfs.vfat and mtools.
+#
+
+QEMU=${QEMU:-qemu-system-aarch64}
+MACHINE=${MACHINE:-raspi3b}
+IMAGE=${IMAGE:-sd.img}
+HELLO="Hello from the SD card"
+
+if [ ! -f console.elf ]; then
+  echo "console.elf not found, build with 'make' first"
+  exit 1
+fi
+
+if [ ! -f "$IMAGE" ]; then
+  truncate -s 256M "$IMAGE" || exit 1
+  echo 'start=2048, type=c' | sfdisk -q "$IMAGE" || exit 1
+  mkfs.vfat -F 32 --offset 2048 "$IMAGE" > /dev/null || exit 1
+  echo "$HELLO" > hello.txt
+  dd if=/dev/urandom of=file.bin bs=1M count=4 2> /dev/null
+  mcopy -i "$IMAGE@@1M" hello.txt file.bin :: || exit 1
+  rm -f hello.txt file.bin
+fi
+
+RUN="$QEMU -M $MACHINE -kernel console.elf -display none \
+     -drive file=$IMAGE,if=sd,format=raw -serial stdio"
+
+if [ "$1" != "test" ]; then
+  exec $RUN
+fi
+
+# Type each command after the last had time to complete
+(
+  sleep 3
+  for command in emmc fat dir 'cat hello.txt' 'cat file.bin time' \
+                 'bench 1 8' 'bench 8 128' 'rbench file.bin 1000' \
+                 'wbench stream 1024' 'cat hello.txt'; do
+    printf '%s\r' "$command"
+    sleep 3
+  done
+) | timeout 45 $RUN > qemu.log 2>&1
+
+cat qemu.log
+echo "----"
+if ! grep -q "SD card .* MB" qemu.log; then
+  echo "FAIL: SD card not initialized"
+  exit 1
+fi
+if ! grep -q "FAT mounted" qemu.log; then
+  echo "FAIL: FAT not mounted"
+  exit 1
+fi
+if [ "$(grep -c "$HELLO" qemu.log)" -lt 2 ]; then
+  echo "FAIL: hello.txt not read back before and after wbench"
+  exit 1
+fi
+if grep -q -i "failed\|error" qemu.log; then
+  echo "FAIL: errors reported"
+  exit 1
+fi
+echo "PASS"
@@ -0,0 +1,554 @@
+/*...................................................................*/
+/*                                                                   */
+/*   Module:  disk.c                                                 */
+/*   Version: 2020.0                                                 */
+/*   Purpose: Disk image mass storage device for Linux host board    */
+/*                                                                   */
+/*...................................................................*/
+/*                                                                   */
+/*                   Copyright 2020, Sean Lawless                    */
+/*                                                                   */
+/*                      ALL RIGHTS RESERVED                          */
+/*                                                                   */
+/* Redistribution and use in source, binary or derived forms, with   */
+/* or without modification, are permitted provided that the          */
+/* following conditions are met:                                     */
+/*                                                                   */
+/*  1. Redistributions in any form, including but not limited to     */
+/*     source code, binary, or derived works, must include the above */
+/*     copyright notice, this list of conditions and the following   */
+/*     disclaimer.                                                   */
+/*                                                                   */
+/*  2. Any change or addition to this copyright notice requires the  */
+/*     prior written permission of the above copyright holder.       */
+/*                                                                   */
+/* THIS SOFTWARE IS PROVIDED ''AS IS''. ANY EXPRESS OR IMPLIED       */
+/* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES */
+/* OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE       */
+/* DISCLAIMED. IN NO EVENT SHALL ANY AUTHOR AND/OR COPYRIGHT HOLDER  */
+/* BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,          */
+/* EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED   */
+/* TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,     */
+/* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON */
+/* ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,   */
+/* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY    */
+/* OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE           */
+/* POSSIBILITY OF SUCH DAMAGE.                                       */
+/*...................................................................*/
+#include <board.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if ENABLE_DISK_IMAGE
+
+/*...................................................................*/
+/* Configuration                                                     */
+/*...................................................................*/
+#define DISK_MAX_DEPTH    32 /* deepest command queue 'disk depth' sets */
+#define DISK_DEPTH        8  /* default, the queue of USB mass storage */
+#define DISK_MAX_FAULTS   4  /* failed or slow block ranges at once */
+#define DISK_MAP_MAX      0x40000000 /* largest image to map, 1 GB */
+#define DISK_MAX_TRANSFER 0x400000   /* largest command, 4 MB */
+#define DISK_MAX_RATE     4000000    /* fastest transfer rate, KB/s */
+
+/*...................................................................*/
+/* Symbol Definitions                                                */
+/*...................................................................*/
+#define O_RDWR            0x0002
+#define O_LARGEFILE       0x8000
+
+#define BLOCK_SIZE        512
+#define BLOCK_SHIFT       9
+
+#define REQUEST_READ      0
+#define REQUEST_WRITE     1
+#define REQUEST_SYNC      2
+
+#define FAULT_FAIL        1
+#define FAULT_SLOW        2
+
+/*...................................................................*/
+/* Type Definitions                                                  */
+/*...................................................................*/
+typedef struct
+{
+  u32 block;  // first block
+  u32 count;  // length in bytes
+  u8 *buffer;
+  int type;   // REQUEST_READ, _WRITE or _SYNC
+  void (*callback)(u8 *buffer, int buffLen, void *payload);
+  void *payload;
+  u64 done;   // TimerNow() when the device completes it
+} DiskRequest;
+
+typedef struct
+{
+  int type;   // FAULT_FAIL or FAULT_SLOW, zero if unused
+  u32 block;  // first block affected
+  u32 blocks; // blocks affected
+  u32 delay;  // microseconds a slow block adds to its command
+  u32 times;  // commands left to affect, zero for every command
+} DiskFault;
+
+typedef struct
+{
+  int fd;
+  u8 *map;    // the mapped image, NULL if read and written instead
+  u32 blocks;
+
+  // Simulated device timing. Each command takes the latency, which
+  // overlaps for the commands queued together (up to depth), and then
+  // transfers at the rate after the transfer of the one before
+  u32 latency; // microseconds per command
+  u32 rate;    // KB/s, zero for no limit
+  int depth;   // commands queued at most
+  u64 busy;    // TimerNow() when the last transfer queued ends
+
+  // Queued commands, completed in order
+  DiskRequest requests[DISK_MAX_DEPTH];
+  int head, count;
+
+  DiskFault faults[DISK_MAX_FAULTS];
+
+  // Commands and blocks, for 'disk'
+  u32 reads, writes, syncs, failed;
+  u32 blocksRead, blocksWritten;
+} DiskDevice;
+
+/*...................................................................*/
+/* Global Variables                                                  */
+/*...................................................................*/
+static DiskDevice Disk =
+{
+  .fd = -1,
+  .depth = DISK_DEPTH,
+};
+
+/*...................................................................*/
+/* Local Functions                                                   */
+/*...................................................................*/
+
+/*...................................................................*/
+/* fault_find: Find the first fault of a type within a command       */
+/*                                                                   */
+/*      Input: request is the command                                */
+/*             type is FAULT_FAIL or FAULT_SLOW                      */
+/*                                                                   */
+/*    Returns: the fault, NULL if none                               */
+/*...................................................................*/
+static DiskFault *fault_find(DiskRequest *request, int type)
+{
+  u32 last = request->block + (request->count >> BLOCK_SHIFT);
+  DiskFault *found = NULL;
+  int i;
+
+  for (i = 0; i < DISK_MAX_FAULTS; ++i)
+    if ((Disk.faults[i].type == type) &&
+        (Disk.faults[i].block < last) &&
+        (Disk.faults[i].block + Disk.faults[i].blocks > request->block) &&
+        ((found == NULL) || (Disk.faults[i].block < found->block)))
+      found = &Disk.faults[i];
+  return found;
+}
+
+/*...................................................................*/
+/*  fault_hit: Count a command a fault affected, removing the fault  */
+/*             once it affected as many as requested                 */
+/*                                                                   */
+/*      Input: fault is the fault                                    */
+/*...................................................................*/
+static void fault_hit(DiskFault *fault)
+{
+  if (fault->times && (--fault->times == 0))
+    fault->type = 0;
+}
+
+/*...................................................................*/
+/*  disk_transfer: Read or write blocks of the image                 */
+/*                                                                   */
+/*      Input: request is the command                                */
+/*             length is the bytes to transfer                       */
+/*                                                                   */
+/*    Returns: Zero on success, failure otherwise                    */
+/*...................................................................*/
+static int disk_transfer(DiskRequest *request, u32 length)
+{
+  u64 offset = (u64)request->block << BLOCK_SHIFT;
+
+  if (Disk.map)
+  {
+    if (request->type == REQUEST_READ)
+      memcpy(request->buffer, &Disk.map[offset], length);
+    else
+      memcpy(&Disk.map[offset], request->buffer, length);
+    return 0;
+  }
+
+  if (request->type == REQUEST_READ)
+    return HostPread(Disk.fd, request->buffer, length, offset) !=
+           (int)length;
+  return HostPwrite(Disk.fd, request->buffer, length, offset) !=
+         (int)length;
+}
+
+/*...................................................................*/
+/* disk_complete: Perform a command the device completed and call    */
+/*                back with the length transferred, or -1 if failed  */
+/*                                                                   */
+/*      Input: request is a copy of the command, no longer queued    */
+/*...................................................................*/
+static void disk_complete(DiskRequest *request)
+{
+  DiskFault *fault;
+  int length = request->count;
+
+  if (request->type == REQUEST_SYNC)
+  {
+    ++Disk.syncs;
+    if (Disk.map)
+      length = HostMapSync(Disk.map, Disk.blocks << BLOCK_SHIFT) ? -1 : 0;
+    else
+      length = HostSync(Disk.fd) ? -1 : 0;
+    request->callback(request->buffer, length, request->payload);
+    return;
+  }
+
+  // A failed block ends the transfer before it
+  fault = fault_find(request, FAULT_FAIL);
+  if (fault)
+  {
+    fault_hit(fault);
+    length = 0;
+    if (fault->block > request->block)
+      length = (fault->block - request->block) << BLOCK_SHIFT;
+  }
+
+  if ((length > 0) && disk_transfer(request, length))
+    length = 0;
+
+  if (request->type == REQUEST_READ)
+  {
+    ++Disk.reads;
+    Disk.blocksRead += length >> BLOCK_SHIFT;
+  }
+  else
+  {
+    ++Disk.writes;
+    Disk.blocksWritten += length >> BLOCK_SHIFT;
+  }
+
+  if (length < (int)request->count)
+  {
+    ++Disk.failed;
+    if (length == 0)
+      length = -1;
+  }
+  request->callback(request->buffer, length, request->payload);
+}
+
+/*...................................................................*/
+/*  queue_request: Queue a command, timed to complete after its      */
+/*                 latency and the transfers queued before it        */
+/*                                                                   */
+/*      Inputs: block is the first Logical Block Address (LBA)       */
+/*              buffer is the data to read or write                  */
+/*              count is the length in bytes                         */
+/*              type is REQUEST_READ, _WRITE or _SYNC                */
+/*              callback is called on completion with payload        */
+/*                                                                   */
+/*     Returns: count if queued, -1 if invalid or -2 if queue full   */
+/*...................................................................*/
+static int queue_request(u32 block, void *buffer, u32 count, int type,
+                         void (callback)(u8 *buffer, int buffLen,
+                                         void *payload), void *payload)
+{
+  DiskRequest *request;
+  DiskFault *fault;
+  u64 done;
+
+  if ((Disk.fd < 0) || ((count & (BLOCK_SIZE - 1)) != 0) ||
+      ((count == 0) && (type != REQUEST_SYNC)) ||
+      (count > DISK_MAX_TRANSFER) ||
+      (block + (count >> BLOCK_SHIFT) > Disk.blocks) ||
+      (block + (count >> BLOCK_SHIFT) < block))
+    return -1;
+
+  if (Disk.count >= Disk.depth)
+    return -2;
+
+  request = &Disk.requests[(Disk.head + Disk.count) % DISK_MAX_DEPTH];
+  request->block = block;
+  request->count = count;
+  request->buffer = buffer;
+  request->type = type;
+  request->callback = callback;
+  request->payload = payload;
+
+  // The command latency, longer if it accesses a slow block
+  done = TimerNow() + Disk.latency;
+  fault = fault_find(request, FAULT_SLOW);
+  if (fault)
+  {
+    done += fault->delay;
+    fault_hit(fault);
+  }
+
+  // Transfer after the transfers queued before, completing in order
+  if (done < Disk.busy)
+    done = Disk.busy;
+  // Microseconds to transfer at the rate in bytes per millisecond,
+  // within 32 bits for the largest command and the fastest rate
+  if (Disk.rate)
+    done += (count * 1000) / ((Disk.rate * 1024) / 1000);
+  request->done = Disk.busy = done;
+
+  Disk.count++;
+  return count;
+}
+
+/*...................................................................*/
+/*    next_arg: Return the next space separated argument             */
+/*                                                                   */
+/*      Input: arg is the current argument, or the command           */
+/*                                                                   */
+/*    Returns: the next argument, NULL if none                       */
+/*...................................................................*/
+static const char *next_arg(const char *arg)
+{
+  if (arg)
+    arg = strchr(arg, ' ');
+  if (arg)
+    ++arg;
+  return arg;
+}
+
+/*...................................................................*/
+/*   arg_value: Return the decimal value of an argument, ending at   */
+/*              the space before the next one unlike atoi()          */
+/*                                                                   */
+/*      Input: arg is the argument                                   */
+/*                                                                   */
+/*    Returns: the value                                             */
+/*...................................................................*/
+static u32 arg_value(const char *arg)
+{
+  u32 value = 0;
+
+  while ((*arg >= '0') && (*arg <= '9'))
+    value = value * 10 + (*arg++ - '0');
+  return value;
+}
+
+/*...................................................................*/
+/* Global Functions                                                  */
+/*...................................................................*/
+
+/*...................................................................*/
+/*   DiskOpen: Open a disk image as the mass storage device          */
+/*                                                                   */
+/*      Input: path is the image file                                */
+/*             map is TRUE to map the image instead of reading and   */
+/*             writing it                                            */
+/*                                                                   */
+/*    Returns: Zero on success, failure otherwise                    */
+/*...................................................................*/
+int DiskOpen(const char *path, int map)
+{
+  u64 size;
+
+  Disk.fd = HostOpen(path, O_RDWR | O_LARGEFILE);
+  if (Disk.fd < 0)
+  {
+    printf("Cannot open disk image %s (error %d)\n", path, -Disk.fd);
+    return -1;
+  }
+
+  size = HostSize(Disk.fd);
+  Disk.blocks = (size >> BLOCK_SHIFT) > 0xFFFFFFFF ? 0xFFFFFFFF :
+                (u32)(size >> BLOCK_SHIFT);
+
+  // A 32 bit process cannot map much, larger images are read instead
+  if (map)
+  {
+    if (size <= DISK_MAP_MAX)
+      Disk.map = HostMap(Disk.fd, (u32)size);
+    if (Disk.map == NULL)
+      puts("Disk image not mapped, reading and writing instead");
+  }
+
+  printf("Disk image %s, %u MB%s\n", path, Disk.blocks >> 11,
+         Disk.map ? " mapped" : "");
+  return 0;
+}
+
+/*...................................................................*/
+/*   DiskPoll: Complete the commands the device has finished         */
+/*                                                                   */
+/*      Input: unused                                                */
+/*                                                                   */
+/*    Returns: TASK_IDLE                                             */
+/*...................................................................*/
+int DiskPoll(void *unused)
+{
+  DiskRequest request;
+
+  while (Disk.count && (Disk.requests[Disk.head].done <= TimerNow()))
+  {
+    // Dequeue before the callback so that it can queue more
+    request = Disk.requests[Disk.head];
+    Disk.head = (Disk.head + 1) % DISK_MAX_DEPTH;
+    Disk.count--;
+    disk_complete(&request);
+  }
+  return TASK_IDLE;
+}
+
+/*...................................................................*/
+/* DiskCommand: Shell command to report or configure the device      */
+/*                                                                   */
+/*   disk                         report the device and its commands */
+/*   disk latency <us>            command latency                    */
+/*   disk rate <KB/s>             transfer rate, zero for no limit   */
+/*   disk depth <commands>        command queue depth                */
+/*   disk fail <block> [blocks] [times]                              */
+/*                                fail the commands that access the  */
+/*                                blocks, the next times or always   */
+/*   disk slow <block> <blocks> <us> [times]                         */
+/*                                slow down those commands           */
+/*   disk clear                   remove faults and reset counters   */
+/*                                                                   */
+/*   input: command = the entire command                             */
+/*                                                                   */
+/*  return: TASK_FINISHED                                            */
+/*...................................................................*/
+int DiskCommand(const char *command)
+{
+  const char *arg1 = next_arg(command), *arg2 = next_arg(arg1);
+  const char *arg3 = next_arg(arg2), *arg4 = next_arg(arg3);
+  const char *arg5 = next_arg(arg4);
+  DiskFault *fault = NULL;
+  int i;
+
+  if (arg1 == NULL)
+  {
+    printf("Disk %u blocks, latency %u us, rate %u KB/s, depth %d\n",
+           Disk.blocks, Disk.latency, Disk.rate, Disk.depth);
+    printf("%u reads of %u blocks, %u writes of %u blocks, %u syncs, %u"
+           " failed\n", Disk.reads, Disk.blocksRead, Disk.writes,
+           Disk.blocksWritten, Disk.syncs, Disk.failed);
+    for (i = 0; i < DISK_MAX_FAULTS; ++i)
+      if (Disk.faults[i].type)
+        printf("  %s blocks %u to %u, %u us, %u times\n",
+               Disk.faults[i].type == FAULT_FAIL ? "fail" : "slow",
+               Disk.faults[i].block, Disk.faults[i].block +
+               Disk.faults[i].blocks - 1, Disk.faults[i].delay,
+               Disk.faults[i].times);
+    return TASK_FINISHED;
+  }
+
+  if (memcmp(arg1, "latency", 7) == 0 && arg2)
+    Disk.latency = arg_value(arg2);
+  else if (memcmp(arg1, "rate", 4) == 0 && arg2)
+  {
+    Disk.rate = arg_value(arg2);
+    if (Disk.rate > DISK_MAX_RATE)
+      Disk.rate = DISK_MAX_RATE;
+  }
+  else if (memcmp(arg1, "depth", 5) == 0 && arg2)
+  {
+    Disk.depth = arg_value(arg2);
+    if (Disk.depth < 1)
+      Disk.depth = 1;
+    if (Disk.depth > DISK_MAX_DEPTH)
+      Disk.depth = DISK_MAX_DEPTH;
+  }
+  else if ((memcmp(arg1, "fail", 4) == 0 ||
+            (memcmp(arg1, "slow", 4) == 0 && arg4)) && arg2)
+  {
+    for (i = 0; i < DISK_MAX_FAULTS; ++i)
+      if (Disk.faults[i].type == 0)
+      {
+        fault = &Disk.faults[i];
+        break;
+      }
+    if (fault == NULL)
+    {
+      puts("No more faults, 'disk clear' first");
+      return TASK_FINISHED;
+    }
+
+    fault->block = arg_value(arg2);
+    fault->blocks = arg3 ? arg_value(arg3) : 1;
+    if (fault->blocks == 0)
+      fault->blocks = 1;
+    if (arg1[0] == 'f')
+    {
+      fault->delay = 0;
+      fault->times = arg4 ? arg_value(arg4) : 0;
+      fault->type = FAULT_FAIL;
+    }
+    else
+    {
+      fault->delay = arg_value(arg4);
+      fault->times = arg5 ? arg_value(arg5) : 0;
+      fault->type = FAULT_SLOW;
+    }
+  }
+  else if (memcmp(arg1, "clear", 5) == 0)
+  {
+    bzero(Disk.faults, sizeof(Disk.faults));
+    Disk.reads = Disk.writes = Disk.syncs = Disk.failed = 0;
+    Disk.blocksRead = Disk.blocksWritten = 0;
+  }
+  else
+    puts("disk [latency <us> | rate <KB/s> | depth <n> | fail <block> "
+         "[blocks] [times] | slow <block> <blocks> <us> [times] | clear]");
+
+  return TASK_FINISHED;
+}
+
+/*...................................................................*/
+/* Mass Storage interface                                            */
+/*...................................................................*/
+u32 MassStorageBlockSize()
+{
+  return BLOCK_SIZE;
+}
+
+u32 MassStorageBlockCapacity()
+{
+  return Disk.blocks;
+}
+
+int MassStorageRead(u32 block, void *buffer, u32 count,
+                    void (callback)(u8 *buffer, int buffLen,
+                                    void *payload),
+                    void *payload)
+{
+  return queue_request(block, buffer, count, REQUEST_READ, callback,
+                       payload);
+}
+
+int MassStorageWrite(u32 block, const void *buffer, u32 count, int fua,
+                     void (callback)(u8 *buffer, int buffLen,
+                                     void *payload),
+                     void *payload)
+{
+  return queue_request(block, (void *)buffer, count, REQUEST_WRITE,
+                       callback, payload);
+}
+
+int MassStorageSync(void (callback)(u8 *buffer, int buffLen,
+                                    void *payload),
+                    void *payload)
+{
+  return queue_request(0, NULL, 0, REQUEST_SYNC, callback, payload);
+}
+
+int MassStorageQueued()
+{
+  return Disk.count;
+}
+
+#endif /* ENABLE_DISK_IMAGE */
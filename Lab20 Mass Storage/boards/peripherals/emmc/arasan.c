@@ -0,0 +1,877 @@
+/*...................................................................*/
+/*                                                                   */
+/*   Module:  arasan.c                                               */
+/*   Version: 2020.0                                                 */
+/*   Purpose: Arasan SD card host (EMMC) mass storage device         */
+/*                                                                   */
+/*...................................................................*/
+/*                                                                   */
+/*                   Copyright 2020, Sean Lawless                    */
+/*                                                                   */
+/*                      ALL RIGHTS RESERVED                          */
+/*                                                                   */
+/* Redistribution and use in source, binary or derived forms, with   */
+/* or without modification, are permitted provided that the          */
+/* following conditions are met:                                     */
+/*                                                                   */
+/*  1. Redistributions in any form, including but not limited to     */
+/*     source code, binary, or derived works, must include the above */
+/*     copyright notice, this list of conditions and the following   */
+/*     disclaimer.                                                   */
+/*                                                                   */
+/*  2. Any change or addition to this copyright notice requires the  */
+/*     prior written permission of the above copyright holder.       */
+/*                                                                   */
+/* THIS SOFTWARE IS PROVIDED ''AS IS''. ANY EXPRESS OR IMPLIED       */
+/* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES */
+/* OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE       */
+/* DISCLAIMED. IN NO EVENT SHALL ANY AUTHOR AND/OR COPYRIGHT HOLDER  */
+/* BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,          */
+/* EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED   */
+/* TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,     */
+/* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON */
+/* ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,   */
+/* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY    */
+/* OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE           */
+/* POSSIBILITY OF SUCH DAMAGE.                                       */
+/*                                                                   */
+/* Thanks to the SD Association for the SD Host Controller and       */
+/* Physical Layer simplified specifications, and to Linux/Circle for */
+/* the BCM2835 specific behavior of the Arasan controller.           */
+/*...................................................................*/
+#include <system.h>
+#include <board.h>
+#include <string.h>
+#include <stdio.h>
+
+#if ENABLE_EMMC
+
+/*...................................................................*/
+/* Configuration                                                     */
+/*...................................................................*/
+#define EMMC_DEPTH         8  /* commands queued, as USB storage */
+#define EMMC_DMA_CHANNEL   4  /* a full DMA channel left to the ARM */
+#define EMMC_TIMEOUT       MICROS_PER_SECOND /* command or transfer */
+#define EMMC_INIT_CLOCK    400000   /* identification, 400 kHz */
+#define EMMC_NORMAL_CLOCK  25000000 /* default speed, 25 MHz */
+#define EMMC_HIGH_CLOCK    50000000 /* high speed, 50 MHz */
+
+/*...................................................................*/
+/* Symbol Definitions                                                */
+/*...................................................................*/
+/*
+ * Arasan SD host controller register map. The BCM2835 controller
+ * only supports 32 bit register accesses, so none are narrower.
+*/
+#define EMMC_BASE          (PERIPHERAL_BASE | 0x300000)
+#define EMMC_BLKSIZECNT    (EMMC_BASE | 0x04)
+#define EMMC_ARG1          (EMMC_BASE | 0x08)
+#define EMMC_CMDTM         (EMMC_BASE | 0x0C)
+#define EMMC_RESP0         (EMMC_BASE | 0x10)
+#define EMMC_RESP1         (EMMC_BASE | 0x14)
+#define EMMC_RESP2         (EMMC_BASE | 0x18)
+#define EMMC_RESP3         (EMMC_BASE | 0x1C)
+#define EMMC_DATA          (EMMC_BASE | 0x20)
+#define EMMC_STATUS        (EMMC_BASE | 0x24)
+#define   STATUS_CMD_INHIBIT     (1 << 0)
+#define   STATUS_DAT_INHIBIT     (1 << 1)
+#define EMMC_CONTROL0      (EMMC_BASE | 0x28)
+#define   C0_HCTL_DWIDTH         (1 << 1)  /* 4 bit data bus */
+#define   C0_SD_BUS_POWER        (1 << 8)
+#define   C0_SD_BUS_3V3          (7 << 9)
+#define EMMC_CONTROL1      (EMMC_BASE | 0x2C)
+#define   C1_CLK_INTLEN          (1 << 0)  /* internal clock enable */
+#define   C1_CLK_STABLE          (1 << 1)
+#define   C1_CLK_EN              (1 << 2)  /* SD clock enable */
+#define   C1_CLK_FREQ_MASK       (0x3FF << 6)
+#define   C1_DATA_TOUNIT_MAX     (0xE << 16)
+#define   C1_SRST_HC             (1 << 24)
+#define   C1_SRST_CMD            (1 << 25)
+#define   C1_SRST_DATA           (1 << 26)
+#define EMMC_INTERRUPT     (EMMC_BASE | 0x30)
+#define   INT_CMD_DONE           (1 << 0)
+#define   INT_DATA_DONE          (1 << 1)
+#define   INT_WRITE_RDY          (1 << 4)
+#define   INT_READ_RDY           (1 << 5)
+#define   INT_ERR                (1 << 15)
+#define   INT_CTO_ERR            (1 << 16) /* command timeout */
+#define   INT_ERROR_MASK         0xFFFF8000
+#define EMMC_IRPT_MASK     (EMMC_BASE | 0x34)
+#define EMMC_IRPT_EN       (EMMC_BASE | 0x38)
+#define EMMC_CONTROL2      (EMMC_BASE | 0x3C)
+
+/*
+ * Command and transfer mode (CMDTM) register
+*/
+#define CMD_INDEX(i)       ((i) << 24)
+#define CMD_ISDATA         (1 << 21)
+#define CMD_IXCHK_EN       (1 << 20)
+#define CMD_CRCCHK_EN      (1 << 19)
+#define CMD_RSPNS_136      (1 << 16)
+#define CMD_RSPNS_48       (2 << 16)
+#define CMD_RSPNS_48B      (3 << 16) /* 48 bits with busy */
+#define TM_MULTI_BLOCK     (1 << 5)
+#define TM_DAT_DIR_CH      (1 << 4)  /* card to host */
+#define TM_AUTO_CMD12      (1 << 2)
+#define TM_BLKCNT_EN       (1 << 1)
+
+#define R1           (CMD_RSPNS_48 | CMD_CRCCHK_EN | CMD_IXCHK_EN)
+#define R1B          (CMD_RSPNS_48B | CMD_CRCCHK_EN | CMD_IXCHK_EN)
+#define R2           (CMD_RSPNS_136 | CMD_CRCCHK_EN)
+#define R3           CMD_RSPNS_48
+#define R6           R1
+#define R7           R1
+#define READ_DATA    (CMD_ISDATA | TM_DAT_DIR_CH)
+#define MULTIPLE     (TM_MULTI_BLOCK | TM_BLKCNT_EN | TM_AUTO_CMD12)
+
+/*
+ * SD card commands, with their response and data transfer
+*/
+#define GO_IDLE_STATE        CMD_INDEX(0)
+#define ALL_SEND_CID         (CMD_INDEX(2) | R2)
+#define SEND_RELATIVE_ADDR   (CMD_INDEX(3) | R6)
+#define SWITCH_FUNC          (CMD_INDEX(6) | R1 | READ_DATA)
+#define SELECT_CARD          (CMD_INDEX(7) | R1B)
+#define SEND_IF_COND         (CMD_INDEX(8) | R7)
+#define SEND_CSD             (CMD_INDEX(9) | R2)
+#define STOP_TRANSMISSION    (CMD_INDEX(12) | R1B)
+#define SET_BLOCKLEN         (CMD_INDEX(16) | R1)
+#define READ_SINGLE_BLOCK    (CMD_INDEX(17) | R1 | READ_DATA)
+#define READ_MULTIPLE_BLOCK  (CMD_INDEX(18) | R1 | READ_DATA | \
+                              MULTIPLE)
+#define WRITE_BLOCK          (CMD_INDEX(24) | R1 | CMD_ISDATA)
+#define WRITE_MULTIPLE_BLOCK (CMD_INDEX(25) | R1 | CMD_ISDATA | \
+                              MULTIPLE)
+#define APP_CMD              (CMD_INDEX(55) | R1)
+
+// Application commands, sent after APP_CMD
+#define SET_BUS_WIDTH        (CMD_INDEX(6) | R1)
+#define SD_SEND_OP_COND      (CMD_INDEX(41) | R3)
+#define SEND_SCR             (CMD_INDEX(51) | R1 | READ_DATA)
+
+#define IF_COND_CHECK        0x1AA      /* 2.7-3.6V, check pattern */
+#define OCR_BUSY             (1 << 31)  /* set once powered up */
+#define OCR_HCS              (1 << 30)  /* high capacity (SDHC/SDXC) */
+#define OCR_3V2_3V4          (3 << 20)
+#define SWITCH_HIGH_SPEED    0x80FFFFF1 /* set group 1 to function 1 */
+#define SCR_BUS_WIDTH_4      (1 << 2)
+
+/*
+ * BCM2835 DMA controller. The Arasan controller cannot master the
+ * bus itself, so a system DMA channel paced by the EMMC DREQ moves
+ * the data between memory and the data register.
+*/
+#define DMA_BASE           (PERIPHERAL_BASE | 0x007000)
+#define DMA_CHANNEL_BASE   (DMA_BASE + (EMMC_DMA_CHANNEL << 8))
+#define DMA_CS             (DMA_CHANNEL_BASE | 0x00)
+#define   DMA_CS_ACTIVE          (1 << 0)
+#define   DMA_CS_END             (1 << 1)
+#define   DMA_CS_INT             (1 << 2)
+#define   DMA_CS_ERROR           (1 << 8)
+#define   DMA_CS_ABORT           (1 << 30)
+#define   DMA_CS_RESET           (1 << 31)
+#define DMA_CONBLK_AD      (DMA_CHANNEL_BASE | 0x04)
+#define DMA_DEBUG          (DMA_CHANNEL_BASE | 0x20)
+#define DMA_ENABLE         (DMA_BASE | 0xFF0)
+
+#define TI_WAIT_RESP       (1 << 3)
+#define TI_DEST_INC        (1 << 4)
+#define TI_DEST_DREQ       (1 << 6)
+#define TI_SRC_INC         (1 << 8)
+#define TI_SRC_DREQ        (1 << 10)
+#define TI_PERMAP(p)       ((p) << 16)
+#define   DREQ_EMMC              11
+
+// The data register as the DMA controller addresses it
+#define BUS_PERIPHERAL(a)  (0x7E000000 | ((a) & 0x00FFFFFF))
+
+#define BLOCK_SIZE         512
+#define BLOCK_SHIFT        9
+#define MAX_BLOCKS         0xFFFF /* block count of one command */
+
+#define REQUEST_READ       0
+#define REQUEST_WRITE      1
+#define REQUEST_SYNC       2
+
+/*...................................................................*/
+/* Type Definitions                                                  */
+/*...................................................................*/
+typedef struct
+{
+  u32 transferInfo;
+  u32 source;
+  u32 destination;
+  u32 length;
+  u32 stride;
+  u32 next;
+  u32 reserved[2];
+} DmaControlBlock;
+
+typedef struct
+{
+  u32 block;  // first block
+  u32 count;  // length in bytes
+  u8 *buffer;
+  int type;   // REQUEST_READ, _WRITE or _SYNC
+  void (*callback)(u8 *buffer, int buffLen, void *payload);
+  void *payload;
+} EmmcRequest;
+
+typedef struct
+{
+  u32 baseClock; // Hz
+  u32 clock;     // SD clock, Hz
+  u32 rca;       // relative card address, upper 16 bits
+  u32 blocks;
+  int sdhc;      // block rather than byte addressed
+
+  // Queued commands, the oldest one on the bus once started
+  EmmcRequest requests[EMMC_DEPTH];
+  int head, count;
+  int active;
+  u64 start;     // TimerNow() the active command started
+
+  u32 reads, writes, failed;
+} EmmcDevice;
+
+/*...................................................................*/
+/* Global Variables                                                  */
+/*...................................................................*/
+static EmmcDevice Emmc;
+static DmaControlBlock ControlBlock __attribute__((aligned(32)));
+
+/*...................................................................*/
+/* Local Functions                                                   */
+/*...................................................................*/
+
+/*...................................................................*/
+/*  wait_until: Wait for register bits to set, or to clear           */
+/*                                                                   */
+/*      Input: reg is the register address                           */
+/*             mask is the bits                                      */
+/*             set is TRUE to wait for any set, FALSE for all clear  */
+/*                                                                   */
+/*    Returns: Zero on success, -1 if timed out                      */
+/*...................................................................*/
+static int wait_until(u32 reg, u32 mask, int set)
+{
+  u64 start = TimerNow();
+
+  while (((REG32(reg) & mask) != 0) != set)
+    if (TimerNow() - start > EMMC_TIMEOUT)
+      return -1;
+  return 0;
+}
+
+/*...................................................................*/
+/*  reset_lines: Reset the command and data lines after an error     */
+/*                                                                   */
+/*...................................................................*/
+static void reset_lines(void)
+{
+  REG32(EMMC_CONTROL1) |= C1_SRST_CMD | C1_SRST_DATA;
+  wait_until(EMMC_CONTROL1, C1_SRST_CMD | C1_SRST_DATA, FALSE);
+  REG32(EMMC_INTERRUPT) = 0xFFFFFFFF;
+}
+
+/*...................................................................*/
+/*     command: Send a command and wait for its response             */
+/*                                                                   */
+/*      Input: cmdtm is the command and transfer mode                */
+/*             arg is the argument                                   */
+/*                                                                   */
+/*    Returns: Zero on success, -1 if timed out or failed            */
+/*...................................................................*/
+static int command(u32 cmdtm, u32 arg)
+{
+  u32 inhibit = STATUS_CMD_INHIBIT, irpt;
+
+  // Commands with data or busy also wait for the data lines
+  if ((cmdtm & CMD_ISDATA) ||
+      ((cmdtm & CMD_RSPNS_48B) == CMD_RSPNS_48B))
+    inhibit |= STATUS_DAT_INHIBIT;
+  if (wait_until(EMMC_STATUS, inhibit, FALSE))
+    return -1;
+
+  REG32(EMMC_INTERRUPT) = 0xFFFFFFFF;
+  REG32(EMMC_ARG1) = arg;
+  REG32(EMMC_CMDTM) = cmdtm;
+
+  if (wait_until(EMMC_INTERRUPT, INT_CMD_DONE | INT_ERR, TRUE))
+  {
+    reset_lines();
+    return -1;
+  }
+  irpt = REG32(EMMC_INTERRUPT);
+  if (irpt & INT_ERROR_MASK)
+  {
+    reset_lines();
+    return -1;
+  }
+  REG32(EMMC_INTERRUPT) = INT_CMD_DONE;
+
+  // A busy response completes once the card is no longer busy
+  if (((cmdtm & CMD_RSPNS_48B) == CMD_RSPNS_48B) &&
+      !(cmdtm & CMD_ISDATA))
+  {
+    if (wait_until(EMMC_INTERRUPT, INT_DATA_DONE | INT_ERR, TRUE))
+      return -1;
+    REG32(EMMC_INTERRUPT) = INT_DATA_DONE;
+  }
+  return 0;
+}
+
+/*...................................................................*/
+/* app_command: Send an application specific command                 */
+/*                                                                   */
+/*      Input: cmdtm is the command and transfer mode                */
+/*             arg is the argument                                   */
+/*                                                                   */
+/*    Returns: Zero on success, -1 if timed out or failed            */
+/*...................................................................*/
+static int app_command(u32 cmdtm, u32 arg)
+{
+  if (command(APP_CMD, Emmc.rca))
+    return -1;
+  return command(cmdtm, arg);
+}
+
+/*...................................................................*/
+/*   pio_read: Read the data of a command through the data register  */
+/*                                                                   */
+/*      Input: buffer is where to read the data, any alignment       */
+/*             blockSize is the bytes of each block                  */
+/*             blocks is the number of blocks                        */
+/*                                                                   */
+/*    Returns: Zero on success, -1 if timed out or failed            */
+/*...................................................................*/
+static int pio_read(u8 *buffer, u32 blockSize, u32 blocks)
+{
+  u32 i, word;
+
+  for (; blocks > 0; --blocks)
+  {
+    if (wait_until(EMMC_INTERRUPT, INT_READ_RDY | INT_ERR, TRUE) ||
+        (REG32(EMMC_INTERRUPT) & INT_ERROR_MASK))
+      return -1;
+    REG32(EMMC_INTERRUPT) = INT_READ_RDY;
+    for (i = 0; i < blockSize; i += sizeof(word))
+    {
+      word = REG32(EMMC_DATA);
+      memcpy(&buffer[i], &word, sizeof(word));
+    }
+    buffer += blockSize;
+  }
+  return 0;
+}
+
+/*...................................................................*/
+/*  pio_write: Write the data of a command through the data register */
+/*                                                                   */
+/*      Input: buffer is the data to write, any alignment            */
+/*             blocks is the number of 512 byte blocks               */
+/*                                                                   */
+/*    Returns: Zero on success, -1 if timed out or failed            */
+/*...................................................................*/
+static int pio_write(const u8 *buffer, u32 blocks)
+{
+  u32 i, word;
+
+  for (; blocks > 0; --blocks)
+  {
+    if (wait_until(EMMC_INTERRUPT, INT_WRITE_RDY | INT_ERR, TRUE) ||
+        (REG32(EMMC_INTERRUPT) & INT_ERROR_MASK))
+      return -1;
+    REG32(EMMC_INTERRUPT) = INT_WRITE_RDY;
+    for (i = 0; i < BLOCK_SIZE; i += sizeof(word))
+    {
+      memcpy(&word, &buffer[i], sizeof(word));
+      REG32(EMMC_DATA) = word;
+    }
+    buffer += BLOCK_SIZE;
+  }
+  return 0;
+}
+
+/*...................................................................*/
+/* read_data: Send a command that reads a small data block by PIO    */
+/*                                                                   */
+/*      Input: cmdtm is the command and transfer mode                */
+/*             arg is the argument                                   */
+/*             buffer is where to read the data                      */
+/*             length is the length of the data in bytes             */
+/*             app is TRUE if an application specific command        */
+/*                                                                   */
+/*    Returns: Zero on success, -1 if timed out or failed            */
+/*...................................................................*/
+static int read_data(u32 cmdtm, u32 arg, u8 *buffer, u32 length,
+                     int app)
+{
+  REG32(EMMC_BLKSIZECNT) = (1 << 16) | length;
+  if ((app ? app_command(cmdtm, arg) : command(cmdtm, arg)) ||
+      pio_read(buffer, length, 1) ||
+      wait_until(EMMC_INTERRUPT, INT_DATA_DONE | INT_ERR, TRUE))
+  {
+    reset_lines();
+    return -1;
+  }
+  REG32(EMMC_INTERRUPT) = INT_DATA_DONE;
+  return 0;
+}
+
+/*...................................................................*/
+/*   set_clock: Set the SD clock at or below a frequency             */
+/*                                                                   */
+/*      Input: frequency is the SD clock in Hz                       */
+/*                                                                   */
+/*    Returns: Zero on success, -1 if timed out                      */
+/*...................................................................*/
+static int set_clock(u32 frequency)
+{
+  u32 divisor, control1;
+
+  // The SD clock is the base clock divided by twice the divisor
+  divisor = (Emmc.baseClock + 2 * frequency - 1) / (2 * frequency);
+  if (divisor > 0x3FF)
+    divisor = 0x3FF;
+
+  // Stop the SD clock while changing it
+  if (wait_until(EMMC_STATUS, STATUS_CMD_INHIBIT | STATUS_DAT_INHIBIT,
+                 FALSE))
+    return -1;
+  control1 = REG32(EMMC_CONTROL1) & ~(C1_CLK_EN | C1_CLK_FREQ_MASK);
+  REG32(EMMC_CONTROL1) = control1;
+  usleep(10);
+
+  // Ten bit divided clock, low eight bits then upper two
+  control1 |= ((divisor & 0xFF) << 8) | ((divisor >> 8) << 6);
+  REG32(EMMC_CONTROL1) = control1;
+  if (wait_until(EMMC_CONTROL1, C1_CLK_STABLE, TRUE))
+    return -1;
+  REG32(EMMC_CONTROL1) = control1 | C1_CLK_EN;
+  usleep(10);
+  Emmc.clock = divisor ? Emmc.baseClock / (2 * divisor) :
+                         Emmc.baseClock;
+  return 0;
+}
+
+/*...................................................................*/
+/*  route_pins: Route the SD card pins, GPIO 48 to 53, to the Arasan */
+/*              controller, as the RPi 3 boots with them on SDHOST   */
+/*                                                                   */
+/*...................................................................*/
+static void route_pins(void)
+{
+  u32 select;
+  int gpio;
+
+  // GPIO 48 and 49 are the last two of GPFSEL4, 50 to 53 in GPFSEL5
+  select = REG32(GPFSEL4);
+  for (gpio = 48; gpio <= 49; ++gpio)
+    select = (select & ~(7 << ((gpio - 40) * 3))) |
+             (GPIO_ALT3 << ((gpio - 40) * 3));
+  REG32(GPFSEL4) = select;
+  select = REG32(GPFSEL5);
+  for (gpio = 50; gpio <= 53; ++gpio)
+    select = (select & ~(7 << ((gpio - 50) * 3))) |
+             (GPIO_ALT3 << ((gpio - 50) * 3));
+  REG32(GPFSEL5) = select;
+
+  // Pull up CMD and DAT0 to DAT3, GPIO 49 to 53
+  REG32(GPPUD) = GPPUD_PULL_UP;
+  usleep(MICROS_PER_MILLISECOND); /* 1ms hold time */
+  REG32(GPPUDCLK1) = (0x1F << (49 - 32));
+  usleep(MICROS_PER_MILLISECOND); /* 1ms hold time */
+  REG32(GPPUD) = GPPUD_OFF;
+  REG32(GPPUDCLK1) = 0;
+}
+
+/*...................................................................*/
+/*   card_init: Identify the card, select it and switch it to the    */
+/*              4 bit bus at the highest speed it supports           */
+/*                                                                   */
+/*    Returns: Zero on success, -1 if failed                         */
+/*...................................................................*/
+static int card_init(void)
+{
+  u32 ocr, csize, mult, readBlockLength;
+  u8 data[64];
+  int version2, i;
+
+  // Reset the card, then check for a version 2 or later card
+  Emmc.rca = 0;
+  if (command(GO_IDLE_STATE, 0))
+    return -1;
+  version2 = (command(SEND_IF_COND, IF_COND_CHECK) == 0);
+  if (version2 && ((REG32(EMMC_RESP0) & 0xFFF) != IF_COND_CHECK))
+  {
+    puts("SD card voltage check failed");
+    return -1;
+  }
+
+  // Wait up to a second for the card to power up
+  for (i = 0, ocr = 0; !(ocr & OCR_BUSY); ++i)
+  {
+    if ((i >= 100) || app_command(SD_SEND_OP_COND, OCR_3V2_3V4 |
+                                  (version2 ? OCR_HCS : 0)))
+    {
+      puts("SD card not ready");
+      return -1;
+    }
+    ocr = REG32(EMMC_RESP0);
+    if (!(ocr & OCR_BUSY))
+      usleep(10 * MICROS_PER_MILLISECOND);
+  }
+  Emmc.sdhc = (ocr & OCR_HCS) != 0;
+
+  // Assign the relative card address (RCA) and read the capacity
+  if (command(ALL_SEND_CID, 0) || command(SEND_RELATIVE_ADDR, 0))
+    return -1;
+  Emmc.rca = REG32(EMMC_RESP0) & 0xFFFF0000;
+  if (command(SEND_CSD, Emmc.rca))
+    return -1;
+
+  // The response omits the CRC, so CSD bit N is response bit N - 8
+  if (((REG32(EMMC_RESP3) >> 22) & 3) == 1)
+  {
+    // CSD version 2, C_SIZE is bits 69:48 in 512 KB units
+    csize = (REG32(EMMC_RESP1) >> 8) & 0x3FFFFF;
+    Emmc.blocks = (csize + 1) << 10;
+  }
+  else
+  {
+    // CSD version 1, C_SIZE is bits 73:62, C_SIZE_MULT 49:47 and
+    // READ_BL_LEN 83:80
+    csize = ((REG32(EMMC_RESP2) & 3) << 10) |
+            (REG32(EMMC_RESP1) >> 22);
+    mult = (REG32(EMMC_RESP1) >> 7) & 7;
+    readBlockLength = (REG32(EMMC_RESP2) >> 8) & 0xF;
+    Emmc.blocks = (csize + 1) << (mult + 2 + readBlockLength -
+                                  BLOCK_SHIFT);
+  }
+
+  // Select the card, with 512 byte blocks if byte addressed
+  if (command(SELECT_CARD, Emmc.rca) ||
+      (!Emmc.sdhc && command(SET_BLOCKLEN, BLOCK_SIZE)))
+    return -1;
+
+  // Use the 4 bit bus if the card configuration register allows
+  if (read_data(SEND_SCR, 0, data, 8, TRUE))
+    return -1;
+  if (data[1] & SCR_BUS_WIDTH_4)
+  {
+    if (app_command(SET_BUS_WIDTH, 2))
+      return -1;
+    REG32(EMMC_CONTROL0) |= C0_HCTL_DWIDTH;
+  }
+
+  // Switch to high speed if SD 1.10 or later and the switch succeeds.
+  // The BCM2835 controller needs no high speed enable, as in Linux.
+  if (((data[0] & 0xF) >= 1) &&
+      !read_data(SWITCH_FUNC, SWITCH_HIGH_SPEED, data, 64, FALSE) &&
+      ((data[16] & 0xF) == 1))
+    return set_clock(EMMC_HIGH_CLOCK);
+  return set_clock(EMMC_NORMAL_CLOCK);
+}
+
+/*...................................................................*/
+/* start_request: Start the oldest queued read or write on the bus,  */
+/*                by DMA if the buffer is word aligned, else by PIO  */
+/*                                                                   */
+/*      Input: request is the command                                */
+/*                                                                   */
+/*    Returns: Zero on success, -1 if failed                         */
+/*...................................................................*/
+static int start_request(EmmcRequest *request)
+{
+  u32 blocks = request->count >> BLOCK_SHIFT, cmdtm;
+  int dma = ((uintptr_t)request->buffer & 3) == 0;
+
+  if (request->type == REQUEST_READ)
+    cmdtm = blocks > 1 ? READ_MULTIPLE_BLOCK : READ_SINGLE_BLOCK;
+  else
+    cmdtm = blocks > 1 ? WRITE_MULTIPLE_BLOCK : WRITE_BLOCK;
+
+  REG32(EMMC_BLKSIZECNT) = (blocks << 16) | BLOCK_SIZE;
+  if (command(cmdtm, Emmc.sdhc ? request->block :
+                                 request->block << BLOCK_SHIFT))
+    return -1;
+
+  // Without DMA move the data now, EmmcPoll() then completes it
+  if (!dma)
+  {
+    if (request->type == REQUEST_READ)
+      return pio_read(request->buffer, BLOCK_SIZE, blocks);
+    return pio_write(request->buffer, blocks);
+  }
+
+  // Otherwise start the DMA, paced by the data requests (DREQ) of the
+  // controller. It holds the data until then, and an emulator that
+  // ignores DREQ (QEMU) finds the data ready.
+  if (request->type == REQUEST_READ)
+  {
+    ControlBlock.transferInfo = TI_WAIT_RESP | TI_DEST_INC |
+                                TI_SRC_DREQ | TI_PERMAP(DREQ_EMMC);
+    ControlBlock.source = BUS_PERIPHERAL(EMMC_DATA);
+    ControlBlock.destination = (u32)request->buffer | GPU_MEM_BASE;
+  }
+  else
+  {
+    ControlBlock.transferInfo = TI_WAIT_RESP | TI_SRC_INC |
+                                TI_DEST_DREQ | TI_PERMAP(DREQ_EMMC);
+    ControlBlock.source = (u32)request->buffer | GPU_MEM_BASE;
+    ControlBlock.destination = BUS_PERIPHERAL(EMMC_DATA);
+  }
+  ControlBlock.length = request->count;
+  ControlBlock.stride = 0;
+  ControlBlock.next = 0;
+  REG32(DMA_CONBLK_AD) = (u32)&ControlBlock | GPU_MEM_BASE;
+  REG32(DMA_CS) = DMA_CS_END | DMA_CS_INT; // clear the last transfer
+  REG32(DMA_CS) = DMA_CS_ACTIVE;
+  return 0;
+}
+
+/*...................................................................*/
+/*  abort_request: Stop the DMA and the card after a failed transfer */
+/*                                                                   */
+/*...................................................................*/
+static void abort_request(void)
+{
+  if (REG32(DMA_CS) & DMA_CS_ACTIVE)
+  {
+    REG32(DMA_CS) = DMA_CS_ABORT;
+    wait_until(DMA_CS, DMA_CS_ACTIVE, FALSE);
+  }
+  REG32(DMA_CS) = DMA_CS_RESET;
+  REG32(DMA_DEBUG) = 7; // clear the error flags
+
+  // Return the card to the transfer state, in case no auto CMD12
+  reset_lines();
+  command(STOP_TRANSMISSION, 0);
+}
+
+/*...................................................................*/
+/* complete_request: Dequeue the oldest command and call back with   */
+/*                   the length transferred, or -1 if failed         */
+/*                                                                   */
+/*      Input: length is the length transferred, or -1 if failed     */
+/*...................................................................*/
+static void complete_request(int length)
+{
+  EmmcRequest request = Emmc.requests[Emmc.head];
+
+  // Dequeue before the callback so that it can queue more
+  Emmc.head = (Emmc.head + 1) % EMMC_DEPTH;
+  Emmc.count--;
+  Emmc.active = FALSE;
+
+  if (request.type == REQUEST_READ)
+    ++Emmc.reads;
+  else if (request.type == REQUEST_WRITE)
+    ++Emmc.writes;
+  if (length < 0)
+    ++Emmc.failed;
+  request.callback(request.buffer, length, request.payload);
+}
+
+/*...................................................................*/
+/*  queue_request: Queue a command, started by EmmcPoll() in order   */
+/*                                                                   */
+/*      Inputs: block is the first Logical Block Address (LBA)       */
+/*              buffer is the data to read or write                  */
+/*              count is the length in bytes                         */
+/*              type is REQUEST_READ, _WRITE or _SYNC                */
+/*              callback is called on completion with payload        */
+/*                                                                   */
+/*     Returns: count if queued, -1 if invalid or -2 if queue full   */
+/*...................................................................*/
+static int queue_request(u32 block, void *buffer, u32 count, int type,
+                         void (callback)(u8 *buffer, int buffLen,
+                                         void *payload), void *payload)
+{
+  EmmcRequest *request;
+
+  if ((Emmc.blocks == 0) || ((count & (BLOCK_SIZE - 1)) != 0) ||
+      ((count == 0) && (type != REQUEST_SYNC)) ||
+      ((count >> BLOCK_SHIFT) > MAX_BLOCKS) ||
+      (block + (count >> BLOCK_SHIFT) > Emmc.blocks) ||
+      (block + (count >> BLOCK_SHIFT) < block))
+    return -1;
+
+  if (Emmc.count >= EMMC_DEPTH)
+    return -2;
+
+  request = &Emmc.requests[(Emmc.head + Emmc.count) % EMMC_DEPTH];
+  request->block = block;
+  request->count = count;
+  request->buffer = buffer;
+  request->type = type;
+  request->callback = callback;
+  request->payload = payload;
+
+  Emmc.count++;
+  return count;
+}
+
+/*...................................................................*/
+/* Global Functions                                                  */
+/*...................................................................*/
+
+/*...................................................................*/
+/*   EmmcInit: Initialize the SD card host and the card              */
+/*                                                                   */
+/*    Returns: Zero on success, failure otherwise                    */
+/*...................................................................*/
+int EmmcInit(void)
+{
+#if RPI == 4
+  // The RPi 4 card is on the EMMC2 controller, not supported here
+  puts("SD card host not supported on RPi 4");
+  return -1;
+#endif
+
+  bzero(&Emmc, sizeof(Emmc));
+
+  // Power on the card and read the controller base clock
+  SetSdPowerStateOn();
+  Emmc.baseClock = GetEmmcClockRate();
+  if (Emmc.baseClock == 0)
+  {
+    puts("EMMC clock rate unknown");
+    return -1;
+  }
+  route_pins();
+
+  // Reset the controller and power the bus at 3.3V
+  REG32(EMMC_CONTROL0) = 0;
+  REG32(EMMC_CONTROL2) = 0;
+  REG32(EMMC_CONTROL1) = C1_SRST_HC;
+  if (wait_until(EMMC_CONTROL1, C1_SRST_HC | C1_SRST_CMD |
+                 C1_SRST_DATA, FALSE))
+  {
+    puts("SD card host reset failed");
+    return -1;
+  }
+  REG32(EMMC_CONTROL0) = C0_SD_BUS_POWER | C0_SD_BUS_3V3;
+  REG32(EMMC_CONTROL1) = C1_CLK_INTLEN | C1_DATA_TOUNIT_MAX;
+
+  // Poll for all interrupts, none signalled to the ARM
+  REG32(EMMC_IRPT_EN) = 0;
+  REG32(EMMC_IRPT_MASK) = 0xFFFFFFFF;
+  REG32(EMMC_INTERRUPT) = 0xFFFFFFFF;
+
+  // Enable and reset the DMA channel
+  REG32(DMA_ENABLE) |= 1 << EMMC_DMA_CHANNEL;
+  REG32(DMA_CS) = DMA_CS_RESET;
+
+  if (set_clock(EMMC_INIT_CLOCK) || card_init())
+  {
+    puts("SD card initialization failed");
+    Emmc.blocks = 0;
+    return -1;
+  }
+
+  printf("SD card %u MB, %s, %u bit bus at %u kHz\n",
+         Emmc.blocks >> 11, Emmc.sdhc ? "SDHC/SDXC" : "SDSC",
+         REG32(EMMC_CONTROL0) & C0_HCTL_DWIDTH ? 4 : 1,
+         Emmc.clock / 1000);
+  return 0;
+}
+
+/*...................................................................*/
+/*   EmmcPoll: Start the queued commands and complete them in order  */
+/*                                                                   */
+/*      Input: unused                                                */
+/*                                                                   */
+/*    Returns: TASK_IDLE                                             */
+/*...................................................................*/
+int EmmcPoll(void *unused)
+{
+  EmmcRequest *request;
+  u32 irpt;
+
+  if (Emmc.count == 0)
+    return TASK_IDLE;
+  request = &Emmc.requests[Emmc.head];
+
+  // The card has no write cache, so a sync follows the writes before
+  if (request->type == REQUEST_SYNC)
+  {
+    complete_request(0);
+    return TASK_IDLE;
+  }
+
+  // Start the oldest command
+  if (!Emmc.active)
+  {
+    Emmc.start = TimerNow();
+    if (start_request(request))
+    {
+      abort_request();
+      complete_request(-1);
+    }
+    else
+      Emmc.active = TRUE;
+    return TASK_IDLE;
+  }
+
+  // Complete it once the data and the DMA are done, or on error
+  irpt = REG32(EMMC_INTERRUPT);
+  if ((irpt & INT_ERROR_MASK) || (REG32(DMA_CS) & DMA_CS_ERROR) ||
+      (TimerNow() - Emmc.start > EMMC_TIMEOUT))
+  {
+    abort_request();
+    complete_request(-1);
+  }
+  else if ((irpt & INT_DATA_DONE) && !(REG32(DMA_CS) & DMA_CS_ACTIVE))
+  {
+    REG32(EMMC_INTERRUPT) = INT_DATA_DONE;
+    complete_request(request->count);
+  }
+  return TASK_IDLE;
+}
+
+/*...................................................................*/
+/* Mass Storage interface                                            */
+/*...................................................................*/
+u32 MassStorageBlockSize()
+{
+  return BLOCK_SIZE;
+}
+
+u32 MassStorageBlockCapacity()
+{
+  return Emmc.blocks;
+}
+
+int MassStorageRead(u32 block, void *buffer, u32 count,
+                    void (callback)(u8 *buffer, int buffLen,
+                                    void *payload),
+                    void *payload)
+{
+  return queue_request(block, buffer, count, REQUEST_READ, callback,
+                       payload);
+}
+
+int MassStorageWrite(u32 block, const void *buffer, u32 count, int fua,
+                     void (callback)(u8 *buffer, int buffLen,
+                                     void *payload),
+                     void *payload)
+{
+  return queue_request(block, (void *)buffer, count, REQUEST_WRITE,
+                       callback, payload);
+}
+
+int MassStorageSync(void (callback)(u8 *buffer, int buffLen,
+                                    void *payload),
+                    void *payload)
+{
+  return queue_request(0, NULL, 0, REQUEST_SYNC, callback, payload);
+}
+
+int MassStorageQueued()
+{
+  return Emmc.count;
+}
+
+#endif /* ENABLE_EMMC */
@@ -68,6 +68,7 @@
 #define GPFSEL2         (GPIO_BASE | 0x8) // GPIO select 2
 #define GPFSEL3         (GPIO_BASE | 0xC) // GPIO select 3
 #define GPFSEL4         (GPIO_BASE | 0x10)// GPIO select 4
+#define GPFSEL5         (GPIO_BASE | 0x14)// GPIO select 5
 #define   GPIO_INPUT         (0 << 0) // GPIO is input      (000)
 #define   GPIO_OUTPUT        (1 << 0) // GPIO is output     (001)
 #define   GPIO_ALT0          (4)      // GPIO is Alternate0 (100)
@@ -184,6 +185,14 @@ u32 SetDisplayResolution(u32 *width, u32 *height, u32 *depth,
 int SetUsbPowerStateOn(void);
 int SetUsbPowerStateOff(void);
 int GetMACAddress (u8 buffer[6]);
+int SetSdPowerStateOn(void);
+u32 GetEmmcClockRate(void);
+
+/*
+ * SD card host (EMMC) interface
+*/
+int EmmcInit(void);
+int EmmcPoll(void *data);
 
 /*
  * Framebuffer interface
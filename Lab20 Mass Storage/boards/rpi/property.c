@@ -40,7 +40,7 @@
 #include <string.h>
 #include <stdio.h>
 
-#if ENABLE_VIDEO || ENABLE_USB
+#if ENABLE_VIDEO || ENABLE_USB || ENABLE_EMMC
 
 // Thank you to the following sources.
 // 
@@ -76,6 +76,7 @@
 
 //Power
 #define TAG_SET_POWER_STATE           0x00028001
+  #define DEVICE_ID_SD_CARD             0
   #define DEVICE_ID_USB_HCD             3
 
   #define POWER_STATE_OFF              (0 << 0)
@@ -83,6 +84,10 @@
   #define POWER_STATE_WAIT             (1 << 1)
   #define POWER_STATE_NO_DEVICE        (1 << 1) // response only
 
+// Clocks
+#define TAG_GET_CLOCK_RATE            0x00030002
+  #define CLOCK_ID_EMMC                 1
+
 // Property buffer codes
 #define CODE_REQUEST                  0x00000000
 #define CODE_RESPONSE_SUCCESS         0x80000000
@@ -120,6 +125,14 @@ typedef struct PropertyPowerState
 }
 PropertyPowerState;
 
+typedef struct PropertyClockRate
+{
+  PropertyTag tag;
+  u32 clockId;
+  u32 rate;
+}
+PropertyClockRate;
+
 // Must include all display property tags in one mailbox transaction
 typedef struct PropertyDisplayDimensions
 {
@@ -396,4 +409,41 @@ int GetMACAddress(u8 buffer[6])
 #endif /* ENABLE_USB_ETHER */
 #endif /* ENABLE_USB */
 
-#endif /* ENABLE_VIDEO || ENABLE_USB */
+#if ENABLE_EMMC
+int SetSdPowerStateOn(void)
+{
+  PropertyPowerState powerState;
+
+  powerState.tag.tagId = TAG_SET_POWER_STATE;
+  powerState.tag.bufSize = 8;
+  powerState.tag.code = CODE_REQUEST;
+
+  powerState.deviceId = DEVICE_ID_SD_CARD;
+  powerState.state = POWER_STATE_ON | POWER_STATE_WAIT;
+  if (property_get(&powerState, sizeof(powerState)) ||
+      (powerState.state & POWER_STATE_NO_DEVICE) ||
+      !(powerState.state & POWER_STATE_ON))
+    return -1;
+
+  return 0;
+}
+
+// Return the EMMC base clock in Hz, zero if unknown
+u32 GetEmmcClockRate(void)
+{
+  PropertyClockRate clockRate;
+
+  clockRate.tag.tagId = TAG_GET_CLOCK_RATE;
+  clockRate.tag.bufSize = 8;
+  clockRate.tag.code = CODE_REQUEST;
+
+  clockRate.clockId = CLOCK_ID_EMMC;
+  clockRate.rate = 0;
+  if (property_get(&clockRate, sizeof(clockRate)))
+    return 0;
+
+  return clockRate.rate;
+}
+#endif /* ENABLE_EMMC */
+
+#endif /* ENABLE_VIDEO || ENABLE_USB || ENABLE_EMMC */
@@ -17,6 +17,7 @@
 //#include <stdlib.h>
 #include <system.h>
 #include <string.h>
+#include <stdlib.h>
 
 #if ENABLE_FAT
 
@@ -36,7 +37,21 @@
     #define ONLY_EXPOSE_FOR_TESTING static
 #endif
 
-#define AFATFS_NUM_CACHE_SECTORS 8
+/*
+ * The default number of sectors in the cache, allocated from the heap by afatfs_init() unless afatfs_setCacheSize() was
+ * called first. If the heap is too small the size is halved down to AFATFS_MIN_CACHE_SECTORS.
+ */
+#define AFATFS_NUM_CACHE_SECTORS 256
+#define AFATFS_MIN_CACHE_SECTORS 8
+#define AFATFS_MAX_CACHE_SECTORS 4096
+
+/*
+ * Sequential reads of a file are followed by reads of the sectors ahead of the cursor into discardable cache sectors.
+ * The window starts at the minimum, doubles while the reader catches up with it and halves when read-ahead sectors are
+ * evicted before being read. It is limited to a quarter of the cache.
+ */
+#define AFATFS_READ_AHEAD_MIN_SECTORS 4
+#define AFATFS_READ_AHEAD_MAX_SECTORS 64
 
 // FAT filesystems are allowed to differ from these parameters, but we choose not to support those weird filesystems:
 #define AFATFS_SECTOR_SIZE  512
@@ -51,7 +66,23 @@
  * How many blocks will we write in a row before we bother using the SDcard's multiple block write method?
  * If this define is omitted, this disables multi-block write.
  */
-//#define AFATFS_MIN_MULTIPLE_BLOCK_WRITE_COUNT 4
+#define AFATFS_MIN_MULTIPLE_BLOCK_WRITE_COUNT 4
+
+/*
+ * How many runs of contiguous clusters of its chain each open file remembers, so seeks needn't walk the FAT from the
+ * start of the file. If this define is omitted, seeks always walk the FAT.
+ */
+#define AFATFS_MAX_FILE_EXTENTS 32
+
+/*
+ * Once mounted, the FAT is scanned in the background into a bitmap of the free clusters with a count of the free
+ * clusters per FAT sector, so searches for free space skip full FAT sectors without reading them. The FSInfo free count
+ * and next free hint are kept up to date from it. If this define is omitted, or the heap can't hold the bitmap,
+ * searches read the FAT.
+ */
+#define AFATFS_FREE_MAP
+#define AFATFS_FREE_MAP_SECTORS_PER_POLL 16 // FAT sectors scanned by each afatfs_poll() at most
+#define AFATFS_FREE_MAP_READ_AHEAD       16 // FAT sectors read ahead of the scan, at most a quarter of the cache
 
 #define AFATFS_FILES_PER_DIRECTORY_SECTOR (AFATFS_SECTOR_SIZE / sizeof(fatDirectoryEntry_t))
 
@@ -194,6 +225,18 @@ typedef struct afatfsCacheBlockDescriptor_t {
      * is overridden by the locked and retainCount flags.
      */
     unsigned discardable:1;
+
+    // Set on access and cleared as the replacement clock hand passes, giving recently used sectors a second chance
+    unsigned referenced:1;
+
+    /*
+     * The writes of this block queued on the card. A sector dirtied again while being written is flushed again before
+     * the first write completes, and only becomes In Sync (so replaceable) once the last of its writes completes.
+     */
+    unsigned writesInProgress:4;
+
+    // The next descriptor index in this sector's hash bucket, or -1
+    int16_t hashNext;
 } afatfsCacheBlockDescriptor_t;
 
 typedef enum {
@@ -312,6 +355,7 @@ typedef struct afatfsDeleteFile_t {
 
 typedef struct afatfsCloseFile_t {
     afatfsCallback_t callback;
+    bool released; // Directory entry saved and cache sectors released, waiting for the sync
 } afatfsCloseFile_t;
 
 typedef enum {
@@ -343,6 +387,14 @@ typedef struct afatfsFileOperation_t {
     } state;
 } afatfsFileOperation_t;
 
+#ifdef AFATFS_MAX_FILE_EXTENTS
+typedef struct afatfsExtent_t {
+    uint32_t fileCluster; // The index of the first cluster of the extent within the file
+    uint32_t cluster;     // Its cluster number
+    uint32_t length;      // The number of contiguous clusters
+} afatfsExtent_t;
+#endif
+
 typedef struct afatfsFile_t {
     afatfsFileType_e type;
 
@@ -391,9 +443,28 @@ typedef struct afatfsFile_t {
      * seek across a sector boundary. This allows fwrite() to complete faster because it doesn't need to check the
      * cache on every call.
      */
-    int8_t writeLockedCacheIndex;
+    int16_t writeLockedCacheIndex;
     // Ditto for fread():
-    int8_t readRetainCacheIndex;
+    int16_t readRetainCacheIndex;
+
+    /*
+     * Read-ahead state: the file sector fread() last asked for, the file sector up to which (exclusive) sectors have
+     * been read ahead, and the number of sectors to read ahead of the cursor (zero until reads are sequential).
+     */
+    uint32_t readAheadSector;
+    uint32_t readAheadEnd;
+    uint16_t readAheadWindow;
+
+#ifdef AFATFS_MAX_FILE_EXTENTS
+    /*
+     * The cluster chain from the start of the file as far as it has been walked (mappedClusters clusters), as runs of
+     * contiguous clusters in file order. Valid while extents[0] starts at firstCluster, and reset when the chain is
+     * appended to or truncated.
+     */
+    afatfsExtent_t extents[AFATFS_MAX_FILE_EXTENTS];
+    uint8_t extentCount;
+    uint32_t mappedClusters;
+#endif
 
     // The position of our directory entry on the disk (so we can update it without consulting a parent directory file)
     afatfsDirEntryPointer_t directoryEntryPos;
@@ -408,6 +479,7 @@ typedef struct afatfsFile_t {
 typedef enum {
     AFATFS_INITIALIZATION_READ_MBR,
     AFATFS_INITIALIZATION_READ_VOLUME_ID,
+    AFATFS_INITIALIZATION_READ_FSINFO,
 
 #ifdef AFATFS_USE_FREEFILE
     AFATFS_INITIALIZATION_FREEFILE_CREATE,
@@ -427,8 +499,22 @@ typedef enum {
 } afatfsInitializationPhase_e;
 
 typedef struct afatfs_t {
-    uint8_t cache[AFATFS_SECTOR_SIZE * AFATFS_NUM_CACHE_SECTORS];
-    afatfsCacheBlockDescriptor_t cacheDescriptor[AFATFS_NUM_CACHE_SECTORS];
+    // The cache memory and descriptors, allocated once from the heap and kept over afatfs_destroy()
+    uint8_t *cache;
+    afatfsCacheBlockDescriptor_t *cacheDescriptor;
+    int cacheSectors;
+
+    int16_t *cacheHash;      // Hash buckets of descriptor indexes by sector index, chained through hashNext
+    uint32_t cacheHashMask;
+    int16_t *cacheFree;      // Stack of descriptor indexes not assigned to a sector
+    int cacheFreeCount;
+    int cacheClockHand;      // Next descriptor the replacement clock considers
+
+    uint32_t cacheHits, cacheMisses;
+
+    // Sectors read ahead, and of those later read by fread() when in sync, while still reading, or once evicted
+    uint32_t readAheadSectors, readAheadHits, readAheadWaits, readAheadMisses;
+
     fatFilesystemType_e filesystemType;
 
     afatfsFilesystemState_e filesystemState;
@@ -446,6 +532,8 @@ typedef struct afatfs_t {
 
     int cacheDirtyEntries; // The number of cache entries in the AFATFS_CACHE_STATE_DIRTY state
     bool cacheFlushInProgress;
+    bool cacheSyncNeeded;     // Sectors were written since the device cache was last synchronized
+    bool cacheSyncInProgress;
 
     afatfsFile_t openFiles[AFATFS_MAX_OPEN_FILES];
 
@@ -488,10 +576,50 @@ typedef struct afatfs_t {
 
     uint32_t rootDirectoryCluster; // Present on FAT32 and set to zero for FAT16
     uint32_t rootDirectorySectors; // Zero on FAT32, for FAT16 the number of sectors that the root directory occupies
+
+    uint32_t fsInfoSector;         // Physical sector of the FAT32 FSInfo, zero if none or its signatures are invalid
+
+#ifdef AFATFS_FREE_MAP
+    uint32_t *freeMap;             // Bit per cluster number, set if free. NULL if the heap couldn't hold it
+    uint16_t *freeMapSectorFree;   // Free clusters in each FAT sector
+    uint32_t freeMapSectors;       // FAT sectors that hold the entries of the volume's clusters
+    uint32_t freeMapScanned;       // FAT sectors scanned so far, the map is only valid for the clusters of these
+    uint32_t freeClusters;         // Free clusters in the scanned FAT sectors
+    u64 freeMapStart;              // TimerNow() when the scan began
+    uint32_t freeMapTime;          // Microseconds the scan took, once finished
+    bool fsInfoDirty;              // The free count or allocation hint changed since the FSInfo was written
+#endif
 } afatfs_t;
 
 static afatfs_t afatfs;
 
+// The cache memory, kept over afatfs_destroy() since large heap blocks are not reused once freed
+static uint8_t *afatfsCacheMemory;
+static int afatfsCacheMemorySectors;
+static int afatfsCacheRequested;
+
+#ifdef AFATFS_FREE_MAP
+// The free cluster map memory, kept over afatfs_destroy() like the cache
+static uint8_t *afatfsFreeMapMemory;
+static uint32_t afatfsFreeMapMemorySize;
+#endif
+
+// The maximum read-ahead window in sectors, zero to disable read-ahead
+static int afatfsReadAheadMax = AFATFS_READ_AHEAD_MAX_SECTORS;
+
+// Heap needed for a cache of the given number of sectors: memory, descriptors, hash buckets and free stack
+static uint32_t afatfs_cacheMemorySize(int sectors)
+{
+    uint32_t hashSize = 1;
+
+    while (hashSize < (uint32_t) sectors) {
+        hashSize <<= 1;
+    }
+
+    return sectors * (AFATFS_SECTOR_SIZE + sizeof(afatfsCacheBlockDescriptor_t) + sizeof(int16_t))
+        + hashSize * sizeof(int16_t);
+}
+
 static void afatfs_fileOperationContinue(afatfsFile_t *file);
 static uint8_t* afatfs_fileLockCursorSectorForWrite(afatfsFilePtr_t file);
 static uint8_t* afatfs_fileRetainCursorSectorForRead(afatfsFilePtr_t file);
@@ -584,7 +712,7 @@ static int afatfs_getCacheDescriptorIndexForBuffer(uint8_t *memory)
 {
     int index = (memory - afatfs.cache) / AFATFS_SECTOR_SIZE;
 
-    if (afatfs_assert(index >= 0 && index < AFATFS_NUM_CACHE_SECTORS)) {
+    if (afatfs_assert(index >= 0 && index < afatfs.cacheSectors)) {
         return index;
     } else {
         return -1;
@@ -605,6 +733,59 @@ static void afatfs_cacheSectorMarkDirty(afatfsCacheBlockDescriptor_t *descriptor
     }
 }
 
+static uint32_t afatfs_cacheHashBucket(uint32_t sectorIndex)
+{
+    // Consecutive sectors land in consecutive buckets, mix in the high bits so distant regions don't collide in step
+    return (sectorIndex ^ (sectorIndex >> 12)) & afatfs.cacheHashMask;
+}
+
+/**
+ * Find the index of the cache descriptor assigned to the given physical sector, or -1 if none is. The descriptor could
+ * be in any state including empty.
+ */
+static int afatfs_cacheHashFind(uint32_t sectorIndex)
+{
+    int i;
+
+    for (i = afatfs.cacheHash[afatfs_cacheHashBucket(sectorIndex)]; i != -1; i = afatfs.cacheDescriptor[i].hashNext) {
+        if (afatfs.cacheDescriptor[i].sectorIndex == sectorIndex) {
+            break;
+        }
+    }
+
+    return i;
+}
+
+static void afatfs_cacheHashInsert(int index)
+{
+    uint32_t bucket = afatfs_cacheHashBucket(afatfs.cacheDescriptor[index].sectorIndex);
+
+    afatfs.cacheDescriptor[index].hashNext = afatfs.cacheHash[bucket];
+    afatfs.cacheHash[bucket] = index;
+}
+
+static void afatfs_cacheHashRemove(int index)
+{
+    int16_t *link = &afatfs.cacheHash[afatfs_cacheHashBucket(afatfs.cacheDescriptor[index].sectorIndex)];
+
+    for (; *link != -1; link = &afatfs.cacheDescriptor[*link].hashNext) {
+        if (*link == index) {
+            *link = afatfs.cacheDescriptor[index].hashNext;
+            break;
+        }
+    }
+}
+
+/**
+ * Unassign a descriptor from its sector, returning it to the free stack.
+ */
+static void afatfs_cacheSectorRelease(int index)
+{
+    afatfs_cacheHashRemove(index);
+    afatfs.cacheDescriptor[index].state = AFATFS_CACHE_STATE_EMPTY;
+    afatfs.cacheFree[afatfs.cacheFreeCount++] = index;
+}
+
 static void afatfs_cacheSectorInit(afatfsCacheBlockDescriptor_t *descriptor, uint32_t sectorIndex, bool locked)
 {
     descriptor->sectorIndex = sectorIndex;
@@ -618,6 +799,8 @@ static void afatfs_cacheSectorInit(afatfsCacheBlockDescriptor_t *descriptor, uin
     descriptor->locked = locked;
     descriptor->retainCount = 0;
     descriptor->discardable = 0;
+    descriptor->referenced = 1;
+    descriptor->writesInProgress = 0;
 }
 
 /**
@@ -628,20 +811,16 @@ static void afatfs_sdcardReadComplete(sdcardBlockOperation_e operation, uint32_t
     (void) operation;
     (void) callbackData;
 
-    for (int i = 0; i < AFATFS_NUM_CACHE_SECTORS; i++) {
-        if (afatfs.cacheDescriptor[i].state != AFATFS_CACHE_STATE_EMPTY
-            && afatfs.cacheDescriptor[i].sectorIndex == sectorIndex
-        ) {
-            if (buffer == NULL) {
-                // Read failed, mark the sector as empty and whoever asked for it will ask for it again later to retry
-                afatfs.cacheDescriptor[i].state = AFATFS_CACHE_STATE_EMPTY;
-            } else {
-                afatfs_assert(afatfs_cacheSectorGetMemory(i) == buffer && afatfs.cacheDescriptor[i].state == AFATFS_CACHE_STATE_READING);
+    int i = afatfs_cacheHashFind(sectorIndex);
 
-                afatfs.cacheDescriptor[i].state = AFATFS_CACHE_STATE_IN_SYNC;
-            }
+    if (i != -1 && afatfs.cacheDescriptor[i].state != AFATFS_CACHE_STATE_EMPTY) {
+        if (buffer == NULL) {
+            // Read failed, mark the sector as empty and whoever asked for it will ask for it again later to retry
+            afatfs_cacheSectorRelease(i);
+        } else {
+            afatfs_assert(afatfs_cacheSectorGetMemory(i) == buffer && afatfs.cacheDescriptor[i].state == AFATFS_CACHE_STATE_READING);
 
-            break;
+            afatfs.cacheDescriptor[i].state = AFATFS_CACHE_STATE_IN_SYNC;
         }
     }
 }
@@ -656,23 +835,26 @@ static void afatfs_sdcardWriteComplete(sdcardBlockOperation_e operation, uint32_
 
     afatfs.cacheFlushInProgress = false;
 
-    for (int i = 0; i < AFATFS_NUM_CACHE_SECTORS; i++) {
-        /* Keep in mind that someone may have marked the sector as dirty after writing had already begun. In this case we must leave
-         * it marked as dirty because those modifications may have been made too late to make it to the disk!
-         */
-        if (afatfs.cacheDescriptor[i].sectorIndex == sectorIndex
-            && afatfs.cacheDescriptor[i].state == AFATFS_CACHE_STATE_WRITING
-        ) {
-            if (buffer == NULL) {
-                // Write failed, remark the sector as dirty
-                afatfs.cacheDescriptor[i].state = AFATFS_CACHE_STATE_DIRTY;
-                afatfs.cacheDirtyEntries++;
-            } else {
-                afatfs_assert(afatfs_cacheSectorGetMemory(i) == buffer);
+    int i = afatfs_cacheHashFind(sectorIndex);
 
-                afatfs.cacheDescriptor[i].state = AFATFS_CACHE_STATE_IN_SYNC;
-            }
-            break;
+    if (i == -1 || afatfs.cacheDescriptor[i].writesInProgress == 0) {
+        return;
+    }
+
+    afatfs.cacheDescriptor[i].writesInProgress--;
+
+    /* Keep in mind that someone may have marked the sector as dirty after writing had already begun. In this case we must leave
+     * it marked as dirty because those modifications may have been made too late to make it to the disk!
+     */
+    if (afatfs.cacheDescriptor[i].state == AFATFS_CACHE_STATE_WRITING) {
+        if (buffer == NULL) {
+            // Write failed, remark the sector as dirty
+            afatfs.cacheDescriptor[i].state = AFATFS_CACHE_STATE_DIRTY;
+            afatfs.cacheDirtyEntries++;
+        } else if (afatfs.cacheDescriptor[i].writesInProgress == 0) {
+            afatfs_assert(afatfs_cacheSectorGetMemory(i) == buffer);
+
+            afatfs.cacheDescriptor[i].state = AFATFS_CACHE_STATE_IN_SYNC;
         }
     }
 }
@@ -695,13 +877,16 @@ static void afatfs_cacheFlushSector(int cacheIndex)
             // The card will call us back later when the buffer transmission finishes
             afatfs.cacheDirtyEntries--;
             cacheDescriptor->state = AFATFS_CACHE_STATE_WRITING;
+            cacheDescriptor->writesInProgress++;
             afatfs.cacheFlushInProgress = true;
+            afatfs.cacheSyncNeeded = true;
             break;
 
         case SDCARD_OPERATION_SUCCESS:
             // Buffer is already transmitted
             afatfs.cacheDirtyEntries--;
             cacheDescriptor->state = AFATFS_CACHE_STATE_IN_SYNC;
+            afatfs.cacheSyncNeeded = true;
             break;
 
         case SDCARD_OPERATION_BUSY:
@@ -717,33 +902,54 @@ static void afatfs_cacheFlushSector(int cacheIndex)
  */
 static afatfsCacheBlockDescriptor_t* afatfs_findCacheSector(uint32_t sectorIndex)
 {
-    for (int i = 0; i < AFATFS_NUM_CACHE_SECTORS; i++) {
-        if (afatfs.cacheDescriptor[i].sectorIndex == sectorIndex) {
-            return &afatfs.cacheDescriptor[i];
+    int i = afatfs_cacheHashFind(sectorIndex);
+
+    return i == -1 ? NULL : &afatfs.cacheDescriptor[i];
+}
+
+#ifdef AFATFS_MIN_MULTIPLE_BLOCK_WRITE_COUNT
+
+/**
+ * After flushing the given sector, flush the dirty sectors that follow it on disk too so the card can write them in
+ * one multiple block write. While a file holds the following sector locked for writing, the multiple block write is
+ * left open for that sector, otherwise it ends here.
+ */
+static void afatfs_cacheFlushConsecutive(int cacheIndex)
+{
+    uint32_t sectorIndex = afatfs.cacheDescriptor[cacheIndex].sectorIndex;
+
+    while (afatfs.cacheDescriptor[cacheIndex].state == AFATFS_CACHE_STATE_WRITING) {
+        afatfsCacheBlockDescriptor_t *descriptor = afatfs_findCacheSector(++sectorIndex);
+
+        if (descriptor == NULL || descriptor->state != AFATFS_CACHE_STATE_DIRTY || descriptor->locked) {
+            if (descriptor == NULL || !descriptor->locked) {
+                sdcard_endWriteBlocks();
+            }
+            break;
         }
-    }
 
-    return NULL;
+        cacheIndex = descriptor - afatfs.cacheDescriptor;
+        afatfs_cacheFlushSector(cacheIndex);
+    }
 }
 
+#endif
+
 /**
  * Find or allocate a cache sector for the given sector index on disk. Returns a block which matches one of these
  * conditions (in descending order of preference):
  *
  * - The requested sector that already exists in the cache
  * - The index of an empty sector
- * - The index of a synced discardable sector
- * - The index of the oldest synced sector
+ * - The index of an empty, or synced discardable, sector reached by the replacement clock
+ * - The index of the first synced sector not referenced since the last pass of the replacement clock
  *
- * Otherwise it returns -1 to signal failure (cache is full!)
+ * Sectors which are locked or retained are never replaced. Otherwise it returns -1 to signal failure (cache is full!)
  */
 static int afatfs_allocateCacheSector(uint32_t sectorIndex)
 {
+    afatfsCacheBlockDescriptor_t *descriptor;
     int allocateIndex;
-    int emptyIndex = -1, discardableIndex = -1;
-
-    uint32_t oldestSyncedSectorLastUse = 0xFFFFFFFF;
-    int oldestSyncedSectorIndex = -1;
 
     if (
         !afatfs_assert(
@@ -754,71 +960,90 @@ static int afatfs_allocateCacheSector(uint32_t sectorIndex)
         return -1;
     }
 
-    for (int i = 0; i < AFATFS_NUM_CACHE_SECTORS; i++) {
-        if (afatfs.cacheDescriptor[i].sectorIndex == sectorIndex) {
-            /*
-             * If the sector is actually empty then do a complete re-init of it just like the standard
-             * empty case. (Sectors marked as empty should be treated as if they don't have a block index assigned)
-             */
-            if (afatfs.cacheDescriptor[i].state == AFATFS_CACHE_STATE_EMPTY) {
-                emptyIndex = i;
+    allocateIndex = afatfs_cacheHashFind(sectorIndex);
+
+    if (allocateIndex != -1) {
+        descriptor = &afatfs.cacheDescriptor[allocateIndex];
+
+        /*
+         * If the sector is actually empty then do a complete re-init of it just like the standard
+         * empty case. (Sectors marked as empty should be treated as if they don't have a block index assigned)
+         */
+        if (descriptor->state != AFATFS_CACHE_STATE_EMPTY) {
+            // Bump the last access time
+            descriptor->accessTimestamp = ++afatfs.cacheTimer;
+            descriptor->referenced = 1;
+            afatfs.cacheHits++;
+            return allocateIndex;
+        }
+
+        afatfs_cacheHashRemove(allocateIndex);
+    } else if (afatfs.cacheFreeCount > 0) {
+        allocateIndex = afatfs.cacheFree[--afatfs.cacheFreeCount];
+    } else {
+        /*
+         * Sweep the clock at most twice around: the first pass may only clear the referenced bits. Locked, retained,
+         * dirty and in-flight sectors are skipped.
+         */
+        for (int i = 0; i < 2 * afatfs.cacheSectors; i++) {
+            int index = afatfs.cacheClockHand;
+
+            afatfs.cacheClockHand = (index + 1) % afatfs.cacheSectors;
+            descriptor = &afatfs.cacheDescriptor[index];
+
+            if (descriptor->locked || descriptor->retainCount > 0) {
+                continue;
+            }
+
+            if (descriptor->state == AFATFS_CACHE_STATE_EMPTY
+                || (descriptor->state == AFATFS_CACHE_STATE_IN_SYNC && (descriptor->discardable || !descriptor->referenced))
+            ) {
+                allocateIndex = index;
                 break;
             }
 
-            // Bump the last access time
-            afatfs.cacheDescriptor[i].accessTimestamp = ++afatfs.cacheTimer;
-            return i;
+            descriptor->referenced = 0;
         }
 
-        switch (afatfs.cacheDescriptor[i].state) {
-            case AFATFS_CACHE_STATE_EMPTY:
-                emptyIndex = i;
-            break;
-            case AFATFS_CACHE_STATE_IN_SYNC:
-                // Is this a synced sector that we could evict from the cache?
-                if (!afatfs.cacheDescriptor[i].locked && afatfs.cacheDescriptor[i].retainCount == 0) {
-                    if (afatfs.cacheDescriptor[i].discardable) {
-                        discardableIndex = i;
-                    } else if (afatfs.cacheDescriptor[i].accessTimestamp < oldestSyncedSectorLastUse) {
-                        // This is older than last block we decided to evict, so evict this one in preference
-                        oldestSyncedSectorLastUse = afatfs.cacheDescriptor[i].accessTimestamp;
-                        oldestSyncedSectorIndex = i;
-                    }
-                }
-            break;
-            default:
-                ;
+        if (allocateIndex == -1) {
+            return -1;
         }
-    }
 
-    if (emptyIndex > -1) {
-        allocateIndex = emptyIndex;
-    } else if (discardableIndex > -1) {
-        allocateIndex = discardableIndex;
-    } else if (oldestSyncedSectorIndex > -1) {
-        allocateIndex = oldestSyncedSectorIndex;
-    } else {
-        allocateIndex = -1;
+        afatfs_cacheHashRemove(allocateIndex);
     }
 
-    if (allocateIndex > -1) {
-        afatfs_cacheSectorInit(&afatfs.cacheDescriptor[allocateIndex], sectorIndex, false);
-    }
+    afatfs.cacheMisses++;
+    afatfs_cacheSectorInit(&afatfs.cacheDescriptor[allocateIndex], sectorIndex, false);
+    afatfs_cacheHashInsert(allocateIndex);
 
     return allocateIndex;
 }
 
 /**
- * Attempt to flush dirty cache pages out to the sdcard, returning true if all flushable data has been flushed.
+ * Called by the SD card driver when the device write cache has been synchronized.
  */
-bool afatfs_flush()
+static void afatfs_sdcardSyncComplete(bool success)
+{
+    /* A device without a write cache may reject the command, the writes before it have completed regardless so don't
+     * retry forever.
+     */
+    (void) success;
+
+    afatfs.cacheSyncInProgress = false;
+}
+
+/**
+ * Attempt to flush dirty cache pages out to the sdcard, returning true if all flushable data has been flushed. If sync
+ * is true the device write cache is also synchronized once the flushable data is written.
+ */
+static bool afatfs_flushInternal(bool sync)
 {
     if (afatfs.cacheDirtyEntries > 0) {
         // Flush the oldest flushable sector
         uint32_t earliestSectorTime = 0xFFFFFFFF;
         int earliestSectorIndex = -1;
 
-        for (int i = 0; i < AFATFS_NUM_CACHE_SECTORS; i++) {
+        for (int i = 0; i < afatfs.cacheSectors; i++) {
             if (afatfs.cacheDescriptor[i].state == AFATFS_CACHE_STATE_DIRTY && !afatfs.cacheDescriptor[i].locked
                 && (earliestSectorIndex == -1 || afatfs.cacheDescriptor[i].writeTimestamp < earliestSectorTime)
             ) {
@@ -829,15 +1054,41 @@ bool afatfs_flush()
 
         if (earliestSectorIndex > -1) {
             afatfs_cacheFlushSector(earliestSectorIndex);
+#ifdef AFATFS_MIN_MULTIPLE_BLOCK_WRITE_COUNT
+            afatfs_cacheFlushConsecutive(earliestSectorIndex);
+#endif
 
             // That flush will take time to complete so we may as well tell caller to come back later
             return false;
         }
     }
 
+    if (sync) {
+        if (afatfs.cacheSyncInProgress) {
+            return false;
+        }
+
+        if (afatfs.cacheSyncNeeded) {
+            if (sdcard_sync(afatfs_sdcardSyncComplete) == SDCARD_OPERATION_IN_PROGRESS) {
+                afatfs.cacheSyncNeeded = false;
+                afatfs.cacheSyncInProgress = true;
+            }
+            return false;
+        }
+    }
+
     return true;
 }
 
+/**
+ * Attempt to flush dirty cache pages out to the sdcard and synchronize the device write cache, returning true if all
+ * flushable data is on the medium.
+ */
+bool afatfs_flush()
+{
+    return afatfs_flushInternal(true);
+}
+
 /**
  * Returns true if either the freefile or the regular cluster pool has been exhausted during a previous write operation.
  */
@@ -933,7 +1184,7 @@ static afatfsOperationStatus_e afatfs_cacheSector(uint32_t physicalSectorIndex,
             if (eraseCount < AFATFS_MIN_MULTIPLE_BLOCK_WRITE_COUNT) {
                 eraseCount = 0;
             } else {
-                eraseCount = MIN(eraseCount, UINT16_MAX); // If caller asked for a longer chain of sectors we silently truncate that here
+                eraseCount = MIN(eraseCount, 0xFFFF); // If caller asked for a longer chain of sectors we silently truncate that here
             }
 
             afatfs.cacheDescriptor[cacheSectorIndex].consecutiveEraseBlockCount = eraseCount;
@@ -1039,6 +1290,12 @@ static bool afatfs_parseVolumeID(const uint8_t *sector)
 
     if (afatfs.filesystemType == FAT_FILESYSTEM_TYPE_FAT32) {
         afatfs.rootDirectoryCluster = volume->fatDescriptor.fat32.rootCluster;
+
+        // Zero and 0xFFFF mean there is no FSInfo sector
+        if (volume->fatDescriptor.fat32.fsInfo != 0 && volume->fatDescriptor.fat32.fsInfo != 0xFFFF
+                && volume->fatDescriptor.fat32.fsInfo < volume->reservedSectorCount) {
+            afatfs.fsInfoSector = afatfs.partitionStartSector + volume->fatDescriptor.fat32.fsInfo;
+        }
     } else {
         // FAT16 doesn't store the root directory in clusters
         afatfs.rootDirectoryCluster = 0;
@@ -1078,6 +1335,103 @@ static bool afatfs_FATIsEndOfChainMarker(uint32_t clusterNumber)
     }
 }
 
+#ifdef AFATFS_FREE_MAP
+
+/**
+ * Record in the free cluster map that the FAT entries of the clusters from startCluster up to endCluster (exclusive)
+ * were set to free or occupied. Clusters in FAT sectors not scanned yet are left for the scan to find.
+ */
+static void afatfs_freeMapMark(uint32_t startCluster, uint32_t endCluster, bool free)
+{
+    if (afatfs.freeMap == NULL) {
+        return;
+    }
+
+    endCluster = MIN(endCluster, MIN(afatfs.freeMapScanned * afatfs_fatEntriesPerSector(),
+        afatfs.numClusters + FAT_SMALLEST_LEGAL_CLUSTER_NUMBER));
+
+    for (uint32_t cluster = startCluster; cluster < endCluster; cluster++) {
+        uint32_t mask = 1U << (cluster & 31);
+        uint32_t fatSectorIndex = cluster / afatfs_fatEntriesPerSector();
+
+        if (((afatfs.freeMap[cluster / 32] & mask) != 0) == free) {
+            continue;
+        }
+
+        if (free) {
+            afatfs.freeMap[cluster / 32] |= mask;
+            afatfs.freeMapSectorFree[fatSectorIndex]++;
+            afatfs.freeClusters++;
+        } else {
+            afatfs.freeMap[cluster / 32] &= ~mask;
+            afatfs.freeMapSectorFree[fatSectorIndex]--;
+            afatfs.freeClusters--;
+        }
+
+        afatfs.fsInfoDirty = true;
+    }
+}
+
+/**
+ * Search the free cluster map for the first cluster from *cluster which meets the condition (see
+ * afatfs_findClusterWithCondition()), skipping FAT sectors whose free count rules them out and 32 clusters at a time
+ * within the others.
+ *
+ * Returns true with the cluster in *cluster if found before searchLimit. Otherwise *cluster is left where the map ends
+ * or at the searchLimit, and the FAT must be searched from there.
+ */
+static bool afatfs_freeMapFind(afatfsClusterSearchCondition_e condition, uint32_t *cluster, uint32_t searchLimit)
+{
+    uint32_t fatEntriesPerSector = afatfs_fatEntriesPerSector();
+    uint32_t mapLimit = MIN(searchLimit, afatfs.freeMapScanned * fatEntriesPerSector);
+    bool lookingForFree = condition != CLUSTER_SEARCH_OCCUPIED;
+
+    if (afatfs.freeMap == NULL) {
+        return false;
+    }
+
+    while (*cluster < mapLimit) {
+        uint32_t fatSectorIndex = *cluster / fatEntriesPerSector;
+        uint32_t sectorFree = afatfs.freeMapSectorFree[fatSectorIndex];
+        uint32_t bits;
+
+        if (lookingForFree ? sectorFree == 0 : sectorFree == fatEntriesPerSector) {
+            *cluster = (fatSectorIndex + 1) * fatEntriesPerSector;
+            continue;
+        }
+
+        if (condition == CLUSTER_SEARCH_FREE_AT_BEGINNING_OF_FAT_SECTOR) {
+            if ((afatfs.freeMap[*cluster / 32] & (1U << (*cluster & 31))) != 0) {
+                return true;
+            }
+            *cluster += fatEntriesPerSector;
+            continue;
+        }
+
+        bits = lookingForFree ? afatfs.freeMap[*cluster / 32] : ~afatfs.freeMap[*cluster / 32];
+        bits &= 0xFFFFFFFF << (*cluster & 31);
+
+        if (bits == 0) {
+            *cluster = (*cluster | 31) + 1;
+            continue;
+        }
+
+        while ((bits & (1U << (*cluster & 31))) == 0) {
+            (*cluster)++;
+        }
+
+        if (*cluster < mapLimit) {
+            return true;
+        }
+    }
+
+    *cluster = MIN(*cluster, mapLimit);
+
+    return false;
+}
+
+#endif
+
 /**
  * Look up the FAT to find out which cluster follows the one with the given number and store it into *nextCluster.
  *
@@ -1141,6 +1495,10 @@ static afatfsOperationStatus_e afatfs_FATSetNextCluster(uint32_t startCluster, u
         } else {
             sector.fat32[fatSectorEntryIndex] = nextCluster;
         }
+
+#ifdef AFATFS_FREE_MAP
+        afatfs_freeMapMark(startCluster, startCluster + 1, nextCluster == 0);
+#endif
     }
 
     return result;
@@ -1196,6 +1554,13 @@ static afatfsFindClusterStatus_e afatfs_findClusterWithCondition(afatfsClusterSe
 
     int jump;
 
+#ifdef AFATFS_FREE_MAP
+    // The map answers for the FAT sectors scanned so far, the FAT beyond those is searched as usual
+    if (afatfs_freeMapFind(condition, cluster, searchLimit)) {
+        return AFATFS_FIND_CLUSTER_FOUND;
+    }
+#endif
+
     // Get the FAT entry which corresponds to this cluster so we can begin our search there
     afatfs_getFATPositionForCluster(*cluster, &fatSectorIndex, &fatSectorEntryIndex);
 
@@ -1363,6 +1728,10 @@ static afatfsOperationStatus_e afatfs_FATFillWithPattern(afatfsFATPattern_e patt
             return result;
         }
 
+#ifdef AFATFS_FREE_MAP
+        afatfs_freeMapMark(*startCluster, *startCluster + (lastEntryIndex - firstEntryIndex), pattern == AFATFS_FAT_PATTERN_FREE);
+#endif
+
 #ifdef AFATFS_DEBUG_VERBOSE
         if (pattern == AFATFS_FAT_PATTERN_FREE) {
             fprintf(stderr, "Marking cluster %u to %u as free in FAT sector %u...\n", *startCluster, endCluster, fatPhysicalSector);
@@ -1482,6 +1851,98 @@ static afatfsOperationStatus_e afatfs_saveDirectoryEntry(afatfsFilePtr_t file, a
     return result;
 }
 
+#ifdef AFATFS_MAX_FILE_EXTENTS
+
+static void afatfs_fileExtentsInvalidate(afatfsFilePtr_t file)
+{
+    file->extentCount = 0;
+    file->mappedClusters = 0;
+}
+
+/**
+ * Add the cluster at the file cursor to the extent map, if it is the cluster that follows the ones already mapped.
+ * Called whenever the cursor moves to a new cluster.
+ */
+static void afatfs_fileExtentRecord(afatfsFilePtr_t file)
+{
+    uint32_t cluster = file->cursorCluster;
+    afatfsExtent_t *extent;
+
+    if (file->type == AFATFS_FILE_TYPE_FAT16_ROOT_DIRECTORY || cluster < FAT_SMALLEST_LEGAL_CLUSTER_NUMBER
+        || afatfs_FATIsEndOfChainMarker(cluster)) {
+        return;
+    }
+
+    // The map is of the chain that starts at the first cluster, which may have been changed directly
+    if (file->extentCount > 0 && file->extents[0].cluster != file->firstCluster) {
+        afatfs_fileExtentsInvalidate(file);
+    }
+
+    if (file->cursorOffset / afatfs_clusterSize() != file->mappedClusters) {
+        return;
+    }
+
+    if (file->extentCount > 0
+        && file->extents[file->extentCount - 1].cluster + file->extents[file->extentCount - 1].length == cluster) {
+        file->extents[file->extentCount - 1].length++;
+    } else if (file->extentCount < AFATFS_MAX_FILE_EXTENTS) {
+        extent = &file->extents[file->extentCount++];
+        extent->fileCluster = file->mappedClusters;
+        extent->cluster = cluster;
+        extent->length = 1;
+    } else {
+        // The map is full, clusters past it are found by walking the FAT
+        return;
+    }
+
+    file->mappedClusters++;
+}
+
+/**
+ * Move the cursor, which must be at the start of the file, to the start of the furthest mapped cluster at or before
+ * the given offset by binary search of the extent map.
+ */
+static void afatfs_fileExtentSeek(afatfsFilePtr_t file, uint32_t offset)
+{
+    uint32_t fileCluster;
+    afatfsExtent_t *extent;
+    int low = 0, high = file->extentCount - 1;
+
+    afatfs_fileExtentRecord(file);
+
+    if (file->mappedClusters == 0) {
+        return;
+    }
+
+    fileCluster = MIN(offset / afatfs_clusterSize(), file->mappedClusters - 1);
+
+    // Find the last extent starting at or before the cluster
+    while (low < high) {
+        int middle = (low + high + 1) / 2;
+
+        if (file->extents[middle].fileCluster <= fileCluster) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+
+    extent = &file->extents[low];
+
+    file->cursorCluster = extent->cluster + (fileCluster - extent->fileCluster);
+    file->cursorOffset = fileCluster * afatfs_clusterSize();
+
+    if (fileCluster == 0) {
+        file->cursorPreviousCluster = 0;
+    } else if (fileCluster > extent->fileCluster) {
+        file->cursorPreviousCluster = file->cursorCluster - 1;
+    } else {
+        file->cursorPreviousCluster = file->extents[low - 1].cluster + file->extents[low - 1].length - 1;
+    }
+}
+
+#endif
+
 /**
  * Attempt to add a free cluster to the end of the given file. If the file was previously empty, the directory entry
  * is updated to point to the new cluster.
@@ -1612,6 +2073,10 @@ static afatfsOperationStatus_e afatfs_appendRegularFreeCluster(afatfsFilePtr_t f
 
     file->operation.operation = AFATFS_FILE_OPERATION_APPEND_FREE_CLUSTER;
 
+#ifdef AFATFS_MAX_FILE_EXTENTS
+    afatfs_fileExtentsInvalidate(file);
+#endif
+
     afatfs_appendRegularFreeClusterInitOperationState(&file->operation.state.appendFreeCluster, file->cursorPreviousCluster);
 
     return afatfs_appendRegularFreeClusterContinue(file);
@@ -1745,6 +2210,10 @@ static afatfsOperationStatus_e afatfs_appendSupercluster(afatfsFilePtr_t file)
 
     file->operation.operation = AFATFS_FILE_OPERATION_APPEND_SUPERCLUSTER;
     opState->phase = AFATFS_APPEND_SUPERCLUSTER_PHASE_INIT;
+
+#ifdef AFATFS_MAX_FILE_EXTENTS
+    afatfs_fileExtentsInvalidate(file);
+#endif
     opState->previousCluster = file->cursorPreviousCluster;
 
     return afatfs_appendSuperclusterContinue(file);
@@ -1786,6 +2255,92 @@ static bool afatfs_isEndOfAllocatedFile(afatfsFilePtr_t file)
     }
 }
 
+/**
+ * Track the file sector fread() is asking for to detect sequential reads and size the read-ahead window. Called before
+ * the cursor sector is cached, for each attempt to read it, but only the first attempt at a sector updates the window.
+ */
+static void afatfs_fileReadAheadUpdate(afatfsFilePtr_t file, uint32_t physicalSector)
+{
+    uint32_t fileSector = file->cursorOffset / AFATFS_SECTOR_SIZE;
+    afatfsCacheBlockDescriptor_t *descriptor;
+    int maxWindow = MIN(afatfsReadAheadMax, afatfs.cacheSectors / 4);
+
+    if (fileSector == file->readAheadSector) {
+        return;
+    }
+
+    if (maxWindow < AFATFS_READ_AHEAD_MIN_SECTORS || fileSector != file->readAheadSector + 1) {
+        // Random access (or read-ahead disabled), stop reading ahead until reads are sequential again
+        file->readAheadWindow = 0;
+        file->readAheadEnd = fileSector + 1;
+    } else if (file->readAheadWindow == 0) {
+        file->readAheadWindow = AFATFS_READ_AHEAD_MIN_SECTORS;
+    } else if (fileSector < file->readAheadEnd) {
+        descriptor = afatfs_findCacheSector(physicalSector);
+
+        if (descriptor == NULL || descriptor->state == AFATFS_CACHE_STATE_EMPTY) {
+            // Evicted before we got to it, the window is too large for the cache
+            afatfs.readAheadMisses++;
+            file->readAheadWindow = MAX(file->readAheadWindow / 2, AFATFS_READ_AHEAD_MIN_SECTORS);
+        } else if (descriptor->state == AFATFS_CACHE_STATE_READING) {
+            // The reader caught up with the device, read further ahead
+            afatfs.readAheadWaits++;
+            file->readAheadWindow = MIN(file->readAheadWindow * 2, maxWindow);
+        } else {
+            afatfs.readAheadHits++;
+        }
+    } else {
+        // The reader went past the end of the window before more could be read ahead
+        file->readAheadWindow = MIN(file->readAheadWindow * 2, maxWindow);
+    }
+
+    file->readAheadSector = fileSector;
+}
+
+/**
+ * Read the sectors of the file that follow the cursor sector, up to the read-ahead window, into discardable cache
+ * sectors. Follows the cluster chain only as far as the FAT sectors are cached, and stops when the cache or the card is
+ * busy, to continue on the next call.
+ */
+static void afatfs_fileReadAhead(afatfsFilePtr_t file)
+{
+    uint32_t fileSector = file->cursorOffset / AFATFS_SECTOR_SIZE;
+    uint32_t endSector = MIN(fileSector + 1 + file->readAheadWindow,
+        (file->logicalSize + AFATFS_SECTOR_SIZE - 1) / AFATFS_SECTOR_SIZE);
+    uint32_t sector = MAX(file->readAheadEnd, fileSector + 1);
+    uint32_t cluster = file->cursorCluster;
+    uint32_t clusterIndex = fileSector / afatfs.sectorsPerCluster;
+
+    while (sector < endSector) {
+        // Find the cluster of the sector, which is within the next few of the cursor cluster
+        while (sector / afatfs.sectorsPerCluster > clusterIndex) {
+            if (afatfs_fileGetNextCluster(file, cluster, &cluster) != AFATFS_OPERATION_SUCCESS
+                || cluster < FAT_SMALLEST_LEGAL_CLUSTER_NUMBER || afatfs_FATIsEndOfChainMarker(cluster)) {
+                return;
+            }
+            clusterIndex++;
+        }
+
+        uint32_t physicalSector = afatfs_fileClusterToPhysical(cluster, sector % afatfs.sectorsPerCluster);
+        afatfsCacheBlockDescriptor_t *descriptor = afatfs_findCacheSector(physicalSector);
+
+        if (descriptor == NULL || descriptor->state == AFATFS_CACHE_STATE_EMPTY) {
+            int cacheSectorIndex = afatfs_allocateCacheSector(physicalSector);
+
+            if (cacheSectorIndex == -1
+                || !sdcard_readBlock(physicalSector, afatfs_cacheSectorGetMemory(cacheSectorIndex), afatfs_sdcardReadComplete, 0)) {
+                return;
+            }
+
+            afatfs.cacheDescriptor[cacheSectorIndex].state = AFATFS_CACHE_STATE_READING;
+            afatfs.cacheDescriptor[cacheSectorIndex].discardable = 1;
+            afatfs.readAheadSectors++;
+        }
+
+        file->readAheadEnd = ++sector;
+    }
+}
+
 /**
  * Take a lock on the sector at the current file cursor position.
  *
@@ -1814,6 +2369,10 @@ static uint8_t* afatfs_fileRetainCursorSectorForRead(afatfsFilePtr_t file)
 
         afatfs_assert(physicalSector > 0); // We never read the root sector using files
 
+        if (file->type == AFATFS_FILE_TYPE_NORMAL) {
+            afatfs_fileReadAheadUpdate(file, physicalSector);
+        }
+
         afatfsOperationStatus_e status = afatfs_cacheSector(
             physicalSector,
             &result,
@@ -1821,6 +2380,11 @@ static uint8_t* afatfs_fileRetainCursorSectorForRead(afatfsFilePtr_t file)
             0
         );
 
+        // Queue the reads ahead after the read of the cursor sector, so they complete after it
+        if (file->type == AFATFS_FILE_TYPE_NORMAL && file->readAheadWindow > 0) {
+            afatfs_fileReadAhead(file);
+        }
+
         if (status != AFATFS_OPERATION_SUCCESS) {
             // Sector not ready for read
             return NULL;
@@ -1961,6 +2525,9 @@ static bool afatfs_fseekAtomic(afatfsFilePtr_t file, int32_t offset)
             file->cursorPreviousCluster = file->cursorCluster;
             file->cursorCluster = nextCluster;
             file->cursorOffset += bytesToSeek;
+#ifdef AFATFS_MAX_FILE_EXTENTS
+            afatfs_fileExtentRecord(file);
+#endif
 
             offset -= bytesToSeek;
         } else {
@@ -2002,6 +2569,9 @@ static bool afatfs_fseekInternalContinue(afatfsFile_t *file)
             file->cursorCluster = nextCluster;
 
             file->cursorOffset += bytesToSeek;
+#ifdef AFATFS_MAX_FILE_EXTENTS
+            afatfs_fileExtentRecord(file);
+#endif
             opState->seekOffset -= bytesToSeek;
             offsetInCluster = 0;
         } else {
@@ -2112,8 +2682,13 @@ afatfsOperationStatus_e afatfs_fseek(afatfsFilePtr_t file, int32_t offset, afatf
     file->cursorCluster = file->firstCluster;
     file->cursorOffset = 0;
 
-    // Then seek forwards by the offset
-    return afatfs_fseekInternal(file, MIN((uint32_t) offset, file->logicalSize), NULL);
+#ifdef AFATFS_MAX_FILE_EXTENTS
+    // Jump to the furthest cluster known before the offset
+    afatfs_fileExtentSeek(file, MIN((uint32_t) offset, file->logicalSize));
+#endif
+
+    // Then seek forwards by the rest of the offset
+    return afatfs_fseekInternal(file, MIN((uint32_t) offset, file->logicalSize) - file->cursorOffset, NULL);
 }
 
 /**
@@ -2528,6 +3103,10 @@ bool afatfs_ftruncate(afatfsFilePtr_t file, afatfsFileCallback_t callback)
     file->logicalSize = 0;
     file->physicalSize = 0;
 
+#ifdef AFATFS_MAX_FILE_EXTENTS
+    afatfs_fileExtentsInvalidate(file);
+#endif
+
     afatfs_fseek(file, 0, AFATFS_SEEK_SET);
 
     return true;
@@ -2699,6 +3278,7 @@ static void afatfs_initFileHandle(afatfsFilePtr_t file)
     memset(file, 0, sizeof(*file));
     file->writeLockedCacheIndex = -1;
     file->readRetainCacheIndex = -1;
+    file->readAheadSector = 0xFFFFFFFF; // So a read from the start of the file is sequential
 }
 
 static void afatfs_funlinkContinue(afatfsFilePtr_t file)
@@ -2806,32 +3386,44 @@ static void afatfs_fcloseContinue(afatfsFilePtr_t file)
 {
     afatfsCacheBlockDescriptor_t *descriptor;
     afatfsCloseFile_t *opState = &file->operation.state.closeFile;
+    bool written = (file->mode & (AFATFS_FILE_MODE_APPEND | AFATFS_FILE_MODE_WRITE)) != 0;
 
-    /*
-     * Directories don't update their parent directory entries over time, because their fileSize field in the directory
-     * never changes (when we add the first cluster to the directory we save the directory entry at that point and it
-     * doesn't change afterwards). So don't bother trying to save their directory entries during fclose().
-     *
-     * Also if we only opened the file for read then we didn't change the directory entry either.
-     */
-    if (file->type != AFATFS_FILE_TYPE_DIRECTORY && file->type != AFATFS_FILE_TYPE_FAT16_ROOT_DIRECTORY
-            && (file->mode & (AFATFS_FILE_MODE_APPEND | AFATFS_FILE_MODE_WRITE)) != 0) {
-        if (afatfs_saveDirectoryEntry(file, AFATFS_SAVE_DIRECTORY_FOR_CLOSE) != AFATFS_OPERATION_SUCCESS) {
-            return;
+    if (!opState->released) {
+        /*
+         * Directories don't update their parent directory entries over time, because their fileSize field in the directory
+         * never changes (when we add the first cluster to the directory we save the directory entry at that point and it
+         * doesn't change afterwards). So don't bother trying to save their directory entries during fclose().
+         *
+         * Also if we only opened the file for read then we didn't change the directory entry either.
+         */
+        if (file->type != AFATFS_FILE_TYPE_DIRECTORY && file->type != AFATFS_FILE_TYPE_FAT16_ROOT_DIRECTORY && written) {
+            if (afatfs_saveDirectoryEntry(file, AFATFS_SAVE_DIRECTORY_FOR_CLOSE) != AFATFS_OPERATION_SUCCESS) {
+                return;
+            }
         }
-    }
 
-    // Release our reservation on the directory cache if needed
-    if ((file->mode & AFATFS_FILE_MODE_RETAIN_DIRECTORY) != 0) {
-        descriptor = afatfs_findCacheSector(file->directoryEntryPos.sectorNumberPhysical);
+        // Release our reservation on the directory cache if needed
+        if ((file->mode & AFATFS_FILE_MODE_RETAIN_DIRECTORY) != 0) {
+            descriptor = afatfs_findCacheSector(file->directoryEntryPos.sectorNumberPhysical);
 
-        if (descriptor) {
-            descriptor->retainCount = MAX((int) descriptor->retainCount - 1, 0);
+            if (descriptor) {
+                descriptor->retainCount = MAX((int) descriptor->retainCount - 1, 0);
+            }
         }
+
+        // Release locks on the sector at the file cursor position
+        afatfs_fileUnlockCacheSector(file);
+
+        opState->released = true;
     }
 
-    // Release locks on the sector at the file cursor position
-    afatfs_fileUnlockCacheSector(file);
+    /*
+     * Writes don't force unit access, so before a written file is reported closed write back its sectors and synchronize
+     * the device write cache.
+     */
+    if (written && !afatfs_flush()) {
+        return;
+    }
 
 #ifdef AFATFS_USE_FREEFILE
     // Release our exclusive lock on the freefile if needed
@@ -2869,6 +3461,7 @@ bool afatfs_fclose(afatfsFilePtr_t file, afatfsCallback_t callback)
 
         file->operation.operation = AFATFS_FILE_OPERATION_CLOSE;
         file->operation.state.closeFile.callback = callback;
+        file->operation.state.closeFile.released = false;
         afatfs_fcloseContinue(file);
         return true;
     }
@@ -3369,6 +3962,152 @@ static void afatfs_introspecLogCreated(afatfsFile_t *file)
 
 #endif
 
+/**
+ * Check the signatures of the FSInfo sector and begin the search for free clusters at its next free hint. The FSInfo
+ * is forgotten if the signatures are invalid, so it is never written.
+ */
+static void afatfs_parseFSInfo(const uint8_t *sector)
+{
+    fatFSInfo_t *fsInfo = (fatFSInfo_t *) sector;
+
+    if (fsInfo->leadSignature != FAT_FSINFO_LEAD_SIGNATURE || fsInfo->structSignature != FAT_FSINFO_STRUCT_SIGNATURE
+            || fsInfo->trailSignature != FAT_FSINFO_TRAIL_SIGNATURE) {
+        afatfs.fsInfoSector = 0;
+        return;
+    }
+
+    if (fsInfo->nextFree >= FAT_SMALLEST_LEGAL_CLUSTER_NUMBER && fsInfo->nextFree < afatfs.numClusters + FAT_SMALLEST_LEGAL_CLUSTER_NUMBER) {
+        afatfs.lastClusterAllocated = fsInfo->nextFree;
+    }
+}
+
+#ifdef AFATFS_FREE_MAP
+
+/**
+ * Allocate the free cluster map for the mounted volume on first use and clear it for the scan to begin. If the heap
+ * can't hold it, or a map allocated for a smaller volume is too small, the FAT is searched instead.
+ */
+static void afatfs_freeMapInit()
+{
+    uint32_t clusters = afatfs.numClusters + FAT_SMALLEST_LEGAL_CLUSTER_NUMBER;
+    uint32_t mapWords = (clusters + 31) / 32;
+    uint32_t size;
+
+    afatfs.freeMapSectors = (clusters + afatfs_fatEntriesPerSector() - 1) / afatfs_fatEntriesPerSector();
+    size = mapWords * sizeof(uint32_t) + afatfs.freeMapSectors * sizeof(uint16_t);
+
+    if (afatfsFreeMapMemory == NULL && size < MallocRemaining()) {
+        afatfsFreeMapMemory = malloc(size);
+        if (afatfsFreeMapMemory) {
+            afatfsFreeMapMemorySize = size;
+        }
+    }
+
+    if (afatfsFreeMapMemory == NULL || afatfsFreeMapMemorySize < size) {
+        afatfs.freeMap = NULL;
+        return;
+    }
+
+    memset(afatfsFreeMapMemory, 0, size);
+    afatfs.freeMap = (uint32_t *) afatfsFreeMapMemory;
+    afatfs.freeMapSectorFree = (uint16_t *) (afatfs.freeMap + mapWords);
+    afatfs.freeMapScanned = 0;
+    afatfs.freeClusters = 0;
+    afatfs.freeMapStart = TimerNow();
+    afatfs.freeMapTime = 0;
+}
+
+/**
+ * Scan the next FAT sectors into the free cluster map, after queueing reads of the FAT sectors ahead so that the card
+ * streams them. Stops when the cache or the card is busy, to continue on the next call.
+ */
+static void afatfs_freeMapScan()
+{
+    uint32_t fatEntriesPerSector = afatfs_fatEntriesPerSector();
+    uint32_t endCluster = afatfs.numClusters + FAT_SMALLEST_LEGAL_CLUSTER_NUMBER;
+    // A small cache filled with read-ahead would evict the sector scanned next and starve the files being written
+    uint32_t readAhead = MIN(AFATFS_FREE_MAP_READ_AHEAD, afatfs.cacheSectors / 4);
+    uint32_t readAheadEnd = MIN(afatfs.freeMapScanned + readAhead, afatfs.freeMapSectors);
+    afatfsFATSector_t sector;
+
+    for (uint32_t fatSectorIndex = afatfs.freeMapScanned + 1; fatSectorIndex < readAheadEnd; fatSectorIndex++) {
+        uint32_t physicalSector = afatfs_fatSectorToPhysical(0, fatSectorIndex);
+        afatfsCacheBlockDescriptor_t *descriptor = afatfs_findCacheSector(physicalSector);
+
+        if (descriptor == NULL || descriptor->state == AFATFS_CACHE_STATE_EMPTY) {
+            int cacheSectorIndex = afatfs_allocateCacheSector(physicalSector);
+
+            if (cacheSectorIndex == -1
+                || !sdcard_readBlock(physicalSector, afatfs_cacheSectorGetMemory(cacheSectorIndex), afatfs_sdcardReadComplete, 0)) {
+                break;
+            }
+
+            afatfs.cacheDescriptor[cacheSectorIndex].state = AFATFS_CACHE_STATE_READING;
+            afatfs.cacheDescriptor[cacheSectorIndex].discardable = 1;
+        }
+    }
+
+    for (int i = 0; i < AFATFS_FREE_MAP_SECTORS_PER_POLL && afatfs.freeMapScanned < afatfs.freeMapSectors; i++) {
+        uint32_t cluster = afatfs.freeMapScanned * fatEntriesPerSector;
+        uint16_t sectorFree = 0;
+
+        if (afatfs_cacheSector(afatfs_fatSectorToPhysical(0, afatfs.freeMapScanned), &sector.bytes,
+                AFATFS_CACHE_READ | AFATFS_CACHE_DISCARDABLE, 0) != AFATFS_OPERATION_SUCCESS) {
+            return;
+        }
+
+        for (uint32_t entry = 0; entry < fatEntriesPerSector && cluster < endCluster; entry++, cluster++) {
+            uint32_t nextCluster = afatfs.filesystemType == FAT_FILESYSTEM_TYPE_FAT16 ? sector.fat16[entry]
+                : fat32_decodeClusterNumber(sector.fat32[entry]);
+
+            if (cluster >= FAT_SMALLEST_LEGAL_CLUSTER_NUMBER && fat_isFreeSpace(nextCluster)) {
+                afatfs.freeMap[cluster / 32] |= 1U << (cluster & 31);
+                sectorFree++;
+            }
+        }
+
+        afatfs.freeMapSectorFree[afatfs.freeMapScanned++] = sectorFree;
+        afatfs.freeClusters += sectorFree;
+    }
+
+    if (afatfs.freeMapScanned == afatfs.freeMapSectors) {
+        afatfs.freeMapTime = TimerNow() - afatfs.freeMapStart;
+        afatfs.fsInfoDirty = true;
+    }
+}
+
+/**
+ * Store the free cluster count and the cluster to begin the next search at into the FSInfo sector in the cache.
+ */
+static void afatfs_fsInfoUpdate()
+{
+    fatFSInfo_t *fsInfo;
+
+    if (afatfs_cacheSector(afatfs.fsInfoSector, (uint8_t **) &fsInfo, AFATFS_CACHE_READ | AFATFS_CACHE_WRITE, 0) == AFATFS_OPERATION_SUCCESS) {
+        fsInfo->freeCount = afatfs.freeClusters;
+        fsInfo->nextFree = afatfs.lastClusterAllocated;
+        afatfs.fsInfoDirty = false;
+    }
+}
+
+/**
+ * Continue the background scan of the FAT into the free cluster map, then keep the FSInfo up to date.
+ */
+static void afatfs_freeMapPoll()
+{
+    if (afatfs.freeMap == NULL) {
+        return;
+    }
+
+    if (afatfs.freeMapScanned < afatfs.freeMapSectors) {
+        afatfs_freeMapScan();
+    } else if (afatfs.fsInfoDirty && afatfs.fsInfoSector != 0) {
+        afatfs_fsInfoUpdate();
+    }
+}
+
+#endif
+
 static void afatfs_initContinue()
 {
 #ifdef AFATFS_USE_FREEFILE
@@ -3398,12 +4137,25 @@ static void afatfs_initContinue()
                     afatfs_chdir(NULL);
 
                     afatfs.initPhase++;
+                    goto doMore;
                 } else {
                     afatfs.lastError = AFATFS_ERROR_BAD_FILESYSTEM_HEADER;
                     afatfs.filesystemState = AFATFS_FILESYSTEM_STATE_FATAL;
                 }
             }
         break;
+        case AFATFS_INITIALIZATION_READ_FSINFO:
+            if (afatfs.fsInfoSector == 0) {
+                afatfs.initPhase++;
+                goto doMore;
+            }
+
+            if (afatfs_cacheSector(afatfs.fsInfoSector, &sector, AFATFS_CACHE_READ | AFATFS_CACHE_DISCARDABLE, 0) == AFATFS_OPERATION_SUCCESS) {
+                afatfs_parseFSInfo(sector);
+                afatfs.initPhase++;
+                goto doMore;
+            }
+        break;
 
 #ifdef AFATFS_USE_FREEFILE
         case AFATFS_INITIALIZATION_FREEFILE_CREATE:
@@ -3491,6 +4243,10 @@ static void afatfs_initContinue()
 
         case AFATFS_INITIALIZATION_DONE:
             afatfs.filesystemState = AFATFS_FILESYSTEM_STATE_READY;
+
+#ifdef AFATFS_FREE_MAP
+            afatfs_freeMapInit();
+#endif
         break;
     }
 }
@@ -3503,7 +4259,8 @@ void afatfs_poll()
 {
     // Only attempt to continue FS operations if the card is present & ready, otherwise we would just be wasting time
     if (sdcard_poll()) {
-        afatfs_flush();
+        // Write back in the background, the device cache is synchronized by afatfs_flush() and afatfs_fclose()
+        afatfs_flushInternal(false);
 
         switch (afatfs.filesystemState) {
             case AFATFS_FILESYSTEM_STATE_INITIALIZATION:
@@ -3511,6 +4268,10 @@ void afatfs_poll()
             break;
             case AFATFS_FILESYSTEM_STATE_READY:
                 afatfs_fileOperationsPoll();
+
+#ifdef AFATFS_FREE_MAP
+                afatfs_freeMapPoll();
+#endif
             break;
             default:
                 ;
@@ -3572,8 +4333,139 @@ afatfsError_e afatfs_getLastError()
     return afatfs.lastError;
 }
 
+/**
+ * Set the number of sectors in the cache. The cache memory is allocated from the heap by the first afatfs_init() and
+ * kept, so this returns false if called after that.
+ */
+bool afatfs_setCacheSize(int sectors)
+{
+    if (afatfsCacheMemory) {
+        return false;
+    }
+
+    afatfsCacheRequested = MIN(MAX(sectors, AFATFS_MIN_CACHE_SECTORS), AFATFS_MAX_CACHE_SECTORS);
+    return true;
+}
+
+/**
+ * Get the number of sectors in the cache and the lookups which found the sector cached (hits) or not (misses).
+ */
+void afatfs_getCacheStats(int *sectors, uint32_t *hits, uint32_t *misses)
+{
+    *sectors = afatfs.cacheSectors;
+    *hits = afatfs.cacheHits;
+    *misses = afatfs.cacheMisses;
+}
+
+/**
+ * Set the maximum number of sectors read ahead of sequential file reads, zero to disable read-ahead. The window is also
+ * limited to a quarter of the cache.
+ */
+void afatfs_setReadAhead(int sectors)
+{
+    afatfsReadAheadMax = MIN(MAX(sectors, 0), AFATFS_MAX_CACHE_SECTORS / 4);
+}
+
+/**
+ * Get the number of sectors read ahead, and of those read by fread() once in the cache (hits), while still being read
+ * (waits) or after they had been evicted again (misses).
+ */
+void afatfs_getReadAheadStats(uint32_t *sectors, uint32_t *hits, uint32_t *waits, uint32_t *misses)
+{
+    *sectors = afatfs.readAheadSectors;
+    *hits = afatfs.readAheadHits;
+    *waits = afatfs.readAheadWaits;
+    *misses = afatfs.readAheadMisses;
+}
+
+/**
+ * Get the progress of the background scan of the FAT into the free cluster map in FAT sectors, the free clusters found
+ * so far and the microseconds the scan took once finished. All are zero if there is no free cluster map.
+ */
+void afatfs_getFreeMapStats(uint32_t *scanned, uint32_t *fatSectors, uint32_t *freeClusters, uint32_t *scanTime)
+{
+#ifdef AFATFS_FREE_MAP
+    if (afatfs.freeMap) {
+        *scanned = afatfs.freeMapScanned;
+        *fatSectors = afatfs.freeMapSectors;
+        *freeClusters = afatfs.freeClusters;
+        *scanTime = afatfs.freeMapTime;
+        return;
+    }
+#endif
+
+    *scanned = *fatSectors = *freeClusters = *scanTime = 0;
+}
+
+/**
+ * Allocate the cache memory, descriptors and index on first use and reset them to empty. Returns false if even the
+ * minimum cache size could not be allocated.
+ */
+static bool afatfs_cacheInit()
+{
+    uint32_t hashSize = 1;
+    uint8_t *memory;
+    int sectors;
+
+    if (afatfsCacheMemory == NULL) {
+        // Halve the size until the heap can provide it
+        for (sectors = afatfsCacheRequested ? afatfsCacheRequested : AFATFS_NUM_CACHE_SECTORS;
+             sectors >= AFATFS_MIN_CACHE_SECTORS; sectors /= 2) {
+            if (afatfs_cacheMemorySize(sectors) >= MallocRemaining()) {
+                continue;
+            }
+
+            afatfsCacheMemory = malloc(afatfs_cacheMemorySize(sectors));
+            if (afatfsCacheMemory) {
+                afatfsCacheMemorySectors = sectors;
+                break;
+            }
+        }
+
+        if (afatfsCacheMemory == NULL) {
+            return false;
+        }
+    }
+
+    sectors = afatfsCacheMemorySectors;
+    while (hashSize < (uint32_t) sectors) {
+        hashSize <<= 1;
+    }
+
+    // Sector memory first to keep it aligned, then the descriptors and the 16 bit index arrays
+    memory = afatfsCacheMemory;
+    afatfs.cache = memory;
+    memory += sectors * AFATFS_SECTOR_SIZE;
+    afatfs.cacheDescriptor = (afatfsCacheBlockDescriptor_t *) memory;
+    memory += sectors * sizeof(afatfsCacheBlockDescriptor_t);
+    afatfs.cacheHash = (int16_t *) memory;
+    memory += hashSize * sizeof(int16_t);
+    afatfs.cacheFree = (int16_t *) memory;
+
+    afatfs.cacheSectors = sectors;
+    afatfs.cacheHashMask = hashSize - 1;
+    afatfs.cacheClockHand = 0;
+    memset(afatfs.cacheDescriptor, 0, sectors * sizeof(afatfsCacheBlockDescriptor_t));
+    memset(afatfs.cacheHash, 0xFF, hashSize * sizeof(int16_t)); // -1, empty buckets
+
+    // Every descriptor starts unassigned, pushed so the first allocated is index 0
+    for (int i = 0; i < sectors; i++) {
+        afatfs.cacheDescriptor[i].state = AFATFS_CACHE_STATE_EMPTY;
+        afatfs.cacheDescriptor[i].hashNext = -1;
+        afatfs.cacheFree[i] = sectors - 1 - i;
+    }
+    afatfs.cacheFreeCount = sectors;
+
+    return true;
+}
+
 void afatfs_init()
 {
+    if (!afatfs_cacheInit()) {
+        afatfs.filesystemState = AFATFS_FILESYSTEM_STATE_FATAL;
+        return;
+    }
+
     afatfs.filesystemState = AFATFS_FILESYSTEM_STATE_INITIALIZATION;
     afatfs.initPhase = AFATFS_INITIALIZATION_READ_MBR;
     afatfs.lastClusterAllocated = FAT_SMALLEST_LEGAL_CLUSTER_NUMBER;
@@ -3639,7 +4531,7 @@ bool afatfs_destroy(bool dirty)
         /* All sector locks should have been released by closing the files, so the subsequent flush should have written
          * all dirty pages to disk. If not, something's wrong:
          */
-        for (int i = 0; i < AFATFS_NUM_CACHE_SECTORS; i++) {
+        for (int i = 0; i < afatfs.cacheSectors; i++) {
             afatfs_assert(afatfs.cacheDescriptor[i].state != AFATFS_CACHE_STATE_DIRTY);
         }
 #endif
@@ -3657,7 +4549,7 @@ bool afatfs_destroy(bool dirty)
 uint32_t afatfs_getFreeBufferSpace()
 {
     uint32_t result = 0;
-    for (int i = 0; i < AFATFS_NUM_CACHE_SECTORS; i++) {
+    for (int i = 0; i < afatfs.cacheSectors; i++) {
         if (!afatfs.cacheDescriptor[i].locked && (afatfs.cacheDescriptor[i].state == AFATFS_CACHE_STATE_EMPTY || afatfs.cacheDescriptor[i].state == AFATFS_CACHE_STATE_IN_SYNC)) {
             result += AFATFS_SECTOR_SIZE;
         }
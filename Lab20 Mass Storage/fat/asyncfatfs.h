@@ -65,6 +65,11 @@ afatfsOperationStatus_e afatfs_findNext(afatfsFilePtr_t directory, afatfsFinder_
 void afatfs_findLast(afatfsFilePtr_t directory);
 
 bool afatfs_flush();
+bool afatfs_setCacheSize(int sectors);
+void afatfs_getCacheStats(int *sectors, uint32_t *hits, uint32_t *misses);
+void afatfs_setReadAhead(int sectors);
+void afatfs_getReadAheadStats(uint32_t *sectors, uint32_t *hits, uint32_t *waits, uint32_t *misses);
+void afatfs_getFreeMapStats(uint32_t *scanned, uint32_t *fatSectors, uint32_t *freeClusters, uint32_t *scanTime);
 void afatfs_init();
 bool afatfs_destroy(bool dirty);
 void afatfs_poll();
@@ -37,6 +37,7 @@
 /*...................................................................*/
 #include <system.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "sdcard.h"
 
@@ -50,6 +51,14 @@
 
 static char CWD[256];  // Current Working Directory
 static char CDDir[16]; // Change subdirectory in progress
+static char FileName[16]; // Read file in progress
+static int TimeOnly;      // Read file without output
+static u32 ReadBytes;     // Bytes read by file in progress
+static u64 ReadStart;     // Time read file started
+static int CacheSectors;  // Sector cache size and counters at start
+static uint32_t CacheHits, CacheMisses;
+static uint32_t ReadAhead[4];  // Read-ahead sectors, hits, waits, misses
+static int Mounting;      // Mount in progress
 static afatfsFilePtr_t openDirectory;
 static afatfsFinder_t finder;
 typedef enum {
@@ -60,6 +69,48 @@ typedef enum {
 } fatState;
 fatState readState = READ_INIT;
 
+// Write benchmark state
+typedef enum {
+    WBENCH_IDLE,
+    WBENCH_OPEN,
+    WBENCH_OPENING,
+    WBENCH_WRITE,
+    WBENCH_CLOSE,
+    WBENCH_CLOSING
+} wbenchState;
+static struct
+{
+  wbenchState state;
+  int append;      // append to a log instead of creating files
+  int stream;      // append sectors to a contiguous file
+  u32 files, done; // files to write and written
+  u32 size, bytes; // bytes per file and written to the current one
+  u64 start;
+  afatfsFilePtr_t file;
+} WBench;
+
+// Random read benchmark state
+typedef enum {
+    RBENCH_IDLE,
+    RBENCH_OPENING,
+    RBENCH_SIZE,
+    RBENCH_SEEK,
+    RBENCH_READ,
+    RBENCH_CLOSE,
+    RBENCH_FAILED
+} rbenchState;
+static struct
+{
+  rbenchState state;
+  u32 reads, done;   // sectors to read and read
+  u32 size, length;  // file size and bytes read of the current sector
+  u32 walk;          // time to seek to the end, walking the chain
+  u32 latency, max;  // total and maximum time of a seek and read
+  u64 start, readStart;
+  int sizeSeek;      // seek to the end issued to find the size
+  afatfsFilePtr_t file;
+} RBench;
+
 /*...................................................................*/
 /* Local function definitions                                        */
 /*...................................................................*/
@@ -101,8 +152,13 @@ static void read_directory_callback(afatfsFilePtr_t file)
                  !(dirEntry->attrib & (FAT_FILE_ATTRIBUTE_VOLUME_ID | FAT_FILE_ATTRIBUTE_SYSTEM)))
         {
           char filename[16];
-          fat_convertFATStyleToFilename(dirEntry->filename, filename);
-          printf("%s\n", filename);
+
+          ++ReadBytes;
+          if (!TimeOnly)
+          {
+            fat_convertFATStyleToFilename(dirEntry->filename, filename);
+            printf("%s\n", filename);
+          }
         }
       }
 
@@ -144,12 +200,27 @@ static void read_file_callback(afatfsFilePtr_t file)
 
     if (length > 0)
     {
+      ReadBytes += length;
       buffer[length] = '\0';
-      printf("%s", buffer);
+      if (!TimeOnly)
+        printf("%s", buffer);
     }
     else if (afatfs_feof(openDirectory))
     {
-      puts("");
+      u32 commands, blocks, ms;
+      uint32_t sectors, hits, waits, misses;
+
+      // Report the throughput and the sectors per mass storage command
+      ms = (u32)(TimerNow() - ReadStart) / MICROS_PER_MILLISECOND;
+      sdcard_stats(&commands, &blocks);
+      printf("\n%u bytes in %u ms, %u KB/s, %u sectors in %u commands\n",
+             ReadBytes, ms, ms ? ReadBytes / ms : 0, blocks, commands);
+
+      // Report the sectors read ahead and how many were ready in time
+      afatfs_getReadAheadStats(&sectors, &hits, &waits, &misses);
+      printf("%u sectors read ahead, %u hits %u waits %u misses\n",
+             sectors - ReadAhead[0], hits - ReadAhead[1],
+             waits - ReadAhead[2], misses - ReadAhead[3]);
       readState = READ_END;
     }
   }
@@ -183,12 +254,66 @@ static void change_dir_callback(afatfsFilePtr_t dir)
   }
 }
 
+/*...................................................................*/
+/* wbench_open_callback: Callback on write benchmark file open       */
+/*                                                                   */
+/*   input: file = the AsyncFATFS file pointer, NULL if failed       */
+/*                                                                   */
+/*...................................................................*/
+static void wbench_open_callback(afatfsFilePtr_t file)
+{
+  WBench.file = file;
+  WBench.bytes = 0;
+  if (file)
+    WBench.state = WBENCH_WRITE;
+  else
+  {
+    printf("Creating file failed\n");
+    WBench.state = WBENCH_IDLE;
+  }
+}
+
+/*...................................................................*/
+/* wbench_close_callback: Callback on write benchmark file close,    */
+/*                        after the device cache is synchronized     */
+/*                                                                   */
+/*...................................................................*/
+static void wbench_close_callback(void)
+{
+  WBench.file = NULL;
+  ++WBench.done;
+  WBench.state = WBENCH_OPEN;
+}
+
+/*...................................................................*/
+/* rbench_open_callback: Callback on random read benchmark file open */
+/*                                                                   */
+/*   input: file = the AsyncFATFS file pointer, NULL if failed       */
+/*                                                                   */
+/*...................................................................*/
+static void rbench_open_callback(afatfsFilePtr_t file)
+{
+  RBench.file = file;
+  if (file)
+  {
+    RBench.state = RBENCH_SIZE;
+    RBench.start = TimerNow();
+  }
+  else
+  {
+    printf("Opening file failed\n");
+    RBench.state = RBENCH_FAILED;
+  }
+}
+
 /*...................................................................*/
 /* Global function definitions                                       */
 /*...................................................................*/
 
 /*...................................................................*/
 /* ReadDirectory: Set up command as a read directory state machine   */
+/*                'dir <dir> time' walks the directory without       */
+/*                output and reports the sector cache hit rate       */
 /*                                                                   */
 /*   input: command = the entire command                             */
 /*                                                                   */
@@ -196,44 +321,72 @@ static void change_dir_callback(afatfsFilePtr_t dir)
 /*...................................................................*/
 int ReadDirectory(const char *command)
 {
-  if ((UsbUp) &&
+  if ((MassStorageUp) &&
       (afatfs_getFilesystemState() == AFATFS_FILESYSTEM_STATE_READY))
   {
     if (readState == READ_INIT)
     {
-      const char *arg1 = strchr(command, ' '), *dir;
+      const char *arg1 = strchr(command, ' '), *arg2 = NULL;
+      int length;
 
       // If argument and too long, display error and finish task
-      if (arg1 && (strlen(arg1) > 16))
+      if (arg1 && (strlen(arg1) > 16 + 5))
       {
-        puts("USB not up or FAT not mounted.");
+        puts("Storage not up or FAT not mounted.");
         return TASK_FINISHED;
       }
 
       // Otherwise if argument skip the space to directory name
       else if (arg1)
-        dir = &arg1[1];
+      {
+        arg2 = strchr(++arg1, ' ');
+        length = arg2 ? arg2 - arg1 : strlen(arg1);
+        if (length > 15)
+          length = 15;
+        memcpy(FileName, arg1, length);
+        FileName[length] = '\0';
+      }
 
       // Otherwise use '.' for current directory
       else
-        dir = ".";
+        strcpy(FileName, ".");
+
+      TimeOnly = arg2 && (strcmp(&arg2[1], "time") == 0);
+      ReadBytes = 0;
+      ReadStart = TimerNow();
+      afatfs_getCacheStats(&CacheSectors, &CacheHits, &CacheMisses);
 
       // Set read state to open and fopen the file with callback
       readState = READ_OPEN;
-      afatfs_fopen(dir, "r", read_directory_callback);
+      afatfs_fopen(FileName, "r", read_directory_callback);
     }
     else if (openDirectory && (readState == READ_READ))
       read_directory_callback(openDirectory);
   }
   else
   {
-    puts("USB not up or FAT not mounted.");
+    puts("Storage not up or FAT not mounted.");
     return TASK_FINISHED;
   }
 
   // If done close the file, clear the state variables and return finished
   if (readState == READ_END)
   {
+    // Report the walk time and the sector cache hits and misses
+    if (TimeOnly)
+    {
+      uint32_t hits, misses;
+      u32 ms;
+
+      ms = (u32)(TimerNow() - ReadStart) / MICROS_PER_MILLISECOND;
+      afatfs_getCacheStats(&CacheSectors, &hits, &misses);
+      hits -= CacheHits;
+      misses -= CacheMisses;
+      printf("%u entries in %u ms, %u cache hits %u misses (%u%%) of %d"
+             " sectors\n", ReadBytes, ms, hits, misses, (hits + misses) ?
+             (hits * 100) / (hits + misses) : 0, CacheSectors);
+    }
+
     afatfs_fclose(openDirectory, NULL);
     openDirectory = NULL;
     readState = READ_INIT;
@@ -265,7 +418,7 @@ int PrintWorkingDirectory(const char *command)
 /*...................................................................*/
 int ChangeDirectory(const char *command)
 {
-  if ((UsbUp) &&
+  if ((MassStorageUp) &&
       (afatfs_getFilesystemState() == AFATFS_FILESYSTEM_STATE_READY))
   {
     const char *arg1 = strchr(command, ' ');
@@ -286,13 +439,16 @@ int ChangeDirectory(const char *command)
       afatfs_fopen(CDDir, "r", change_dir_callback);
   }
   else
-    puts("USB not up or FAT not mounted.");
+    puts("Storage not up or FAT not mounted.");
    return TASK_FINISHED;
 }
 
 // 
 /*...................................................................*/
 /* ReadFile: Set up command as a read file state machine             */
+/*           'cat <file> time' reads without output, to benchmark    */
+/*           'cat <file> time <sectors>' also sets the maximum       */
+/*           sequential read-ahead, 0 to disable it                  */
 /*                                                                   */
 /*   input: command = the entire command                             */
 /*                                                                   */
@@ -300,33 +456,53 @@ int ChangeDirectory(const char *command)
 /*...................................................................*/
 int ReadFile(const char *command)
 {
-  if ((UsbUp) &&
+  if ((MassStorageUp) &&
       (afatfs_getFilesystemState() == AFATFS_FILESYSTEM_STATE_READY))
   {
     if (readState == READ_INIT)
     {
-      const char *arg1 = strchr(command, ' '), *file;
+      const char *arg1 = strchr(command, ' '), *arg2;
+      int length;
 
       // If no argument or length too long, display error and finish
-      if (!arg1 || (strlen(arg1) > 16))
+      if (!arg1 || (strlen(arg1) > 16 + 5 + 5))
       {
         puts("filename required and <= 16 characters.");
         return TASK_FINISHED;
       }
 
-      // Skip the space to file name
-      file = &arg1[1];
+      // Skip the space to file name and check for 'time' after it
+      arg2 = strchr(++arg1, ' ');
+      length = arg2 ? arg2 - arg1 : strlen(arg1);
+      if (length > 15)
+      {
+        puts("filename required and <= 16 characters.");
+        return TASK_FINISHED;
+      }
+      memcpy(FileName, arg1, length);
+      FileName[length] = '\0';
+      TimeOnly = arg2 && (memcmp(&arg2[1], "time", 4) == 0) &&
+                 ((arg2[5] == '\0') || (arg2[5] == ' '));
+
+      // Set the read-ahead window if given after 'time'
+      if (TimeOnly && (arg2[5] == ' '))
+        afatfs_setReadAhead(atoi(&arg2[6]));
+
+      ReadBytes = 0;
+      afatfs_getReadAheadStats(&ReadAhead[0], &ReadAhead[1], &ReadAhead[2],
+                               &ReadAhead[3]);
+      ReadStart = TimerNow();
 
       // Set read state to open and fopen the file with callback
       readState = READ_OPEN;
-      afatfs_fopen(file, "r", read_file_callback);
+      afatfs_fopen(FileName, "r", read_file_callback);
     }
     else if (openDirectory && (readState == READ_READ))
       read_file_callback(openDirectory);
   }
   else
   {
-    puts("USB not up or FAT not mounted.");
+    puts("Storage not up or FAT not mounted.");
     return TASK_FINISHED;
   }
 
@@ -342,6 +518,257 @@ int ReadFile(const char *command)
     return TASK_IDLE;
 }
 
+/*...................................................................*/
+/* WriteBench: Write benchmark state machine, either creating small  */
+/*             files, 'wbench create [files]', appending 64 byte     */
+/*             lines to a log, 'wbench append [KB]', or appending    */
+/*             sectors to a contiguous file, 'wbench stream [KB]'    */
+/*                                                                   */
+/*   input: command = the entire command                             */
+/*                                                                   */
+/*  return: TASK_IDLE until complete/error, then TASK_FINISHED       */
+/*...................................................................*/
+int WriteBench(const char *command)
+{
+  static const u8 line[64] =
+    "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ\r\n";
+  static u8 sector[SECTOR_SIZE];
+  u32 length, commands, blocks, ms;
+
+  if (!MassStorageUp ||
+      (afatfs_getFilesystemState() != AFATFS_FILESYSTEM_STATE_READY))
+  {
+    puts("Storage not up or FAT not mounted.");
+    return TASK_FINISHED;
+  }
+
+  if (WBench.state == WBENCH_IDLE)
+  {
+    const char *arg1 = strchr(command, ' '), *arg2 = NULL;
+
+    if (arg1)
+      arg2 = strchr(++arg1, ' ');
+    if (!arg1 || (memcmp(arg1, "create", 6) && memcmp(arg1, "append", 6) &&
+                  memcmp(arg1, "stream", 6)))
+    {
+      puts("wbench create [files] | wbench append [KB] | wbench stream [KB]");
+      return TASK_FINISHED;
+    }
+
+    memset(&WBench, 0, sizeof(WBench));
+    WBench.stream = (memcmp(arg1, "stream", 6) == 0);
+    WBench.append = WBench.stream || (memcmp(arg1, "append", 6) == 0);
+    if (WBench.stream)
+    {
+      // Fill the sector with lines
+      for (length = 0; length < SECTOR_SIZE; length += sizeof(line))
+        memcpy(&sector[length], line, sizeof(line));
+      WBench.files = 1;
+      WBench.size = (arg2 ? atoi(&arg2[1]) : 4096) * 1024;
+    }
+    else if (WBench.append)
+    {
+      WBench.files = 1;
+      WBench.size = (arg2 ? atoi(&arg2[1]) : 256) * 1024;
+    }
+    else
+    {
+      WBench.files = arg2 ? atoi(&arg2[1]) : 100;
+      WBench.size = sizeof(line);
+    }
+    WBench.state = WBENCH_OPEN;
+    WBench.start = TimerNow();
+  }
+
+  // Open the next file, creating it or appending to the log
+  if (WBench.state == WBENCH_OPEN)
+  {
+    if (WBench.done >= WBench.files)
+    {
+      ms = (u32)(TimerNow() - WBench.start) / MICROS_PER_MILLISECOND;
+      sdcard_stats(&commands, &blocks);
+      if (WBench.append)
+        printf("appended %u KB in %u ms, %u KB/s", WBench.size / 1024, ms,
+               ms ? WBench.size / ms : 0);
+      else
+        printf("created %u files in %u ms, %u files/s", WBench.files, ms,
+               ms ? (WBench.files * 1000) / ms : 0);
+      printf(", %u sectors in %u commands\n", blocks, commands);
+      WBench.state = WBENCH_IDLE;
+      return TASK_FINISHED;
+    }
+
+    if (WBench.stream)
+      strcpy(FileName, "WBSTREAM.TXT");
+    else if (WBench.append)
+      strcpy(FileName, "WBLOG.TXT");
+    else
+      sprintf(FileName, "WB%d.TXT", WBench.done);
+    // Opening before the call, as the callback may complete it within
+    WBench.state = WBENCH_OPENING;
+    if (!afatfs_fopen(FileName, WBench.stream ? "as" : WBench.append ?
+                      "a" : "w", wbench_open_callback))
+      WBench.state = WBENCH_OPEN;
+  }
+
+  // Write as much of the file as the cache accepts
+  else if (WBench.state == WBENCH_WRITE)
+  {
+    length = WBench.size - WBench.bytes;
+    if (WBench.stream)
+    {
+      if (length > SECTOR_SIZE)
+        length = SECTOR_SIZE;
+      WBench.bytes += afatfs_fwrite(WBench.file, sector, length);
+    }
+    else
+    {
+      if (length > sizeof(line))
+        length = sizeof(line);
+      WBench.bytes += afatfs_fwrite(WBench.file, line, length);
+    }
+    if (WBench.bytes >= WBench.size)
+      WBench.state = WBENCH_CLOSE;
+  }
+
+  // Close the file, completing once its data is on the medium
+  else if (WBench.state == WBENCH_CLOSE)
+  {
+    WBench.state = WBENCH_CLOSING;
+    if (!afatfs_fclose(WBench.file, wbench_close_callback))
+      WBench.state = WBENCH_CLOSE;
+  }
+
+  return TASK_IDLE;
+}
+
+/*...................................................................*/
+/* RandomReadBench: Random read benchmark state machine, seeks to    */
+/*                  random sectors of a file and reads each one,     */
+/*                  'rbench <file> [reads]'                          */
+/*                                                                   */
+/*   input: command = the entire command                             */
+/*                                                                   */
+/*  return: TASK_IDLE until complete/error, then TASK_FINISHED       */
+/*...................................................................*/
+int RandomReadBench(const char *command)
+{
+  static u8 sector[SECTOR_SIZE];
+  u32 length, ms;
+  uint32_t hits, misses;
+
+  if (!MassStorageUp ||
+      (afatfs_getFilesystemState() != AFATFS_FILESYSTEM_STATE_READY))
+  {
+    puts("Storage not up or FAT not mounted.");
+    return TASK_FINISHED;
+  }
+
+  if (RBench.state == RBENCH_IDLE)
+  {
+    const char *arg1 = strchr(command, ' '), *arg2 = NULL;
+
+    if (arg1)
+      arg2 = strchr(++arg1, ' ');
+    length = arg2 ? arg2 - arg1 : (arg1 ? strlen(arg1) : 0);
+    if ((length == 0) || (length > 15))
+    {
+      puts("rbench <file> [reads]");
+      return TASK_FINISHED;
+    }
+
+    memset(&RBench, 0, sizeof(RBench));
+    memcpy(FileName, arg1, length);
+    FileName[length] = '\0';
+    RBench.reads = arg2 ? atoi(&arg2[1]) : 1000;
+    // Seed as rand() stays zero unseeded, the same each run so that
+    // builds read the same sectors
+    srand(1);
+    afatfs_getCacheStats(&CacheSectors, &CacheHits, &CacheMisses);
+    RBench.state = RBENCH_OPENING;
+    if (!afatfs_fopen(FileName, "r", rbench_open_callback))
+    {
+      puts("Opening file failed");
+      RBench.state = RBENCH_IDLE;
+      return TASK_FINISHED;
+    }
+  }
+
+  // Seek to the end for the size, which walks the whole chain once
+  if (RBench.state == RBENCH_SIZE)
+  {
+    if (!RBench.sizeSeek)
+      RBench.sizeSeek = (afatfs_fseek(RBench.file, 0, AFATFS_SEEK_END) !=
+                         AFATFS_OPERATION_FAILURE);
+    else if (afatfs_ftell(RBench.file, &RBench.size))
+    {
+      RBench.walk = (u32)(TimerNow() - RBench.start);
+      RBench.start = TimerNow();
+      RBench.state = (RBench.size > 0) ? RBENCH_SEEK : RBENCH_CLOSE;
+    }
+  }
+
+  // Seek to the start of a random sector
+  else if (RBench.state == RBENCH_SEEK)
+  {
+    if (RBench.done >= RBench.reads)
+      RBench.state = RBENCH_CLOSE;
+    else
+    {
+      RBench.readStart = TimerNow();
+      if (afatfs_fseek(RBench.file, (rand() % ((RBench.size + SECTOR_SIZE -
+                       1) / SECTOR_SIZE)) * SECTOR_SIZE, AFATFS_SEEK_SET) !=
+          AFATFS_OPERATION_FAILURE)
+      {
+        RBench.length = 0;
+        RBench.state = RBENCH_READ;
+      }
+    }
+  }
+
+  // Read the sector, or to the end of the file
+  else if (RBench.state == RBENCH_READ)
+  {
+    RBench.length += afatfs_fread(RBench.file, &sector[RBench.length],
+                                  SECTOR_SIZE - RBench.length);
+    if ((RBench.length >= SECTOR_SIZE) || afatfs_feof(RBench.file))
+    {
+      length = (u32)(TimerNow() - RBench.readStart);
+      RBench.latency += length;
+      if (length > RBench.max)
+        RBench.max = length;
+      ++RBench.done;
+      RBench.state = RBENCH_SEEK;
+    }
+  }
+
+  // Close the file and report the reads per second and latency
+  else if (RBench.state == RBENCH_CLOSE)
+  {
+    if (afatfs_fclose(RBench.file, NULL))
+    {
+      ms = (u32)(TimerNow() - RBench.start) / MICROS_PER_MILLISECOND;
+      afatfs_getCacheStats(&CacheSectors, &hits, &misses);
+      printf("%u reads in %u ms, %u reads/s, latency average %u us max %u"
+             " us\n", RBench.done, ms, ms ? (RBench.done * 1000) / ms : 0,
+             RBench.done ? RBench.latency / RBench.done : 0, RBench.max);
+      printf("seek to end %u us, %u cache hits %u misses\n", RBench.walk,
+             hits - CacheHits, misses - CacheMisses);
+      RBench.state = RBENCH_IDLE;
+      return TASK_FINISHED;
+    }
+  }
+
+  // If the open failed, finish
+  else if (RBench.state == RBENCH_FAILED)
+  {
+    RBench.state = RBENCH_IDLE;
+    return TASK_FINISHED;
+  }
+
+  return TASK_IDLE;
+}
+
 /*..................................................................*/
 /* FatPoll: poll the FAT file system                                */
 /*                                                                  */
@@ -364,24 +791,65 @@ void FatInit()
 }
 
 /*...................................................................*/
-/* MountFAT: Initialize FAT file system                              */
+/* MountFAT: Initialize FAT file system, 'fat [cache sectors]' sizes */
+/*           the sector cache on the first mount. Completes once    */
+/*           mounted, so a script can continue with file commands.   */
+/*           Once mounted it reports the free cluster map built in   */
+/*           the background                                          */
 /*                                                                   */
 /*   input: command = the entire command                             */
 /*                                                                   */
-/*  return: TASK_FINISHED                                            */
+/*  return: TASK_FINISHED, or TASK_IDLE while mounting               */
 /*...................................................................*/
 int MountFAT(char *command)
 {
-  if (UsbUp)
+  afatfsFilesystemState_e state = afatfs_getFilesystemState();
+
+  // Wait for the mount started by the first call
+  if (Mounting)
   {
+    if (state == AFATFS_FILESYSTEM_STATE_INITIALIZATION)
+      return TASK_IDLE;
+    Mounting = FALSE;
+    if (state == AFATFS_FILESYSTEM_STATE_READY)
+      puts("FAT mounted");
+    else
+      printf("FAT mount failed, error %d\n", afatfs_getLastError());
+  }
+  else if (state == AFATFS_FILESYSTEM_STATE_INITIALIZATION)
+    puts("FAT mount in progress");
+  else if (state == AFATFS_FILESYSTEM_STATE_READY)
+  {
+    u32 scanned, sectors, clusters, us;
+
+    afatfs_getFreeMapStats(&scanned, &sectors, &clusters, &us);
+    if (sectors == 0)
+      puts("Mounted, no free cluster map");
+    else if (scanned < sectors)
+      printf("Mounted, free cluster map %u of %u FAT sectors, %u free"
+             " clusters so far\n", scanned, sectors, clusters);
+    else
+      printf("Mounted, free cluster map of %u FAT sectors in %u ms, %u"
+             " free clusters\n", sectors, us / 1000, clusters);
+  }
+  else if (MassStorageUp)
+  {
+    const char *arg1 = strchr(command, ' ');
+
+    // Size the sector cache if requested, only before first allocated
+    if (arg1 && !afatfs_setCacheSize(atoi(&arg1[1])))
+      puts("Cache size is fixed after the first mount");
+
     // Create the polling task and initialize the FAT file system
 #if ENABLE_OS
     TaskNew(MAX_TASKS - 4, FatPoll, NULL);
 #endif
     FatInit();
+    Mounting = TRUE;
+    return TASK_IDLE;
   }
   else
-    puts("USB not initialized");
+    puts("Storage not initialized");
 
   return TASK_FINISHED;
 }
@@ -13,6 +13,14 @@
 #define FAT_VOLUME_ID_SIGNATURE_1 0x55
 #define FAT_VOLUME_ID_SIGNATURE_2 0xAA
 
+// Signatures of the FAT32 FSInfo sector
+#define FAT_FSINFO_LEAD_SIGNATURE   0x41615252
+#define FAT_FSINFO_STRUCT_SIGNATURE 0x61417272
+#define FAT_FSINFO_TRAIL_SIGNATURE  0xAA550000
+
+// FSInfo free count and next free cluster value when not known
+#define FAT_FSINFO_UNKNOWN 0xFFFFFFFF
+
 #define FAT_DIRECTORY_ENTRY_SIZE 32
 #define FAT_SMALLEST_LEGAL_CLUSTER_NUMBER 2
 
@@ -96,6 +104,16 @@ typedef struct fatVolumeID_t {
     } fatDescriptor;
 } __attribute__((packed)) fatVolumeID_t;
 
+typedef struct fatFSInfo_t {
+    uint32_t leadSignature;
+    uint8_t reserved1[480];
+    uint32_t structSignature;
+    uint32_t freeCount;         // Free clusters on the volume, a hint
+    uint32_t nextFree;          // Cluster to begin the search for a free cluster at, a hint
+    uint8_t reserved2[12];
+    uint32_t trailSignature;
+} __attribute__((packed)) fatFSInfo_t;
+
 typedef struct fatDirectoryEntry_t {
     char filename[FAT_FILENAME_LENGTH];
     uint8_t attrib;
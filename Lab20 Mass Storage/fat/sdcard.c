@@ -1,4 +1,5 @@
 #include <system.h>
+#include <string.h>
 #include "./sdcard.h"
 
 #if ENABLE_FAT
@@ -43,52 +44,261 @@ typedef void(*sdcard_operationCompleteCallback_c)(sdcardBlockOperation_e operati
 typedef void(*sdcard_profilerCallback_c)(sdcardBlockOperation_e operation, uint32_t blockIndex, uint32_t duration);
 */
 
-/*
-int MassStorageRead(void *buffer, u32 count,
-                    void (callback)(u8 *buffer, int buffLen),
-                    void *callback_payload);
-*/
-#define MAX_OPERATIONS 8
+// Enough operations for file read-ahead or a multiple block write to
+// queue a full merged command behind the one in progress
+#define MAX_OPERATIONS 32
+
+// Adjacent requests queued while commands are in progress are merged
+// into one READ(10)/WRITE(10) of up to MAX_MERGE_BLOCKS blocks. Not
+// sized by cluster, a single block on small FAT32 volumes, as a merge
+// may span contiguous clusters. 8 KB issued the fewest commands for
+// read-ahead and gathered writes with 1 and 8 block clusters, larger
+// merges leave too few operations queued for the next command
+#define MAX_MERGE_BLOCKS 16
+
+// Merged commands queued to mass storage at once, the one in progress
+// and the next, pipelined as the CSW of the first arrives
+#define MAX_COMMANDS 2
+
+// Operation states
+#define OP_FREE    0
+#define OP_QUEUED  1
+#define OP_ACTIVE  2
 
 typedef struct OpCallback
 {
   sdcard_operationCompleteCallback_c callback;
   uint32_t callbackData;
   uint32_t blockIndex;
+  uint8_t *buffer;
+  sdcardBlockOperation_e operation;
+  uint32_t sequence; // queue order
+  int state;
 } OpCallback;
 
+// A merged command, its operations in block order
+typedef struct MergedCommand
+{
+  OpCallback *ops[MAX_MERGE_BLOCKS];
+  int count; // zero if free
+  uint8_t *buffer;
+
+  // Bounce buffer for operations whose buffers are not contiguous
+  uint8_t bounce[MAX_MERGE_BLOCKS * BLOCK_SIZE] __attribute__ ((aligned (4)));
+} MergedCommand;
+
 OpCallback Operations[MAX_OPERATIONS];
+static MergedCommand Merged[MAX_COMMANDS];
+static uint32_t Sequence;
+
+// Commands issued and blocks transferred, for the merge ratio
+static uint32_t Commands, Blocks;
+
+// Multiple block write, the next block expected and the blocks left.
+// Writes at its end are held until a full command is gathered
+static uint32_t WriteRunNext, WriteRunRemaining;
 
 OpCallback *NewOp()
 {
   for (int i = 0; i < MAX_OPERATIONS; ++i)
-    if (Operations[i].callback == NULL)
+    if (Operations[i].state == OP_FREE)
       return &Operations[i];
   return NULL;
 }
 
-void ms_readBlockCallback(u8 *buffer, int buffLen, void *opPayload)
+// Find a queued operation for a block, NULL if none
+static OpCallback *find_queued(sdcardBlockOperation_e operation,
+                               uint32_t blockIndex)
 {
-  OpCallback *op = opPayload;
+  for (int i = 0; i < MAX_OPERATIONS; ++i)
+    if ((Operations[i].state == OP_QUEUED) &&
+        (Operations[i].operation == operation) &&
+        (Operations[i].blockIndex == blockIndex))
+      return &Operations[i];
+  return NULL;
+}
 
-  op->callback(SDCARD_BLOCK_OPERATION_READ, op->blockIndex, buffer,
-               op->callbackData);
+static void start_next(void);
 
-  op->callback = NULL;
-  op->callbackData = 0;
-  op->blockIndex = 0;
+/*...................................................................*/
+/* ms_blocksCallback: Complete every operation of a merged command   */
+/*                                                                   */
+/*      Inputs: buffer is the command data buffer                    */
+/*              buffLen is the length transferred, < 0 if failed     */
+/*              opPayload is the merged command                      */
+/*...................................................................*/
+void ms_blocksCallback(u8 *buffer, int buffLen, void *opPayload)
+{
+  MergedCommand *merged = opPayload;
+  int i, count = merged->count;
+  OpCallback *ops[MAX_MERGE_BLOCKS];
+
+  // Scatter read data from the bounce buffer if one was used
+  for (i = 0; i < count; ++i)
+    if ((buffLen >= (i + 1) * BLOCK_SIZE) &&
+        (merged->ops[i]->operation == SDCARD_BLOCK_OPERATION_READ) &&
+        (merged->buffer == merged->bounce))
+      memcpy(merged->ops[i]->buffer, &merged->bounce[i * BLOCK_SIZE],
+             BLOCK_SIZE);
+
+  // Release the command before the callbacks so they can queue more
+  memcpy(ops, merged->ops, count * sizeof(OpCallback *));
+  merged->count = 0;
+
+  for (i = 0; i < count; ++i)
+  {
+    OpCallback *op = ops[i];
+    sdcard_operationCompleteCallback_c callback = op->callback;
+    uint32_t callbackData = op->callbackData;
+    uint8_t *opBuffer = op->buffer;
+
+    // A failed or short transfer fails the blocks not transferred
+    if (buffLen < (i + 1) * BLOCK_SIZE)
+      opBuffer = NULL;
+
+    op->callback = NULL;
+    op->callbackData = 0;
+    op->state = OP_FREE;
+
+    callback(op->operation, op->blockIndex, opBuffer, callbackData);
+  }
+
+  // Issue the requests queued while this command was in progress
+  start_next();
 }
 
-void ms_writeBlockCallback(u8 *buffer, int buffLen, void *opPayload)
+/*...................................................................*/
+/* start_next: Merge the oldest queued requests with their neighbors */
+/*             and queue them as mass storage commands               */
+/*                                                                   */
+/*...................................................................*/
+static void start_next(void)
 {
-  OpCallback *op = opPayload;
+  MergedCommand *merged;
+  OpCallback *first, *op;
+  uint32_t blockIndex;
+  int i, result;
+
+  for (;;)
+  {
+    // Return if the maximum number of commands are queued
+    for (merged = NULL, i = 0; i < MAX_COMMANDS; ++i)
+      if (Merged[i].count == 0)
+      {
+        merged = &Merged[i];
+        break;
+      }
+    if (merged == NULL)
+      return;
+
+    // Find the oldest queued request so none are starved
+    for (first = NULL, i = 0; i < MAX_OPERATIONS; ++i)
+      if ((Operations[i].state == OP_QUEUED) && ((first == NULL) ||
+          ((i32)(Operations[i].sequence - first->sequence) < 0)))
+        first = &Operations[i];
+    if (first == NULL)
+      return;
+
+    // Extend the run backward then forward over adjacent blocks
+    blockIndex = first->blockIndex;
+    for (i = 1; i < MAX_MERGE_BLOCKS; ++i)
+      if (find_queued(first->operation, blockIndex - 1) == NULL)
+        break;
+      else
+        --blockIndex;
+    for (merged->count = 0; merged->count < MAX_MERGE_BLOCKS;
+         ++merged->count)
+    {
+      op = find_queued(first->operation, blockIndex + merged->count);
+      if (op == NULL)
+        break;
+      merged->ops[merged->count] = op;
+    }
+
+    // Hold a partial command at the end of a multiple block write
+    // until the blocks that follow are written or the write ends
+    if (WriteRunRemaining && (merged->count < MAX_MERGE_BLOCKS) &&
+        (first->operation == SDCARD_BLOCK_OPERATION_WRITE) &&
+        (blockIndex + merged->count == WriteRunNext))
+    {
+      merged->count = 0;
+      return;
+    }
+    for (i = 0; i < merged->count; ++i)
+      merged->ops[i]->state = OP_ACTIVE;
+
+    // Use the request buffer directly if one block or all contiguous
+    merged->buffer = merged->ops[0]->buffer;
+    for (i = 1; i < merged->count; ++i)
+      if (merged->ops[i]->buffer != merged->buffer + i * BLOCK_SIZE)
+      {
+        merged->buffer = merged->bounce;
+        break;
+      }
+
+    // Queue the asynchronous read or write, gathering if needed
+    if (first->operation == SDCARD_BLOCK_OPERATION_READ)
+      result = MassStorageRead(blockIndex, merged->buffer,
+                               merged->count * BLOCK_SIZE,
+                               ms_blocksCallback, merged);
+    else
+    {
+      if (merged->buffer == merged->bounce)
+        for (i = 0; i < merged->count; ++i)
+          memcpy(&merged->bounce[i * BLOCK_SIZE], merged->ops[i]->buffer,
+                 BLOCK_SIZE);
+      result = MassStorageWrite(blockIndex, merged->buffer,
+                                merged->count * BLOCK_SIZE, FALSE,
+                                ms_blocksCallback, merged);
+    }
+
+    // If the device queue is full, requeue and retry from sdcard_poll()
+    if (result < 0)
+    {
+      for (i = 0; i < merged->count; ++i)
+        merged->ops[i]->state = OP_QUEUED;
+      merged->count = 0;
+      return;
+    }
+
+    ++Commands;
+    Blocks += merged->count;
+  }
+}
 
-  op->callback(SDCARD_BLOCK_OPERATION_WRITE, op->blockIndex, buffer,
-               op->callbackData);
+// Queue an operation and start it if a command slot is free
+static bool queue_op(sdcardBlockOperation_e operation, uint32_t blockIndex,
+                     uint8_t *buffer, sdcard_operationCompleteCallback_c
+                     callback, uint32_t callbackData)
+{
+  OpCallback *op = NewOp();
 
-  op->callback = NULL;
-  op->callbackData = 0;
-  op->blockIndex = 0;
+  if (op == NULL)
+    return false;
+
+  // Reads and writes out of sequence end a multiple block write
+  if (WriteRunRemaining)
+  {
+    if ((operation == SDCARD_BLOCK_OPERATION_WRITE) &&
+        (blockIndex == WriteRunNext))
+    {
+      ++WriteRunNext;
+      --WriteRunRemaining;
+    }
+    else
+      WriteRunRemaining = 0;
+  }
+
+  op->callback = callback;
+  op->callbackData = callbackData;
+  op->blockIndex = blockIndex;
+  op->buffer = buffer;
+  op->operation = operation;
+  op->sequence = Sequence++;
+  op->state = OP_QUEUED;
+
+  start_next();
+  return true;
 }
 
 /**
@@ -105,22 +315,8 @@ void ms_writeBlockCallback(u8 *buffer, int buffLen, void *opPayload)
  */
 bool sdcard_readBlock(uint32_t blockIndex, uint8_t *buffer, sdcard_operationCompleteCallback_c callback, uint32_t callbackData)
 {
-  OpCallback *op = NewOp();
-
-  if (op == NULL)
-    return false;
-
-  op->callback = callback;
-  op->callbackData = callbackData;
-  op->blockIndex = blockIndex;
-
-  // Seek to the block
-  if (MassStorageSeek(blockIndex * BLOCK_SIZE) != blockIndex * BLOCK_SIZE)
-    return false;
-
-  // Start the asynchronous read
-  return (MassStorageRead(buffer, BLOCK_SIZE, ms_readBlockCallback,
-                          (void *)op) < 0) ? false : true;
+  return queue_op(SDCARD_BLOCK_OPERATION_READ, blockIndex, buffer,
+                  callback, callbackData);
 }
 
 
@@ -140,22 +336,9 @@ bool sdcard_readBlock(uint32_t blockIndex, uint8_t *buffer, sdcard_operationComp
  */
 sdcardOperationStatus_e sdcard_writeBlock(uint32_t blockIndex, uint8_t *buffer, sdcard_operationCompleteCallback_c callback, uint32_t callbackData)
 {
-  OpCallback *op = NewOp();
-
-  if (op == NULL)
-    return false;
-
-  op->callback = callback;
-  op->callbackData = callbackData;
-  op->blockIndex = blockIndex;
-
-  // Seek to the block
-  if (MassStorageSeek(blockIndex * BLOCK_SIZE) != blockIndex * BLOCK_SIZE)
-    return false;
-
-  // Start the asynchronous write
-  return (MassStorageWrite(buffer, BLOCK_SIZE, ms_writeBlockCallback,
-                           (void *)op) < 0) ? false : true;
+  return queue_op(SDCARD_BLOCK_OPERATION_WRITE, blockIndex, buffer,
+                  callback, callbackData) ? SDCARD_OPERATION_IN_PROGRESS :
+                                            SDCARD_OPERATION_BUSY;
 }
 
 /**
@@ -165,41 +348,108 @@ sdcardOperationStatus_e sdcard_writeBlock(uint32_t blockIndex, uint8_t *buffer,
  */
 bool sdcard_poll()
 {
+  // Retry queued requests if the device was busy when queued
+  start_next();
+
   // If another operation available, return true
+  return NewOp() != NULL;
+}
+
+static sdcard_syncCompleteCallback_c SyncCallback;
+
+// Complete a synchronize cache command
+static void ms_syncCallback(u8 *buffer, int buffLen, void *unused)
+{
+  sdcard_syncCompleteCallback_c callback = SyncCallback;
+
+  SyncCallback = NULL;
+  callback(buffLen >= 0);
+}
+
+/**
+ * Synchronize the device write cache, so the blocks written before are on the medium. Writes do not force unit
+ * access, so this is the durability point.
+ *
+ * Returns:
+ *     SDCARD_OPERATION_IN_PROGRESS - Your callback will be called when the device cache is synchronized
+ *     SDCARD_OPERATION_BUSY        - Writes are still queued or a synchronize is in progress, try again later
+ */
+sdcardOperationStatus_e sdcard_sync(sdcard_syncCompleteCallback_c callback)
+{
+  // Issue the writes held for a multiple block write
+  sdcard_endWriteBlocks();
+
+  // Writes queued but not yet issued would not be covered, wait for them
   for (int i = 0; i < MAX_OPERATIONS; ++i)
-    if (Operations[i].callback == NULL)
-      return true;
-  return false;
+    if (Operations[i].state == OP_QUEUED)
+      return SDCARD_OPERATION_BUSY;
+
+  if (SyncCallback != NULL)
+    return SDCARD_OPERATION_BUSY;
+
+  // Mass storage commands complete in order, so this follows the writes
+  SyncCallback = callback;
+  if (MassStorageSync(ms_syncCallback, NULL) < 0)
+  {
+    SyncCallback = NULL;
+    return SDCARD_OPERATION_BUSY;
+  }
+  return SDCARD_OPERATION_IN_PROGRESS;
+}
+
+/*...................................................................*/
+/* sdcard_stats: Return the commands issued and blocks transferred   */
+/*                                                                   */
+/*...................................................................*/
+void sdcard_stats(uint32_t *commands, uint32_t *blocks)
+{
+  *commands = Commands;
+  *blocks = Blocks;
 }
 
 /**
- * Begin writing a series of consecutive blocks beginning at the given block index. This will allow (but not require)
- * the SD card to pre-erase the number of blocks you specifiy, which can allow the writes to complete faster.
+ * Begin writing a series of consecutive blocks beginning at the given block index. Mass storage has no pre-erase, so
+ * instead the writes are gathered: a write at the end of the series is held until enough follow it to fill a
+ * WRITE(10) of MAX_MERGE_BLOCKS blocks, or the series ends.
  *
  * Afterwards, just call sdcard_writeBlock() as normal to write those blocks consecutively.
  *
  * The multi-block write will be aborted automatically when writing to a non-consecutive address, or by performing a
  * read. You can abort it manually by calling sdcard_endWriteBlocks().
  *
- * If you don't want to implement this feature, remove the define AFATFS_MIN_MULTIPLE_BLOCK_WRITE_COUNT in asyncfatfs.c.
- *
  * Returns:
  *     SDCARD_OPERATION_SUCCESS     - Multi-block write has been queued
- *     SDCARD_OPERATION_BUSY        - The card is already busy and cannot accept your write
- *     SDCARD_OPERATION_FAILURE     - A fatal error occured, card will be reset
  */
-//sdcardOperationStatus_e sdcard_beginWriteBlocks(uint32_t blockIndex, uint32_t blockCount);
+sdcardOperationStatus_e sdcard_beginWriteBlocks(uint32_t blockIndex, uint32_t blockCount)
+{
+  // Continue a series this one follows, else issue the writes held
+  if (WriteRunRemaining && (blockIndex == WriteRunNext))
+  {
+    WriteRunRemaining = blockCount;
+    return SDCARD_OPERATION_SUCCESS;
+  }
+  sdcard_endWriteBlocks();
+
+  WriteRunNext = blockIndex;
+  WriteRunRemaining = blockCount;
+  return SDCARD_OPERATION_SUCCESS;
+}
 
 /**
- * Abort a multiple-block write early (before all the `blockCount` blocks had been written).
- *
- * If you don't want to implement this feature, remove the define AFATFS_MIN_MULTIPLE_BLOCK_WRITE_COUNT in asyncfatfs.c.
+ * Abort a multiple-block write early (before all the `blockCount` blocks had been written), issuing the writes held.
  *
  * Returns:
  *     SDCARD_OPERATION_SUCCESS     - Multi-block write has been cancelled, or no multi-block write was in progress.
- *     SDCARD_OPERATION_BUSY        - The card is busy with another operation and could not cancel the multi-block write.
  */
-//sdcardOperationStatus_e sdcard_endWriteBlocks();
+sdcardOperationStatus_e sdcard_endWriteBlocks()
+{
+  if (WriteRunRemaining)
+  {
+    WriteRunRemaining = 0;
+    start_next();
+  }
+  return SDCARD_OPERATION_SUCCESS;
+}
 
 /**
  * Only required to be provided when using AFATFS_USE_INTROSPECTIVE_LOGGING.
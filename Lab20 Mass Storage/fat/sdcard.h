@@ -37,6 +37,8 @@ typedef enum {
 
 typedef void(*sdcard_operationCompleteCallback_c)(sdcardBlockOperation_e operation, uint32_t blockIndex, uint8_t *buffer, uint32_t callbackData);
 
+typedef void(*sdcard_syncCompleteCallback_c)(bool success);
+
 typedef void(*sdcard_profilerCallback_c)(sdcardBlockOperation_e operation, uint32_t blockIndex, uint32_t duration);
 
 /**
@@ -109,3 +111,18 @@ sdcardOperationStatus_e sdcard_endWriteBlocks();
  * Only required to be provided when using AFATFS_USE_INTROSPECTIVE_LOGGING.
  */
 void sdcard_setProfilerCallback(sdcard_profilerCallback_c callback);
+
+/**
+ * Synchronize the device write cache, so the blocks written before are on the medium. Writes do not force unit
+ * access, so this is the durability point.
+ *
+ * Returns:
+ *     SDCARD_OPERATION_IN_PROGRESS - Your callback will be called when the device cache is synchronized
+ *     SDCARD_OPERATION_BUSY        - Writes are still queued or a synchronize is in progress, try again later
+ */
+sdcardOperationStatus_e sdcard_sync(sdcard_syncCompleteCallback_c callback);
+
+/**
+ * Return the mass storage commands issued and the blocks they transferred, adjacent requests are merged into one.
+ */
+void sdcard_stats(uint32_t *commands, uint32_t *blocks);
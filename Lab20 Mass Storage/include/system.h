@@ -223,7 +223,14 @@ extern u32 LedTime;
 extern struct led_state LedState;
 extern struct shell_state Uart0State, Uart1State, ConsoleState;
 extern struct timer_task *TimerStart;
-extern int ScreenUp, GameUp, UsbUp;
+extern int ScreenUp, GameUp, UsbUp, EmmcUp;
+
+/* The mass storage device is up, the SD card host or USB */
+#if ENABLE_EMMC
+#define MassStorageUp EmmcUp
+#else
+#define MassStorageUp UsbUp
+#endif
 
 /*...................................................................*/
 /* Global Function Definitions                                       */
@@ -345,16 +352,18 @@ int LanReceiveAsync(void);
 /* Mass Storage interface */
 u32 MassStorageBlockSize();
 u32 MassStorageBlockCapacity();
-int MassStorageRead(void *buffer, u32 count,
+int MassStorageRead(u32 block, void *buffer, u32 count,
                     void (callback)(u8 *buffer, int buffLen,
                                     void *callback_payload),
                     void *callback_payload);
-int MassStorageWrite(const void *buffer, u32 count,
+int MassStorageWrite(u32 block, const void *buffer, u32 count, int fua,
                      void (callback)(u8 *buffer, int buffLen,
                                      void *callback_payload),
                      void *callback_payload);
-u64 MassStorageSeek(u64 offset);
-u64 MassStorageOffset();
+int MassStorageSync(void (callback)(u8 *buffer, int buffLen,
+                                    void *callback_payload),
+                    void *callback_payload);
+int MassStorageQueued();
 
 /* FAT interface */
 void FatInit();
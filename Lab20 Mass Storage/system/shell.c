@@ -62,18 +62,27 @@ extern int UsbHostStart(const char *command);
 extern int KeyboardUp(const char *command);
 extern int MouseUp(const char *command);
 #endif
-#if ENABLE_USB_STORAGE
+#endif /* ENABLE_USB */
+#if ENABLE_EMMC
+extern int EmmcStart(const char *command);
+#endif
+#if ENABLE_USB_STORAGE || ENABLE_EMMC
 extern int MountFilesystem(const char *command);
 extern int ReadBlock(const char *command);
+extern int MassStorageBench(const char *command);
+#endif
+#if ENABLE_FAT
 extern int ReadDirectory(const char *command);
 extern int ChangeDirectory(const char *command);
 extern int PrintWorkingDirectory(const char *command);
 extern int ReadFile(const char *command);
-#endif
-#if ENABLE_FAT
 extern int MountFAT(const char *command);
+extern int WriteBench(const char *command);
+extern int RandomReadBench(const char *command);
+#endif
+#if ENABLE_DISK_IMAGE
+extern int DiskCommand(const char *command);
 #endif
-#endif /* ENABLE_USB */
 
 /* local commands */
 #if ENABLE_XMODEM
@@ -204,6 +213,7 @@ static int echo(const char *command)
 /*...................................................................*/
 static int run(const char *command)
 {
+#ifdef __arm__
 #if RPI == 1
   u32 rpi = 0xc42; /* RPI1 hw id as required for Linux kernel boot */
 #elif RPI == 2
@@ -211,6 +221,7 @@ static int run(const char *command)
 #else
   u32 rpi = 0xc44; /* RPI3 hw id as required for Linux kernel boot */
 #endif
+#endif
 
 #if ENABLE_VIDEO
   if (ScreenUp)
@@ -230,7 +241,9 @@ static int run(const char *command)
 #endif
 
   /* assign the machine ID to register one (r1) for other kernels */
+#ifdef __arm__
   asm volatile("mov r1, %0" : : "r" (rpi));
+#endif
   /* what else? why does linux complain about memory size? */
   /* Maybe clear all the memory used by bootloader? */
 
@@ -355,11 +368,19 @@ int ShellInit(void)
   ShellCommands[++i].command = "Usb";
   ShellCommands[i].function = UsbHostStart;
 #endif
-#if ENABLE_USB_STORAGE
+#if ENABLE_EMMC
+  ShellCommands[++i].command = "emmc";
+  ShellCommands[i].function = EmmcStart;
+#endif
+#if ENABLE_USB_STORAGE || ENABLE_EMMC
   ShellCommands[++i].command = "Mount";
   ShellCommands[i].function = MountFilesystem;
   ShellCommands[++i].command = "read";
   ShellCommands[i].function = ReadBlock;
+  ShellCommands[++i].command = "bench";
+  ShellCommands[i].function = MassStorageBench;
+#endif
+#if ENABLE_FAT
   ShellCommands[++i].command = "dir";
   ShellCommands[i].function = ReadDirectory;
   ShellCommands[++i].command = "pwd";
@@ -368,10 +389,16 @@ int ShellInit(void)
   ShellCommands[i].function = ChangeDirectory;
   ShellCommands[++i].command = "cat";
   ShellCommands[i].function = ReadFile;
-#endif
-#if ENABLE_FAT
   ShellCommands[++i].command = "fat";
   ShellCommands[i].function = MountFAT;
+  ShellCommands[++i].command = "wbench";
+  ShellCommands[i].function = WriteBench;
+  ShellCommands[++i].command = "rbench";
+  ShellCommands[i].function = RandomReadBench;
+#endif
+#if ENABLE_DISK_IMAGE
+  ShellCommands[++i].command = "disk";
+  ShellCommands[i].function = DiskCommand;
 #endif
 #if ENABLE_USB_HID
   ShellCommands[++i].command = "Keyboard";
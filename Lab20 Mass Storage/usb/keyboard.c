@@ -55,6 +55,7 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <usb/hid.h>
 #include <usb/request.h>
 #include <usb/device.h>
@@ -69,6 +70,11 @@
 #define RIGHT_SHIFT_MODIFIER 0x20
 #define DEFAULT_MODIFIER     1
 
+// A failed report is retried after a delay that grows with each
+// consecutive failure, and the keyboard stops if they continue
+#define MAX_ERRORS           8
+#define ERROR_DELAY          (10 * MICROS_PER_MILLISECOND)
+
 
 /*...................................................................*/
 /* Type Definitions                                                  */
@@ -91,6 +97,7 @@ typedef struct KeyboardDevice
 
   u8 lastPhyCode;
   u32 tmr;
+  u32 errors; // consecutive failed reports
 
   int capsLock;
 }
@@ -169,6 +176,11 @@ extern KeyboardDevice *KBD1;
 static int KeyboardInitState = 0;
 int KeyboardEnabled = 0;
 
+// Interval between report completions, the latency of a key press,
+// to measure the effect of other USB traffic such as mass storage
+static u64 ReportLast, ReportIntervals;
+static u32 ReportCount, ReportMax;
+
 extern int KeyboardUp(const char *command);
 extern int UsbUp;
 
@@ -434,6 +446,9 @@ static u8 get_key_code(KeyboardDevice *keyboard)
   return 0;
 }
 
+static void submit(KeyboardDevice *keyboard);
+static int retry(u32 id, void *data, void *context);
+
 /*...................................................................*/
 /*  completion: Keyboard URB completion parses keypress events       */
 /*                                                                   */
@@ -450,6 +465,18 @@ static void completion(void *urb, void *param, void *context)
   assert(request != 0);
   assert(keyboard->urb == request);
 
+  // Record the interval since the previous report
+  if (ReportLast)
+  {
+    u32 interval = (u32)(TimerNow() - ReportLast);
+
+    ReportIntervals += interval;
+    if (interval > ReportMax)
+      ReportMax = interval;
+    ++ReportCount;
+  }
+  ReportLast = TimerNow();
+
   if ((request->status != 0) &&
       (request->resultLen == REPORT_SIZE))
   {
@@ -474,6 +501,35 @@ static void completion(void *urb, void *param, void *context)
     }
   }
 
+  // Back off after a failure, as a device that is gone or stalled
+  // fails again at once, and stop if the failures continue
+  if (request->status == 0)
+  {
+    if (++keyboard->errors >= MAX_ERRORS)
+    {
+      puts("USB keyboard stopped after repeated errors");
+      FreeRequest(keyboard->urb);
+      keyboard->urb = 0;
+      KeyboardEnabled = FALSE;
+      return;
+    }
+    if (TimerSchedule(keyboard->errors * ERROR_DELAY, retry, keyboard,
+                      NULL))
+      return;
+  }
+  else
+    keyboard->errors = 0;
+
+  submit(keyboard);
+}
+
+/*...................................................................*/
+/* submit: Reattach the URB and submit it for the next report        */
+/*                                                                   */
+/*       Input: keyboard is the keyboard device                      */
+/*...................................................................*/
+static void submit(KeyboardDevice *keyboard)
+{
   // Reuse the URB by releasing it
   RequestRelease(keyboard->urb);
 
@@ -490,6 +546,21 @@ static void completion(void *urb, void *param, void *context)
   HostSubmitAsyncRequest(keyboard->urb, keyboard->device.host, NULL);
 }
 
+/*...................................................................*/
+/* retry: Timer callback to submit the URB after a failed report     */
+/*                                                                   */
+/*       Input: id is unused                                         */
+/*              data is the keyboard device                          */
+/*              context is unused                                    */
+/*                                                                   */
+/*     Returns: TASK_FINISHED                                        */
+/*...................................................................*/
+static int retry(u32 id, void *data, void *context)
+{
+  submit(data);
+  return TASK_FINISHED;
+}
+
 /*...................................................................*/
 /* start_request: Initiate URB for keypress events                   */
 /*                                                                   */
@@ -509,6 +580,7 @@ static int start_request(KeyboardDevice *keyboard)
   keyboard->urb = NewRequest();
   assert(keyboard->urb != 0);
   bzero(keyboard->urb, sizeof(Request));
+  keyboard->errors = 0;
 
   /* Prefer the interrupt endpoint. */
   if (keyboard->interruptEndpoint)
@@ -601,8 +673,10 @@ void KeyboardRelease(KeyboardDevice *device)
 
 /*...................................................................*/
 /*  KeyboardUp: Activate a discovered and configured USB keyboard    */
+/*              'Keyboard latency' reports and resets the interval   */
+/*              between keyboard reports                             */
 /*                                                                   */
-/*       Input: command is unused                                    */
+/*       Input: command is the entire command                        */
 /*                                                                   */
 /*     Returns: TASK_FINISHED as it is a shell command               */
 /*...................................................................*/
@@ -614,6 +688,16 @@ int KeyboardUp(const char *command)
   else if (!KBD1)
     puts("Keyboard not present");
 
+  else if (KeyboardEnabled && command && strchr(command, ' ') &&
+           (strcmp(strchr(command, ' ') + 1, "latency") == 0))
+  {
+    printf("%u reports, interval average %u us, max %u us\n", ReportCount,
+           ReportCount ? (u32)ReportIntervals / ReportCount : 0, ReportMax);
+    ReportIntervals = 0;
+    ReportCount = ReportMax = 0;
+    ReportLast = 0;
+  }
+
   else if (!KeyboardEnabled)
   {
       KeyboardEnabled = TRUE;
@@ -48,7 +48,13 @@
 #define BLOCK_SIZE   512
 #define BLOCK_MASK   (BLOCK_SIZE - 1)
 #define BLOCK_SHIFT  9
-#define MAX_OFFSET   0x1FFFFFFFFFF
+
+// Largest DWC host channel transfer, requests beyond are split
+#define MAX_TRANSFER_BYTES   0x7FFFF // HCTSIZ transfer size field
+#define MAX_TRANSFER_PACKETS 1023    // HCTSIZ packet count field
+
+// Requests queued, each command is pipelined as the CSW arrives
+#define MAX_REQUESTS 8
 
 // USB Mass Storage configuration state machine
 #define STATE_INQUIRY         0
@@ -91,6 +97,26 @@
 #define SCSI_OP_READ    0x28
 #define SCSI_OP_WRITE   0x2A
 #define SCSI_WRITE_FUA    0x08
+#define SCSI_OP_SYNCHRONIZE_CACHE10 0x35
+
+// Request types
+#define REQUEST_READ   0
+#define REQUEST_WRITE  1
+#define REQUEST_SYNC   2
+
+// Queued read or write request
+typedef struct MassStorageRequest
+{
+  u32 block;     // Logical Block Address (LBA)
+  u32 count;     // bytes
+  u32 done;      // bytes of the commands completed, if split
+  void *buffer;
+  int type;
+  int fua;       // Force Unit Access, write through the device cache
+  void (*callback)(u8 *buffer, int buffLen, void *payload);
+  void *payload;
+}
+MassStorageRequest;
 
 typedef struct MassStorageDevice
 {
@@ -102,6 +128,8 @@ typedef struct MassStorageDevice
   Request *urb;
   int configurationState;
   int resetState;
+  int resetPending; // Bulk-Only reset recovery before the next CBW
+  int resetActive;
 
   // Command state variables
   int commandState;
@@ -110,13 +138,15 @@ typedef struct MassStorageDevice
   int commandBufferLen;
   void (*commandComplete)
        (void *urb, void *param, void *context);
-  void (*operationCallback)(u8 *buffer, int buffLen, void *opPayload);
-  void *operationPayload;
+
+  // Request queue, the head is in progress if requestActive
+  MassStorageRequest requests[MAX_REQUESTS];
+  int requestHead, requestCount, requestActive;
 
   // Device variables
   u32 tag;
   u32 blockCount;
-  u64 offset;
+  u32 maxTransfer; // bytes of the largest command
 }
 MassStorageDevice;
 
@@ -256,6 +286,16 @@ typedef struct SCSIWrite10
 }
 __attribute__((packed)) SCSIWrite10;
 
+typedef struct SCSISynchronizeCache10
+{
+  u8 OperationCode, Flags;
+  u32 LogicalBlockAddress;
+  u8 GroupNumber;
+  u16 NumberOfBlocks; // zero for all blocks to the end of the medium
+  u8 Control;
+}
+__attribute__((packed)) SCSISynchronizeCache10;
+
 MassStorageDevice MassStorage;
 MassStorageDevice *MS1;
 
@@ -271,15 +311,56 @@ inline static u32 le2be32(u32 value)
          ((value & 0x00FF0000) >> 8) | ((value & 0xFF000000) >> 24);
 }
 
+static void op_complete(void *urb, void *param, void *context);
+static void start_request(MassStorageDevice *massStorage);
+static void reset_complete(void *urb, void *param, void *context);
+
+/*...................................................................*/
+/* command_abort: End a failed command, completing a request         */
+/*                                                                   */
+/*      Inputs: massStorage is the mass storage device               */
+/*...................................................................*/
+static void command_abort(MassStorageDevice *massStorage)
+{
+  CommandStatusWrapper CSW;
+
+  massStorage->commandState = 0;
+
+  // The device may be stalled or out of phase, so reset it before the
+  // next command as the Bulk-Only Transport requires
+  massStorage->resetPending = TRUE;
+
+  // Fail a read or write request so the requests queued behind it run
+  if (massStorage->commandComplete == op_complete)
+  {
+    memset(&CSW, 0, sizeof(CSW));
+    CSW.status = CSW_STATUS_PHASE_ERROR;
+    op_complete(NULL, massStorage, &CSW);
+  }
+}
+
 static void command_complete(void *urb, void *param, void *context)
 {
   Endpoint *endpoint = param;
   MassStorageDevice *massStorage = (MassStorageDevice *)endpoint->device;
   static CommandStatusWrapper CSW;
+  int failed = FALSE;
 
   // Clear last request before sending a new one
   if (urb)
+  {
+    failed = (((Request *)urb)->status == 0);
     FreeRequest(urb);
+  }
+
+  // End the command if the CBW, data or CSW transfer failed (STALL)
+  if (failed)
+  {
+    printf("MS transfer failed in state %d\n",
+           massStorage->commandState);
+    command_abort(massStorage);
+    return;
+  }
 
 //  printf("  cmd complete state %d\n",
 //         massStorage->commandState);
@@ -302,7 +383,7 @@ static void command_complete(void *urb, void *param, void *context)
     if (nResult < 0)
     {
       puts("Data transfer failed");
-      massStorage->commandState = 0;
+      command_abort(massStorage);
       return;
     }
   }
@@ -313,7 +394,7 @@ csw:
          massStorage->endpointIn, &CSW, sizeof(CSW), command_complete))
     {
       puts("CSW transfer failed");
-      massStorage->commandState = 0;
+      command_abort(massStorage);
       return;
     }
   }
@@ -323,14 +404,14 @@ csw:
     if (CSW.signature != CSW_SIGNATURE)
     {
       puts("invalid CSW signature");
-      massStorage->commandState = 0;
+      command_abort(massStorage);
       return;
     }
 
     if (CSW.tag != massStorage->tag)
     {
       puts("CSW tag incorrect");
-      massStorage->commandState = 0;
+      command_abort(massStorage);
       return;
     }
 
@@ -559,6 +640,7 @@ static int configure(Device *device, void (complete)
   MassStorageDevice *massStorage = (MassStorageDevice *)device;
   InterfaceDescriptor *interfaceDesc;
   int count = 0;
+  u32 packet;
   assert (massStorage != 0);
 
   ConfigurationDescriptor *confDesc =
@@ -653,6 +735,21 @@ static int configure(Device *device, void (complete)
     return FALSE;
   }
 
+  // Commands move whole blocks, as many as the host channel transfer
+  // size and packet count allow with the smaller packet size
+  packet = massStorage->endpointIn->maxPacketSize & 0x7FF;
+  if ((massStorage->endpointOut->maxPacketSize & 0x7FF) < packet)
+    packet = massStorage->endpointOut->maxPacketSize & 0x7FF;
+  massStorage->maxTransfer = packet * MAX_TRANSFER_PACKETS;
+  if (massStorage->maxTransfer > MAX_TRANSFER_BYTES)
+    massStorage->maxTransfer = MAX_TRANSFER_BYTES;
+  massStorage->maxTransfer &= ~BLOCK_MASK;
+  if (massStorage->maxTransfer == 0)
+  {
+    puts("USB MS endpoint packet size invalid");
+    return FALSE;
+  }
+
   // Otherwise begin device configuration sequence (asynchronous)
   if (!DeviceConfigure(&massStorage->device, configure_complete,
                        massStorage))
@@ -666,34 +763,62 @@ static int configure(Device *device, void (complete)
 }
 
 
+/*...................................................................*/
+/* clear_halt: Clear the ENDPOINT_HALT feature of a bulk endpoint    */
+/*                                                                   */
+/*      Inputs: massStorage is the mass storage device               */
+/*              endpoint is the bulk endpoint                        */
+/*                                                                   */
+/*     Returns: zero on success, negative if the request failed      */
+/*...................................................................*/
+static int clear_halt(MassStorageDevice *massStorage, Endpoint *endpoint)
+{
+  // CLEAR_FEATURE (1) ENDPOINT_HALT (0) to the endpoint address
+  if (HostEndpointControlMessage(massStorage->device.host,
+        massStorage->device.endpoint0, 0x02, 1, 0,
+        endpoint->number | (endpoint->directionIn ? 0x80 : 0), 0, 0,
+        reset_complete, massStorage) < 0)
+  {
+    printf("Cannot clear halt on endpoint %d\n", endpoint->number);
+    return -1;
+  }
+  return 0;
+}
+
+/*...................................................................*/
+/* reset_complete: State machine of the Bulk-Only reset recovery     */
+/*                                                                   */
+/*      Inputs: urb is USB Request Buffer (URB)                      */
+/*              param is the mass storage device                     */
+/*              context is unused                                    */
+/*...................................................................*/
 static void reset_complete(void *urb, void *param, void *context)
 {
   MassStorageDevice *massStorage = (MassStorageDevice *)param;
 
+  // Clear last request before sending a new one
+  if (urb)
+    FreeRequest(urb);
+
   if (massStorage->resetState == STATE_RESET_ENDPOINT1)
   {
-    if (HostEndpointControlMessage(massStorage->device.host,
-          massStorage->device.endpoint0, 0x02, 1, 0, 1, 0, 0,
-          reset_complete, massStorage) < 0)
-    {
-      puts("Cannot clear halt on endpoint 1");
-      return;
-    }
+    if (clear_halt(massStorage, massStorage->endpointIn) < 0)
+      massStorage->resetState = STATE_RESET_FINISHED;
   }
   else if (massStorage->resetState == STATE_RESET_ENDPOINT2)
   {
-    if (HostEndpointControlMessage(massStorage->device.host,
-          massStorage->device.endpoint0, 0x02, 1, 0, 2, 0, 0,
-          reset_complete, massStorage) < 0)
-    {
-      puts("Cannot clear halt on endpoint 2");
-      return;
-    }
+    if (clear_halt(massStorage, massStorage->endpointOut) < 0)
+      massStorage->resetState = STATE_RESET_FINISHED;
   }
-  else if (massStorage->resetState == STATE_RESET_FINISHED)
+
+  if (massStorage->resetState == STATE_RESET_FINISHED)
   {
     EndpointResetPID(massStorage->endpointIn);
     EndpointResetPID(massStorage->endpointOut);
+
+    // Start the requests queued during the reset
+    massStorage->resetActive = FALSE;
+    start_request(massStorage);
     return;
   }
 
@@ -708,186 +833,217 @@ static int reset(MassStorageDevice *massStorage)
 
   puts("-Reset MS device");
 
+  // Bulk-Only Mass Storage Reset (0xFF) to the interface
+  massStorage->resetActive = TRUE;
+  massStorage->resetState = STATE_RESET_ENDPOINT1;
   if (HostEndpointControlMessage(massStorage->device.host,
         massStorage->device.endpoint0, 0x21, 0xFF, 0, 0x00, 0, 0,
         reset_complete, massStorage) < 0)
   {
     puts("Cannot reset device");
+    massStorage->resetActive = FALSE;
     return -1;
   }
-
-  massStorage->resetState = STATE_RESET_ENDPOINT1;
   return 0;
 }
 
 /*...................................................................*/
-/* op_complete: User level operation callback for mass storage       */
+/* start_request: Start the command of the request at queue head     */
 /*                                                                   */
-/*      Inputs: urb is USB Request Buffer (URB)                      */
-/*              param is the keyboard device                         */
-/*              context is resulting Command Status Wrapper (CSW)    */
+/*      Inputs: massStorage is the mass storage device               */
 /*...................................................................*/
-static void op_complete(void *urb, void *param, void *context)
+static void start_request(MassStorageDevice *massStorage)
 {
-  MassStorageDevice *massStorage = (MassStorageDevice *)param;
-  CommandStatusWrapper *csw = context;
-
-  // Clear last request before sending a new one
-  if (urb)
-    FreeRequest(urb);
-  massStorage->commandComplete = NULL;
+  MassStorageRequest *request;
+  u32 block, count;
+  void *buffer;
+  int result;
+
+  // Return if a request or reset is in progress or none are queued
+  if (massStorage->requestActive || massStorage->resetActive ||
+      (massStorage->requestCount == 0))
+    return;
 
-  if (csw->status != CSW_STATUS_PASSED)
+  // Recover from a failed command before sending the next CBW
+  if (massStorage->resetPending)
   {
-    printf("  csw status 'not passed', read failed %d.\n",
-           csw->status);
-    massStorage->commandBufferLen = -csw->status; // return failure
+    massStorage->resetPending = FALSE;
+    if (reset(massStorage) == 0)
+      return;
   }
 
-  // If there is data left over, reduce the amount
-  if ((csw->dataResidue > 0) &&
-      (massStorage->commandBufferLen >= csw->dataResidue))
-    massStorage->commandBufferLen -= csw->dataResidue;
-
-  // Invoke the user callback if configured
-  if (massStorage->operationCallback)
-    massStorage->operationCallback(massStorage->commandBuffer,
-                                   massStorage->commandBufferLen,
-                                   massStorage->operationPayload);
-
-  // Clear the buffer for next user command
-  massStorage->commandBuffer = NULL;
-  massStorage->commandBufferLen = 0;
-
-  // Increment the offset to the next block for the next read
-  massStorage->offset += BLOCK_SIZE;
-}
+  request = &massStorage->requests[massStorage->requestHead];
+  massStorage->requestActive = TRUE;
 
-static int read(MassStorageDevice *device, void *buffer, unsigned count)
-{
-  u32 blockAddress = (u32)(device->offset >> BLOCK_SHIFT);
-  u16 transferLength = (u16) (count >> BLOCK_SHIFT);
-  assert(device != 0);
-  assert (buffer != 0);
+  // Requests larger than the host channel are split into commands
+  block = request->block + (request->done >> BLOCK_SHIFT);
+  buffer = (u8 *)request->buffer + request->done;
+  count = request->count - request->done;
+  if (count > massStorage->maxTransfer)
+    count = massStorage->maxTransfer;
 
-  if (((device->offset & BLOCK_MASK) != 0))// ||
-//      (device->offset > MAX_OFFSET))
+  if (request->type == REQUEST_WRITE)
   {
-    printf("Offset %d invalid (... & %x, > %x)", device->offset,
-           BLOCK_MASK, MAX_OFFSET);
-    return -1;
+    SCSIWrite10 SCSIWrite;
+    SCSIWrite.OperationCode = SCSI_OP_WRITE;
+    SCSIWrite.Flags = request->fua ? SCSI_WRITE_FUA : 0;
+    SCSIWrite.LogicalBlockAddress = le2be32(block);
+    SCSIWrite.Reserved = 0;
+    SCSIWrite.TransferLength = le2be16(count >> BLOCK_SHIFT);
+    SCSIWrite.Control = SCSI_CONTROL;
+
+    result = command(massStorage, &SCSIWrite, sizeof SCSIWrite,
+                     buffer, count, FALSE, op_complete);
   }
-
-  if ((count & BLOCK_MASK) != 0)
+  else if (request->type == REQUEST_SYNC)
   {
-    printf("Count %d invalid (... & %x)", count, BLOCK_MASK);
-    return -1;
+    SCSISynchronizeCache10 SCSISync;
+    SCSISync.OperationCode = SCSI_OP_SYNCHRONIZE_CACHE10;
+    SCSISync.Flags = 0;
+    SCSISync.LogicalBlockAddress = 0;
+    SCSISync.GroupNumber = 0;
+    SCSISync.NumberOfBlocks = 0;
+    SCSISync.Control = SCSI_CONTROL;
+
+    result = command(massStorage, &SCSISync, sizeof SCSISync, 0, 0, FALSE,
+                     op_complete);
   }
-
-//  printf("read %u/0x%X/%u", blockAddress, (uintptr_t)buffer,
-//         (u32)transferLength);
-
-  SCSIRead10 SCSIRead;
-  SCSIRead.OperationCode = SCSI_OP_READ;
-  SCSIRead.Reserved1    = 0;
-  SCSIRead.LogicalBlockAddress = le2be32(blockAddress);
-  SCSIRead.Reserved2 = 0;
-  SCSIRead.TransferLength = le2be16(transferLength);
-  SCSIRead.Control = SCSI_CONTROL;
-
-  if (command(device, &SCSIRead, sizeof SCSIRead, buffer, count, TRUE,
-              op_complete) < 0)
+  else
   {
-    puts("MS read failed");
-    return -1;
+    SCSIRead10 SCSIRead;
+    SCSIRead.OperationCode = SCSI_OP_READ;
+    SCSIRead.Reserved1    = 0;
+    SCSIRead.LogicalBlockAddress = le2be32(block);
+    SCSIRead.Reserved2 = 0;
+    SCSIRead.TransferLength = le2be16(count >> BLOCK_SHIFT);
+    SCSIRead.Control = SCSI_CONTROL;
+
+    result = command(massStorage, &SCSIRead, sizeof SCSIRead,
+                     buffer, count, TRUE, op_complete);
   }
 
-  return count;
+  // If the command did not start, fail the request
+  if (result < 0)
+  {
+    CommandStatusWrapper CSW;
+
+    puts("MS command failed to initiate");
+    memset(&CSW, 0, sizeof(CSW));
+    CSW.status = CSW_STATUS_PHASE_ERROR;
+    massStorage->commandComplete = op_complete;
+    op_complete(NULL, massStorage, &CSW);
+  }
 }
 
 /*...................................................................*/
-/* write_complete: State machine to write from mass storage          */
+/* op_complete: User level operation callback for mass storage       */
 /*                                                                   */
 /*      Inputs: urb is USB Request Buffer (URB)                      */
 /*              param is the keyboard device                         */
-/*              context is unused                                    */
+/*              context is resulting Command Status Wrapper (CSW)    */
 /*...................................................................*/
-/*static void write_complete(void *urb, void *param, void *context)
+static void op_complete(void *urb, void *param, void *context)
 {
   MassStorageDevice *massStorage = (MassStorageDevice *)param;
   CommandStatusWrapper *csw = context;
+  MassStorageRequest request, *head;
+  u32 length = massStorage->commandBufferLen;
+  int bufferLen;
 
   // Clear last request before sending a new one
   if (urb)
     FreeRequest(urb);
   massStorage->commandComplete = NULL;
+  massStorage->commandBuffer = NULL;
+  massStorage->commandBufferLen = 0;
+  massStorage->requestActive = FALSE;
 
-  if (csw->status != CSW_STATUS_PASSED)
+  // Start the next command of a split request if this one completed
+  head = &massStorage->requests[massStorage->requestHead];
+  if ((csw->status == CSW_STATUS_PASSED) && (csw->dataResidue == 0) &&
+      (head->done + length < head->count))
   {
-    printf("  csw status 'not passed', write failed %d.\n",
-           csw->status);
-    massStorage->commandBufferLen = -csw->status; // return failure
+    head->done += length;
+    start_request(massStorage);
+    return;
   }
 
-  // If there is data left over, reduce the amount written
-  if ((csw->dataResidue > 0) &&
-      (massStorage->commandBufferLen >= csw->dataResidue))
-    massStorage->commandBufferLen -= csw->dataResidue;
+  // Remove the completed request from the queue
+  request = *head;
+  massStorage->requestHead = (massStorage->requestHead + 1) % MAX_REQUESTS;
+  massStorage->requestCount--;
 
-  // Invoke the user callback if configured
-  if (massStorage->operationCallback)
-    massStorage->operationCallback(massStorage->commandBuffer,
-                                   massStorage->commandBufferLen);
+  if (csw->status != CSW_STATUS_PASSED)
+  {
+    printf("  csw status 'not passed', %s failed %d.\n",
+           request.type == REQUEST_READ ? "read" : request.type ==
+           REQUEST_WRITE ? "write" : "sync", csw->status);
+    bufferLen = -csw->status; // return failure
+  }
 
-  // Clear the buffer for next user command
-  massStorage->commandBuffer = NULL;
-  massStorage->commandBufferLen = 0;
+  // If there is data left over, reduce the amount
+  else if (csw->dataResidue <= length)
+    bufferLen = request.done + length - csw->dataResidue;
+  else
+    bufferLen = request.done;
 
-  // Increment the offset to the next block for the next read
-  massStorage->offset += BLOCK_SIZE;
+  // Pipeline the next command before the callback of this one
+  start_request(massStorage);
+
+  // Invoke the user callback if configured
+  if (request.callback)
+    request.callback(request.buffer, bufferLen, request.payload);
 }
-*/
 
-static int write(MassStorageDevice *device, const void *buffer,
-                 u32 count)
+/*...................................................................*/
+/* queue_request: Queue a read or write request of whole blocks      */
+/*                                                                   */
+/*      Inputs: device is the mass storage device                    */
+/*              block is the first Logical Block Address (LBA)       */
+/*              buffer is the data to read or write                  */
+/*              count is the length in bytes                         */
+/*              type is REQUEST_READ, _WRITE or _SYNC                */
+/*              fua is TRUE to write through the device cache        */
+/*              callback is called on completion with payload        */
+/*                                                                   */
+/*     Returns: count if queued, -1 if invalid or -2 if queue full   */
+/*...................................................................*/
+static int queue_request(MassStorageDevice *device, u32 block,
+                         void *buffer, u32 count, int type, int fua,
+                         void (callback)(u8 *buffer, int buffLen,
+                                         void *payload), void *payload)
 {
-  assert(device != 0);
-  assert(buffer != 0);
+  MassStorageRequest *request;
 
-  if (((device->offset & BLOCK_MASK) != 0))// ||
-//      (device->offset > MAX_OFFSET))
-  {
-    printf("Offset %d invalid (... & %x, > %x)", device->offset,
-           BLOCK_MASK, MAX_OFFSET);
-    return -1;
-  }
-  u32 blockAddress = (u32)(device->offset >> BLOCK_SHIFT);
+  assert(device != 0);
+  assert((buffer != 0) || (type == REQUEST_SYNC));
 
-  if ((count & BLOCK_MASK) != 0)
+  if (((count & BLOCK_MASK) != 0) || ((count == 0) && (type != REQUEST_SYNC)))
   {
     printf("Count %d invalid (... & %x)", count, BLOCK_MASK);
     return -1;
   }
-  u16 transferLength = (u16)(count >> BLOCK_SHIFT);
-
-//  printf("write %u/0x%X/%u", blockAddress, (uintptr_t)buffer,
-//         (u32)transferLength);
-
-  SCSIWrite10 SCSIWrite;
-  SCSIWrite.OperationCode = SCSI_OP_WRITE;
-  SCSIWrite.Flags = SCSI_WRITE_FUA;
-  SCSIWrite.LogicalBlockAddress = le2be32 (blockAddress);
-  SCSIWrite.Reserved = 0;
-  SCSIWrite.TransferLength = le2be16(transferLength);
-  SCSIWrite.Control = SCSI_CONTROL;
 
-  if (command(device, &SCSIWrite, sizeof SCSIWrite, (void *)buffer,
-              count, FALSE, op_complete) < 0)
-  {
-    puts("Write command failed to initiate");
-    return -1;
-  }
+  if (device->requestCount >= MAX_REQUESTS)
+    return -2;
 
+//  printf("%d %u/0x%X/%u", type, block, (uintptr_t)buffer,
+//         count >> BLOCK_SHIFT);
+
+  request = &device->requests[(device->requestHead + device->requestCount) %
+                              MAX_REQUESTS];
+  request->block = block;
+  request->count = count;
+  request->done = 0;
+  request->buffer = buffer;
+  request->type = type;
+  request->fua = fua;
+  request->callback = callback;
+  request->payload = payload;
+  device->requestCount++;
+
+  // Start it now if the device is idle
+  start_request(device);
   return count;
 }
 
@@ -904,12 +1060,17 @@ void *MassStorageAttach(Device *device)
 
   massStorage->configurationState = 0;
   massStorage->commandState = 0;
+  massStorage->resetPending = FALSE;
+  massStorage->resetActive = FALSE;
 
   massStorage->endpointIn = 0;
   massStorage->endpointOut = 0;
   massStorage->tag = 0;
   massStorage->blockCount = 0;
-  massStorage->offset = 0;
+  massStorage->maxTransfer = 0;
+  massStorage->requestHead = 0;
+  massStorage->requestCount = 0;
+  massStorage->requestActive = FALSE;
   return massStorage;
 }
 
@@ -934,7 +1095,7 @@ void MassStorageRelease(MassStorageDevice *device)
   DeviceRelease(&device->device);
 }
 
-int MassStorageRead(void *buffer, u32 count,
+int MassStorageRead(u32 block, void *buffer, u32 count,
                     void (callback)(u8 *buffer, int buffLen,
                                     void *payload),
                     void *payload)
@@ -942,56 +1103,48 @@ int MassStorageRead(void *buffer, u32 count,
   MassStorageDevice *device = MS1;
   assert(device != 0);
 
-  device->operationCallback = callback;
-  device->operationPayload = payload;
-  return read(device, buffer, count);
+  return queue_request(device, block, buffer, count, REQUEST_READ, FALSE,
+                       callback, payload);
 }
 
-int MassStorageWrite(const void *buffer, u32 count,
-                           void (callback)(u8 *buffer, int buffLen,
-                                           void *payload),
-                           void *payload)
+int MassStorageWrite(u32 block, const void *buffer, u32 count, int fua,
+                     void (callback)(u8 *buffer, int buffLen,
+                                     void *payload),
+                     void *payload)
 {
   MassStorageDevice *device = MS1;
   assert(device != 0);
 
-  device->operationCallback = callback;
-  device->operationPayload = payload;
-  return write(device, buffer, count);
+  return queue_request(device, block, (void *)buffer, count,
+                       REQUEST_WRITE, fua, callback, payload);
 }
 
-int MassStorageReset()
+int MassStorageSync(void (callback)(u8 *buffer, int buffLen,
+                                    void *payload),
+                    void *payload)
 {
   MassStorageDevice *device = MS1;
   assert(device != 0);
 
-  return reset(device);
+  return queue_request(device, 0, NULL, 0, REQUEST_SYNC, FALSE,
+                       callback, payload);
 }
 
-u64 MassStorageSeek(u64 offset)
+int MassStorageReset()
 {
   MassStorageDevice *device = MS1;
-
   assert(device != 0);
 
-  if (((offset & BLOCK_MASK) != 0))// || (offset > MAX_OFFSET))
-  {
-    printf("Offset %x invalid (... & %x, > %x)", offset,
-           BLOCK_MASK, MAX_OFFSET);
-    return 0;
-  }
-
-  device->offset = offset;
-  return device->offset;
+  return reset(device);
 }
 
-u64 MassStorageOffset()
+int MassStorageQueued()
 {
   MassStorageDevice *device = MS1;
 
   assert(device != 0);
 
-  return device->offset;
+  return device->requestCount;
 }
 
 u32 MassStorageBlockCapacity()
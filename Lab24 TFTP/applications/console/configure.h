@@ -72,7 +72,7 @@
 #define ENABLE_IP4         (TRUE && ENABLE_MALLOC && ENABLE_ETHER) /* Inet Protocol v4 */
 #define ENABLE_IP6         (FALSE && ENABLE_MALLOC && ENABLE_ETHER) /* Inet Protocol v6 */
 #define ENABLE_UDP         (TRUE && (ENABLE_IP4 || ENABLE_IP4))/* UDP */
-#define ENABLE_TCP         (FALSE && (ENABLE_IP4 || ENABLE_IP4))/* TCP*/
+#define ENABLE_TCP         (TRUE && (ENABLE_IP4 || ENABLE_IP4))/* TCP*/
 #define ENABLE_DHCP        (TRUE && ENABLE_UDP)/* Dynamic IP Discovery*/
 #define ENABLE_ICMP        (TRUE && ENABLE_IP4)/* Internet Control */
 
@@ -0,0 +1,83 @@
+/*...................................................................*/
+/*                                                                   */
+/*   Module:  configure.h                                            */
+/*   Version: 2020.0                                                 */
+/*   Purpose: system configuration declarations                      */
+/*                                                                   */
+/*...................................................................*/
+/*                                                                   */
+/*                   Copyright 2015, Sean Lawless                    */
+/*                                                                   */
+/*                      ALL RIGHTS RESERVED                          */
+/*                                                                   */
+/* Redistribution and use in source, binary or derived forms, with   */
+/* or without modification, are permitted provided that the          */
+/* following conditions are met:                                     */
+/*                                                                   */
+/*  1. Redistributions in any form, including but not limited to     */
+/*     source code, binary, or derived works, must include the above */
+/*     copyright notice, this list of conditions and the following   */
+/*     disclaimer.                                                   */
+/*                                                                   */
+/*  2. Any change or addition to this copyright notice requires the  */
+/*     prior written permission of the above copyright holder.       */
+/*                                                                   */
+/* THIS SOFTWARE IS PROVIDED ''AS IS''. ANY EXPRESS OR IMPLIED       */
+/* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES */
+/* OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE       */
+/* DISCLAIMED. IN NO EVENT SHALL ANY AUTHOR AND/OR COPYRIGHT HOLDER  */
+/* BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,          */
+/* EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED   */
+/* TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,     */
+/* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON */
+/* ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,   */
+/* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY    */
+/* OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE           */
+/* POSSIBILITY OF SUCH DAMAGE.                                       */
+/*...................................................................*/
+#ifndef _CONFIGURE_H
+#define _CONFIGURE_H
+
+/*...................................................................*/
+/* Configuration                                                     */
+/*...................................................................*/
+#define ENABLE_OS          TRUE
+#define ENABLE_SHELL       TRUE
+#define ENABLE_UART0       TRUE  /* terminal is the primary UART */
+#define ENABLE_UART1       FALSE /* enable secondary UART */
+#define ENABLE_JTAG        FALSE /* enable JTAG debugging */
+#define ENABLE_VIDEO       FALSE /* enable video console */
+#define   COLOR_DEPTH_BITS      16  /* color depth in bits, 32 or 16 */
+#define ENABLE_USB         FALSE /* enable Universtal Serial Bus Host */
+#define ENABLE_XMODEM      FALSE /* enable xmodem receiver */
+#define ENABLE_BOOTLOADER  FALSE /* enable boot loader */
+#define ENABLE_MALLOC      TRUE  /* enable malloc/free */
+#define ENABLE_PRINTF      TRUE  /* printf arguments */
+#define ENABLE_ASSERT      (TRUE && ENABLE_PRINTF)/*enable assertions */
+#define ENABLE_AUTO_START  FALSE /* Auto start enabled devices */
+
+/* Host specific configuration */
+#define ENABLE_TAP         TRUE  /* enable Linux TAP Ethernet */
+#define   TAP_DEVICE_NAME  "tap%d" /* tap0, or tapN for host.elf N */
+
+/* USB Specific configuration */
+#define ENABLE_USB_HID     (FALSE && ENABLE_USB) /* for keyboard/mouse*/
+#define ENABLE_USB_ETHER   (FALSE && ENABLE_USB) /* enable Ethernet */
+#define ENABLE_USB_TASK    (FALSE && ENABLE_USB) /* USB intr task */
+
+/* Network configuration, static 192.168.1.202 unless DHCP */
+#define ENABLE_IP4         (TRUE && ENABLE_MALLOC && ENABLE_ETHER) /* Inet Protocol v4 */
+#define ENABLE_IP6         (FALSE && ENABLE_MALLOC && ENABLE_ETHER) /* Inet Protocol v6 */
+#define ENABLE_UDP         (TRUE && (ENABLE_IP4 || ENABLE_IP4))/* UDP */
+#define ENABLE_TCP         (TRUE && (ENABLE_IP4 || ENABLE_IP4))/* TCP*/
+#define ENABLE_DHCP        (FALSE && ENABLE_UDP)/* Dynamic IP Discovery*/
+#define ENABLE_ICMP        (TRUE && ENABLE_IP4)/* Internet Control */
+
+/* DO NOT EDIT BELOW : Derived configurations */
+#define ENABLE_ETHER       (ENABLE_USB_ETHER || ENABLE_TAP) /* Ethernet */
+#define ENABLE_NETWORK     (ENABLE_ETHER && (ENABLE_IP4 || ENABLE_IP6))
+#define MAX_TASKS          (10 + ENABLE_UART0 + ENABLE_UART1 + \
+                            ENABLE_VIDEO + ENABLE_USB_TASK + \
+                            ENABLE_ETHER)
+
+#endif /* _CONFIGURE_H */
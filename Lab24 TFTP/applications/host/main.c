@@ -0,0 +1,84 @@
+/*...................................................................*/
+/*                                                                   */
+/*   Module:  main.c                                                 */
+/*   Version: 2020.0                                                 */
+/*   Purpose: main function for Linux host network application       */
+/*                                                                   */
+/*...................................................................*/
+/*                                                                   */
+/*                   Copyright 2015, Sean Lawless                    */
+/*                                                                   */
+/*                      ALL RIGHTS RESERVED                          */
+/*                                                                   */
+/* Redistribution and use in source, binary or derived forms, with   */
+/* or without modification, are permitted provided that the          */
+/* following conditions are met:                                     */
+/*                                                                   */
+/*  1. Redistributions in any form, including but not limited to     */
+/*     source code, binary, or derived works, must include the above */
+/*     copyright notice, this list of conditions and the following   */
+/*     disclaimer.                                                   */
+/*                                                                   */
+/*  2. Any change or addition to this copyright notice requires the  */
+/*     prior written permission of the above copyright holder.       */
+/*                                                                   */
+/* THIS SOFTWARE IS PROVIDED ''AS IS''. ANY EXPRESS OR IMPLIED       */
+/* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES */
+/* OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE       */
+/* DISCLAIMED. IN NO EVENT SHALL ANY AUTHOR AND/OR COPYRIGHT HOLDER  */
+/* BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,          */
+/* EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED   */
+/* TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,     */
+/* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON */
+/* ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,   */
+/* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY    */
+/* OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE           */
+/* POSSIBILITY OF SUCH DAMAGE.                                       */
+/*...................................................................*/
+#include <system.h>
+#include <board.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*...................................................................*/
+/* Global variables                                                  */
+/*...................................................................*/
+int ScreenUp, UsbUp, NetUp;
+
+/*...................................................................*/
+/*        main: Application Entry Point                              */
+/*                                                                   */
+/*     Returns: Exit error                                           */
+/*...................................................................*/
+int main(void)
+{
+  // Initialize global variables
+  NetUp = UsbUp = ScreenUp = FALSE;
+
+  /* Initialize the host board. */
+  BoardInit();
+
+  // Initialize the Operating System (OS) and create system tasks
+  OsInit();
+
+  /* Set task specific stdio. */
+  StdioState = &Uart0State;
+  TaskNew(0, ShellPoll, &Uart0State);
+
+  // Initialize the timer and LED tasks
+  TaskNew(1, TimerPoll, &TimerStart);
+  TaskNew(MAX_TASKS - 1, LedPoll, &LedState);
+
+  /* Display the introductory splash. */
+  puts("Host network application");
+  printf("  'net [address]' attaches to tap%d as 192.168.1.202 by "
+         "default\n", HostInstance);
+
+  /* Run the priority loop scheduler. */
+  OsStart();
+
+  /* On OS exit say goodbye. */
+  puts("Goodbye");
+  return 0;
+}
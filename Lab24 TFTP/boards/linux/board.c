@@ -0,0 +1,550 @@
+/*...................................................................*/
+/*                                                                   */
+/*   Module:  board.c                                                */
+/*   Version: 2020.0                                                 */
+/*   Purpose: Board support package for Linux host process           */
+/*                                                                   */
+/*...................................................................*/
+/*                                                                   */
+/*                   Copyright 2020, Sean Lawless                    */
+/*                                                                   */
+/*                      ALL RIGHTS RESERVED                          */
+/*                                                                   */
+/* Redistribution and use in source, binary or derived forms, with   */
+/* or without modification, are permitted provided that the          */
+/* following conditions are met:                                     */
+/*                                                                   */
+/*  1. Redistributions in any form, including but not limited to     */
+/*     source code, binary, or derived works, must include the above */
+/*     copyright notice, this list of conditions and the following   */
+/*     disclaimer.                                                   */
+/*                                                                   */
+/*  2. Any change or addition to this copyright notice requires the  */
+/*     prior written permission of the above copyright holder.       */
+/*                                                                   */
+/* THIS SOFTWARE IS PROVIDED ''AS IS''. ANY EXPRESS OR IMPLIED       */
+/* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES */
+/* OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE       */
+/* DISCLAIMED. IN NO EVENT SHALL ANY AUTHOR AND/OR COPYRIGHT HOLDER  */
+/* BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,          */
+/* EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED   */
+/* TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,     */
+/* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON */
+/* ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,   */
+/* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY    */
+/* OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE           */
+/* POSSIBILITY OF SUCH DAMAGE.                                       */
+/*...................................................................*/
+#include <board.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if ENABLE_MALLOC
+#include <malloc.h>
+#endif
+
+/*...................................................................*/
+/* Symbol Definitions                                                */
+/*...................................................................*/
+/*
+ * Linux i386 system call numbers (int 0x80)
+*/
+#define SYS_EXIT          1
+#define SYS_READ          3
+#define SYS_WRITE         4
+#define SYS_OPEN          5
+#define SYS_CLOSE         6
+#define SYS_IOCTL         54
+#define SYS_POLL          168
+#define SYS_CLOCK_GETTIME 265
+
+#define CLOCK_MONOTONIC   1
+#define O_RDONLY          0x0000
+#define O_WRONLY          0x0001
+#define O_CREAT           0x0040
+#define O_TRUNC           0x0200
+#define POLLIN            0x0001
+
+/*
+ * Terminal (termios) control
+*/
+#define TCGETS            0x5401
+#define TCSETS            0x5402
+#define   ICRNL             0x0100 // c_iflag: map CR to NL on input
+#define   ICANON            0x0002 // c_lflag: line (canonical) input
+#define   ECHO              0x0008 // c_lflag: echo input characters
+
+#define STDIN             0
+#define STDOUT            1
+
+/*...................................................................*/
+/* Type Definitions                                                  */
+/*...................................................................*/
+struct host_timespec
+{
+  u32 tv_sec;
+  u32 tv_nsec;
+};
+
+struct host_pollfd
+{
+  int fd;
+  short events;
+  short revents;
+};
+
+struct host_termios
+{
+  u32 c_iflag;
+  u32 c_oflag;
+  u32 c_cflag;
+  u32 c_lflag;
+  u8  c_line;
+  u8  c_cc[19];
+};
+
+/*...................................................................*/
+/* Global Variables                                                  */
+/*...................................................................*/
+struct led_state LedState;
+u32 LedTime;
+int HostInstance;
+
+extern void XmodemInit(void);
+extern void ShellInit(void);
+extern int main(void);
+
+#if ENABLE_MALLOC
+static u8 HeapMemory[MEM_SIZE] __attribute__ ((aligned (16)));
+#endif
+static u8 RunImage[KERNEL_MAX_SIZE] __attribute__ ((aligned (16)));
+static u8 PersistMemory[MEM_PERSIST_SIZE] __attribute__ ((aligned (16)));
+static struct host_termios Terminal;
+static int TerminalRaw, InputEnd;
+
+/*...................................................................*/
+/* Local Functions                                                   */
+/*...................................................................*/
+
+/*...................................................................*/
+/*    syscall3: Perform a three argument Linux system call           */
+/*                                                                   */
+/*      Input: number - the system call number                       */
+/*             arg1, arg2, arg3 - the system call arguments          */
+/*                                                                   */
+/*    Returns: system call result, negative error number on failure  */
+/*...................................................................*/
+static int syscall3(int number, u32 arg1, u32 arg2, u32 arg3)
+{
+  int result;
+
+  asm volatile("int $0x80" : "=a" (result)
+               : "0" (number), "b" (arg1), "c" (arg2), "d" (arg3)
+               : "memory");
+  return result;
+}
+
+/*...................................................................*/
+/* persist_file: Read or write the persistent memory file of this    */
+/*               instance, host<N>.ram in the working directory      */
+/*                                                                   */
+/*      Input: save - TRUE to write the file, FALSE to read it       */
+/*...................................................................*/
+static void persist_file(int save)
+{
+  char path[16];
+  int fd;
+
+  sprintf(path, "host%d.ram", HostInstance);
+  if (save)
+    fd = syscall3(SYS_OPEN, (uintptr_t)path, O_WRONLY | O_CREAT | O_TRUNC,
+                  0644);
+  else
+    fd = syscall3(SYS_OPEN, (uintptr_t)path, O_RDONLY, 0);
+  if (fd < 0)
+    return;
+  if (save)
+    HostWrite(fd, PersistMemory, MEM_PERSIST_SIZE);
+  else
+    HostRead(fd, PersistMemory, MEM_PERSIST_SIZE);
+  syscall3(SYS_CLOSE, fd, 0, 0);
+}
+
+/*...................................................................*/
+/* Global Function Definitions                                       */
+/*...................................................................*/
+
+/*...................................................................*/
+/*     _start: Process entry point, argc and argv are on the stack   */
+/*                                                                   */
+/*...................................................................*/
+asm(".globl _start\n"
+    "_start:\n"
+    "  xorl %ebp, %ebp\n"
+    "  movl %esp, %eax\n"
+    "  andl $-16, %esp\n"
+    "  subl $12, %esp\n"
+    "  pushl %eax\n"
+    "  call HostStart\n");
+
+/*...................................................................*/
+/*  HostStart: Parse the command line and run the application        */
+/*                                                                   */
+/*      Input: stack - the process stack, argc then argv             */
+/*...................................................................*/
+void HostStart(u32 *stack)
+{
+  char **argv = (char **)&stack[1];
+
+  // An instance number selects the TAP interface and MAC address, so
+  // that several processes can share a bridge
+  if (stack[0] > 1)
+    HostInstance = atoi(argv[1]);
+  HostExit(main());
+}
+
+int HostRead(int fd, void *buffer, u32 length)
+{
+  return syscall3(SYS_READ, fd, (uintptr_t)buffer, length);
+}
+
+int HostWrite(int fd, const void *buffer, u32 length)
+{
+  return syscall3(SYS_WRITE, fd, (uintptr_t)buffer, length);
+}
+
+int HostOpen(const char *path, int flags)
+{
+  return syscall3(SYS_OPEN, (uintptr_t)path, flags, 0);
+}
+
+int HostIoctl(int fd, u32 request, void *argument)
+{
+  return syscall3(SYS_IOCTL, fd, request, (uintptr_t)argument);
+}
+
+/*...................................................................*/
+/*   HostExit: Restore the terminal and exit the process             */
+/*                                                                   */
+/*      Input: status - process exit status                          */
+/*...................................................................*/
+void HostExit(int status)
+{
+  if (TerminalRaw)
+    HostIoctl(STDIN, TCSETS, &Terminal);
+  for (;;)
+    syscall3(SYS_EXIT, status, 0, 0);
+}
+
+/*...................................................................*/
+/*  BoardInit: Initialize the Linux host board                       */
+/*                                                                   */
+/*...................................................................*/
+void BoardInit(void)
+{
+  // initialize the LED state
+  bzero(&LedState, sizeof(struct led_state));
+
+#if ENABLE_UART0
+  /* Initialize the primary UART, the process terminal. */
+  Uart0Init();
+
+#if ENABLE_SHELL
+  bzero(&Uart0State, sizeof(struct shell_state));
+
+  /* initialize a shell task for the primary UART */
+  Uart0State.result = TASK_FINISHED;
+  Uart0State.cmd = NULL;
+  Uart0State.getc = Uart0Getc;
+  Uart0State.putc = Uart0Putc;
+  Uart0State.puts = Uart0Puts;
+  Uart0State.check = Uart0RxCheck;
+  Uart0State.flush = Uart0Flush;
+
+  /* display the introductory splash */
+  Uart0State.puts("Computer Systems");
+  Uart0State.puts("  Using priority loop scheduler");
+  Uart0State.puts("Copyright 2015-2020 Sean Lawless.");
+  Uart0State.puts("  All rights reserved.\n");
+  Uart0State.puts("Connected to Linux host terminal.");
+  Uart0State.puts("'?' for a list of commands");
+#endif
+#endif /* ENABLE_UART0 */
+
+#if ENABLE_MALLOC
+  MallocInit(MEM_HEAP_START, MEM_SIZE);
+#endif
+
+  /* Restore the memory kept by the last reboot, if any. */
+  persist_file(FALSE);
+
+#if ENABLE_XMODEM
+  XmodemInit();
+#endif
+
+#if ENABLE_SHELL
+  ShellInit();
+#endif
+
+  /* Initialize LED task blinker. */
+  LedTime = MICROS_PER_SECOND;
+  LedState.expire = TimerRegister(LedTime);
+  LedState.state = 0;
+}
+
+#if ENABLE_MALLOC
+/*...................................................................*/
+/*   HeapBase: Return the start of the heap memory                   */
+/*                                                                   */
+/*...................................................................*/
+uintptr_t HeapBase(void)
+{
+  return (uintptr_t)HeapMemory;
+}
+#endif
+
+/*...................................................................*/
+/* _run_location: Return the download (run) image location           */
+/*                                                                   */
+/*...................................................................*/
+uintptr_t _run_location(void)
+{
+  return (uintptr_t)RunImage;
+}
+
+u32 _run_size(void)
+{
+  return KERNEL_MAX_SIZE;
+}
+
+/*...................................................................*/
+/*  PersistBase: Return the start of the persistent memory           */
+/*                                                                   */
+/*...................................................................*/
+uintptr_t PersistBase(void)
+{
+  return (uintptr_t)PersistMemory;
+}
+
+/*...................................................................*/
+/* SystemReboot: Exit the host process, there is nothing to reboot   */
+/*               but the persistent memory is saved for the next run */
+/*...................................................................*/
+void SystemReboot(void)
+{
+  persist_file(TRUE);
+  HostExit(0);
+}
+
+void _branch_to_boot(void)
+{
+  HostExit(0);
+}
+
+void _branch_to_run(void)
+{
+  HostExit(0);
+}
+
+/*...................................................................*/
+/*      LedOn: Turn on the activity LED, the host has none           */
+/*                                                                   */
+/*...................................................................*/
+void LedOn(void)
+{
+}
+
+/*...................................................................*/
+/*     LedOff: Turn off the activity LED, the host has none          */
+/*                                                                   */
+/*...................................................................*/
+void LedOff(void)
+{
+}
+
+/*..................................................................*/
+/* LedPoll: poll the led timer and toggle LED if expired            */
+/*                                                                  */
+/* returns: exit error                                              */
+/*..................................................................*/
+int LedPoll(void *data)
+{
+  struct led_state *state = data;
+
+  /* check if the timer has expired */
+  if (TimerRemaining(&state->expire) == 0)
+  {
+    /* if on then turn off */
+    if (state->state)
+    {
+      LedOff();
+      state->state = 0;
+    }
+
+    /* otherwise turn on */
+    else
+    {
+      LedOn();
+      state->state = 1;
+    }
+    state->expire = TimerRegister(LedTime);
+  }
+
+  return TASK_IDLE;
+}
+
+/*...................................................................*/
+/* TimerRegister: Register an expiration time                        */
+/*                                                                   */
+/*      Input: microseconds until timer expires                      */
+/*                                                                   */
+/*    Returns: resulting expiration time                             */
+/*...................................................................*/
+struct timer TimerRegister(u64 microseconds)
+{
+  struct timer tw;
+
+  /* Calculate and return the expiration time of the new timer. */
+  tw.expire = TimerNow() + microseconds;
+  return tw;
+}
+
+/*...................................................................*/
+/* TimerRemaining: Check if a registered timer has expired           */
+/*                                                                   */
+/*      Input: expire - clock time of expiration in microseconds     */
+/*                                                                   */
+/*    Returns: Zero (0) or microseconds until timer expiration       */
+/*...................................................................*/
+u64 TimerRemaining(struct timer *tw)
+{
+  u64 now = TimerNow();
+
+  /* Return zero if timer expired. */
+  if (now > tw->expire)
+    return 0;
+
+  /* Return time until expiration if not expired. */
+  return tw->expire - now;
+}
+
+/*.....................................................................*/
+/*   TimerNow: Return the current time in microseconds                 */
+/*                                                                     */
+/*.....................................................................*/
+u64 TimerNow(void)
+{
+  struct host_timespec ts;
+
+  /* Read the monotonic clock, nanoseconds divided in 32 bits. */
+  syscall3(SYS_CLOCK_GETTIME, CLOCK_MONOTONIC, (uintptr_t)&ts, 0);
+  return ((u64)ts.tv_sec * MICROS_PER_SECOND) + (ts.tv_nsec / 1000);
+}
+
+/*...................................................................*/
+/* GetArmClockRate: Return the CPU clock rate, unknown on the host   */
+/*                                                                   */
+/*    Returns: zero (0) as cycles cannot be derived from time        */
+/*...................................................................*/
+u32 GetArmClockRate(void)
+{
+  return 0;
+}
+
+/*...................................................................*/
+/*    Uart0Init: Put the terminal in raw (character) mode            */
+/*...................................................................*/
+void Uart0Init(void)
+{
+  struct host_termios raw;
+
+  /* Characters are echoed by the shell, so disable line mode/echo. */
+  TerminalRaw = InputEnd = FALSE;
+  if (HostIoctl(STDIN, TCGETS, &Terminal) == 0)
+  {
+    raw = Terminal;
+    raw.c_iflag &= ~ICRNL;
+    raw.c_lflag &= ~(ICANON | ECHO);
+    if (HostIoctl(STDIN, TCSETS, &raw) == 0)
+      TerminalRaw = TRUE;
+  }
+}
+
+/*...................................................................*/
+/*   Uart0Puts: Output a string to the terminal                      */
+/*                                                                   */
+/*       Input: string to output                                     */
+/*...................................................................*/
+void Uart0Puts(const char *string)
+{
+  HostWrite(STDOUT, string, strlen(string));
+
+  /* The puts() command must end with new line and carriage return. */
+  Uart0Putc('\n');
+  Uart0Putc('\r');
+}
+
+/*...................................................................*/
+/*   Uart0Putc: Output one character to the terminal                 */
+/*                                                                   */
+/*       Input: character to output                                  */
+/*...................................................................*/
+void Uart0Putc(char character)
+{
+  HostWrite(STDOUT, &character, 1);
+}
+
+/*...................................................................*/
+/* Uart0RxCheck: Return true if a character can be read              */
+/*                                                                   */
+/*     Returns: one '1' if the terminal has a character              */
+/*...................................................................*/
+u32 Uart0RxCheck(void)
+{
+  struct host_pollfd pfd;
+
+  /* Once input has ended (piped script) never report a character. */
+  if (InputEnd)
+    return 0;
+
+  pfd.fd = STDIN;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  if ((syscall3(SYS_POLL, (uintptr_t)&pfd, 1, 0) > 0) && pfd.revents)
+    return 1;
+  return 0;
+}
+
+/*...................................................................*/
+/*   Uart0Getc: Receive one character from the terminal              */
+/*                                                                   */
+/*     Returns: character received, carriage return for new line     */
+/*...................................................................*/
+char Uart0Getc(void)
+{
+  char character;
+
+  /* Loop until a character is available. */
+  while (!Uart0RxCheck())
+    if (InputEnd)
+      return '\r';
+
+  /* End the input on end of file or error. */
+  if (HostRead(STDIN, &character, 1) != 1)
+  {
+    InputEnd = TRUE;
+    return '\r';
+  }
+
+  /* The shell expects a carriage return to end commands. */
+  if (character == '\n')
+    character = '\r';
+  return character;
+}
+
+/*...................................................................*/
+/*  Uart0Flush: Flush all output                                     */
+/*...................................................................*/
+void Uart0Flush(void)
+{
+}
@@ -0,0 +1,105 @@
+/*...................................................................*/
+/*                                                                   */
+/*   Module:  board.h                                                */
+/*   Version: 2020.0                                                 */
+/*   Purpose: header declarations for Linux host board               */
+/*                                                                   */
+/*...................................................................*/
+/*                                                                   */
+/*                   Copyright 2020, Sean Lawless                    */
+/*                                                                   */
+/*                      ALL RIGHTS RESERVED                          */
+/*                                                                   */
+/* Redistribution and use in source, binary or derived forms, with   */
+/* or without modification, are permitted provided that the          */
+/* following conditions are met:                                     */
+/*                                                                   */
+/*  1. Redistributions in any form, including but not limited to     */
+/*     source code, binary, or derived works, must include the above */
+/*     copyright notice, this list of conditions and the following   */
+/*     disclaimer.                                                   */
+/*                                                                   */
+/*  2. Any change or addition to this copyright notice requires the  */
+/*     prior written permission of the above copyright holder.       */
+/*                                                                   */
+/* THIS SOFTWARE IS PROVIDED ''AS IS''. ANY EXPRESS OR IMPLIED       */
+/* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES */
+/* OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE       */
+/* DISCLAIMED. IN NO EVENT SHALL ANY AUTHOR AND/OR COPYRIGHT HOLDER  */
+/* BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,          */
+/* EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED   */
+/* TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,     */
+/* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON */
+/* ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,   */
+/* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY    */
+/* OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE           */
+/* POSSIBILITY OF SUCH DAMAGE.                                       */
+/*...................................................................*/
+#include <system.h>
+
+/*...................................................................*/
+/* Symbol Definitions                                                */
+/*...................................................................*/
+/*
+ * The host board runs the network stack as a Linux process for
+ * benchmarking. There are no peripheral registers, the UART is the
+ * terminal (stdin/stdout) and the Ethernet device is a TAP interface.
+*/
+#define T1_CLOCK_SECOND MICROS_PER_SECOND /* host time is microseconds */
+
+// If memory allocation calculate heap start and size
+#if ENABLE_MALLOC
+
+#define MEGABYTE    0x100000
+#define KERNEL_MAX_SIZE   (2 * MEGABYTE) // download (run) image size
+
+/* the heap is a static array in the process image */
+#define MEM_SIZE          (8 * MEGABYTE)
+#define MEM_HEAP_START    HeapBase()
+
+uintptr_t HeapBase(void);
+
+#endif /* ENABLE_MALLOC */
+
+/* persistent memory is read from a file at start and written back by
+   SystemReboot(), standing in for the RAM a warm reboot keeps */
+#define MEM_PERSIST_START PersistBase()
+#define MEM_PERSIST_SIZE  0x1000
+
+uintptr_t PersistBase(void);
+
+/* Data memory barrier, a full fence of the host processor */
+#define DataMemoryBarrier() __sync_synchronize()
+
+/*
+ * Boot Loader interface, exits the process
+*/
+void SystemReboot(void);
+void _branch_to_boot(void);
+void _branch_to_run(void);
+u32  _run_size(void);
+extern uintptr_t _run_location(void);
+
+/*
+ * UART0 interface, the process terminal
+*/
+void Uart0Putc(char character);
+void Uart0Puts(const char *string);
+u32  Uart0RxCheck(void);
+char Uart0Getc(void);
+void Uart0Flush(void);
+
+/*
+ * Property interfaces
+*/
+u32 GetArmClockRate(void);
+
+/*
+ * Linux system calls
+*/
+int  HostRead(int fd, void *buffer, u32 length);
+int  HostWrite(int fd, const void *buffer, u32 length);
+int  HostOpen(const char *path, int flags);
+int  HostIoctl(int fd, u32 request, void *argument);
+void HostExit(int status);
+extern int HostInstance;
@@ -0,0 +1,324 @@
+/*...................................................................*/
+/*                                                                   */
+/*   Module:  tap.c                                                  */
+/*   Version: 2020.0                                                 */
+/*   Purpose: Linux TAP interface as the host Ethernet device        */
+/*                                                                   */
+/*...................................................................*/
+/*                                                                   */
+/*                   Copyright 2020, Sean Lawless                    */
+/*                                                                   */
+/*                      ALL RIGHTS RESERVED                          */
+/*                                                                   */
+/* Redistribution and use in source, binary or derived forms, with   */
+/* or without modification, are permitted provided that the          */
+/* following conditions are met:                                     */
+/*                                                                   */
+/*  1. Redistributions in any form, including but not limited to     */
+/*     source code, binary, or derived works, must include the above */
+/*     copyright notice, this list of conditions and the following   */
+/*     disclaimer.                                                   */
+/*                                                                   */
+/*  2. Any change or addition to this copyright notice requires the  */
+/*     prior written permission of the above copyright holder.       */
+/*                                                                   */
+/* THIS SOFTWARE IS PROVIDED ''AS IS''. ANY EXPRESS OR IMPLIED       */
+/* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES */
+/* OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE       */
+/* DISCLAIMED. IN NO EVENT SHALL ANY AUTHOR AND/OR COPYRIGHT HOLDER  */
+/* BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,          */
+/* EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED   */
+/* TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,     */
+/* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON */
+/* ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,   */
+/* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY    */
+/* OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE           */
+/* POSSIBILITY OF SUCH DAMAGE.                                       */
+/*...................................................................*/
+#include <board.h>
+#include <stdio.h>
+#include <string.h>
+
+#if ENABLE_ETHER
+
+/*...................................................................*/
+/* Configuration                                                     */
+/*...................................................................*/
+#ifndef TAP_DEVICE_NAME
+#define TAP_DEVICE_NAME   "tap%d" /* with the host instance number */
+#endif
+#define TAP_TASK_PRIORITY 3    /* just below the network task */
+
+/*...................................................................*/
+/* Symbol Definitions                                                */
+/*...................................................................*/
+#define O_RDWR            0x0002
+#define O_NONBLOCK        0x0800
+
+#define TUNSETIFF         0x400454CA
+#define   IFF_TAP           0x0002
+#define   IFF_NO_PI         0x1000
+
+#define FRAME_BUFFER_SIZE 1600
+
+/*...................................................................*/
+/* Type Definitions                                                  */
+/*...................................................................*/
+struct host_ifreq
+{
+  char name[16];
+  u16  flags;
+  u8   pad[22];
+};
+
+typedef struct
+{
+  int fd;
+  u8 address[6];
+
+  // Transmit frame, written synchronously on send
+  u32 txLength;
+  u32 txFrames, txTransfers, txDropped;
+  u8 txBuffer[FRAME_BUFFER_SIZE];
+} TapDevice;
+
+/*...................................................................*/
+/* Global Variables                                                  */
+/*...................................................................*/
+static TapDevice Tap0 =
+{
+  .fd = -1,
+  // Locally administered unicast address
+  .address = { 0x02, 0x00, 0x00, 0x4C, 0x57, 0x50 },
+};
+static int TapTaskUp = FALSE;
+
+/*...................................................................*/
+/* Local Functions                                                   */
+/*...................................................................*/
+
+/*...................................................................*/
+/*   tap_open: Open and attach to the TAP interface if not yet open  */
+/*                                                                   */
+/*    Returns: Zero on success, failure otherwise                    */
+/*...................................................................*/
+static int tap_open(TapDevice *tap)
+{
+  struct host_ifreq ifr;
+
+  if (tap->fd >= 0)
+    return 0;
+
+  tap->fd = HostOpen("/dev/net/tun", O_RDWR | O_NONBLOCK);
+  if (tap->fd < 0)
+  {
+    printf("Cannot open /dev/net/tun (error %d)\n", -tap->fd);
+    return -1;
+  }
+
+  // Attach to the TAP interface, raw Ethernet frames without header
+  bzero(&ifr, sizeof(ifr));
+  sprintf(ifr.name, TAP_DEVICE_NAME, HostInstance);
+  ifr.flags = IFF_TAP | IFF_NO_PI;
+  if (HostIoctl(tap->fd, TUNSETIFF, &ifr) < 0)
+  {
+    printf("Cannot attach to %s, create it with 'ip tuntap add'\n",
+           ifr.name);
+    tap->fd = -1;
+    return -1;
+  }
+
+  // Each instance has its own locally administered address
+  tap->address[5] += HostInstance;
+  return 0;
+}
+
+/*...................................................................*/
+/*   tap_poll: Receive all frames pending on the TAP interface       */
+/*                                                                   */
+/*      Input: data is a void pointer to the TAP device              */
+/*                                                                   */
+/*    Returns: TASK_IDLE                                             */
+/*...................................................................*/
+static int tap_poll(void *data)
+{
+  TapDevice *tap = data;
+  u8 *buffer;
+  int frameLength;
+  u64 start = TimerNow();
+
+  // Read directly into the network RX ring until empty or ring full
+  for (buffer = NetRxSlot(); buffer; buffer = NetRxSlot())
+  {
+    frameLength = HostRead(tap->fd, buffer, FRAME_BUFFER_SIZE);
+    if (frameLength <= 0)
+      break;
+
+    // Queue the frame for the network task, no checksum offload
+    NetRxPush(buffer, frameLength, 0);
+  }
+  NetCpu.driver += (u32)(TimerNow() - start);
+  return TASK_IDLE;
+}
+
+/*...................................................................*/
+/* Global functions                                                  */
+/*...................................................................*/
+
+/*...................................................................*/
+/* LanReceiveAsync: Start receiving frames from the TAP interface    */
+/*                                                                   */
+/*    Returns: Zero on success, failure otherwise                    */
+/*...................................................................*/
+int LanReceiveAsync(void)
+{
+  if (tap_open(&Tap0))
+    return -1;
+
+  // Poll the TAP interface from a task, the host has no interrupts
+  if (!TapTaskUp)
+  {
+    if (TaskNew(TAP_TASK_PRIORITY, tap_poll, &Tap0) == NULL)
+      return -1;
+    TapTaskUp = TRUE;
+  }
+  return 0;
+}
+
+/*...................................................................*/
+/* LanReceiveResume: Nothing to resume, the receive task re-polls    */
+/*...................................................................*/
+void LanReceiveResume(void)
+{
+}
+
+/*...................................................................*/
+/* LanDeviceFrameAlloc: Reserve space for a frame to transmit        */
+/*                                                                   */
+/*      Input: length is the length of the frame                     */
+/*                                                                   */
+/*    Returns: Pointer to write the frame to or NULL if too long     */
+/*...................................................................*/
+void *LanDeviceFrameAlloc(u32 length)
+{
+  TapDevice *tap = &Tap0;
+
+  if (length > FRAME_BUFFER_SIZE)
+  {
+    ++tap->txDropped;
+    return NULL;
+  }
+  tap->txLength = length;
+  return tap->txBuffer;
+}
+
+/*...................................................................*/
+/* LanDeviceFrameSend: Send frame written after LanDeviceFrameAlloc  */
+/*                                                                   */
+/*    Returns: TRUE on success, FALSE if failure                     */
+/*...................................................................*/
+int LanDeviceFrameSend(void)
+{
+  TapDevice *tap = &Tap0;
+  u32 length = tap->txLength;
+
+  if ((length == 0) || (tap->fd < 0))
+    return FALSE;
+
+  tap->txLength = 0;
+  if (HostWrite(tap->fd, tap->txBuffer, length) != length)
+  {
+    ++tap->txDropped;
+    return FALSE;
+  }
+  ++tap->txFrames;
+  ++tap->txTransfers;
+  return TRUE;
+}
+
+/*...................................................................*/
+/* LanDeviceTxResume: Nothing to resume, frames are written directly */
+/*...................................................................*/
+void LanDeviceTxResume(void)
+{
+}
+
+/*...................................................................*/
+/* LanDeviceTxPending: Number of frames not yet completed            */
+/*                                                                   */
+/*    Returns: Zero (0) as TAP writes complete synchronously         */
+/*...................................................................*/
+int LanDeviceTxPending(void)
+{
+  return 0;
+}
+
+/*...................................................................*/
+/* LanDeviceTxStats: Retrieve the TX statistics                      */
+/*                                                                   */
+/*     Output: frames is the number of frames completed              */
+/*             transfers is the number of writes to the TAP          */
+/*             dropped is the number of frames dropped               */
+/*...................................................................*/
+void LanDeviceTxStats(u32 *frames, u32 *transfers, u32 *dropped)
+{
+  *frames = Tap0.txFrames;
+  *transfers = Tap0.txTransfers;
+  *dropped = Tap0.txDropped;
+}
+
+/*...................................................................*/
+/* LanChecksumOffload: Enable or disable the checksum offload        */
+/*                                                                   */
+/*      Input: enable is TRUE to offload checksums, FALSE otherwise  */
+/*                                                                   */
+/*    Returns: FALSE as TAP checksums are computed by software       */
+/*...................................................................*/
+int LanChecksumOffload(int enable)
+{
+  return FALSE;
+}
+
+/*...................................................................*/
+/* LanChecksumStats: Retrieve the checksum offload statistics        */
+/*                                                                   */
+/*     Output: rx and tx are always zero, no offload supported       */
+/*...................................................................*/
+void LanChecksumStats(u32 *rx, u32 *tx)
+{
+  *rx = *tx = 0;
+}
+
+/*...................................................................*/
+/* LanDeviceSendFrame: Send an Ethernet frame over network           */
+/*                                                                   */
+/*      Input: buffer is the buffer of the network frame             */
+/*             length is the length of the buffer                    */
+/*                                                                   */
+/*    Returns: TRUE on success, FALSE if failure                     */
+/*...................................................................*/
+int LanDeviceSendFrame(const void *buffer, u32 length)
+{
+  void *frame;
+
+  frame = LanDeviceFrameAlloc(length);
+  if (frame == NULL)
+    return FALSE;
+
+  memcpy(frame, buffer, length);
+  return LanDeviceFrameSend();
+}
+
+/*...................................................................*/
+/*  LanGetMAC: Retrieve pointer to unmodifiable MAC address          */
+/*                                                                   */
+/*    Returns: Constant (unmodifiable) pointer to the MAC Id         */
+/*...................................................................*/
+const u8 *LanGetMAC(void)
+{
+  if (tap_open(&Tap0))
+    return NULL;
+  return Tap0.address;
+}
+
+#endif /* ENABLE_ETHER */
@@ -957,7 +957,7 @@ static void process_channel_interrupt(Host *host, u32 channel)
       if (status & HC_INT_ERROR_MASK)
       {
         printf("No split Transaction failed (status 0x%X)\n", status);
-        urb->status = status;
+        urb->status = 0;
       }
       else if ((status & (HC_INT_NAK | HC_INT_NYET))
          && TransferStageDataIsPeriodic(stageData))
@@ -984,7 +984,10 @@ static void process_channel_interrupt(Host *host, u32 channel)
       host->stageData[channel] = 0;
       free_channel(host, channel);
 
-      if (!(status & HC_INT_ERROR_MASK))
+      // Complete bulk and interrupt transfers also on error so the
+      // driver reclaims the URB, failed control stages stop here
+      if (!(status & HC_INT_ERROR_MASK) ||
+          (urb->endpoint->type != EndpointTypeControl))
         RequestCallCompletionRoutine(urb);
       break;
 
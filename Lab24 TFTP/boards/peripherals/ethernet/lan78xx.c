@@ -47,6 +47,8 @@
 /* Configuration                                                     */
 /*...................................................................*/
 #define STATIC_MAC_ADDRESS FALSE
+#define TX_RING_SIZE       4    /* TX buffers, one more than in flight */
+#define TX_BUFFER_SIZE     4096 /* bytes of aggregated TX frames */
 
 // This driver has been written based on FreeBSD lan78xx driver
 //  Copyright (C) 2015 Microchip Technology
@@ -155,11 +157,25 @@
 #define   PFILTER_HI_TYPE_DST (0 << 0)
 
 // TX command A
+#define TX_CMD_A_IPE        0x04000000 // insert IPv4 header checksum
+#define TX_CMD_A_TPE        0x02000000 // insert TCP/UDP checksum
 #define TX_CMD_A_FCS        0x00400000
 #define TX_CMD_A_LEN_MASK     0x000FFFFF
 
+// TX frames are aligned to 32 bits within an aggregated transfer
+#define TX_FRAME_ALIGN(len) (((len) + 3) & ~3)
+
 // RX command A
+#define RX_CMD_A_ICE        0x80000000 // IP header checksum error
+#define RX_CMD_A_TCE        0x40000000 // TCP/UDP checksum error
+#define RX_CMD_A_IPV        0x20000000 // IPv6 frame
+#define RX_CMD_A_PID_MASK   0x18000000 // protocol identifier
+#define   RX_CMD_A_PID_TCP    0x08000000
+#define   RX_CMD_A_PID_UDP    0x10000000
+#define   RX_CMD_A_PID_IP     0x18000000
+#define RX_CMD_A_FVTG       0x00800000 // frame VLAN tagged
 #define RX_CMD_A_RED        0x00400000
+#define RX_CMD_A_ICSM       0x00004000 // checksum not calculated
 #define RX_CMD_A_LEN_MASK     0x00003FFF
 
 // Lan78xx configuration state machine
@@ -201,6 +217,17 @@
 /*...................................................................*/
 /* Type Definitions                                                  */
 /*...................................................................*/
+// One bulk out transfer of one or more aggregated Ethernet frames
+typedef struct TxBuffer
+{
+  u32 length;   // bytes used, including TX command headers
+  u32 frames;   // number of frames aggregated in the buffer
+  u32 last;     // offset of the TX command of the last frame
+  int busy;     // TRUE while submitted to the host controller
+  u8 buffer[TX_BUFFER_SIZE];
+}
+TxBuffer;
+
 typedef struct Lan78xxDevice
 {
   Device device;
@@ -211,12 +238,23 @@ typedef struct Lan78xxDevice
   int configurationState;
   u8 address[MAC_ADDRESS_SIZE];
 
-  u8 *txBuffer;
   u8 *rxBuffer;
   Request *rxURB;
-  u8 TxBuffer[FRAME_BUFFER_SIZE];
+  int rxHeld;   // TRUE if URB not resubmitted as the RX ring is full
   u8 RxBuffer[FRAME_BUFFER_SIZE];
 
+  // TX ring, frames are added to txHead until it is submitted
+  TxBuffer tx[TX_RING_SIZE];
+  u32 txHead;
+  u32 txInFlight;
+  u32 txFrames;     // frames completed
+  u32 txTransfers;  // bulk out transfers completed
+  u32 txDropped;    // frames dropped as TX ring was full
+
+  // Checksum offload, hardware verified RX and inserted TX frames
+  int checksum;
+  u32 rxChecksummed;
+  u32 txChecksummed;
 }
 Lan78xxDevice;
 
@@ -225,7 +263,8 @@ Lan78xxDevice;
 /*...................................................................*/
 #if ENABLE_NETWORK
 int NetStart(char *command);
-int NetIn(u8 *frame, int frameLength);
+u8 *NetRxSlot(void);
+void NetRxPush(u8 *frame, int frameLength, u32 checksum);
 #endif
 Lan78xxDevice EtherDevice;
 Lan78xxDevice *Eth0 = NULL;
@@ -233,6 +272,7 @@ Lan78xxDevice *Eth0 = NULL;
 /*...................................................................*/
 /* Static local functions                                            */
 /*...................................................................*/
+static int send_buffer(Lan78xxDevice *lan);
 
 /*...................................................................*/
 /*  write_reg: Write data to a LAN register as USB request           */
@@ -404,8 +444,10 @@ static void configure_complete(void *urb, void *param, void *context)
   }
   else if (lan->configurationState == STATE_WRITE_RFE_CTL)
   {
-    // Enable broadcast and perfect filter
-    reg |= RFE_CTL_BCAST_EN | RFE_CTL_DA_PERFECT;
+    // Enable broadcast, all multicast (lwIP filters the groups joined),
+    // perfect filter and RX checksum offload
+    reg |= RFE_CTL_BCAST_EN | RFE_CTL_MCAST_EN | RFE_CTL_DA_PERFECT;
+    reg |= RFE_CTL_TCPUDP_COE | RFE_CTL_IP_COE;
     write_reg(lan, RFE_CTL, reg, configure_complete);
   }
   else if (lan->configurationState == STATE_PHY_RESET)
@@ -624,6 +666,38 @@ int configure(Device *device, void (complete)
   return TRUE;
 }
 
+static void receive_complete(void *request, void *param, void *context);
+
+/*...................................................................*/
+/* receive_submit: Submit the bulk in URB to receive the next frame  */
+/*                                                                   */
+/*      Input: lan is the USB device                                 */
+/*                                                                   */
+/*    Returns: Zero on success, failure if held as RX ring is full   */
+/*...................................................................*/
+static int receive_submit(Lan78xxDevice *lan)
+{
+#if ENABLE_NETWORK
+  // Receive directly into the next free RX ring slot, or hold the URB
+  // until the network task frees one (backpressure)
+  lan->rxBuffer = NetRxSlot();
+  if (lan->rxBuffer == NULL)
+  {
+    lan->rxHeld = TRUE;
+    return -1;
+  }
+#else
+  lan->rxBuffer = lan->RxBuffer;
+#endif
+  lan->rxHeld = FALSE;
+
+  RequestAttach(lan->rxURB, &lan->endpointBulkIn, lan->rxBuffer,
+                FRAME_BUFFER_SIZE, 0);
+  RequestSetCompletionRoutine(lan->rxURB, receive_complete, lan, NULL);
+  HostSubmitAsyncRequest(lan->rxURB, lan->device.host, NULL);
+  return 0;
+}
+
 /*...................................................................*/
 /* receive_complete: Callback for Rx inbound Ethernet frame          */
 /*                                                                   */
@@ -634,9 +708,12 @@ int configure(Device *device, void (complete)
 static void receive_complete(void *request, void *param, void *context)
 {
   Request *urb = request;
-  u32 resultLength, rxStatus, frameLength;
+  u32 resultLength, rxStatus, frameLength, checksum = 0;
   Lan78xxDevice *lan = param;
   u8 *buffer;
+#if ENABLE_NETWORK
+  u64 start = TimerNow();
+#endif
 
   assert (lan != 0);
   assert (urb != 0);
@@ -661,26 +738,108 @@ static void receive_complete(void *request, void *param, void *context)
 //  putbyte(frameLength); puts(" IN frame bytes");
 
 #if ENABLE_NETWORK
+  // Pass the checksum verdict only if hardware checked an untagged
+  // IPv4 TCP or UDP frame, error frames are verified again by software
+  if (lan->checksum && !(rxStatus & (RX_CMD_A_ICSM | RX_CMD_A_FVTG |
+      RX_CMD_A_IPV | RX_CMD_A_ICE | RX_CMD_A_TCE)))
+  {
+    if ((rxStatus & RX_CMD_A_PID_MASK) == RX_CMD_A_PID_IP)
+      checksum = NET_CHECKSUM_IP;
+    else if ((rxStatus & RX_CMD_A_PID_MASK) != 0)
+      checksum = NET_CHECKSUM_IP | NET_CHECKSUM_L4;
+    if (checksum)
+      ++lan->rxChecksummed;
+  }
+
   // Remove RX status, empty VLAN and padding from the frame
   frameLength -= 4;
   buffer += 10;
 
-  // Inform the network stack of the new frame
-  NetIn(buffer, frameLength);
+  // Queue the frame for the network task
+  NetRxPush(buffer, frameLength, checksum);
 #endif /* ENABLE_NETWORK */
 
 finished:
 
   //Reuse urb and start another async request
   RequestRelease(urb);
-  RequestAttach(urb, &lan->endpointBulkIn, lan->rxBuffer,
-                FRAME_BUFFER_SIZE, 0);
+  receive_submit(lan);
+#if ENABLE_NETWORK
+  NetCpu.driver += (u32)(TimerNow() - start);
+#endif
+}
 
-  //Register the callback and submit the request asynchronously
-  RequestSetCompletionRoutine(urb, receive_complete, lan, NULL);
-  HostSubmitAsyncRequest(urb, lan->device.host, NULL);
+/*...................................................................*/
+/* send_complete: Callback for bulk out TX buffer completion         */
+/*                                                                   */
+/*      Input: request is the USB request or URB                     */
+/*             param is a void pointer to the LAN USB device         */
+/*             context is the TX buffer that was sent                */
+/*...................................................................*/
+static void send_complete(void *request, void *param, void *context)
+{
+  Request *urb = request;
+  Lan78xxDevice *lan = param;
+  TxBuffer *tx = context;
+#if ENABLE_NETWORK
+  u64 start = TimerNow();
+#endif
+
+  assert(lan != 0);
+  assert(tx != 0);
+
+  // Reclaim the TX buffer, counting frames of a failed transfer as
+  // dropped
+  if (urb->status)
+  {
+    lan->txFrames += tx->frames;
+    ++lan->txTransfers;
+  }
+  else
+    lan->txDropped += tx->frames;
+  RequestRelease(urb);
+  FreeRequest(urb);
+
+  --lan->txInFlight;
+  tx->length = tx->frames = 0;
+  tx->busy = FALSE;
+
+  // Submit any frames aggregated while the TX ring was full
+  if (lan->tx[lan->txHead].frames)
+    send_buffer(lan);
+#if ENABLE_NETWORK
+  NetCpu.driver += (u32)(TimerNow() - start);
+#endif
+}
+
+/*...................................................................*/
+/* send_buffer: Submit the TX ring head to the bulk out endpoint     */
+/*                                                                   */
+/*      Input: lan is the USB device                                 */
+/*                                                                   */
+/*    Returns: Zero on success, failure otherwise                    */
+/*...................................................................*/
+static int send_buffer(Lan78xxDevice *lan)
+{
+  TxBuffer *tx = &lan->tx[lan->txHead];
+  Request *urb;
 
-  return;
+  assert(tx->busy == FALSE);
+
+  // If no URB available leave frames queued until next completion,
+  // or until LanDeviceTxResume() from the network task
+  urb = NewRequest();
+  if (urb == NULL)
+    return -1;
+
+  tx->busy = TRUE;
+  ++lan->txInFlight;
+  lan->txHead = (lan->txHead + 1) % TX_RING_SIZE;
+
+  RequestAttach(urb, &lan->endpointBulkOut, tx->buffer, tx->length, 0);
+  RequestSetCompletionRoutine(urb, send_complete, lan, tx);
+  HostSubmitAsyncRequest(urb, lan->device.host, NULL);
+  return 0;
 }
 
 /*...................................................................*/
@@ -707,44 +866,201 @@ int LanReceiveAsync(void)
   assert(lan->rxURB != 0);
   bzero(lan->rxURB, sizeof(Request));
 
-  lan->rxBuffer = lan->RxBuffer;
-
   // Create and submit request to the bulk in endpoint
-  RequestAttach(lan->rxURB, &lan->endpointBulkIn, lan->rxBuffer,
-                FRAME_BUFFER_SIZE, 0);
-  RequestSetCompletionRoutine(lan->rxURB, receive_complete, lan, NULL);
-  HostSubmitAsyncRequest(lan->rxURB, lan->device.host, NULL);
+  receive_submit(lan);
   return 0;
 }
 
 /*...................................................................*/
-/* LanDeviceSendFrame: Send an Ethernet frame over network           */
+/* LanReceiveResume: Resubmit the receive URB if held by ring full   */
+/*...................................................................*/
+void LanReceiveResume(void)
+{
+  Lan78xxDevice *lan = Eth0;
+
+  if (lan && lan->rxHeld)
+    receive_submit(lan);
+}
+
+/*...................................................................*/
+/* LanDeviceFrameAlloc: Reserve space for a frame in the TX ring     */
 /*                                                                   */
-/*      Input: buffer is the buffer of the network frame             */
-/*             length is the length of the buffer                    */
+/*      Input: length is the length of the frame                     */
 /*                                                                   */
-/*    Returns: Zero on success, failure otherwise                    */
+/*    Returns: Pointer to write the frame to or NULL if ring full    */
 /*...................................................................*/
-int LanDeviceSendFrame(const void *buffer, u32 length)
+void *LanDeviceFrameAlloc(u32 length)
 {
-  Lan78xxDevice *lan = Eth0;;
+  Lan78xxDevice *lan = Eth0;
+  TxBuffer *tx;
+  u32 offset;
+
   assert(lan != 0);
 
   if (length > FRAME_BUFFER_SIZE - TX_HEADER_SIZE)
+    return NULL;
+
+  // Append after the last frame, or drop if no room in the TX ring
+  tx = &lan->tx[lan->txHead];
+  offset = TX_FRAME_ALIGN(tx->length);
+  if (tx->busy || (offset + TX_HEADER_SIZE + length > TX_BUFFER_SIZE))
   {
-    return FALSE;
+    ++lan->txDropped;
+    return NULL;
+  }
+
+  // Assign the TX command header for this frame
+  *(u32 *)&tx->buffer[offset] = (length & TX_CMD_A_LEN_MASK) |
+                                TX_CMD_A_FCS;
+  *(u32 *)&tx->buffer[offset + 4] = 0;
+
+  tx->last = offset;
+  tx->length = offset + TX_HEADER_SIZE + length;
+  ++tx->frames;
+  return &tx->buffer[offset + TX_HEADER_SIZE];
+}
+
+/*...................................................................*/
+/* LanDeviceFrameSend: Send frames written after LanDeviceFrameAlloc */
+/*                                                                   */
+/*    Returns: TRUE on success, FALSE if failure                     */
+/*...................................................................*/
+int LanDeviceFrameSend(void)
+{
+  Lan78xxDevice *lan = Eth0;
+  TxBuffer *tx;
+  u8 *frame;
+
+  assert(lan != 0);
+
+  // Request checksum insertion now that the frame is written. The
+  // hardware cannot checksum the payload of an IPv4 fragment.
+  tx = &lan->tx[lan->txHead];
+  frame = &tx->buffer[tx->last + TX_HEADER_SIZE];
+  if (lan->checksum && (frame[12] == 0x08) && (frame[13] == 0x00))
+  {
+    *(u32 *)&tx->buffer[tx->last] |= TX_CMD_A_IPE;
+    if (((frame[23] == 6) || (frame[23] == 17)) &&
+        !(((frame[20] << 8) | frame[21]) & 0x3FFF))
+      *(u32 *)&tx->buffer[tx->last] |= TX_CMD_A_TPE;
+    ++lan->txChecksummed;
   }
 
-  assert(lan->txBuffer != 0);
+  // Submit now if the TX ring has room, otherwise the frame remains
+  // in txHead, aggregated with later frames until a TX completes
+  if (lan->txInFlight < TX_RING_SIZE - 1)
+    send_buffer(lan);
+  return TRUE;
+}
+
+/*...................................................................*/
+/* LanDeviceTxResume: Submit frames left in the TX ring head         */
+/*...................................................................*/
+void LanDeviceTxResume(void)
+{
+  Lan78xxDevice *lan = Eth0;
+
+  // Frames remain if no URB was available when they were queued
+  if (lan && lan->tx[lan->txHead].frames &&
+      !lan->tx[lan->txHead].busy && (lan->txInFlight < TX_RING_SIZE - 1))
+    send_buffer(lan);
+}
+
+/*...................................................................*/
+/* LanDeviceTxPending: Number of frames not yet completed            */
+/*                                                                   */
+/*    Returns: The number of frames in the TX ring                   */
+/*...................................................................*/
+int LanDeviceTxPending(void)
+{
+  Lan78xxDevice *lan = Eth0;
+  int i, frames = 0;
+
+  if (lan == NULL)
+    return 0;
+
+  for (i = 0; i < TX_RING_SIZE; ++i)
+    frames += lan->tx[i].frames;
+  return frames;
+}
+
+/*...................................................................*/
+/* LanDeviceTxStats: Retrieve the TX ring statistics                 */
+/*                                                                   */
+/*     Output: frames is the number of frames completed              */
+/*             transfers is the number of bulk out transfers         */
+/*             dropped is the number of frames dropped or failed     */
+/*...................................................................*/
+void LanDeviceTxStats(u32 *frames, u32 *transfers, u32 *dropped)
+{
+  Lan78xxDevice *lan = Eth0;
+
+  *frames = *transfers = *dropped = 0;
+  if (lan == NULL)
+    return;
+
+  *frames = lan->txFrames;
+  *transfers = lan->txTransfers;
+  *dropped = lan->txDropped;
+}
+
+/*...................................................................*/
+/* LanChecksumOffload: Enable or disable the checksum offload        */
+/*                                                                   */
+/*      Input: enable is TRUE to offload checksums, FALSE otherwise  */
+/*                                                                   */
+/*    Returns: TRUE if offload supported, FALSE if not               */
+/*...................................................................*/
+int LanChecksumOffload(int enable)
+{
+  Lan78xxDevice *lan = Eth0;
+
+  if (lan == NULL)
+    return FALSE;
+
+  // RX checksum engines stay enabled, only the verdict is ignored
+  lan->checksum = enable;
+  return TRUE;
+}
+
+/*...................................................................*/
+/* LanChecksumStats: Retrieve the checksum offload statistics        */
+/*                                                                   */
+/*     Output: rx is the number of hardware verified RX frames       */
+/*             tx is the number of hardware checksummed TX frames    */
+/*...................................................................*/
+void LanChecksumStats(u32 *rx, u32 *tx)
+{
+  Lan78xxDevice *lan = Eth0;
+
+  *rx = *tx = 0;
+  if (lan == NULL)
+    return;
+
+  *rx = lan->rxChecksummed;
+  *tx = lan->txChecksummed;
+}
+
+/*...................................................................*/
+/* LanDeviceSendFrame: Send an Ethernet frame over network           */
+/*                                                                   */
+/*      Input: buffer is the buffer of the network frame             */
+/*             length is the length of the buffer                    */
+/*                                                                   */
+/*    Returns: TRUE on success, FALSE if failure                     */
+/*...................................................................*/
+int LanDeviceSendFrame(const void *buffer, u32 length)
+{
+  void *frame;
+
   assert (buffer != 0);
-  memcpy(lan->txBuffer+TX_HEADER_SIZE, buffer, length);
 
-  *(u32 *)&lan->txBuffer[0] = (length & TX_CMD_A_LEN_MASK) |
-                              TX_CMD_A_FCS;
-  *(u32 *)&lan->txBuffer[4] = 0;
+  frame = LanDeviceFrameAlloc(length);
+  if (frame == NULL)
+    return FALSE;
 
-  return HostEndpointTransfer(lan->device.host, &lan->endpointBulkOut,
-                    lan->txBuffer, length + TX_HEADER_SIZE, NULL) >= 0;
+  memcpy(frame, buffer, length);
+  return LanDeviceFrameSend();
 }
 
 /*...................................................................*/
@@ -781,9 +1097,11 @@ void *LanDeviceAttach(Device *device)
   bzero(&lan->endpointBulkIn, sizeof(Endpoint));
   bzero(&lan->endpointBulkOut, sizeof(Endpoint));
   lan->configurationState = 0;
-  lan->txBuffer = lan->TxBuffer;
 
-  assert(lan->txBuffer != 0);
+  // Initialize the TX ring
+  bzero(lan->tx, sizeof(lan->tx));
+  lan->txHead = lan->txInFlight = 0;
+  lan->txFrames = lan->txTransfers = lan->txDropped = 0;
   return lan;
 }
 
@@ -798,8 +1116,7 @@ void LanDeviceRelease(Device *device)
 
   assert(lan != 0);
 
-  if (lan->txBuffer != 0)
-    lan->txBuffer = 0;
+  lan->txHead = lan->txInFlight = 0;
 
   if (lan->endpointBulkOut.type)
   {
@@ -51,6 +51,7 @@
 #define STATIC_MAC_ADDRESS FALSE
 #define FRAME_BUFFER_SIZE  1600
 #define MAC_ADDRESS_SIZE   6
+#define TX_RING_SIZE       4    /* TX buffers, one more than in flight */
 
 /*...................................................................*/
 /* Symbol Definitions                                                */
@@ -137,6 +138,16 @@
 #define STATE_TX_CFG         4
 #define STATE_FINISHED       5
 
+// One bulk out transfer of one Ethernet frame
+typedef struct TxBuffer
+{
+  u32 length;   // bytes used, including TX command words
+  u32 frames;   // one if a frame is in the buffer
+  int busy;     // TRUE while submitted to the host controller
+  u8 buffer[FRAME_BUFFER_SIZE];
+}
+TxBuffer;
+
 typedef struct Lan95xxDevice
 {
   Device device;
@@ -148,11 +159,18 @@ typedef struct Lan95xxDevice
 
   int configurationState;
   u8 address[MAC_ADDRESS_SIZE];
-  u8 *txBuffer;
   u8 *rxBuffer;
   Request *rxURB;
-  u8 TxBuffer[FRAME_BUFFER_SIZE];
+  int rxHeld;   // TRUE if URB not resubmitted as the RX ring is full
   u8 RxBuffer[FRAME_BUFFER_SIZE];
+
+  // TX ring, txHead is the next buffer to fill and submit
+  TxBuffer tx[TX_RING_SIZE];
+  u32 txHead;
+  u32 txInFlight;
+  u32 txFrames;     // frames completed
+  u32 txTransfers;  // bulk out transfers completed
+  u32 txDropped;    // frames dropped as TX ring was full
 }
 Lan95xxDevice;
 
@@ -161,7 +179,8 @@ Lan95xxDevice *Eth0 = NULL;
 
 #if ENABLE_NETWORK
 int NetStart(char *command);
-int NetIn(u8 *frame, int frameLength);
+u8 *NetRxSlot(void);
+void NetRxPush(u8 *frame, int frameLength, u32 checksum);
 #endif
 
 /*...................................................................*/
@@ -229,7 +248,8 @@ static void configure_complete(void *urb, void *param, void *context)
               LED_GPIO_CFG_LNK_LED | LED_GPIO_CFG_FDX_LED,
               configure_complete);
   else if (lan->configurationState == STATE_MAC_ENABLE)
-    write_reg(lan, MAC_CSR, MAC_CSR_TXEN | MAC_CSR_RXEN,
+    // Pass all multicast frames, lwIP filters the groups joined
+    write_reg(lan, MAC_CSR, MAC_CSR_TXEN | MAC_CSR_RXEN | MAC_CSR_MCPAS,
               configure_complete);
   else if (lan->configurationState == STATE_TX_CFG)
     write_reg(lan, TX_CFG, TX_CFG_ON, configure_complete);
@@ -366,6 +386,39 @@ static int configure(Device *device, void (complete)
   return TRUE;
 }
 
+static void receive_complete(void *request, void *param,
+                                  void *context);
+
+/*...................................................................*/
+/* receive_submit: Submit the bulk in URB to receive the next frame  */
+/*                                                                   */
+/*      Input: lan is the USB device                                 */
+/*                                                                   */
+/*    Returns: Zero on success, failure if held as RX ring is full   */
+/*...................................................................*/
+static int receive_submit(Lan95xxDevice *lan)
+{
+#if ENABLE_NETWORK
+  // Receive directly into the next free RX ring slot, or hold the URB
+  // until the network task frees one (backpressure)
+  lan->rxBuffer = NetRxSlot();
+  if (lan->rxBuffer == NULL)
+  {
+    lan->rxHeld = TRUE;
+    return -1;
+  }
+#else
+  lan->rxBuffer = lan->RxBuffer;
+#endif
+  lan->rxHeld = FALSE;
+
+  RequestAttach(lan->rxURB, lan->endpointBulkIn, lan->rxBuffer,
+                FRAME_BUFFER_SIZE, 0);
+  RequestSetCompletionRoutine(lan->rxURB, receive_complete, lan, NULL);
+  HostSubmitAsyncRequest(lan->rxURB, lan->device.host, NULL);
+  return 0;
+}
+
 static void receive_complete(void *request, void *param,
                                   void *context)
 {
@@ -373,6 +426,9 @@ static void receive_complete(void *request, void *param,
   u32 resultLength, rxStatus, frameLength;
   Lan95xxDevice *lan = (Lan95xxDevice *)param;
   u8 *buffer;
+#if ENABLE_NETWORK
+  u64 start = TimerNow();
+#endif
 
   assert (lan != 0);
   assert (urb != 0);
@@ -398,20 +454,57 @@ static void receive_complete(void *request, void *param,
   frameLength -= 4;
   buffer += 4;
 
-  // Inform the network stack of the new frame
-  NetIn(buffer, frameLength);
+  // Queue the frame for the network task, no checksum offload
+  NetRxPush(buffer, frameLength, 0);
 #endif /* ENABLE_NETWORK */
 
 finished:
 
   //Reuse urb and start another async request
   RequestRelease(urb);
-  RequestAttach(urb, lan->endpointBulkIn, lan->rxBuffer,
-                FRAME_BUFFER_SIZE, 0);
+  receive_submit(lan);
+#if ENABLE_NETWORK
+  NetCpu.driver += (u32)(TimerNow() - start);
+#endif
+}
 
-  //Register the callback and submit the request asynchronously
-  RequestSetCompletionRoutine(urb, receive_complete, lan, NULL);
-  HostSubmitAsyncRequest(urb, lan->device.host, NULL);
+/*...................................................................*/
+/* send_complete: Callback for bulk out TX buffer completion         */
+/*                                                                   */
+/*      Input: request is the USB request or URB                     */
+/*             param is a void pointer to the LAN USB device         */
+/*             context is the TX buffer that was sent                */
+/*...................................................................*/
+static void send_complete(void *request, void *param, void *context)
+{
+  Request *urb = request;
+  Lan95xxDevice *lan = param;
+  TxBuffer *tx = context;
+#if ENABLE_NETWORK
+  u64 start = TimerNow();
+#endif
+
+  assert (lan != 0);
+  assert (tx != 0);
+
+  // Reclaim the TX buffer, counting frames of a failed transfer as
+  // dropped
+  if (urb->status)
+  {
+    lan->txFrames += tx->frames;
+    ++lan->txTransfers;
+  }
+  else
+    lan->txDropped += tx->frames;
+  RequestRelease(urb);
+  FreeRequest(urb);
+
+  --lan->txInFlight;
+  tx->length = tx->frames = 0;
+  tx->busy = FALSE;
+#if ENABLE_NETWORK
+  NetCpu.driver += (u32)(TimerNow() - start);
+#endif
 }
 
 /*...................................................................*/
@@ -437,49 +530,174 @@ int LanReceiveAsync(void)
   assert (dev->rxURB != 0);
   bzero(dev->rxURB, sizeof(Request));
 
-  dev->rxBuffer = dev->RxBuffer;
-
-  u32 buf = (u32)dev->rxBuffer;
-  putbyte(buf); putbyte(buf >> 8);
-  putbyte(buf >> 16); putbyte(buf >> 24);
-
   // Create and submit the endpoint request
-  RequestAttach(dev->rxURB, dev->endpointBulkIn, dev->rxBuffer,
-                FRAME_BUFFER_SIZE, 0);
-  RequestSetCompletionRoutine(dev->rxURB, receive_complete, dev, NULL);
-  HostSubmitAsyncRequest(dev->rxURB, dev->device.host, NULL);
+  receive_submit(dev);
   return 0;
 }
 
 /*...................................................................*/
-/* LanDeviceSendFrame: Send an Ethernet frame over network           */
+/* LanReceiveResume: Resubmit the receive URB if held by ring full   */
+/*...................................................................*/
+void LanReceiveResume(void)
+{
+  Lan95xxDevice *lan = Eth0;
+
+  if (lan && lan->rxHeld)
+    receive_submit(lan);
+}
+
+/*...................................................................*/
+/* LanDeviceFrameAlloc: Reserve space for a frame in the TX ring     */
 /*                                                                   */
-/*      Input: buffer is the buffer of the network frame             */
-/*             length is the length of the buffer                    */
+/*      Input: length is the length of the frame                     */
 /*                                                                   */
-/*    Returns: Zero on success, failure otherwise                    */
+/*    Returns: Pointer to write the frame to or NULL if ring full    */
 /*...................................................................*/
-int LanDeviceSendFrame(const void *buffer, u32 length)
+void *LanDeviceFrameAlloc(u32 length)
 {
   Lan95xxDevice *lan = Eth0;
+  TxBuffer *tx;
+
   assert (lan != 0);
 
   if (length >= FRAME_BUFFER_SIZE-8)
+    return NULL;
+
+  // One frame per transfer, drop if the TX ring is full
+  tx = &lan->tx[lan->txHead];
+  if (tx->busy || tx->frames || (lan->txInFlight >= TX_RING_SIZE - 1))
   {
+    ++lan->txDropped;
+    return NULL;
+  }
+
+  *(u32 *)(&tx->buffer[0]) = TX_CTRL_0_FIRST_SEG |
+                             TX_CTRL_0_LAST_SEG | length;
+  *(u32 *)(&tx->buffer[4]) = length;
+  tx->length = length + 8;
+  tx->frames = 1;
+  return &tx->buffer[8];
+}
+
+/*...................................................................*/
+/* LanDeviceFrameSend: Send frames written after LanDeviceFrameAlloc */
+/*                                                                   */
+/*    Returns: TRUE on success, FALSE if failure                     */
+/*...................................................................*/
+int LanDeviceFrameSend(void)
+{
+  Lan95xxDevice *lan = Eth0;
+  TxBuffer *tx;
+  Request *urb;
+
+  assert (lan != 0);
+  assert (lan->endpointBulkOut != 0);
+
+  tx = &lan->tx[lan->txHead];
+  if (tx->frames == 0)
+    return FALSE;
+
+  urb = NewRequest();
+  if (urb == NULL)
+  {
+    tx->length = tx->frames = 0;
+    ++lan->txDropped;
     return FALSE;
   }
 
-  assert(lan->txBuffer != 0);
+  tx->busy = TRUE;
+  ++lan->txInFlight;
+  lan->txHead = (lan->txHead + 1) % TX_RING_SIZE;
+
+  RequestAttach(urb, lan->endpointBulkOut, tx->buffer, tx->length, 0);
+  RequestSetCompletionRoutine(urb, send_complete, lan, tx);
+  HostSubmitAsyncRequest(urb, lan->device.host, NULL);
+  return TRUE;
+}
+
+/*...................................................................*/
+/* LanDeviceTxResume: Nothing to resume, frames without URB dropped  */
+/*...................................................................*/
+void LanDeviceTxResume(void)
+{
+}
+
+/*...................................................................*/
+/* LanDeviceTxPending: Number of frames not yet completed            */
+/*                                                                   */
+/*    Returns: The number of frames in the TX ring                   */
+/*...................................................................*/
+int LanDeviceTxPending(void)
+{
+  Lan95xxDevice *lan = Eth0;
+
+  if (lan == NULL)
+    return 0;
+  return lan->txInFlight;
+}
+
+/*...................................................................*/
+/* LanDeviceTxStats: Retrieve the TX ring statistics                 */
+/*                                                                   */
+/*     Output: frames is the number of frames completed              */
+/*             transfers is the number of bulk out transfers         */
+/*             dropped is the number of frames dropped or failed     */
+/*...................................................................*/
+void LanDeviceTxStats(u32 *frames, u32 *transfers, u32 *dropped)
+{
+  Lan95xxDevice *lan = Eth0;
+
+  *frames = *transfers = *dropped = 0;
+  if (lan == NULL)
+    return;
+
+  *frames = lan->txFrames;
+  *transfers = lan->txTransfers;
+  *dropped = lan->txDropped;
+}
+
+/*...................................................................*/
+/* LanChecksumOffload: Enable or disable the checksum offload        */
+/*                                                                   */
+/*      Input: enable is TRUE to offload checksums, FALSE otherwise  */
+/*                                                                   */
+/*    Returns: FALSE as LAN95xx checksums are computed by software   */
+/*...................................................................*/
+int LanChecksumOffload(int enable)
+{
+  return FALSE;
+}
+
+/*...................................................................*/
+/* LanChecksumStats: Retrieve the checksum offload statistics        */
+/*                                                                   */
+/*     Output: rx and tx are always zero, no offload supported       */
+/*...................................................................*/
+void LanChecksumStats(u32 *rx, u32 *tx)
+{
+  *rx = *tx = 0;
+}
+
+/*...................................................................*/
+/* LanDeviceSendFrame: Send an Ethernet frame over network           */
+/*                                                                   */
+/*      Input: buffer is the buffer of the network frame             */
+/*             length is the length of the buffer                    */
+/*                                                                   */
+/*    Returns: TRUE on success, FALSE if failure                     */
+/*...................................................................*/
+int LanDeviceSendFrame(const void *buffer, u32 length)
+{
+  void *frame;
+
   assert(buffer != 0);
-  memcpy(lan->txBuffer+8, buffer, length);
 
-  *(u32 *)(&lan->txBuffer[0]) = TX_CTRL_0_FIRST_SEG |
-                                TX_CTRL_0_LAST_SEG | length;
-  *(u32 *)(&lan->txBuffer[4]) = length;
+  frame = LanDeviceFrameAlloc(length);
+  if (frame == NULL)
+    return FALSE;
 
-  assert (lan->endpointBulkOut != 0);
-  return HostEndpointTransfer(lan->device.host, lan->endpointBulkOut,
-                              lan->txBuffer, length + 8, NULL) >= 0;
+  memcpy(frame, buffer, length);
+  return LanDeviceFrameSend();
 }
 
 /*...................................................................*/
@@ -513,11 +731,12 @@ void *LanDeviceAttach(Device *device)
 
   lan->endpointBulkIn = 0;
   lan->endpointBulkOut = 0;
-  lan->txBuffer = 0;
   lan->configurationState = 0;
 
-  lan->txBuffer = lan->TxBuffer;
-  assert (lan->txBuffer != 0);
+  // Initialize the TX ring
+  bzero(lan->tx, sizeof(lan->tx));
+  lan->txHead = lan->txInFlight = 0;
+  lan->txFrames = lan->txTransfers = lan->txDropped = 0;
   Eth0 = NULL; // Do not assign until configured
 
   return lan;
@@ -533,8 +752,7 @@ void LanDeviceRelease(Device *device)
   Lan95xxDevice *lan = (void *)device;
   assert (lan != 0);
 
-  if (lan->txBuffer != 0)
-    lan->txBuffer = 0;
+  lan->txHead = lan->txInFlight = 0;
 
   if (lan->endpointBulkOut != 0)
   {
@@ -130,6 +130,12 @@
 
 #endif /* ENABLE_MALLOC */
 
+/* Persistent memory above the bootloader stack (BOOT_STACK_ADDR in
+   define.s), neither loaded nor cleared at boot so that it survives
+   a warm reboot (watchdog reset) */
+#define MEM_PERSIST_START 0x02000000
+#define MEM_PERSIST_SIZE  0x1000
+
 // GPU memory configuration
 #if RPI <= 1
   #define GPU_MEM_BASE  0x40000000 // L2 cache enabled
@@ -137,6 +143,14 @@
   #define GPU_MEM_BASE  0xC0000000 // L2 cache disabled
 #endif
 
+/* Data memory barrier, the ARMv6 (RPi 1) form is a CP15 operation */
+#if defined(__ARM_ARCH) && (__ARM_ARCH >= 7)
+  #define DataMemoryBarrier() asm volatile ("dmb" : : : "memory")
+#else
+  #define DataMemoryBarrier() \
+          asm volatile ("mcr p15, 0, %0, c7, c10, 5" : : "r" (0) : "memory")
+#endif
+
 /*
  * Boot Loader interface
 */
@@ -184,6 +198,7 @@ u32 SetDisplayResolution(u32 *width, u32 *height, u32 *depth,
 int SetUsbPowerStateOn(void);
 int SetUsbPowerStateOff(void);
 int GetMACAddress (u8 buffer[6]);
+u32 GetArmClockRate(void);
 
 /*
  * Framebuffer interface
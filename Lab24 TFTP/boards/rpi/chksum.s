@@ -0,0 +1,223 @@
+/*...................................................................*/
+/*                                                                   */
+/*   Module:  chksum.s                                               */
+/*   Version: 2020.0                                                 */
+/*   Purpose: ARM optimized Internet checksum (RFC 1071) for lwIP    */
+/*                                                                   */
+/*...................................................................*/
+/*                                                                   */
+/*                   Copyright 2020, Sean Lawless                    */
+/*                                                                   */
+/*                      ALL RIGHTS RESERVED                          */
+/*                                                                   */
+/* Redistribution and use in source, binary or derived forms, with   */
+/* or without modification, are permitted provided that the          */
+/* following conditions are met:                                     */
+/*                                                                   */
+/*  1. Redistributions in any form, including but not limited to     */
+/*     source code, binary, or derived works, must include the above */
+/*     copyright notice, this list of conditions and the following   */
+/*     disclaimer.                                                   */
+/*                                                                   */
+/*  2. Any change or addition to this copyright notice requires the  */
+/*     prior written permission of the above copyright holder.       */
+/*                                                                   */
+/* THIS SOFTWARE IS PROVIDED ''AS IS''. ANY EXPRESS OR IMPLIED       */
+/* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES */
+/* OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE       */
+/* DISCLAIMED. IN NO EVENT SHALL ANY AUTHOR AND/OR COPYRIGHT HOLDER  */
+/* BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,          */
+/* EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED   */
+/* TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,     */
+/* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON */
+/* ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,   */
+/* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY    */
+/* OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE           */
+/* POSSIBILITY OF SUCH DAMAGE.                                       */
+/*...................................................................*/
+
+;@ The one's complement sum is accumulated 32 bits at a time, eight
+;@ words per load multiple, with the carry of each add folded back in
+;@ by the next ADCS. Only ARMv4 instructions are used so the same code
+;@ runs on every Raspberry Pi, including the ARM1176 without NEON.
+;@
+;@ Both functions return the same value as lwip_standard_chksum(), the
+;@ non-inverted 16 bit sum in host order. If the buffer starts at an
+;@ odd address the first byte is summed as the high byte of a halfword
+;@ and the result byte swapped, as lwIP expects.
+
+;@ u16_t arm_chksum(void *dataptr, int len)
+;@   r0 = buffer, any alignment
+;@   r1 = length in bytes
+.globl arm_chksum
+arm_chksum:
+    push {r4-r11}
+    mov  r2, #0            ;@ r2 is the 32 bit one's complement sum
+    ands r12, r0, #1       ;@ r12 is TRUE if started at odd address
+    beq  chksum_even
+    cmp  r1, #1
+    blt  chksum_fold
+    ldrb r2, [r0], #1      ;@ odd byte is high byte of first halfword
+    mov  r2, r2, lsl #8
+    sub  r1, r1, #1
+
+chksum_even:
+    tst  r0, #2            ;@ sum a halfword to become word aligned
+    beq  chksum_aligned
+    cmp  r1, #2
+    blt  chksum_byte
+    ldrh r3, [r0], #2
+    add  r2, r2, r3
+    sub  r1, r1, #2
+
+chksum_aligned:
+    subs r1, r1, #32
+    blt  chksum_words
+
+chksum_block:              ;@ 32 bytes per iteration
+    ldmia r0!, {r3-r10}
+    adds r2, r2, r3
+    adcs r2, r2, r4
+    adcs r2, r2, r5
+    adcs r2, r2, r6
+    adcs r2, r2, r7
+    adcs r2, r2, r8
+    adcs r2, r2, r9
+    adcs r2, r2, r10
+    adc  r2, r2, #0
+    subs r1, r1, #32
+    bge  chksum_block
+
+chksum_words:
+    add  r1, r1, #32
+
+chksum_word:               ;@ remaining words
+    subs r1, r1, #4
+    blt  chksum_half
+    ldr  r3, [r0], #4
+    adds r2, r2, r3
+    adc  r2, r2, #0
+    b    chksum_word
+
+chksum_half:
+    add  r1, r1, #4
+    cmp  r1, #2
+    blt  chksum_byte
+    ldrh r3, [r0], #2
+    adds r2, r2, r3
+    adc  r2, r2, #0
+    sub  r1, r1, #2
+
+chksum_byte:               ;@ trailing byte is low byte of halfword
+    cmp  r1, #1
+    blt  chksum_fold
+    ldrb r3, [r0]
+    adds r2, r2, r3
+    adc  r2, r2, #0
+
+chksum_fold:               ;@ fold 32 bit sum in r2 to 16 bits
+    mov  r3, r2, lsl #16
+    adds r2, r2, r3
+    mov  r2, r2, lsr #16
+    adc  r2, r2, #0
+    cmp  r12, #0           ;@ swap bytes if started at odd address
+    beq  chksum_done
+    and  r3, r2, #0xFF
+    mov  r2, r2, lsr #8
+    orr  r2, r2, r3, lsl #8
+
+chksum_done:
+    mov  r0, r2
+    pop  {r4-r11}
+    bx   lr
+
+;@ u16_t arm_chksum_copy(void *dst, const void *src, u16_t len)
+;@   r0 = destination
+;@   r1 = source
+;@   r2 = length in bytes
+;@ Copy and sum in one pass if source and destination share the same
+;@ word alignment, otherwise copy with memcpy and sum the copy.
+.globl arm_chksum_copy
+arm_chksum_copy:
+    eor  r3, r0, r1
+    tst  r3, #3
+    bne  copy_unaligned
+    push {r4-r11}
+    mov  r11, #0           ;@ r11 is the 32 bit one's complement sum
+    ands r12, r1, #1
+    beq  copy_even
+    cmp  r2, #1
+    blt  copy_fold
+    ldrb r3, [r1], #1
+    strb r3, [r0], #1
+    mov  r11, r3, lsl #8
+    sub  r2, r2, #1
+
+copy_even:
+    tst  r1, #2
+    beq  copy_aligned
+    cmp  r2, #2
+    blt  copy_byte
+    ldrh r3, [r1], #2
+    strh r3, [r0], #2
+    add  r11, r11, r3
+    sub  r2, r2, #2
+
+copy_aligned:
+    subs r2, r2, #32
+    blt  copy_words
+
+copy_block:                ;@ 32 bytes per iteration
+    ldmia r1!, {r3-r10}
+    stmia r0!, {r3-r10}
+    adds r11, r11, r3
+    adcs r11, r11, r4
+    adcs r11, r11, r5
+    adcs r11, r11, r6
+    adcs r11, r11, r7
+    adcs r11, r11, r8
+    adcs r11, r11, r9
+    adcs r11, r11, r10
+    adc  r11, r11, #0
+    subs r2, r2, #32
+    bge  copy_block
+
+copy_words:
+    add  r2, r2, #32
+
+copy_word:
+    subs r2, r2, #4
+    blt  copy_half
+    ldr  r3, [r1], #4
+    str  r3, [r0], #4
+    adds r11, r11, r3
+    adc  r11, r11, #0
+    b    copy_word
+
+copy_half:
+    add  r2, r2, #4
+    cmp  r2, #2
+    blt  copy_byte
+    ldrh r3, [r1], #2
+    strh r3, [r0], #2
+    adds r11, r11, r3
+    adc  r11, r11, #0
+    sub  r2, r2, #2
+
+copy_byte:
+    cmp  r2, #1
+    blt  copy_fold
+    ldrb r3, [r1]
+    strb r3, [r0]
+    adds r11, r11, r3
+    adc  r11, r11, #0
+
+copy_fold:
+    mov  r2, r11
+    b    chksum_fold
+
+copy_unaligned:
+    push {r0, r2, r4, lr}  ;@ save destination and length
+    bl   memcpy
+    pop  {r0, r1, r4, lr}
+    b    arm_chksum
@@ -62,6 +62,10 @@
 // Lan95xx
 #define TAG_GET_MAC_ADDRESS           0x00010003
 
+// Clocks
+#define TAG_GET_CLOCK_RATE            0x00030002
+  #define CLOCK_ID_ARM                  3
+
 // Display
 #define TAG_ALLOCATE_BUFFER           0x00040001
 #define TAG_RELEASE_BUFFER            0x00048001
@@ -112,6 +116,14 @@ typedef struct PropertyMACAddress
 }
 PropertyMACAddress;
 
+typedef struct PropertyClockRate
+{
+  PropertyTag tag;
+  u32 clockId;
+  u32 rate;
+}
+PropertyClockRate;
+
 typedef struct PropertyPowerState
 {
   PropertyTag tag;
@@ -341,6 +353,23 @@ u32 SetDisplayResolution(u32 *width, u32 *height, u32 *depth,
 #endif
 
 #if ENABLE_USB
+// Returns the ARM core clock rate in Hz, or zero if failure
+u32 GetArmClockRate(void)
+{
+  PropertyClockRate clockRate;
+
+  clockRate.tag.tagId = TAG_GET_CLOCK_RATE;
+  clockRate.tag.bufSize = 8;
+  clockRate.tag.code = CODE_REQUEST;
+
+  clockRate.clockId = CLOCK_ID_ARM;
+  clockRate.rate = 0;
+  if (property_get(&clockRate, sizeof(clockRate)))
+    return 0;
+
+  return clockRate.rate;
+}
+
 // Supported devices are DEVICE_ID_SD_CARD or DEVICE_ID_USB_CARD
 int SetUsbPowerStateOn(void)
 {
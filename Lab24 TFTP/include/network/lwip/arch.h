@@ -44,6 +44,19 @@
 #include <system.h>
 #define BYTE_ORDER LITTLE_ENDIAN
 
+/* ARM assembly Internet checksum, see boards/rpi/chksum.s */
+#ifdef __arm__
+u16_t arm_chksum(void *dataptr, int len);
+u16_t arm_chksum_copy(void *dst, const void *src, u16_t len);
+#define LWIP_CHKSUM arm_chksum
+#define LWIP_CHKSUM_COPY(dst, src, len) arm_chksum_copy(dst, src, len)
+#else
+/* Portable C checksum for the host build, see inet_chksum.c */
+u16_t lwip_standard_chksum(void *dataptr, int len);
+#define LWIP_CHKSUM lwip_standard_chksum
+#define LWIP_CHKSUM_ALGORITHM 2
+#endif
+
 /** Temporary: define format string for size_t if not defined in cc.h */
 #ifndef SZT_F
 #define SZT_F U32_F
@@ -62,6 +75,10 @@ extern "C" {
 #define PACK_STRUCT_BEGIN
 #endif /* PACK_STRUCT_BEGIN */
 
+#ifndef PACK_STRUCT_STRUCT
+#define PACK_STRUCT_STRUCT
+#endif /* PACK_STRUCT_STRUCT */
+
 #ifndef PACK_STRUCT_END
 #define PACK_STRUCT_END
 #endif /* PACK_STRUCT_END */
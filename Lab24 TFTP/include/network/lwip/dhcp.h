@@ -63,6 +63,10 @@ struct dhcp
   ip_addr_t offered_si_addr;
   char boot_file_name[DHCP_FILE_LEN];
 #endif /* LWIP_DHCP_BOOTPFILE */
+#if LWIP_ARP
+  ip_addr_t reply_ip_addr; /* sender of the ACK, the server or a relay */
+  u8_t reply_hwaddr[NETIF_MAX_HWADDR_LEN]; /* and its MAC address */
+#endif /* LWIP_ARP */
 };
 
 /* MUST be compiled with "pack structs" or equivalent! */
@@ -111,6 +115,8 @@ void dhcp_set_struct(struct netif *netif, struct dhcp *dhcp);
 void dhcp_cleanup(struct netif *netif);
 /** start DHCP configuration */
 err_t dhcp_start(struct netif *netif);
+/** start DHCP configuration with INIT-REBOOT of a previously leased address */
+err_t dhcp_start_lease(struct netif *netif, ip_addr_t *ipaddr);
 /** enforce early lease renewal (not needed normally)*/
 err_t dhcp_renew(struct netif *netif);
 /** release the DHCP lease, usually called before dhcp_stop()*/
@@ -226,6 +232,7 @@ int dhcp_fine_tmr(u32 id, void *data, void *context);
 #define DHCP_OPTION_CLIENT_ID 61
 #define DHCP_OPTION_TFTP_SERVERNAME 66
 #define DHCP_OPTION_BOOTFILE 67
+#define DHCP_OPTION_RAPID_COMMIT 80 /* RFC 4039, two message exchange */
 
 /** possible combinations of overloading the file and sname fields with options */
 #define DHCP_OVERLOAD_NONE 0
@@ -94,6 +94,21 @@ extern "C" {
  * Set by the netif driver in its init function. */
 #define NETIF_FLAG_IGMP         0x80U
 
+/** Checksum generation and checking flags of a netif, see
+ * LWIP_CHECKSUM_CTRL_PER_NETIF. A cleared GEN flag means the netif
+ * hardware inserts that checksum, a cleared CHECK flag means the netif
+ * hardware has already verified it for every received packet. */
+#define NETIF_CHECKSUM_GEN_IP       0x0001
+#define NETIF_CHECKSUM_GEN_UDP      0x0002
+#define NETIF_CHECKSUM_GEN_TCP      0x0004
+#define NETIF_CHECKSUM_GEN_ICMP     0x0008
+#define NETIF_CHECKSUM_CHECK_IP     0x0100
+#define NETIF_CHECKSUM_CHECK_UDP    0x0200
+#define NETIF_CHECKSUM_CHECK_TCP    0x0400
+#define NETIF_CHECKSUM_CHECK_ICMP   0x0800
+#define NETIF_CHECKSUM_ENABLE_ALL   0xFFFF
+#define NETIF_CHECKSUM_DISABLE_ALL  0x0000
+
 /** Function prototype for netif init functions. Set up flags and output/linkoutput
  * callback functions in this function.
  *
@@ -190,6 +205,10 @@ struct netif {
   u8_t hwaddr[NETIF_MAX_HWADDR_LEN];
   /** flags (see NETIF_FLAG_ above) */
   u8_t flags;
+#if LWIP_CHECKSUM_CTRL_PER_NETIF
+  /** checksums generated/checked in software (see NETIF_CHECKSUM_ above) */
+  u16_t chksum_flags;
+#endif /* LWIP_CHECKSUM_CTRL_PER_NETIF */
   /** descriptive abbreviation */
   char name[4];
   /** number of this interface */
@@ -315,6 +334,16 @@ void netif_poll_all(void);
 #endif /* !LWIP_NETIF_LOOPBACK_MULTITHREADING */
 #endif /* ENABLE_LOOPBACK */
 
+#if LWIP_CHECKSUM_CTRL_PER_NETIF
+#define NETIF_SET_CHECKSUM_CTRL(netif, chksumflags) \
+  do { (netif)->chksum_flags = (chksumflags); } while(0)
+#define NETIF_CHECKSUM_ENABLED(netif, chksumflag) \
+  (((netif) == NULL) || (((netif)->chksum_flags & (chksumflag)) != 0))
+#else /* LWIP_CHECKSUM_CTRL_PER_NETIF */
+#define NETIF_SET_CHECKSUM_CTRL(netif, chksumflags)
+#define NETIF_CHECKSUM_ENABLED(netif, chksumflag) 1
+#endif /* LWIP_CHECKSUM_CTRL_PER_NETIF */
+
 #if LWIP_NETIF_HWADDRHINT
 #define NETIF_SET_HWADDRHINT(netif, hint) ((netif)->addr_hint = (hint))
 #else /* LWIP_NETIF_HWADDRHINT */
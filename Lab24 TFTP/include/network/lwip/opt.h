@@ -1864,6 +1864,16 @@
 #define LWIP_CHECKSUM_ON_COPY           0
 #endif
 
+/**
+ * LWIP_CHECKSUM_CTRL_PER_NETIF==1: Checksum generation/check can be enabled
+ * or disabled per netif at runtime, and a netif driver may mark received
+ * pbufs as already verified by the hardware (PBUF_FLAG_*_CHKSUM_OK).
+ * ATTENTION: the CHECKSUM_GEN_* and CHECKSUM_CHECK_* defines must be enabled!
+ */
+#ifndef LWIP_CHECKSUM_CTRL_PER_NETIF
+#define LWIP_CHECKSUM_CTRL_PER_NETIF    1
+#endif
+
 /*
    ---------------------------------------
    ---------- Hook options ---------------
@@ -12,6 +12,13 @@
 #define TFTP_OPCODE_DATA  3
 #define TFTP_OPCODE_ACK   4
 #define TFTP_OPCODE_ERROR 5
+#define TFTP_OPCODE_OACK  6
+
+#define TFTP_ERROR_NOT_DEFINED 0 /* Not defined, see error message */
+#define TFTP_ERROR_NOT_FOUND 1 /* File not found */
+#define TFTP_ERROR_DISK_FULL 3 /* Disk full or allocation exceeded */
+#define TFTP_ERROR_ILLEGAL   4 /* Illegal TFTP operation */
+#define TFTP_ERROR_OPTION    8 /* Option negotiation failed, RFC 2347 */
 
 #define TFTP_TRACE(...)
 
@@ -29,7 +36,25 @@
 /** Maximum number of times to send the initial RREQ.  */
 #define TFTP_INIT_BLOCK_MAX_RETRIES 5
 
-#define TFTP_BLOCK_SIZE     512
+/** Number of initial RREQs sent with options before falling back to a legacy
+ * RREQ, for servers that silently drop requests with options.  */
+#define TFTP_OPTION_RRQ_RETRIES 2
+
+/** Time to wait for the next block before re-sending the last ACK, and the
+ * maximum number of times it is re-sent before the transfer fails.  */
+#define TFTP_ACK_TIMEOUT        (MICROS_PER_SECOND / 10)
+#define TFTP_ACK_MAX_RETRIES    100
+
+/** Time a multicast client that is not the master waits for the group to go
+ * quiet, plus a random part up to the same again, before requesting the file
+ * again to fill in missing blocks, and the maximum number of requests.  */
+#define TFTP_MCAST_TIMEOUT      MICROS_PER_SECOND
+#define TFTP_MCAST_MAX_RETRIES  20
+
+#define TFTP_BLOCK_SIZE     512  /* default block size, RFC 1350 */
+#define TFTP_MAX_BLOCK_SIZE 1468 /* blksize option, largest without IP
+                                    fragmentation on Ethernet, RFC 2348 */
+#define TFTP_WINDOW_SIZE    8    /* windowsize option, RFC 7440 */
 
 struct tftpPkt
 {
@@ -49,10 +74,19 @@ struct tftpPkt
         {
             uint16_t block_number;
         } ACK;
+        struct
+        {
+            uint16_t error_code;
+            char message[TFTP_BLOCK_SIZE];
+        } ERROR;
+        struct
+        {
+            char options[TFTP_BLOCK_SIZE];
+        } OACK;
     };
 };
 
-#define TFTP_MAX_PACKET_LEN      516
+#define TFTP_MAX_PACKET_LEN      (4 + TFTP_MAX_BLOCK_SIZE)
 
 /**
  * @ingroup tftp
@@ -62,11 +96,24 @@ struct tftpPkt
  */
 typedef int (*tftpRecvDataFunc)(const u8 *data, u32 len, void *ctx);
 
-int tftpGet(void *t);
+/* A TFTP client session, one per download in progress. */
+struct tftpcb;
+
+int tftpGet(struct tftpcb *tftp);
+
+int tftpSendACK(struct tftpcb *tftp, u16 block_number);
+
+int tftpSendError(struct tftpcb *tftp, u16 error_code, const char *message);
+
+int tftpSendRRQ(struct tftpcb *tftp);
+
+int tftp_option_is(const char *option, const char *name);
+
+u8 *tftp_option_add(u8 *p, const char *name, u32 value);
 
-int tftpSendACK(void *conn, u16 block_number);
+int TftpdAddImage(const char *name, const void *data, u32 size);
 
-int tftpSendRRQ(void *conn, const char *filename);
+const void *TftpdImage(const char *name, u32 *size);
 
 void tftp_init(void);
 
@@ -33,13 +33,14 @@
 #define __LWIPOPTS_H__
 
 #include <system.h>
+#include <stdlib.h>
 
 /* Prevent having to link sys_arch.c (we don't test the API layers in unit tests) */
 #define NO_SYS                          1
 #define LWIP_NETCONN                    0
 #define LWIP_SOCKET                     0
 
-/* Minimal changes to opt.h required for tcp unit tests: */
+/* TCP send buffer and window, in full size (TCP_MSS) segments */
 #define TCPIP_MEM_SIZE                  16000
 #define TCP_SND_QUEUELEN                40
 #define MEMP_NUM_TCP_SEG                TCP_SND_QUEUELEN
@@ -49,4 +50,18 @@
 /* Minimal changes to opt.h required for etharp unit tests: */
 #define ETHARP_SUPPORT_STATIC_ENTRIES   0
 
+/* Checksum data while copying into pbufs (LWIP_CHKSUM_COPY in arch.h) */
+#define LWIP_CHECKSUM_ON_COPY           1
+
+/* Keep the boot server (siaddr) of the DHCP reply, the TFTP server,
+   and let the network save the lease and report once bound */
+#define LWIP_DHCP_BOOTP_FILE            1
+struct netif;
+void NetBound(struct netif *netif);
+#define DHCP_BOUND_HOOK(netif)          NetBound(netif)
+
+/* Join multicast groups, for multicast TFTP (RFC 2090) */
+#define LWIP_IGMP                       1
+#define LWIP_RAND()                     rand() /* IGMP report delay */
+
 #endif /* __LWIPOPTS_H__ */
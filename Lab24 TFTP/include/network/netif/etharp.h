@@ -191,6 +191,7 @@ err_t etharp_request(struct netif *netif, ip_addr_t *ipaddr);
  *  From RFC 3220 "IP Mobility Support for IPv4" section 4.6. */
 #define etharp_gratuitous(netif) etharp_request((netif), &(netif)->ip_addr)
 void etharp_cleanup_netif(struct netif *netif);
+err_t etharp_add_entry(struct netif *netif, ip_addr_t *ipaddr, struct eth_addr *ethaddr);
 
 #if ETHARP_SUPPORT_STATIC_ENTRIES
 err_t etharp_add_static_entry(ip_addr_t *ipaddr, struct eth_addr *ethaddr);
@@ -212,6 +213,8 @@ err_t ethernet_input(struct pbuf *p, struct netif *netif);
 #define eth_addr_cmp(addr1, addr2) (memcmp((addr1)->addr, (addr2)->addr, ETHARP_HWADDR_LEN) == 0)
 
 extern struct eth_addr ethbroadcast, ethzero;
+/** Source address of the Ethernet frame of the IP packet being input */
+extern struct eth_addr current_ethhdr_src;
 
 #endif /* LWIP_ARP || LWIP_ETHERNET */
 
@@ -42,6 +42,7 @@
 
 u32 rand(void);
 void srand(u32 seed);
+int atoi(char *a);
 
 #define min(X,Y) ((X) < (Y) ? (X) : (Y))
 #define max(X,Y) ((X) > (Y) ? (X) : (Y))
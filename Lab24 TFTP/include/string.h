@@ -42,6 +42,7 @@
 /* Global Function Definitions                                       */
 /*...................................................................*/
 extern void *memcpy(void *dst, const void *src, size_t length);
+extern void *memmove(void *dst, const void *src, size_t length);
 extern void *memset(void *dst, int value, size_t length);
 extern int memcmp(const void *data1, const void *data2, size_t length);
 extern void *memchr(const void *addr, int value, size_t length);
@@ -267,6 +267,7 @@ u64 TimerNow(void);
 */
 void SystemShell(void);
 int ShellPoll(void *data);
+int ShellExecute(struct shell_state *state);
 int LedPoll(void *data);
 int TimerPoll(void *data);
 
@@ -339,7 +340,33 @@ int HostGetPortSpeed(void);
 */
 const u8 *LanGetMAC(void);
 int LanDeviceSendFrame(const void *buffer, u32 length);
+void *LanDeviceFrameAlloc(u32 length);
+int LanDeviceFrameSend(void);
+int LanDeviceTxPending(void);
+void LanDeviceTxResume(void);
+void LanDeviceTxStats(u32 *frames, u32 *transfers, u32 *dropped);
 int LanReceiveAsync(void);
+void LanReceiveResume(void);
+int LanChecksumOffload(int enable);
+void LanChecksumStats(u32 *rx, u32 *tx);
+
+// Receive checksum verdict passed from the Ethernet device to NetIn()
+#define NET_CHECKSUM_IP       (1 << 0) // IPv4 header checksum verified
+#define NET_CHECKSUM_L4       (1 << 1) // TCP or UDP checksum verified
+int NetIn(u8 *frame, int frameLength, u32 checksum);
+u8 *NetRxSlot(void);
+void NetRxPush(u8 *frame, int frameLength, u32 checksum);
+
+// CPU time of the network layers in microseconds, for 'iperf'
+struct net_cpu
+{
+  u32 driver; // Ethernet device receive and send completion
+  u32 input;  // lwIP input, including the application callbacks
+};
+extern struct net_cpu NetCpu;
+
+// TimerNow() when the network was started, for the time to first byte
+extern u64 NetStartTime;
 
 /*
  * Double linked list inline functions
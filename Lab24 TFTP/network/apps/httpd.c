@@ -0,0 +1,616 @@
+/*...................................................................*/
+/*                                                                   */
+/*   Module:  httpd.c                                                */
+/*   Version: 2020.0                                                 */
+/*   Purpose: HTTP/1.1 server for RAM images and metrics             */
+/*                                                                   */
+/*...................................................................*/
+/*                                                                   */
+/*                   Copyright 2020, Sean Lawless                    */
+/*                                                                   */
+/*                      ALL RIGHTS RESERVED                          */
+/*                                                                   */
+/* Redistribution and use in source, binary or derived forms, with   */
+/* or without modification, are permitted provided that the          */
+/* following conditions are met:                                     */
+/*                                                                   */
+/*  1. Redistributions in any form, including but not limited to     */
+/*     source code, binary, or derived works, must include the above */
+/*     copyright notice, this list of conditions and the following   */
+/*     disclaimer.                                                   */
+/*                                                                   */
+/*  2. Any change or addition to this copyright notice requires the  */
+/*     prior written permission of the above copyright holder.       */
+/*                                                                   */
+/* THIS SOFTWARE IS PROVIDED ''AS IS''. ANY EXPRESS OR IMPLIED       */
+/* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES */
+/* OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE       */
+/* DISCLAIMED. IN NO EVENT SHALL ANY AUTHOR AND/OR COPYRIGHT HOLDER  */
+/* BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,          */
+/* EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED   */
+/* TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,     */
+/* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON */
+/* ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,   */
+/* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY    */
+/* OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE           */
+/* POSSIBILITY OF SUCH DAMAGE.                                       */
+/*...................................................................*/
+#include <system.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if ENABLE_TCP
+
+#include <lwip/tcp.h>
+#include <lwip/stats.h>
+#include <lwip/tftp.h>
+
+/*...................................................................*/
+/* Symbol Definitions                                                */
+/*...................................................................*/
+#define PORT_HTTP            80
+#define HTTPD_MAX_SESSIONS   8
+#define HTTPD_REQUEST_LENGTH 512 /* request line and headers */
+#define HTTPD_HEADER_LENGTH  160
+#define HTTPD_METRICS_LENGTH 1536
+#define HTTPD_IDLE_TIMEOUT   (10 * MICROS_PER_SECOND) /* keep-alive */
+#define HTTPD_TASK_PRIORITY  4
+
+/* A connection to one client, free if pcb is NULL.  Requests are
+ * answered in order, one response queued at a time. */
+struct httpd_session
+{
+  struct tcp_pcb *pcb;  /* the client connection */
+  char request[HTTPD_REQUEST_LENGTH + 1]; /* received, terminated */
+  u32 received;         /* bytes in request */
+  u32 consumed;         /* bytes of the request being answered */
+  char header[HTTPD_HEADER_LENGTH]; /* the response header */
+  u32 header_length;    /* bytes in header */
+  u32 header_sent;      /* bytes of header queued */
+  const u8 *data;       /* the response body */
+  u32 size;             /* bytes in body */
+  u32 sent;             /* bytes of body queued */
+  u8 copy;              /* TCP_WRITE_FLAG_COPY if the body is reused */
+  u8 head;              /* TRUE if HEAD, no body sent */
+  u8 responding;        /* TRUE until the response is queued */
+  u8 keep_alive;        /* TRUE to wait for another request after */
+  char *text;           /* generated body, the metrics */
+  struct timer idle;    /* close if no request before it expires */
+};
+
+/*...................................................................*/
+/* Global Variables                                                  */
+/*...................................................................*/
+extern int NetUp;
+static struct tcp_pcb *HttpdPcb = NULL;
+static struct httpd_session HttpdSessions[HTTPD_MAX_SESSIONS];
+static u32 HttpdRequests, HttpdBytes;
+static int HttpdTask = FALSE;
+
+static err_t httpd_request(struct httpd_session *s);
+
+/*...................................................................*/
+/* Local function definitions                                        */
+/*...................................................................*/
+
+/*...................................................................*/
+/* httpd_is: Compare the start of text, case insensitive             */
+/*                                                                   */
+/*      Input: text - the text to compare                            */
+/*             name - the lower case name to find                    */
+/*                                                                   */
+/*    Returns: TRUE if text starts with name                         */
+/*...................................................................*/
+static int httpd_is(const char *text, const char *name)
+{
+  for (; *name; ++text, ++name)
+    if ((*text | 0x20) != *name)
+      return FALSE;
+  return TRUE;
+}
+
+/*...................................................................*/
+/* httpd_close: End a session and free its resources                 */
+/*                                                                   */
+/*      Input: s - the session                                       */
+/*                                                                   */
+/*    Returns: ERR_ABRT if the connection was aborted, or ERR_OK     */
+/*...................................................................*/
+static err_t httpd_close(struct httpd_session *s)
+{
+  err_t err = ERR_OK;
+
+  if (s->text)
+    free(s->text);
+  s->text = NULL;
+  if (s->pcb)
+  {
+    tcp_arg(s->pcb, NULL);
+    tcp_recv(s->pcb, NULL);
+    tcp_sent(s->pcb, NULL);
+    tcp_err(s->pcb, NULL);
+
+    /* The data queued is sent before the FIN, abort if no memory. */
+    if (tcp_close(s->pcb) != ERR_OK)
+    {
+      tcp_abort(s->pcb);
+      err = ERR_ABRT;
+    }
+  }
+  s->pcb = NULL;
+  return err;
+}
+
+/*...................................................................*/
+/* httpd_respond: Set up the response header and body                */
+/*                                                                   */
+/*      Input: s - the session                                       */
+/*             status - the status code and reason                   */
+/*             type - the content type                               */
+/*             data - the body, which must remain valid unless copy  */
+/*             size - the body length                                */
+/*             copy - TCP_WRITE_FLAG_COPY to copy the body           */
+/*...................................................................*/
+static void httpd_respond(struct httpd_session *s, const char *status,
+                          const char *type, const void *data, u32 size,
+                          u8 copy)
+{
+  sprintf(s->header, "HTTP/1.1 %s\r\nContent-Type: %s\r\n", status, type);
+  sprintf(&s->header[strlen(s->header)], "Content-Length: %u\r\n", size);
+  sprintf(&s->header[strlen(s->header)], "Connection: %s\r\n\r\n",
+          s->keep_alive ? "keep-alive" : "close");
+  s->header_length = strlen(s->header);
+  s->header_sent = 0;
+
+  s->data = data;
+  s->size = s->head ? 0 : size;
+  s->sent = 0;
+  s->copy = copy;
+}
+
+/*...................................................................*/
+/* httpd_error: Set up an error response, the status is the body     */
+/*                                                                   */
+/*      Input: s - the session                                       */
+/*             status - the status code and reason                   */
+/*...................................................................*/
+static void httpd_error(struct httpd_session *s, const char *status)
+{
+  httpd_respond(s, status, "text/plain", status, strlen(status), 0);
+}
+
+/*...................................................................*/
+/* httpd_metrics: Format the counters in Prometheus text format      */
+/*                                                                   */
+/*      Input: text - the resulting text                             */
+/*...................................................................*/
+static void httpd_metrics(char *text)
+{
+#if LWIP_STATS
+  static const struct
+  {
+    const char *name;
+    struct stats_proto *stats;
+  } protocols[] =
+  {
+#if LINK_STATS
+    { "link", &lwip_stats.link },
+#endif
+#if IP_STATS
+    { "ip", &lwip_stats.ip },
+#endif
+#if UDP_STATS
+    { "udp", &lwip_stats.udp },
+#endif
+#if TCP_STATS
+    { "tcp", &lwip_stats.tcp },
+#endif
+  };
+  static const char *counters[] = { "xmit", "recv", "drop", "error" };
+  struct stats_proto *p;
+  u32 value;
+  int j;
+#endif
+  int i, active = 0;
+
+  for (i = 0; i < HTTPD_MAX_SESSIONS; ++i)
+    if (HttpdSessions[i].pcb)
+      ++active;
+  sprintf(text, "# TYPE httpd_requests_total counter\n"
+                "httpd_requests_total %u\n"
+                "# TYPE httpd_sent_bytes_total counter\n"
+                "httpd_sent_bytes_total %u\n"
+                "# TYPE httpd_connections gauge\n"
+                "httpd_connections %u\n",
+          HttpdRequests, HttpdBytes, active);
+
+#if LWIP_STATS
+  /* Packets by protocol, errors are the sum of the error counters. */
+  for (j = 0; j < 4; ++j)
+  {
+    text += strlen(text);
+    sprintf(text, "# TYPE lwip_%s_total counter\n", counters[j]);
+    for (i = 0; i < sizeof(protocols) / sizeof(protocols[0]); ++i)
+    {
+      p = protocols[i].stats;
+      if (j == 0)
+        value = p->xmit;
+      else if (j == 1)
+        value = p->recv;
+      else if (j == 2)
+        value = p->drop;
+      else
+        value = p->chkerr + p->lenerr + p->memerr + p->rterr + p->proterr +
+                p->opterr + p->err;
+      text += strlen(text);
+      sprintf(text, "lwip_%s_total{proto=\"%s\"} %u\n", counters[j],
+              protocols[i].name, value);
+    }
+  }
+#endif
+}
+
+/*...................................................................*/
+/* httpd_send: Queue the response that fits the send buffer          */
+/*                                                                   */
+/*      Input: s - the session                                       */
+/*                                                                   */
+/*    Returns: ERR_ABRT if the connection was aborted, or ERR_OK     */
+/*...................................................................*/
+static err_t httpd_send(struct httpd_session *s)
+{
+  u32 len;
+
+  /* The header is copied, the buffer is reused for the next one. */
+  if (s->header_sent < s->header_length)
+  {
+    len = min(s->header_length - s->header_sent, tcp_sndbuf(s->pcb));
+    if (len && (tcp_write(s->pcb, &s->header[s->header_sent], len,
+                          TCP_WRITE_FLAG_COPY) == ERR_OK))
+      s->header_sent += len;
+  }
+
+  /* Reference RAM images rather than copy them, the segments point
+   * into the image until acknowledged.  Retry once the send buffer or
+   * queue has room again. */
+  while ((s->header_sent == s->header_length) && (s->sent < s->size))
+  {
+    len = min(min(s->size - s->sent, tcp_sndbuf(s->pcb)), 0xFFFF);
+    if ((len == 0) ||
+        (tcp_write(s->pcb, &s->data[s->sent], len, s->copy) != ERR_OK))
+      break;
+    s->sent += len;
+    HttpdBytes += len;
+  }
+
+  tcp_output(s->pcb);
+
+  /* Once all queued close, or answer a request already received. */
+  if ((s->header_sent < s->header_length) || (s->sent < s->size))
+    return ERR_OK;
+  s->responding = FALSE;
+  if (!s->keep_alive)
+    return httpd_close(s);
+  s->idle = TimerRegister(HTTPD_IDLE_TIMEOUT);
+  memmove(s->request, &s->request[s->consumed],
+          s->received - s->consumed);
+  s->received -= s->consumed;
+  s->consumed = 0;
+  return httpd_request(s);
+}
+
+/*...................................................................*/
+/* httpd_request: Answer the request received, once complete         */
+/*                                                                   */
+/*      Input: s - the session                                       */
+/*                                                                   */
+/*    Returns: ERR_ABRT if the connection was aborted, or ERR_OK     */
+/*...................................................................*/
+static err_t httpd_request(struct httpd_session *s)
+{
+  char *end, *path, *version, *line;
+  const void *data;
+  u32 size;
+
+  /* Wait for the blank line that ends the headers. */
+  for (end = s->request; end + 4 <= &s->request[s->received]; ++end)
+    if (memcmp(end, "\r\n\r\n", 4) == 0)
+      break;
+  if (end + 4 > &s->request[s->received])
+  {
+    if (s->received < HTTPD_REQUEST_LENGTH)
+      return ERR_OK;
+    end = NULL;
+  }
+  ++HttpdRequests;
+  s->responding = TRUE;
+  s->head = FALSE;
+
+  /* Discard a request too long to hold, and close. */
+  if (end == NULL)
+  {
+    s->keep_alive = FALSE;
+    s->consumed = s->received;
+    httpd_error(s, "431 Request Header Fields Too Large");
+    return httpd_send(s);
+  }
+  s->consumed = end + 4 - s->request;
+  *end = '\0';
+
+  /* Parse the request line, "GET /path HTTP/1.1". */
+  if (memcmp(s->request, "GET ", 4) == 0)
+    path = &s->request[4];
+  else if (memcmp(s->request, "HEAD ", 5) == 0)
+  {
+    path = &s->request[5];
+    s->head = TRUE;
+  }
+  else
+  {
+    /* A request body would be read as the next request, so close. */
+    s->keep_alive = FALSE;
+    httpd_error(s, "501 Not Implemented");
+    return httpd_send(s);
+  }
+  version = (char *)strchr(path, ' ');
+  if ((path[0] != '/') || (version == NULL))
+  {
+    s->keep_alive = FALSE;
+    httpd_error(s, "400 Bad Request");
+    return httpd_send(s);
+  }
+  *version++ = '\0';
+
+  /* Keep the connection by default for HTTP/1.1, as the Connection
+   * header says otherwise. */
+  s->keep_alive = (memcmp(version, "HTTP/1.1", 8) == 0);
+  for (line = (char *)strchr(version, '\n'); line;
+       line = (char *)strchr(line, '\n'))
+  {
+    if (httpd_is(++line, "connection:"))
+    {
+      for (line += 11; *line == ' '; ++line) ;
+      if (httpd_is(line, "close"))
+        s->keep_alive = FALSE;
+      else if (httpd_is(line, "keep-alive"))
+        s->keep_alive = TRUE;
+    }
+  }
+
+  /* The metrics, or a file in RAM. */
+  if (strcmp(path, "/metrics") == 0)
+  {
+    if (s->text == NULL)
+      s->text = malloc(HTTPD_METRICS_LENGTH);
+    if (s->text == NULL)
+      httpd_error(s, "503 Service Unavailable");
+    else
+    {
+      httpd_metrics(s->text);
+      httpd_respond(s, "200 OK", "text/plain; version=0.0.4", s->text,
+                    strlen(s->text), TCP_WRITE_FLAG_COPY);
+    }
+  }
+#if ENABLE_UDP
+  else if ((data = TftpdImage(&path[1], &size)) != NULL)
+    httpd_respond(s, "200 OK", "application/octet-stream", data, size, 0);
+#endif
+  else
+    httpd_error(s, "404 Not Found");
+
+  return httpd_send(s);
+}
+
+/*...................................................................*/
+/* httpd_recv: Receive request data, or the end of the connection    */
+/*...................................................................*/
+static err_t httpd_recv(void *arg, struct tcp_pcb *pcb, struct pbuf *p,
+                        err_t err)
+{
+  struct httpd_session *s = arg;
+  u32 len;
+
+  /* The client is done sending, close once the response is queued. */
+  if (p == NULL)
+  {
+    if (!s->responding)
+      return httpd_close(s);
+    s->keep_alive = FALSE;
+    return ERR_OK;
+  }
+
+  /* Refuse the data until the response is queued, TCP holds it and
+   * delivers it again later.  Otherwise append what fits. */
+  if (s->responding)
+    return ERR_MEM;
+  len = min(p->tot_len, HTTPD_REQUEST_LENGTH - s->received);
+  pbuf_copy_partial(p, &s->request[s->received], len, 0);
+  s->received += len;
+  tcp_recved(pcb, p->tot_len);
+  pbuf_free(p);
+  return httpd_request(s);
+}
+
+/*...................................................................*/
+/* httpd_sent: Queue more of the response as data is acknowledged    */
+/*...................................................................*/
+static err_t httpd_sent(void *arg, struct tcp_pcb *pcb, u16_t len)
+{
+  struct httpd_session *s = arg;
+
+  if (s->responding)
+    return httpd_send(s);
+  return ERR_OK;
+}
+
+/*...................................................................*/
+/* httpd_err: The connection was reset and the pcb freed             */
+/*...................................................................*/
+static void httpd_err(void *arg, err_t err)
+{
+  struct httpd_session *s = arg;
+
+  if (s)
+  {
+    s->pcb = NULL;
+    httpd_close(s);
+  }
+}
+
+/*...................................................................*/
+/* httpd_accept: Accept a connection into a free session             */
+/*...................................................................*/
+static err_t httpd_accept(void *arg, struct tcp_pcb *pcb, err_t err)
+{
+  struct httpd_session *s = NULL;
+  int i;
+
+  for (i = 0; i < HTTPD_MAX_SESSIONS; ++i)
+  {
+    if (HttpdSessions[i].pcb == NULL)
+    {
+      s = &HttpdSessions[i];
+      break;
+    }
+  }
+
+  /* Returning an error resets the connection. */
+  if (s == NULL)
+    return ERR_MEM;
+  tcp_accepted(HttpdPcb);
+
+  bzero(s, sizeof(struct httpd_session));
+  s->pcb = pcb;
+  s->idle = TimerRegister(HTTPD_IDLE_TIMEOUT);
+
+  /* Send small responses at once rather than wait for the ACK. */
+  tcp_nagle_disable(pcb);
+  tcp_arg(pcb, s);
+  tcp_recv(pcb, httpd_recv);
+  tcp_sent(pcb, httpd_sent);
+  tcp_err(pcb, httpd_err);
+  return ERR_OK;
+}
+
+/*...................................................................*/
+/* httpd_poll: Queue what did not fit, and close idle connections    */
+/*                                                                   */
+/*      Input: data - unused                                         */
+/*                                                                   */
+/*    Returns: TASK_IDLE, or TASK_FINISHED once the server stops     */
+/*...................................................................*/
+static int httpd_poll(void *data)
+{
+  struct httpd_session *s;
+  int i;
+
+  for (i = 0; i < HTTPD_MAX_SESSIONS; ++i)
+  {
+    s = &HttpdSessions[i];
+    if (s->pcb == NULL)
+      continue;
+
+    /* End all sessions if the server stopped. */
+    if (HttpdPcb == NULL)
+      httpd_close(s);
+    else if (s->responding)
+      httpd_send(s);
+    else if (TimerRemaining(&s->idle) == 0)
+      httpd_close(s);
+  }
+
+  if (HttpdPcb == NULL)
+  {
+    HttpdTask = FALSE;
+    return TASK_FINISHED;
+  }
+  return TASK_IDLE;
+}
+
+/*...................................................................*/
+/* Global function definitions                                       */
+/*...................................................................*/
+
+/*...................................................................*/
+/*      Httpd: Start, stop or report the HTTP server                 */
+/*                                                                   */
+/*      Input: command - "httpd [off]"                               */
+/*                                                                   */
+/*    Returns: TASK_FINISHED                                         */
+/*...................................................................*/
+int Httpd(const char *command)
+{
+  const char *arg = strchr(command, ' ');
+  struct tcp_pcb *pcb;
+  int i, active = 0;
+
+  if (!NetUp)
+  {
+    puts("Network down, use 'net' command to enable.");
+    return TASK_FINISHED;
+  }
+
+  /* Stop the server, the task ends the sessions. */
+  if (arg && (strcmp(&arg[1], "off") == 0))
+  {
+    if (HttpdPcb)
+    {
+      tcp_close(HttpdPcb);
+      HttpdPcb = NULL;
+    }
+    printf("HTTP server stopped, %u requests %u bytes served\n",
+           HttpdRequests, HttpdBytes);
+    return TASK_FINISHED;
+  }
+
+  /* Otherwise start the server if not yet running. */
+  if (HttpdPcb == NULL)
+  {
+    pcb = tcp_new();
+    if (pcb == NULL)
+    {
+      puts("HTTP server out of memory");
+      return TASK_FINISHED;
+    }
+    if (tcp_bind(pcb, IP_ADDR_ANY, PORT_HTTP) != ERR_OK)
+    {
+      puts("HTTP port in use");
+      tcp_close(pcb);
+      return TASK_FINISHED;
+    }
+
+    /* Listen frees the pcb, returning a smaller listen pcb. */
+    HttpdPcb = tcp_listen(pcb);
+    if (HttpdPcb == NULL)
+    {
+      puts("HTTP server out of memory");
+      tcp_close(pcb);
+      return TASK_FINISHED;
+    }
+
+    /* The task of a server just stopped may still be running. */
+    if (!HttpdTask)
+    {
+      if (TaskNew(HTTPD_TASK_PRIORITY, httpd_poll, HttpdSessions) == NULL)
+      {
+        puts("HTTP server task failed");
+        tcp_close(HttpdPcb);
+        HttpdPcb = NULL;
+        return TASK_FINISHED;
+      }
+      HttpdTask = TRUE;
+    }
+    tcp_accept(HttpdPcb, httpd_accept);
+    HttpdRequests = HttpdBytes = 0;
+  }
+
+  for (i = 0; i < HTTPD_MAX_SESSIONS; ++i)
+    if (HttpdSessions[i].pcb)
+      ++active;
+  printf("HTTP server on port %u, %u sessions, %u requests %u bytes "
+         "served\n", PORT_HTTP, active, HttpdRequests, HttpdBytes);
+  return TASK_FINISHED;
+}
+
+#endif /* ENABLE_TCP */
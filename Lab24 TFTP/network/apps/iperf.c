@@ -0,0 +1,1073 @@
+/*...................................................................*/
+/*                                                                   */
+/*   Module:  iperf.c                                                */
+/*   Version: 2020.0                                                 */
+/*   Purpose: iperf2 compatible UDP and TCP throughput test          */
+/*                                                                   */
+/*...................................................................*/
+/*                                                                   */
+/*                   Copyright 2020, Sean Lawless                    */
+/*                                                                   */
+/*                      ALL RIGHTS RESERVED                          */
+/*                                                                   */
+/* Redistribution and use in source, binary or derived forms, with   */
+/* or without modification, are permitted provided that the          */
+/* following conditions are met:                                     */
+/*                                                                   */
+/*  1. Redistributions in any form, including but not limited to     */
+/*     source code, binary, or derived works, must include the above */
+/*     copyright notice, this list of conditions and the following   */
+/*     disclaimer.                                                   */
+/*                                                                   */
+/*  2. Any change or addition to this copyright notice requires the  */
+/*     prior written permission of the above copyright holder.       */
+/*                                                                   */
+/* THIS SOFTWARE IS PROVIDED ''AS IS''. ANY EXPRESS OR IMPLIED       */
+/* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES */
+/* OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE       */
+/* DISCLAIMED. IN NO EVENT SHALL ANY AUTHOR AND/OR COPYRIGHT HOLDER  */
+/* BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,          */
+/* EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED   */
+/* TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,     */
+/* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON */
+/* ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,   */
+/* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY    */
+/* OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE           */
+/* POSSIBILITY OF SUCH DAMAGE.                                       */
+/*...................................................................*/
+#include <system.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if ENABLE_UDP
+
+#include <lwip/udp.h>
+#include <lwip/pbuf.h>
+#include <lwip/def.h>
+#if ENABLE_TCP
+#include <lwip/tcp.h>
+#endif
+
+/*...................................................................*/
+/* Symbol Definitions                                                */
+/*...................................................................*/
+#define PORT_IPERF           5001
+#define IPERF_TIME           10   /* default test seconds */
+#define IPERF_MAX_TIME       30   /* so microseconds fit in 32 bits */
+#define IPERF_UDP_RATE       1000 /* default Kbit/s, as iperf2 */
+#define IPERF_UDP_LENGTH     1470 /* default and largest datagram */
+#define IPERF_UDP_HEADER     12   /* id, tv_sec and tv_usec */
+#define IPERF_REPORT_WORDS   10   /* the server report after the FIN */
+#define IPERF_REPORT_FLAG    0x80000000
+#define IPERF_BUFFER_LENGTH  8192 /* zeros, the payload sent */
+#define IPERF_BURST          8    /* most datagrams sent per poll */
+#define IPERF_STALL          (100 * 1000) /* restart pacing after */
+#define IPERF_FIN_RETRIES    10
+#define IPERF_FIN_INTERVAL   (250 * 1000)
+#define IPERF_CONNECT_TIME   (5 * MICROS_PER_SECOND)
+#define IPERF_DRAIN_TIME     (2 * MICROS_PER_SECOND)
+#define IPERF_TASK_PRIORITY  4
+
+/* Client states */
+#define IPERF_IDLE           0
+#define IPERF_CONNECT        1 /* TCP handshake */
+#define IPERF_SEND           2 /* sending for the test time */
+#define IPERF_FIN            3 /* UDP, until the server reports */
+#define IPERF_DRAIN          4 /* TCP, until the data is acked */
+#define IPERF_DONE           5
+
+/* CPU time of a test in microseconds, the network layers are the
+ * change in NetCpu and the rest measured by the callbacks. */
+struct iperf_cpu
+{
+  struct net_cpu net;   /* NetCpu when the test started */
+  u32 callback;         /* in the lwIP receive and sent callbacks */
+  u32 task;             /* in the client task */
+  u32 output;           /* in lwIP output, from either of the above */
+};
+
+/* The client, one test at a time */
+struct iperf_client
+{
+  u8 state;             /* IPERF_IDLE until started */
+  u8 udp;               /* TRUE for UDP, otherwise TCP */
+  u16 port;             /* the server port */
+  ip_addr_t server;     /* the server address */
+  u32 length;           /* datagram or TCP write length */
+  u32 rate;             /* UDP Kbit/s */
+  u32 time;             /* test microseconds */
+  u32 interval;         /* microseconds between datagrams */
+  u64 start;            /* when the test started */
+  u64 next;             /* next datagram, FIN or deadline */
+  u32 elapsed;          /* test microseconds when sending stopped */
+  u32 bytes;            /* sent, or acked for TCP */
+  i32 id;               /* next datagram id */
+  u32 fins;             /* FIN datagrams sent */
+  struct udp_pcb *udp_pcb;
+#if ENABLE_TCP
+  struct tcp_pcb *tcp_pcb;
+#endif
+  struct iperf_cpu cpu;
+};
+
+/* The UDP server statistics of the test in progress */
+struct iperf_udp_server
+{
+  u8 active;            /* TRUE from first datagram until the FIN */
+  u8 reported;          /* TRUE if report holds the last test */
+  u16 port;             /* the client port */
+  ip_addr_t peer;       /* the client address */
+  u64 start, end;       /* first and last datagram arrival */
+  u32 datagrams, bytes; /* received */
+  u32 outorder;         /* received after a higher id */
+  i32 highest;          /* highest id received */
+  u32 transit;          /* relative transit time of the last */
+  u32 jitter;           /* RFC 1889 jitter, 1/16 microseconds */
+  u32 report[IPERF_REPORT_WORDS]; /* network order, for FIN retries */
+  struct iperf_cpu cpu;
+};
+
+#if ENABLE_TCP
+/* The TCP server stream, one at a time */
+struct iperf_tcp_server
+{
+  struct tcp_pcb *pcb;  /* the client connection */
+  u64 start;            /* when accepted */
+  u32 bytes;            /* received */
+  struct iperf_cpu cpu;
+};
+#endif
+
+/*...................................................................*/
+/* Global Variables                                                  */
+/*...................................................................*/
+extern int NetUp;
+static const u8 IperfZero[IPERF_BUFFER_LENGTH];
+static struct iperf_client IperfClient;
+static struct shell_state *IperfShell = NULL; /* waiting for client */
+static struct udp_pcb *IperfUdpPcb = NULL;
+static struct iperf_udp_server IperfUdp;
+#if ENABLE_TCP
+static struct tcp_pcb *IperfTcpPcb = NULL;
+static struct iperf_tcp_server IperfTcp;
+#endif
+
+/*...................................................................*/
+/* Local function definitions                                        */
+/*...................................................................*/
+
+/*...................................................................*/
+/* iperf_cpu_start: Record the CPU time counters at test start       */
+/*                                                                   */
+/*      Input: cpu - the CPU time of the test                        */
+/*...................................................................*/
+static void iperf_cpu_start(struct iperf_cpu *cpu)
+{
+  cpu->net = NetCpu;
+  cpu->callback = cpu->task = cpu->output = 0;
+}
+
+/*...................................................................*/
+/* iperf_cpu_report: Display the CPU time of each layer              */
+/*                                                                   */
+/*      Input: cpu - the CPU time of the test                        */
+/*             elapsed - microseconds of the test                    */
+/*...................................................................*/
+static void iperf_cpu_report(struct iperf_cpu *cpu, u32 elapsed)
+{
+  u32 ms = elapsed / 1000, driver, input, output, app;
+
+  if (ms == 0)
+    ms = 1;
+
+  /* Input time includes the callbacks, which include output. */
+  driver = NetCpu.driver - cpu->net.driver;
+  input = NetCpu.input - cpu->net.input;
+  input = (input > cpu->callback) ? input - cpu->callback : 0;
+  output = cpu->output;
+  app = cpu->callback + cpu->task;
+  app = (app > output) ? app - output : 0;
+
+  /* Microseconds per millisecond is tenths of a percent. */
+  driver /= ms;
+  input /= ms;
+  output /= ms;
+  app /= ms;
+  printf("CPU %u ms: driver %u.%u%%, lwIP input %u.%u%%, "
+         "lwIP output %u.%u%%, iperf %u.%u%%\n", ms,
+         driver / 10, driver % 10, input / 10, input % 10,
+         output / 10, output % 10, app / 10, app % 10);
+}
+
+/*...................................................................*/
+/* iperf_rate_report: Display the bytes and bandwidth of a test      */
+/*                                                                   */
+/*      Input: bytes - the data transferred                          */
+/*             elapsed - microseconds of the test                    */
+/*...................................................................*/
+static void iperf_rate_report(u32 bytes, u32 elapsed)
+{
+  u32 ms = elapsed / 1000, kbps;
+
+  if (ms == 0)
+    ms = 1;
+
+  /* Bits per millisecond without a 64 bit multiply and divide. */
+  kbps = (bytes / ms) * 8 + ((bytes % ms) * 8) / ms;
+  printf("0.0-%u.%u sec %u KBytes %u.%02u Mbits/sec", ms / 1000,
+         (ms % 1000) / 100, bytes / 1024, kbps / 1000,
+         (kbps % 1000) / 10);
+}
+
+/*...................................................................*/
+/* iperf_udp_report: Display the results of a UDP test               */
+/*                                                                   */
+/*      Input: report - the iperf2 server report, host order         */
+/*...................................................................*/
+static void iperf_udp_report(u32 *report)
+{
+  u32 lost = report[5], total = report[7], permille;
+  u32 jitter = report[8] * 1000000 + report[9];
+
+  permille = total ? (lost * 1000) / total : 0;
+  iperf_rate_report(report[2], report[3] * 1000000 + report[4]);
+  printf(" %u.%03u ms %u/%u (%u.%u%%)", jitter / 1000, jitter % 1000,
+         lost, total, permille / 10, permille % 10);
+  if (report[6])
+    printf(" %u out of order", report[6]);
+  puts("");
+}
+
+/*...................................................................*/
+/* iperf_udp_recv: Receive a datagram of a UDP test                  */
+/*                                                                   */
+/*      Input: arg - the UDP server statistics                       */
+/*             pcb - the server UDP port                             */
+/*             p - the datagram received                             */
+/*             addr - the client address                             */
+/*             port - the client port                                */
+/*...................................................................*/
+static void iperf_udp_recv(void *arg, struct udp_pcb *pcb,
+                           struct pbuf *p, ip_addr_t *addr, u16_t port)
+{
+  struct iperf_udp_server *s = arg;
+  u32 header[IPERF_UDP_HEADER / 4], transit, expected, lost, i;
+  u32 message[IPERF_UDP_HEADER / 4 + IPERF_REPORT_WORDS];
+  struct pbuf *reply;
+  u64 start = TimerNow();
+  i32 id, delta;
+
+  /* The payload may be only 16 bit aligned, so copy the header. */
+  if (pbuf_copy_partial(p, header, IPERF_UDP_HEADER, 0) !=
+      IPERF_UDP_HEADER)
+  {
+    pbuf_free(p);
+    return;
+  }
+  id = (i32)ntohl(header[0]);
+
+  /* The first datagram from a client starts a test. */
+  if (!s->active && (id >= 0))
+  {
+    s->active = TRUE;
+    s->reported = FALSE;
+    ip_addr_copy(s->peer, *addr);
+    s->port = port;
+    s->start = start;
+    s->datagrams = s->bytes = s->outorder = 0;
+    s->highest = -1;
+    s->jitter = 0;
+    iperf_cpu_start(&s->cpu);
+  }
+
+  /* Ignore other clients, one test at a time. */
+  else if (!ip_addr_cmp(addr, &s->peer) || (port != s->port))
+  {
+    pbuf_free(p);
+    return;
+  }
+
+  if (s->active && (id >= 0))
+  {
+    ++s->datagrams;
+    s->bytes += p->tot_len;
+    if (id > s->highest)
+      s->highest = id;
+    else
+      ++s->outorder;
+
+    /* Interarrival jitter (RFC 1889), the transit time relative to
+     * the client clock, smoothed in 1/16 microseconds. */
+    transit = (u32)start - (ntohl(header[1]) * 1000000 +
+                            ntohl(header[2]));
+    if (s->datagrams > 1)
+    {
+      delta = (i32)(transit - s->transit);
+      if (delta < 0)
+        delta = -delta;
+      s->jitter += delta - ((s->jitter + 8) >> 4);
+    }
+    s->transit = transit;
+    s->end = start;
+  }
+
+  /* A negative id ends the test, the FIN, answered with the report
+   * until the client stops sending it. */
+  else if (id < 0)
+  {
+    if (s->active)
+    {
+      s->active = FALSE;
+      s->reported = TRUE;
+
+      /* The FIN id is the datagrams sent, as is the highest id + 1. */
+      expected = s->highest + 1;
+      if ((u32)-id > expected)
+        expected = -id;
+      lost = (expected > s->datagrams) ? expected - s->datagrams : 0;
+
+      s->report[0] = IPERF_REPORT_FLAG;
+      s->report[1] = 0;
+      s->report[2] = s->bytes;
+      transit = (u32)(s->end - s->start);
+      s->report[3] = transit / 1000000;
+      s->report[4] = transit % 1000000;
+      s->report[5] = lost;
+      s->report[6] = s->outorder;
+      s->report[7] = expected;
+      s->report[8] = (s->jitter >> 4) / 1000000;
+      s->report[9] = (s->jitter >> 4) % 1000000;
+
+      printf("iperf UDP %u.%u.%u.%u port %u: ", ip4_addr1(addr),
+             ip4_addr2(addr), ip4_addr3(addr), ip4_addr4(addr), port);
+      iperf_udp_report(s->report);
+      s->cpu.callback += (u32)(TimerNow() - start);
+      iperf_cpu_report(&s->cpu, transit);
+      for (i = 0; i < IPERF_REPORT_WORDS; ++i)
+        s->report[i] = htonl(s->report[i]);
+    }
+
+    if (s->reported)
+    {
+      reply = pbuf_alloc(PBUF_TRANSPORT, sizeof(message), PBUF_RAM);
+      if (reply)
+      {
+        memcpy(message, header, IPERF_UDP_HEADER);
+        memcpy(&message[IPERF_UDP_HEADER / 4], s->report,
+               sizeof(s->report));
+        pbuf_take(reply, message, sizeof(message));
+        udp_sendto(pcb, reply, addr, port);
+        pbuf_free(reply);
+      }
+    }
+  }
+  pbuf_free(p);
+  if (s->active)
+    s->cpu.callback += (u32)(TimerNow() - start);
+}
+
+/*...................................................................*/
+/* iperf_datagram: Send a datagram of the client UDP test            */
+/*                                                                   */
+/*      Input: c - the client                                        */
+/*             id - the datagram id, negative for the FIN            */
+/*             now - the current time                                */
+/*                                                                   */
+/*    Returns: ERR_OK or the lwIP error                              */
+/*...................................................................*/
+static err_t iperf_datagram(struct iperf_client *c, i32 id, u64 now)
+{
+  u32 header[IPERF_UDP_HEADER / 4], elapsed = (u32)(now - c->start);
+  struct pbuf *p, *data;
+  err_t err;
+
+  /* The header is copied, the zero payload sent by reference. */
+  p = pbuf_alloc(PBUF_TRANSPORT, IPERF_UDP_HEADER, PBUF_RAM);
+  if (p == NULL)
+    return ERR_MEM;
+  data = pbuf_alloc(PBUF_RAW, c->length - IPERF_UDP_HEADER, PBUF_REF);
+  if (data == NULL)
+  {
+    pbuf_free(p);
+    return ERR_MEM;
+  }
+  data->payload = (void *)IperfZero;
+
+  /* The timestamp is relative to the start of the test. */
+  header[0] = htonl(id);
+  header[1] = htonl(elapsed / 1000000);
+  header[2] = htonl(elapsed % 1000000);
+  pbuf_take(p, header, IPERF_UDP_HEADER);
+  pbuf_cat(p, data);
+
+  err = udp_send(c->udp_pcb, p);
+  c->cpu.output += (u32)(TimerNow() - now);
+  pbuf_free(p);
+  if ((err == ERR_OK) && (id >= 0))
+    c->bytes += c->length;
+  return err;
+}
+
+/*...................................................................*/
+/* iperf_client_recv: Receive the server report of a UDP test        */
+/*                                                                   */
+/*      Input: arg - the client                                      */
+/*             pcb - the client UDP port                             */
+/*             p - the datagram received                             */
+/*             addr - the server address                             */
+/*             port - the server port                                */
+/*...................................................................*/
+static void iperf_client_recv(void *arg, struct udp_pcb *pcb,
+                              struct pbuf *p, ip_addr_t *addr,
+                              u16_t port)
+{
+  struct iperf_client *c = arg;
+  u32 report[IPERF_REPORT_WORDS], i;
+
+  if ((c->state == IPERF_FIN) &&
+      (pbuf_copy_partial(p, report, sizeof(report), IPERF_UDP_HEADER) ==
+       sizeof(report)) && (ntohl(report[0]) & IPERF_REPORT_FLAG))
+  {
+    for (i = 0; i < IPERF_REPORT_WORDS; ++i)
+      report[i] = ntohl(report[i]);
+    printf("Server report: ");
+    iperf_udp_report(report);
+    c->state = IPERF_DONE;
+  }
+  pbuf_free(p);
+}
+
+#if ENABLE_TCP
+/*...................................................................*/
+/* iperf_tcp_fill: Queue data of the client TCP test                 */
+/*                                                                   */
+/*      Input: c - the client                                        */
+/*...................................................................*/
+static void iperf_tcp_fill(struct iperf_client *c)
+{
+  struct tcp_pcb *pcb = c->tcp_pcb;
+  u64 start = TimerNow();
+  u32 length;
+
+  /* Queue the zeros by reference until the send buffer is full. */
+  while (tcp_sndqueuelen(pcb) < TCP_SND_QUEUELEN)
+  {
+    length = min(tcp_sndbuf(pcb), c->length);
+    if ((length == 0) || (tcp_write(pcb, IperfZero, length, 0) != ERR_OK))
+      break;
+  }
+  tcp_output(pcb);
+  c->cpu.output += (u32)(TimerNow() - start);
+}
+
+/*...................................................................*/
+/* iperf_tcp_connected: Start the test once connected                */
+/*                                                                   */
+/*      Input: arg - the client                                      */
+/*             pcb - the client connection                           */
+/*             err - ERR_OK                                          */
+/*                                                                   */
+/*    Returns: ERR_OK                                                */
+/*...................................................................*/
+static err_t iperf_tcp_connected(void *arg, struct tcp_pcb *pcb,
+                                 err_t err)
+{
+  struct iperf_client *c = arg;
+
+  c->state = IPERF_SEND;
+  c->start = TimerNow();
+  iperf_cpu_start(&c->cpu);
+  iperf_tcp_fill(c);
+  return ERR_OK;
+}
+
+/*...................................................................*/
+/* iperf_tcp_sent: Count the data acked and queue more               */
+/*                                                                   */
+/*      Input: arg - the client                                      */
+/*             pcb - the client connection                           */
+/*             len - the bytes acknowledged                          */
+/*                                                                   */
+/*    Returns: ERR_OK                                                */
+/*...................................................................*/
+static err_t iperf_tcp_sent(void *arg, struct tcp_pcb *pcb, u16_t len)
+{
+  struct iperf_client *c = arg;
+  u64 start = TimerNow();
+
+  c->bytes += len;
+  if ((c->state == IPERF_SEND) && ((u32)(start - c->start) < c->time))
+    iperf_tcp_fill(c);
+  c->cpu.callback += (u32)(TimerNow() - start);
+  return ERR_OK;
+}
+
+/*...................................................................*/
+/* iperf_tcp_err: The client connection failed or was reset          */
+/*                                                                   */
+/*      Input: arg - the client                                      */
+/*             err - the reason, the pcb is already freed            */
+/*...................................................................*/
+static void iperf_tcp_err(void *arg, err_t err)
+{
+  struct iperf_client *c = arg;
+
+  c->tcp_pcb = NULL;
+  if (c->state == IPERF_CONNECT)
+    puts("iperf connect failed");
+  else if (c->state != IPERF_DONE)
+    puts("iperf connection reset");
+  c->state = IPERF_DONE;
+}
+#endif /* ENABLE_TCP */
+
+/*...................................................................*/
+/* iperf_client_poll: Drive the client test until finished           */
+/*                                                                   */
+/*      Input: data - the client                                     */
+/*                                                                   */
+/*    Returns: TASK_IDLE, or TASK_FINISHED once the test is done     */
+/*...................................................................*/
+static int iperf_client_poll(void *data)
+{
+  struct iperf_client *c = data;
+  u64 now = TimerNow();
+  int i;
+
+  switch (c->state)
+  {
+    case IPERF_SEND:
+      if ((u32)(now - c->start) >= c->time)
+      {
+        c->elapsed = (u32)(now - c->start);
+        if (c->udp)
+        {
+          iperf_rate_report(c->bytes, c->elapsed);
+          printf(" %u datagrams\n", c->id);
+          iperf_cpu_report(&c->cpu, c->elapsed);
+          c->state = IPERF_FIN;
+          c->next = now;
+        }
+#if ENABLE_TCP
+        else
+        {
+          c->state = IPERF_DRAIN;
+          c->next = now + IPERF_DRAIN_TIME;
+        }
+#endif
+        break;
+      }
+
+#if ENABLE_TCP
+      if (!c->udp)
+      {
+        iperf_tcp_fill(c);
+        break;
+      }
+#endif
+
+      /* Send the datagrams that are due, a burst at most. */
+      for (i = 0; (i < IPERF_BURST) && (now >= c->next); ++i)
+      {
+        if (iperf_datagram(c, c->id, now) == ERR_OK)
+          ++c->id;
+        c->next += c->interval;
+      }
+
+      /* Do not catch up after a stall, such as console output. */
+      if (now > c->next + IPERF_STALL)
+        c->next = now;
+      break;
+
+    case IPERF_FIN:
+      if (now < c->next)
+        break;
+      if (c->fins == IPERF_FIN_RETRIES)
+      {
+        puts("iperf no report from server");
+        c->state = IPERF_DONE;
+        break;
+      }
+      iperf_datagram(c, -c->id, now);
+      ++c->fins;
+      c->next = now + IPERF_FIN_INTERVAL;
+      break;
+
+#if ENABLE_TCP
+    case IPERF_CONNECT:
+      if (now >= c->next)
+      {
+        puts("iperf connect timed out");
+        tcp_abort(c->tcp_pcb);
+      }
+      break;
+
+    /* Wait for the data queued to be acked before the report. */
+    case IPERF_DRAIN:
+      if (c->tcp_pcb->unsent || c->tcp_pcb->unacked)
+        if (now < c->next)
+          break;
+      c->elapsed = (u32)(now - c->start);
+      iperf_rate_report(c->bytes, c->elapsed);
+      puts("");
+      iperf_cpu_report(&c->cpu, c->elapsed);
+      c->state = IPERF_DONE;
+      break;
+#endif
+
+    default:
+      break;
+  }
+
+  /* Free the connection and end the task once done. */
+  if (c->state == IPERF_DONE)
+  {
+    if (c->udp_pcb)
+      udp_remove(c->udp_pcb);
+    c->udp_pcb = NULL;
+#if ENABLE_TCP
+    if (c->tcp_pcb)
+    {
+      tcp_arg(c->tcp_pcb, NULL);
+      tcp_sent(c->tcp_pcb, NULL);
+      tcp_err(c->tcp_pcb, NULL);
+      if (tcp_close(c->tcp_pcb) != ERR_OK)
+        tcp_abort(c->tcp_pcb);
+    }
+    c->tcp_pcb = NULL;
+#endif
+    c->state = IPERF_IDLE;
+    return TASK_FINISHED;
+  }
+
+  c->cpu.task += (u32)(TimerNow() - now);
+  return TASK_IDLE;
+}
+
+#if ENABLE_TCP
+/*...................................................................*/
+/* iperf_stream_end: Report and close the TCP server stream          */
+/*                                                                   */
+/*      Input: s - the TCP server stream                             */
+/*...................................................................*/
+static void iperf_stream_end(struct iperf_tcp_server *s)
+{
+  u32 elapsed = (u32)(TimerNow() - s->start);
+
+  printf("iperf TCP %u.%u.%u.%u port %u: ", ip4_addr1(&s->pcb->remote_ip),
+         ip4_addr2(&s->pcb->remote_ip), ip4_addr3(&s->pcb->remote_ip),
+         ip4_addr4(&s->pcb->remote_ip), s->pcb->remote_port);
+  iperf_rate_report(s->bytes, elapsed);
+  puts("");
+  iperf_cpu_report(&s->cpu, elapsed);
+}
+
+/*...................................................................*/
+/* iperf_stream_recv: Count and discard the data of a TCP test       */
+/*                                                                   */
+/*      Input: arg - the TCP server stream                           */
+/*             pcb - the client connection                           */
+/*             p - the data received, NULL once the client closed    */
+/*             err - ERR_OK                                          */
+/*                                                                   */
+/*    Returns: ERR_OK                                                */
+/*...................................................................*/
+static err_t iperf_stream_recv(void *arg, struct tcp_pcb *pcb,
+                               struct pbuf *p, err_t err)
+{
+  struct iperf_tcp_server *s = arg;
+  u64 start = TimerNow();
+
+  /* The client closed, the test is over. */
+  if (p == NULL)
+  {
+    iperf_stream_end(s);
+    tcp_arg(pcb, NULL);
+    tcp_recv(pcb, NULL);
+    tcp_err(pcb, NULL);
+    s->pcb = NULL;
+    if (tcp_close(pcb) != ERR_OK)
+    {
+      tcp_abort(pcb);
+      return ERR_ABRT;
+    }
+    return ERR_OK;
+  }
+
+  s->bytes += p->tot_len;
+  tcp_recved(pcb, p->tot_len);
+  pbuf_free(p);
+  s->cpu.callback += (u32)(TimerNow() - start);
+  return ERR_OK;
+}
+
+/*...................................................................*/
+/* iperf_stream_err: The TCP server stream was reset                 */
+/*                                                                   */
+/*      Input: arg - the TCP server stream                           */
+/*             err - the reason, the pcb is already freed            */
+/*...................................................................*/
+static void iperf_stream_err(void *arg, err_t err)
+{
+  struct iperf_tcp_server *s = arg;
+
+  printf("iperf TCP reset after %u KBytes\n", s->bytes / 1024);
+  s->pcb = NULL;
+}
+
+/*...................................................................*/
+/* iperf_stream_accept: Start a TCP server test                      */
+/*                                                                   */
+/*      Input: arg - the TCP server stream                           */
+/*             pcb - the client connection                           */
+/*             err - ERR_OK                                          */
+/*                                                                   */
+/*    Returns: ERR_OK, or ERR_MEM to refuse if a test is running     */
+/*...................................................................*/
+static err_t iperf_stream_accept(void *arg, struct tcp_pcb *pcb,
+                                 err_t err)
+{
+  struct iperf_tcp_server *s = arg;
+
+  /* Returning an error resets the connection. */
+  if (s->pcb)
+    return ERR_MEM;
+  tcp_accepted(IperfTcpPcb);
+
+  s->pcb = pcb;
+  s->start = TimerNow();
+  s->bytes = 0;
+  iperf_cpu_start(&s->cpu);
+  tcp_arg(pcb, s);
+  tcp_recv(pcb, iperf_stream_recv);
+  tcp_err(pcb, iperf_stream_err);
+  return ERR_OK;
+}
+#endif /* ENABLE_TCP */
+
+/*...................................................................*/
+/* iperf_next: Find the next word of a command                       */
+/*                                                                   */
+/*      Input: text - the current word                               */
+/*                                                                   */
+/*    Returns: the next word or NULL if none                         */
+/*...................................................................*/
+static const char *iperf_next(const char *text)
+{
+  text = strchr(text, ' ');
+  if (text == NULL)
+    return NULL;
+  while (*text == ' ')
+    ++text;
+  return *text ? text : NULL;
+}
+
+/*...................................................................*/
+/* iperf_number: Convert the decimal number at the start of a word   */
+/*                                                                   */
+/*      Input: text - the word, updated to after the digits          */
+/*                                                                   */
+/*    Returns: the number, zero if none                              */
+/*...................................................................*/
+static u32 iperf_number(const char **text)
+{
+  u32 number = 0;
+
+  /* Unlike atoi() stop at the first non-digit, the next option. */
+  for (; (**text >= '0') && (**text <= '9'); ++*text)
+    number = number * 10 + (**text - '0');
+  return number;
+}
+
+/*...................................................................*/
+/* iperf_rate: Convert a bandwidth with an optional K, M or G suffix */
+/*                                                                   */
+/*      Input: text - the bandwidth in bits per second               */
+/*                                                                   */
+/*    Returns: the bandwidth in Kbit/s                               */
+/*...................................................................*/
+static u32 iperf_rate(const char *text)
+{
+  u32 rate = iperf_number(&text);
+
+  if ((*text | 0x20) == 'g')
+    return rate * 1000000;
+  if ((*text | 0x20) == 'm')
+    return rate * 1000;
+  if ((*text | 0x20) == 'k')
+    return rate;
+  return rate / 1000;
+}
+
+/*...................................................................*/
+/* iperf_server: Start the UDP or TCP server                         */
+/*                                                                   */
+/*      Input: udp - TRUE for the UDP server, otherwise TCP          */
+/*             port - the port to listen on                          */
+/*...................................................................*/
+static void iperf_server(int udp, u16 port)
+{
+#if ENABLE_TCP
+  struct tcp_pcb *pcb;
+#endif
+
+  if (udp)
+  {
+    if (IperfUdpPcb == NULL)
+    {
+      IperfUdpPcb = udp_new();
+      if (IperfUdpPcb == NULL)
+      {
+        puts("iperf out of memory");
+        return;
+      }
+      if (udp_bind(IperfUdpPcb, IP_ADDR_ANY, port) != ERR_OK)
+      {
+        puts("iperf port in use");
+        udp_remove(IperfUdpPcb);
+        IperfUdpPcb = NULL;
+        return;
+      }
+      bzero(&IperfUdp, sizeof(IperfUdp));
+      udp_recv(IperfUdpPcb, iperf_udp_recv, &IperfUdp);
+    }
+    printf("iperf UDP server on port %u\n", IperfUdpPcb->local_port);
+    return;
+  }
+
+#if ENABLE_TCP
+  if (IperfTcpPcb == NULL)
+  {
+    pcb = tcp_new();
+    if (pcb == NULL)
+    {
+      puts("iperf out of memory");
+      return;
+    }
+    if (tcp_bind(pcb, IP_ADDR_ANY, port) != ERR_OK)
+    {
+      puts("iperf port in use");
+      tcp_close(pcb);
+      return;
+    }
+
+    /* Listen frees the pcb, returning a smaller listen pcb. */
+    IperfTcpPcb = tcp_listen(pcb);
+    if (IperfTcpPcb == NULL)
+    {
+      puts("iperf out of memory");
+      tcp_close(pcb);
+      return;
+    }
+    tcp_arg(IperfTcpPcb, &IperfTcp);
+    tcp_accept(IperfTcpPcb, iperf_stream_accept);
+  }
+  printf("iperf TCP server on port %u\n", IperfTcpPcb->local_port);
+#else
+  puts("iperf TCP not enabled, use -u");
+#endif
+}
+
+/*...................................................................*/
+/* Global function definitions                                       */
+/*...................................................................*/
+
+/*...................................................................*/
+/*      Iperf: Run an iperf2 compatible throughput test              */
+/*                                                                   */
+/*      Input: command - "iperf -s [-u] [-p port]" starts a server,  */
+/*                       "iperf -c host [-u] [-t secs] [-b rate]     */
+/*                       [-l len] [-p port]" runs a client test,     */
+/*                       "iperf off" stops the servers               */
+/*                                                                   */
+/*    Returns: TASK_IDLE while the client runs, or TASK_FINISHED     */
+/*...................................................................*/
+int Iperf(const char *command)
+{
+  struct iperf_client *c = &IperfClient;
+  const char *arg, *value;
+  int server = FALSE, udp = FALSE, host = FALSE;
+  u32 time = IPERF_TIME, rate = IPERF_UDP_RATE, length = 0;
+  u16 port = PORT_IPERF;
+  ip_addr_t address;
+
+  /* Wait for the client test started by this shell. */
+  if (IperfShell && (IperfShell == StdioState))
+  {
+    if (c->state != IPERF_IDLE)
+      return TASK_IDLE;
+    IperfShell = NULL;
+    return TASK_FINISHED;
+  }
+
+  if (!NetUp)
+  {
+    puts("Network down, use 'net' command to enable.");
+    return TASK_FINISHED;
+  }
+
+  for (arg = iperf_next(command); arg; arg = iperf_next(arg))
+  {
+    /* Stop the servers, ending a TCP test in progress. */
+    if (strcmp(arg, "off") == 0)
+    {
+      if (IperfUdpPcb)
+        udp_remove(IperfUdpPcb);
+      IperfUdpPcb = NULL;
+#if ENABLE_TCP
+      if (IperfTcpPcb)
+        tcp_close(IperfTcpPcb);
+      IperfTcpPcb = NULL;
+      if (IperfTcp.pcb)
+        tcp_abort(IperfTcp.pcb);
+#endif
+      puts("iperf servers stopped");
+      return TASK_FINISHED;
+    }
+    if ((arg[0] != '-') || (arg[1] == '\0') || (arg[2] && arg[2] != ' '))
+      break;
+
+    /* Options without a value. */
+    if (arg[1] == 's')
+    {
+      server = TRUE;
+      continue;
+    }
+    if (arg[1] == 'u')
+    {
+      udp = TRUE;
+      continue;
+    }
+
+    /* Options with a value. */
+    value = iperf_next(arg);
+    if (value == NULL)
+      break;
+    if (arg[1] == 'c')
+    {
+      if (!ipaddr_aton(value, &address))
+        break;
+      host = TRUE;
+    }
+    else if (arg[1] == 't')
+      time = iperf_number(&value);
+    else if (arg[1] == 'b')
+      rate = iperf_rate(value);
+    else if (arg[1] == 'l')
+      length = iperf_number(&value);
+    else if (arg[1] == 'p')
+      port = iperf_number(&value);
+    else
+      break;
+    arg = value;
+  }
+
+  if (arg || (server == host))
+  {
+    puts("iperf -s [-u] [-p port]");
+    puts("iperf -c host [-u] [-t secs] [-b rate[K|M|G]] [-l len] "
+         "[-p port]");
+    puts("iperf off");
+    return TASK_FINISHED;
+  }
+
+  if (server)
+  {
+    iperf_server(udp, port);
+    return TASK_FINISHED;
+  }
+
+#if !ENABLE_TCP
+  if (!udp)
+  {
+    puts("iperf TCP not enabled, use -u");
+    return TASK_FINISHED;
+  }
+#endif
+  if ((c->state != IPERF_IDLE) || IperfShell)
+  {
+    puts("iperf client test in progress");
+    return TASK_FINISHED;
+  }
+
+  /* Set up the client, with iperf2 defaults and limits. */
+  bzero(c, sizeof(struct iperf_client));
+  c->udp = udp;
+  c->port = port;
+  ip_addr_copy(c->server, address);
+  c->time = min(max(time, 1), IPERF_MAX_TIME) * MICROS_PER_SECOND;
+  c->rate = max(rate, 1);
+  if (udp)
+  {
+    if (length == 0)
+      length = IPERF_UDP_LENGTH;
+    c->length = min(max(length, IPERF_UDP_HEADER +
+                        IPERF_REPORT_WORDS * 4), IPERF_UDP_LENGTH);
+    c->interval = (c->length * 8 * 1000) / c->rate;
+  }
+  else
+    c->length = length ? min(length, IPERF_BUFFER_LENGTH) :
+                IPERF_BUFFER_LENGTH;
+
+  if (udp)
+  {
+    c->udp_pcb = udp_new();
+    if ((c->udp_pcb == NULL) ||
+        (udp_connect(c->udp_pcb, &c->server, port) != ERR_OK))
+    {
+      puts("iperf out of memory");
+      if (c->udp_pcb)
+        udp_remove(c->udp_pcb);
+      return TASK_FINISHED;
+    }
+    udp_recv(c->udp_pcb, iperf_client_recv, c);
+    printf("iperf UDP to %s port %u, %u byte datagrams at %u Kbit/s\n",
+           ipaddr_ntoa(&c->server), port, c->length, c->rate);
+    c->state = IPERF_SEND;
+    c->start = c->next = TimerNow();
+    iperf_cpu_start(&c->cpu);
+  }
+#if ENABLE_TCP
+  else
+  {
+    c->tcp_pcb = tcp_new();
+    if (c->tcp_pcb == NULL)
+    {
+      puts("iperf out of memory");
+      return TASK_FINISHED;
+    }
+    tcp_arg(c->tcp_pcb, c);
+    tcp_sent(c->tcp_pcb, iperf_tcp_sent);
+    tcp_err(c->tcp_pcb, iperf_tcp_err);
+    printf("iperf TCP to %s port %u, %u byte writes\n",
+           ipaddr_ntoa(&c->server), port, c->length);
+    c->state = IPERF_CONNECT;
+    c->next = TimerNow() + IPERF_CONNECT_TIME;
+    if (tcp_connect(c->tcp_pcb, &c->server, port, iperf_tcp_connected)
+        != ERR_OK)
+    {
+      puts("iperf connect failed");
+      tcp_arg(c->tcp_pcb, NULL);
+      tcp_err(c->tcp_pcb, NULL);
+      tcp_abort(c->tcp_pcb);
+      c->state = IPERF_IDLE;
+      return TASK_FINISHED;
+    }
+  }
+#endif
+
+  if (TaskNew(IPERF_TASK_PRIORITY, iperf_client_poll, c) == NULL)
+  {
+    puts("iperf task failed");
+    c->state = IPERF_DONE;
+    iperf_client_poll(c);
+    return TASK_FINISHED;
+  }
+
+  /* The shell waits for the test to finish. */
+  IperfShell = StdioState;
+  return TASK_IDLE;
+}
+
+#endif /* ENABLE_UDP */
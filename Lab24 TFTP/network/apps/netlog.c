@@ -0,0 +1,503 @@
+/*...................................................................*/
+/*                                                                   */
+/*   Module:  netlog.c                                               */
+/*   Version: 2020.0                                                 */
+/*   Purpose: Console output streamed over UDP, raw or syslog        */
+/*                                                                   */
+/*...................................................................*/
+/*                                                                   */
+/*                   Copyright 2020, Sean Lawless                    */
+/*                                                                   */
+/*                      ALL RIGHTS RESERVED                          */
+/*                                                                   */
+/* Redistribution and use in source, binary or derived forms, with   */
+/* or without modification, are permitted provided that the          */
+/* following conditions are met:                                     */
+/*                                                                   */
+/*  1. Redistributions in any form, including but not limited to     */
+/*     source code, binary, or derived works, must include the above */
+/*     copyright notice, this list of conditions and the following   */
+/*     disclaimer.                                                   */
+/*                                                                   */
+/*  2. Any change or addition to this copyright notice requires the  */
+/*     prior written permission of the above copyright holder.       */
+/*                                                                   */
+/* THIS SOFTWARE IS PROVIDED ''AS IS''. ANY EXPRESS OR IMPLIED       */
+/* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES */
+/* OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE       */
+/* DISCLAIMED. IN NO EVENT SHALL ANY AUTHOR AND/OR COPYRIGHT HOLDER  */
+/* BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,          */
+/* EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED   */
+/* TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,     */
+/* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON */
+/* ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,   */
+/* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY    */
+/* OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE           */
+/* POSSIBILITY OF SUCH DAMAGE.                                       */
+/*...................................................................*/
+#include <system.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if ENABLE_UDP
+
+#include <lwip/udp.h>
+#include <lwip/pbuf.h>
+#include <lwip/netif.h>
+#include <netif/etharp.h>
+
+/*...................................................................*/
+/* Symbol Definitions                                                */
+/*...................................................................*/
+#define PORT_NETCONSOLE      6666 /* raw, as Linux netconsole */
+#define PORT_SYSLOG          514  /* RFC 5426 syslog over UDP */
+#define NETLOG_RING_SIZE     16384 /* power of two */
+#define NETLOG_DATAGRAM      1400 /* most log bytes in a datagram */
+#define NETLOG_HEADER        96   /* syslog header and drop notice */
+#define NETLOG_LATENCY       (20 * MICROS_PER_MILLISECOND)
+#define NETLOG_RATE          1000 /* default bytes per millisecond */
+#define NETLOG_BURST_TIME    100  /* milliseconds of rate to burst */
+#define NETLOG_ARP_INTERVAL  MICROS_PER_SECOND
+#define NETLOG_TASK_PRIORITY 5
+
+/* The log output not yet sent, and where it goes */
+struct netlog_state
+{
+  u8 ring[NETLOG_RING_SIZE]; /* output waiting to be sent */
+  u32 head, tail;        /* ring write and read indexes */
+  u64 first;             /* when the oldest output was written */
+  struct udp_pcb *pcb;   /* the socket, NULL until the network is up */
+  ip_addr_t collector;   /* where to send */
+  u16 port;              /* the collector port */
+  u8 syslog;             /* TRUE for RFC 5424, one line per message */
+  u8 task;               /* TRUE while the flush task runs */
+  u32 rate;              /* bytes per millisecond, KB/s */
+  u32 tokens;            /* bytes that may be sent now */
+  u64 refill;            /* when the tokens were last added */
+  u64 arp;               /* when the collector was last requested */
+  struct shell_state *shell; /* the output redirected */
+  void (*putc)(char character); /* the UART output before */
+  void (*puts)(const char *string);
+  u32 datagrams, bytes;  /* sent */
+  u32 dropped, noticed;  /* bytes lost to a full ring, and reported */
+  u32 throttled;         /* flushes deferred by the rate limit */
+};
+
+/*...................................................................*/
+/* Global Variables                                                  */
+/*...................................................................*/
+extern int NetUp;
+static struct netlog_state NetLogState;
+
+/*...................................................................*/
+/* Local function definitions                                        */
+/*...................................................................*/
+
+/*...................................................................*/
+/* netlog_putc: Queue a character of output                          */
+/*                                                                   */
+/*      Input: character - the character to output                  */
+/*...................................................................*/
+static void netlog_putc(char character)
+{
+  struct netlog_state *log = &NetLogState;
+
+  /* Use the UART until the network is up. */
+  if (!NetUp || (log->pcb == NULL))
+  {
+    log->putc(character);
+    return;
+  }
+
+  /* Lines end with a new line only. */
+  if (character == '\r')
+    return;
+
+  /* Drop the output if the ring is full, the newest is lost. */
+  if (log->head - log->tail >= NETLOG_RING_SIZE)
+  {
+    ++log->dropped;
+    return;
+  }
+  if (log->head == log->tail)
+    log->first = TimerNow();
+  log->ring[log->head++ & (NETLOG_RING_SIZE - 1)] = character;
+}
+
+/*...................................................................*/
+/* netlog_puts: Queue a line of output                               */
+/*                                                                   */
+/*      Input: string - the line to output, without the new line    */
+/*...................................................................*/
+static void netlog_puts(const char *string)
+{
+  if (!NetUp || (NetLogState.pcb == NULL))
+  {
+    NetLogState.puts(string);
+    return;
+  }
+  while (*string)
+    netlog_putc(*string++);
+  netlog_putc('\n');
+}
+
+/*...................................................................*/
+/* netlog_send: Send the start of the ring in a datagram             */
+/*                                                                   */
+/*      Input: log - the log state                                   */
+/*             length - the bytes of the ring to send                */
+/*                                                                   */
+/*    Returns: TRUE if sent, FALSE if out of memory                  */
+/*...................................................................*/
+static int netlog_send(struct netlog_state *log, u32 length)
+{
+  char header[NETLOG_HEADER];
+  u32 header_length = 0, offset, part;
+  struct pbuf *p;
+  u8 *data;
+
+  /* The syslog header (RFC 5424) is user.info with no timestamp. */
+  if (log->syslog)
+  {
+    sprintf(header, "<14>1 - %s console - - - ",
+            ipaddr_ntoa(&netif_default->ip_addr));
+    header_length = strlen(header);
+  }
+
+  /* Say what was lost since the last datagram, before the rest. */
+  if (log->dropped != log->noticed)
+  {
+    sprintf(&header[header_length], "[netlog dropped %u bytes]%s",
+            log->dropped - log->noticed, log->syslog ? " " : "\n");
+    header_length += strlen(&header[header_length]);
+  }
+
+  /* A RAM pbuf is contiguous, copy the ring in two parts if it wraps. */
+  p = pbuf_alloc(PBUF_TRANSPORT, header_length + length, PBUF_RAM);
+  if (p == NULL)
+    return FALSE;
+  data = p->payload;
+  memcpy(data, header, header_length);
+  offset = log->tail & (NETLOG_RING_SIZE - 1);
+  part = min(length, NETLOG_RING_SIZE - offset);
+  memcpy(&data[header_length], &log->ring[offset], part);
+  if (part < length)
+    memcpy(&data[header_length + part], log->ring, length - part);
+
+  udp_sendto(log->pcb, p, &log->collector, log->port);
+  pbuf_free(p);
+
+  log->noticed = log->dropped;
+  log->tail += length;
+  log->tokens = (log->tokens > length) ? log->tokens - length : 0;
+  log->bytes += length;
+  ++log->datagrams;
+  return TRUE;
+}
+
+/*...................................................................*/
+/* netlog_resolved: Check the collector, or gateway, is in ARP cache */
+/*                                                                   */
+/*      Input: log - the log state                                   */
+/*                                                                   */
+/*    Returns: TRUE if resolved, otherwise FALSE and ARP requested   */
+/*             at most once per NETLOG_ARP_INTERVAL                  */
+/*...................................................................*/
+static int netlog_resolved(struct netlog_state *log)
+{
+  struct netif *netif = netif_default;
+  struct eth_addr *ethernet;
+  ip_addr_t *hop, *found;
+
+  /* lwIP queues one datagram while resolving and frees the rest, so
+   * keep the output in the ring until the address is known. */
+  hop = &log->collector;
+  if (!ip_addr_netcmp(hop, &netif->ip_addr, &netif->netmask))
+    hop = &netif->gw;
+  if (etharp_find_addr(netif, hop, &ethernet, &found) >= 0)
+    return TRUE;
+
+  /* Each query broadcasts, so do not flood if no collector answers. */
+  if (TimerNow() - log->arp >= NETLOG_ARP_INTERVAL)
+  {
+    log->arp = TimerNow();
+    etharp_query(netif, hop, NULL);
+  }
+  return FALSE;
+}
+
+/*...................................................................*/
+/* netlog_line: Find the end of the first line in the ring           */
+/*                                                                   */
+/*      Input: log - the log state                                   */
+/*             length - the bytes of the ring to search              */
+/*                                                                   */
+/*    Returns: the line length including the new line, 0 if none     */
+/*...................................................................*/
+static u32 netlog_line(struct netlog_state *log, u32 length)
+{
+  u32 i;
+
+  for (i = 0; i < length; ++i)
+    if (log->ring[(log->tail + i) & (NETLOG_RING_SIZE - 1)] == '\n')
+      return i + 1;
+  return 0;
+}
+
+/*...................................................................*/
+/* netlog_burst: The most that may be sent at once                   */
+/*                                                                   */
+/*      Input: log - the log state                                   */
+/*                                                                   */
+/*    Returns: the rate limit bucket size in bytes                   */
+/*...................................................................*/
+static u32 netlog_burst(struct netlog_state *log)
+{
+  /* At least a datagram, or a slow rate would never send one. */
+  return max(log->rate * NETLOG_BURST_TIME, NETLOG_DATAGRAM);
+}
+
+/*...................................................................*/
+/* netlog_poll: Send the queued output, batched and rate limited     */
+/*                                                                   */
+/*      Input: data - the log state                                  */
+/*                                                                   */
+/*    Returns: TASK_IDLE, or TASK_FINISHED once logging stops        */
+/*...................................................................*/
+static int netlog_poll(void *data)
+{
+  struct netlog_state *log = data;
+  u32 pending, length, ms;
+  u64 now;
+
+  if (log->shell == NULL)
+  {
+    log->task = FALSE;
+    return TASK_FINISHED;
+  }
+
+  /* Open the socket once the network is up, the UART until then. */
+  if (log->pcb == NULL)
+  {
+    if (!NetUp)
+      return TASK_IDLE;
+    log->pcb = udp_new();
+    if (log->pcb == NULL)
+      return TASK_IDLE;
+    log->refill = TimerNow();
+    log->tokens = netlog_burst(log);
+  }
+  if ((log->head == log->tail) || !netlog_resolved(log))
+    return TASK_IDLE;
+
+  /* Add the rate for each millisecond passed, up to the burst. */
+  now = TimerNow();
+  ms = min((u32)(now - log->refill) / 1000, NETLOG_BURST_TIME);
+  if (ms)
+  {
+    log->refill = now;
+    log->tokens = min(log->tokens + ms * log->rate, netlog_burst(log));
+  }
+
+  /* Wait to fill a datagram unless the oldest output is too old. */
+  while ((pending = log->head - log->tail) != 0)
+  {
+    length = min(pending, NETLOG_DATAGRAM);
+    if (log->syslog)
+    {
+      /* One line per message, or a partial line once too old. */
+      length = netlog_line(log, length);
+      if ((length == 0) && (pending < NETLOG_DATAGRAM) &&
+          (now - log->first < NETLOG_LATENCY))
+        break;
+      if (length == 0)
+        length = min(pending, NETLOG_DATAGRAM);
+    }
+    else if ((pending < NETLOG_DATAGRAM) &&
+             (now - log->first < NETLOG_LATENCY))
+      break;
+
+    if (log->tokens < length)
+    {
+      ++log->throttled;
+      break;
+    }
+    if (!netlog_send(log, length))
+      break;
+
+    /* The rest was written no earlier than now. */
+    log->first = now;
+  }
+  return TASK_IDLE;
+}
+
+/*...................................................................*/
+/* netlog_next: Find the next word of a command                      */
+/*                                                                   */
+/*      Input: text - the current word                               */
+/*                                                                   */
+/*    Returns: the next word or NULL if none                         */
+/*...................................................................*/
+static const char *netlog_next(const char *text)
+{
+  text = strchr(text, ' ');
+  if (text == NULL)
+    return NULL;
+  while (*text == ' ')
+    ++text;
+  return *text ? text : NULL;
+}
+
+/*...................................................................*/
+/* netlog_word: Compare a word of a command                          */
+/*                                                                   */
+/*      Input: text - the word, ending with a space or the command   */
+/*             word - the word to compare                            */
+/*                                                                   */
+/*    Returns: TRUE if equal                                         */
+/*...................................................................*/
+static int netlog_word(const char *text, const char *word)
+{
+  for (; *word; ++text, ++word)
+    if (*text != *word)
+      return FALSE;
+  return (*text == ' ') || (*text == '\0');
+}
+
+/*...................................................................*/
+/* netlog_number: Convert the decimal number at the start of a word  */
+/*                                                                   */
+/*      Input: text - the word                                       */
+/*                                                                   */
+/*    Returns: the number, zero if none                              */
+/*...................................................................*/
+static u32 netlog_number(const char *text)
+{
+  u32 number = 0;
+
+  for (; (*text >= '0') && (*text <= '9'); ++text)
+    number = number * 10 + (*text - '0');
+  return number;
+}
+
+/*...................................................................*/
+/* Global function definitions                                       */
+/*...................................................................*/
+
+/*...................................................................*/
+/*     NetLog: Send the shell output to a UDP log collector          */
+/*                                                                   */
+/*      Input: command - "netlog [ip [port] [syslog] [-r KB/s]]" to  */
+/*                       start or report, "netlog off" to stop       */
+/*                                                                   */
+/*    Returns: TASK_FINISHED                                         */
+/*...................................................................*/
+int NetLog(const char *command)
+{
+  struct netlog_state *log = &NetLogState;
+  const char *arg;
+  ip_addr_t collector;
+  u32 port = 0, rate = NETLOG_RATE;
+  int syslog = FALSE;
+
+  arg = netlog_next(command);
+
+  /* Stop, sending what is queued and restoring the UART. */
+  if (arg && netlog_word(arg, "off"))
+  {
+    if (log->shell)
+    {
+      if (log->pcb)
+      {
+        if (netlog_resolved(log))
+          while ((log->head != log->tail) &&
+                 netlog_send(log, min(log->head - log->tail,
+                                      NETLOG_DATAGRAM)))
+            ;
+        udp_remove(log->pcb);
+        log->pcb = NULL;
+      }
+      log->shell->putc = log->putc;
+      log->shell->puts = log->puts;
+      log->shell = NULL;
+    }
+    printf("netlog off, %u datagrams %u bytes sent, %u bytes dropped\n",
+           log->datagrams, log->bytes, log->dropped);
+    return TASK_FINISHED;
+  }
+
+  /* Without a collector report the statistics. */
+  if (arg == NULL)
+  {
+    if (log->shell == NULL)
+      puts("netlog off");
+    else
+      printf("netlog to %s port %u%s at %u KB/s, %u datagrams %u bytes "
+             "sent, %u bytes dropped, %u throttled, %u queued\n",
+             ipaddr_ntoa(&log->collector), log->port,
+             log->syslog ? " syslog" : "", log->rate, log->datagrams,
+             log->bytes, log->dropped, log->throttled,
+             log->head - log->tail);
+    return TASK_FINISHED;
+  }
+
+  if (!ipaddr_aton(arg, &collector))
+    arg = NULL;
+  else
+  {
+    for (arg = netlog_next(arg); arg; arg = netlog_next(arg))
+    {
+      if ((arg[0] >= '0') && (arg[0] <= '9'))
+        port = netlog_number(arg);
+      else if (netlog_word(arg, "syslog"))
+        syslog = TRUE;
+      else if (netlog_word(arg, "-r") &&
+               (arg = netlog_next(arg)) != NULL)
+        rate = netlog_number(arg);
+      else
+        break;
+    }
+  }
+  if (arg || (rate == 0))
+  {
+    puts("netlog [ip [port] [syslog] [-r KB/s]]");
+    puts("netlog off");
+    return TASK_FINISHED;
+  }
+
+  /* Redirect the output of this shell, keeping the UART for before
+   * the network is up. */
+  if (log->shell == NULL)
+  {
+    if (!log->task)
+    {
+      if (TaskNew(NETLOG_TASK_PRIORITY, netlog_poll, log) == NULL)
+      {
+        puts("netlog task failed");
+        return TASK_FINISHED;
+      }
+      log->task = TRUE;
+    }
+    log->head = log->tail = 0;
+    log->datagrams = log->bytes = log->throttled = 0;
+    log->dropped = log->noticed = 0;
+    log->shell = StdioState;
+    log->putc = log->shell->putc;
+    log->puts = log->shell->puts;
+    log->shell->putc = netlog_putc;
+    log->shell->puts = netlog_puts;
+  }
+
+  ip_addr_copy(log->collector, collector);
+  log->arp = 0; /* request a new collector right away */
+  log->syslog = syslog;
+  log->port = port ? port : (syslog ? PORT_SYSLOG : PORT_NETCONSOLE);
+  log->rate = rate;
+  printf("netlog to %s port %u%s at %u KB/s\n",
+         ipaddr_ntoa(&log->collector), log->port,
+         syslog ? " syslog" : "", rate);
+  return TASK_FINISHED;
+}
+
+#endif /* ENABLE_UDP */
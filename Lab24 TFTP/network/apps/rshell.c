@@ -0,0 +1,378 @@
+/*...................................................................*/
+/*                                                                   */
+/*   Module:  rshell.c                                               */
+/*   Version: 2020.0                                                 */
+/*   Purpose: Remote shell, command lines over UDP                   */
+/*                                                                   */
+/*...................................................................*/
+/*                                                                   */
+/*                   Copyright 2020, Sean Lawless                    */
+/*                                                                   */
+/*                      ALL RIGHTS RESERVED                          */
+/*                                                                   */
+/* Redistribution and use in source, binary or derived forms, with   */
+/* or without modification, are permitted provided that the          */
+/* following conditions are met:                                     */
+/*                                                                   */
+/*  1. Redistributions in any form, including but not limited to     */
+/*     source code, binary, or derived works, must include the above */
+/*     copyright notice, this list of conditions and the following   */
+/*     disclaimer.                                                   */
+/*                                                                   */
+/*  2. Any change or addition to this copyright notice requires the  */
+/*     prior written permission of the above copyright holder.       */
+/*                                                                   */
+/* THIS SOFTWARE IS PROVIDED ''AS IS''. ANY EXPRESS OR IMPLIED       */
+/* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES */
+/* OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE       */
+/* DISCLAIMED. IN NO EVENT SHALL ANY AUTHOR AND/OR COPYRIGHT HOLDER  */
+/* BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,          */
+/* EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED   */
+/* TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,     */
+/* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON */
+/* ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,   */
+/* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY    */
+/* OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE           */
+/* POSSIBILITY OF SUCH DAMAGE.                                       */
+/*...................................................................*/
+#include <system.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if ENABLE_UDP
+
+#include <lwip/udp.h>
+#include <lwip/pbuf.h>
+
+/*...................................................................*/
+/* Symbol Definitions                                                */
+/*...................................................................*/
+#define PORT_RSHELL           5023
+#define RSHELL_MAX_SESSIONS   4
+#define RSHELL_REQUEST_LENGTH 1472 /* one datagram of command lines */
+#define RSHELL_OUTPUT_LENGTH  8192 /* one response, IP fragmented */
+#define RSHELL_TRUNCATED      "[truncated]\n"
+#define RSHELL_IDLE_TIMEOUT   (60 * MICROS_PER_SECOND)
+#define RSHELL_TASK_PRIORITY  4
+
+/* A client and its shell, free if not busy and idle expired.  The
+ * shell state is first so the output functions find the session from
+ * StdioState. */
+struct rshell_session
+{
+  struct shell_state state; /* the shell of this client */
+  ip_addr_t peer;       /* the client address */
+  u16 port;             /* the client port */
+  u8 busy;              /* TRUE until the response is sent */
+  u8 executing;         /* TRUE while a command line executes */
+  struct timer idle;    /* reusable by another client once expired */
+  char request[RSHELL_REQUEST_LENGTH]; /* the command lines */
+  u32 length;           /* bytes in request */
+  u32 next;             /* the next command line in request */
+  char output[RSHELL_OUTPUT_LENGTH]; /* the response */
+  u32 output_length;    /* bytes in output */
+  u8 truncated;         /* TRUE if output was lost */
+};
+
+/*...................................................................*/
+/* Global Variables                                                  */
+/*...................................................................*/
+extern int NetUp;
+static struct udp_pcb *RshellPcb = NULL;
+static struct rshell_session RshellSessions[RSHELL_MAX_SESSIONS];
+static u32 RshellRequests, RshellCommands;
+static int RshellTask = FALSE;
+
+/*...................................................................*/
+/* Local function definitions                                        */
+/*...................................................................*/
+
+/*...................................................................*/
+/* rshell_putc: Add a character to the response of the shell        */
+/*                                                                   */
+/*      Input: character - the character to output                  */
+/*...................................................................*/
+static void rshell_putc(char character)
+{
+  struct rshell_session *s = (struct rshell_session *)StdioState;
+
+  /* Lines end with a new line only. */
+  if (character == '\r')
+    return;
+  if (s->output_length < RSHELL_OUTPUT_LENGTH - sizeof(RSHELL_TRUNCATED))
+    s->output[s->output_length++] = character;
+  else
+    s->truncated = TRUE;
+}
+
+/*...................................................................*/
+/* rshell_puts: Add a line to the response of the shell              */
+/*                                                                   */
+/*      Input: string - the line to output, without the new line     */
+/*...................................................................*/
+static void rshell_puts(const char *string)
+{
+  while (*string)
+    rshell_putc(*string++);
+  rshell_putc('\n');
+}
+
+/*...................................................................*/
+/* rshell_getc: There is no input other than the command lines       */
+/*                                                                   */
+/*    Returns: zero                                                  */
+/*...................................................................*/
+static char rshell_getc(void)
+{
+  return 0;
+}
+
+/*...................................................................*/
+/* rshell_reply: Send a response to the client                       */
+/*                                                                   */
+/*      Input: addr - the client address                             */
+/*             port - the client port                                */
+/*             data - the response                                   */
+/*             length - bytes in the response                        */
+/*...................................................................*/
+static void rshell_reply(ip_addr_t *addr, u16 port, const char *data,
+                         u32 length)
+{
+  struct pbuf *p;
+
+  /* A RAM pbuf is contiguous, larger than the MTU is fragmented. */
+  p = pbuf_alloc(PBUF_TRANSPORT, length, PBUF_RAM);
+  if (p == NULL)
+    return;
+  memcpy(p->payload, data, length);
+  udp_sendto(RshellPcb, p, addr, port);
+  pbuf_free(p);
+}
+
+/*...................................................................*/
+/* rshell_line: Copy the next command line of a request to the shell */
+/*                                                                   */
+/*      Input: s - the session                                       */
+/*                                                                   */
+/*    Returns: TRUE if a line was copied, FALSE at end of request    */
+/*...................................................................*/
+static int rshell_line(struct rshell_session *s)
+{
+  u32 i = 0;
+  char ch;
+
+  if (s->next >= s->length)
+    return FALSE;
+
+  /* Lines end with a new line, or the end of the datagram. */
+  for (; s->next < s->length; ++s->next)
+  {
+    ch = s->request[s->next];
+    if (ch == '\n')
+    {
+      ++s->next;
+      break;
+    }
+    if ((ch != '\r') && (i < COMMAND_LENGTH - 1))
+      s->state.command[i++] = ch;
+  }
+  s->state.command[i] = '\0';
+  return TRUE;
+}
+
+/*...................................................................*/
+/* rshell_recv: Receive the command lines of a client                */
+/*                                                                   */
+/*      Input: arg - unused                                          */
+/*             pcb - the server UDP port                             */
+/*             p - the datagram received                             */
+/*             addr - the client address                             */
+/*             port - the client port                                */
+/*...................................................................*/
+static void rshell_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p,
+                        ip_addr_t *addr, u16_t port)
+{
+  struct rshell_session *s, *reuse = NULL;
+  int i;
+
+  /* Find the session of the client, or one to reuse. */
+  for (i = 0; i < RSHELL_MAX_SESSIONS; ++i)
+  {
+    s = &RshellSessions[i];
+    if (ip_addr_cmp(&s->peer, addr) && (s->port == port))
+      break;
+    if (!s->busy && (reuse == NULL) && (TimerRemaining(&s->idle) == 0))
+      reuse = s;
+  }
+
+  if (i == RSHELL_MAX_SESSIONS)
+  {
+    if (reuse == NULL)
+    {
+      pbuf_free(p);
+      rshell_reply(addr, port, "rshell sessions full\n", 21);
+      return;
+    }
+
+    /* A new client starts with a new shell. */
+    s = reuse;
+    bzero(&s->state, sizeof(struct shell_state));
+    s->state.result = TASK_FINISHED;
+    s->state.getc = rshell_getc;
+    s->state.putc = rshell_putc;
+    s->state.puts = rshell_puts;
+    ip_addr_copy(s->peer, *addr);
+    s->port = port;
+  }
+
+  /* One request at a time, the client waits for the response. */
+  else if (s->busy)
+  {
+    pbuf_free(p);
+    rshell_reply(addr, port, "rshell busy\n", 12);
+    return;
+  }
+
+  s->length = pbuf_copy_partial(p, s->request, RSHELL_REQUEST_LENGTH, 0);
+  pbuf_free(p);
+  s->next = s->output_length = 0;
+  s->truncated = s->executing = FALSE;
+  s->busy = TRUE;
+  ++RshellRequests;
+}
+
+/*...................................................................*/
+/* rshell_poll: Execute the command lines of each client request     */
+/*                                                                   */
+/*      Input: data - unused                                         */
+/*                                                                   */
+/*    Returns: TASK_IDLE, or TASK_FINISHED once the server stops     */
+/*...................................................................*/
+static int rshell_poll(void *data)
+{
+  struct rshell_session *s;
+  int i;
+
+  for (i = 0; i < RSHELL_MAX_SESSIONS; ++i)
+  {
+    s = &RshellSessions[i];
+    if (!s->busy)
+      continue;
+
+    /* Execute the lines in order, each until it finishes. */
+    for (;;)
+    {
+      if (!s->executing)
+      {
+        if (!rshell_line(s))
+          break;
+        s->executing = TRUE;
+        ++RshellCommands;
+      }
+      if (ShellExecute(&s->state) != TASK_FINISHED)
+        break;
+      s->executing = FALSE;
+    }
+    if (s->executing)
+      continue;
+
+    /* All lines executed, send the output in one response. */
+    if (s->truncated)
+    {
+      memcpy(&s->output[s->output_length], RSHELL_TRUNCATED,
+             sizeof(RSHELL_TRUNCATED) - 1);
+      s->output_length += sizeof(RSHELL_TRUNCATED) - 1;
+    }
+    if (RshellPcb)
+      rshell_reply(&s->peer, s->port, s->output, s->output_length);
+    s->busy = FALSE;
+    s->idle = TimerRegister(RSHELL_IDLE_TIMEOUT);
+  }
+
+  if (RshellPcb == NULL)
+  {
+    RshellTask = FALSE;
+    return TASK_FINISHED;
+  }
+  return TASK_IDLE;
+}
+
+/*...................................................................*/
+/* Global function definitions                                       */
+/*...................................................................*/
+
+/*...................................................................*/
+/*     Rshell: Start, stop or report the remote shell                */
+/*                                                                   */
+/*      Input: command - "rshell [off]"                              */
+/*                                                                   */
+/*    Returns: TASK_FINISHED                                         */
+/*...................................................................*/
+int Rshell(const char *command)
+{
+  const char *arg = strchr(command, ' ');
+  int i, active = 0;
+
+  if (!NetUp)
+  {
+    puts("Network down, use 'net' command to enable.");
+    return TASK_FINISHED;
+  }
+
+  /* Stop the server, commands executing finish without response. */
+  if (arg && (strcmp(&arg[1], "off") == 0))
+  {
+    if (RshellPcb)
+    {
+      udp_remove(RshellPcb);
+      RshellPcb = NULL;
+    }
+    printf("Remote shell stopped, %u requests %u commands\n",
+           RshellRequests, RshellCommands);
+    return TASK_FINISHED;
+  }
+
+  if (RshellPcb == NULL)
+  {
+    RshellPcb = udp_new();
+    if (RshellPcb == NULL)
+    {
+      puts("Remote shell out of memory");
+      return TASK_FINISHED;
+    }
+    if (udp_bind(RshellPcb, IP_ADDR_ANY, PORT_RSHELL) != ERR_OK)
+    {
+      puts("Remote shell port in use");
+      udp_remove(RshellPcb);
+      RshellPcb = NULL;
+      return TASK_FINISHED;
+    }
+
+    /* The task of a server just stopped may still be running. */
+    if (!RshellTask)
+    {
+      if (TaskNew(RSHELL_TASK_PRIORITY, rshell_poll, RshellSessions)
+          == NULL)
+      {
+        puts("Remote shell task failed");
+        udp_remove(RshellPcb);
+        RshellPcb = NULL;
+        return TASK_FINISHED;
+      }
+      RshellTask = TRUE;
+    }
+    udp_recv(RshellPcb, rshell_recv, NULL);
+    RshellRequests = RshellCommands = 0;
+  }
+
+  for (i = 0; i < RSHELL_MAX_SESSIONS; ++i)
+    if (RshellSessions[i].busy || TimerRemaining(&RshellSessions[i].idle))
+      ++active;
+  printf("Remote shell on UDP port %u, %u sessions, %u requests %u "
+         "commands\n", PORT_RSHELL, active, RshellRequests,
+         RshellCommands);
+  return TASK_FINISHED;
+}
+
+#endif /* ENABLE_UDP */
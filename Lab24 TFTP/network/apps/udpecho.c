@@ -0,0 +1,125 @@
+/*...................................................................*/
+/*                                                                   */
+/*   Module:  udpecho.c                                              */
+/*   Version: 2020.0                                                 */
+/*   Purpose: UDP echo service (RFC 862) for network benchmarks      */
+/*                                                                   */
+/*...................................................................*/
+/*                                                                   */
+/*                   Copyright 2020, Sean Lawless                    */
+/*                                                                   */
+/*                      ALL RIGHTS RESERVED                          */
+/*                                                                   */
+/* Redistribution and use in source, binary or derived forms, with   */
+/* or without modification, are permitted provided that the          */
+/* following conditions are met:                                     */
+/*                                                                   */
+/*  1. Redistributions in any form, including but not limited to     */
+/*     source code, binary, or derived works, must include the above */
+/*     copyright notice, this list of conditions and the following   */
+/*     disclaimer.                                                   */
+/*                                                                   */
+/*  2. Any change or addition to this copyright notice requires the  */
+/*     prior written permission of the above copyright holder.       */
+/*                                                                   */
+/* THIS SOFTWARE IS PROVIDED ''AS IS''. ANY EXPRESS OR IMPLIED       */
+/* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES */
+/* OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE       */
+/* DISCLAIMED. IN NO EVENT SHALL ANY AUTHOR AND/OR COPYRIGHT HOLDER  */
+/* BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,          */
+/* EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED   */
+/* TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,     */
+/* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON */
+/* ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,   */
+/* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY    */
+/* OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE           */
+/* POSSIBILITY OF SUCH DAMAGE.                                       */
+/*...................................................................*/
+#include <system.h>
+#include <stdio.h>
+#include <string.h>
+
+#if ENABLE_UDP
+
+#include <lwip/udp.h>
+#include <lwip/pbuf.h>
+
+/*...................................................................*/
+/* Symbol Definitions                                                */
+/*...................................................................*/
+#define PORT_ECHO  7
+
+/*...................................................................*/
+/* Global Variables                                                  */
+/*...................................................................*/
+extern int NetUp;
+static struct udp_pcb *EchoPcb = NULL;
+static u32 EchoDatagrams, EchoBytes;
+
+/*...................................................................*/
+/*  echo_recv: Return each datagram received to the sender           */
+/*...................................................................*/
+static void echo_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p,
+                      ip_addr_t *addr, u16_t port)
+{
+  ++EchoDatagrams;
+  EchoBytes += p->tot_len;
+  udp_sendto(pcb, p, addr, port);
+  pbuf_free(p);
+}
+
+/*...................................................................*/
+/*    UdpEcho: Start, stop or report the UDP echo service            */
+/*                                                                   */
+/*      Input: command - "udpecho [off]"                             */
+/*                                                                   */
+/*    Returns: TASK_FINISHED                                         */
+/*...................................................................*/
+int UdpEcho(const char *command)
+{
+  const char *arg = strchr(command, ' ');
+
+  if (!NetUp)
+  {
+    puts("Network down, use 'net' command to enable.");
+    return TASK_FINISHED;
+  }
+
+  /* Report and stop the service if requested. */
+  if (arg && (strcmp(&arg[1], "off") == 0))
+  {
+    if (EchoPcb)
+    {
+      udp_remove(EchoPcb);
+      EchoPcb = NULL;
+    }
+    printf("UDP echo stopped, %u datagrams %u bytes\n", EchoDatagrams,
+           EchoBytes);
+    return TASK_FINISHED;
+  }
+
+  /* Otherwise start the service if not yet running. */
+  if (EchoPcb == NULL)
+  {
+    EchoPcb = udp_new();
+    if (EchoPcb == NULL)
+    {
+      puts("UDP echo out of memory");
+      return TASK_FINISHED;
+    }
+    if (udp_bind(EchoPcb, IP_ADDR_ANY, PORT_ECHO) != ERR_OK)
+    {
+      puts("UDP echo port in use");
+      udp_remove(EchoPcb);
+      EchoPcb = NULL;
+      return TASK_FINISHED;
+    }
+    udp_recv(EchoPcb, echo_recv, NULL);
+    EchoDatagrams = EchoBytes = 0;
+  }
+  printf("UDP echo on port %u, %u datagrams %u bytes\n", PORT_ECHO,
+         EchoDatagrams, EchoBytes);
+  return TASK_FINISHED;
+}
+
+#endif /* ENABLE_UDP */
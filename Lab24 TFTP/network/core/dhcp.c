@@ -108,6 +108,12 @@
 
 #define REBOOT_TRIES 2
 
+/** DHCP_BOUND_HOOK(netif): called once the netif is bound to a lease,
+ * for the application to save it or report the time taken */
+#ifndef DHCP_BOUND_HOOK
+#define DHCP_BOUND_HOOK(netif)
+#endif
+
 /** Option handling: options are parsed in dhcp_parse_reply
  * and saved in an array where other functions can load them from.
  * This might be moved into the struct dhcp (not necessarily since
@@ -121,7 +127,8 @@
 #define DHCP_OPTION_IDX_T2          5
 #define DHCP_OPTION_IDX_SUBNET_MASK 6
 #define DHCP_OPTION_IDX_ROUTER      7
-#define DHCP_OPTION_IDX_DNS_SERVER  8
+#define DHCP_OPTION_IDX_RAPID_COMMIT 8
+#define DHCP_OPTION_IDX_DNS_SERVER  9
 #define DHCP_OPTION_IDX_MAX         (DHCP_OPTION_IDX_DNS_SERVER + DNS_MAX_SERVERS)
 
 /** Holds the decoded option values, only valid while in dhcp_recv.
@@ -548,6 +555,12 @@ dhcp_handle_ack(struct netif *netif)
     dhcp->offered_t2_rebind = dhcp->offered_t0_lease;
   }
 
+  /* server identifier, not known from an OFFER after rapid commit
+     or INIT-REBOOT, needed to renew the lease */
+  if (dhcp_option_given(dhcp, DHCP_OPTION_IDX_SERVER_ID)) {
+    ip4_addr_set_u32(&dhcp->server_ip_addr, htonl(dhcp_get_option_value(dhcp, DHCP_OPTION_IDX_SERVER_ID)));
+  }
+
   /* (y)our internet address */
   ip_addr_copy(dhcp->offered_ip_addr, dhcp->msg_in->yiaddr);
 
@@ -635,6 +648,22 @@ void dhcp_cleanup(struct netif *netif)
  */
 err_t
 dhcp_start(struct netif *netif)
+{
+  return dhcp_start_lease(netif, NULL);
+}
+
+/**
+ * Start DHCP negotiation for a network interface that held a lease
+ * before a reboot. The address is requested with INIT-REBOOT (RFC 2131
+ * 3.2), saving the DISCOVER and OFFER, and if the server does not
+ * confirm it the negotiation falls back to discovery.
+ *
+ * @param netif The lwIP network interface
+ * @param ipaddr The address previously leased, NULL to discover
+ * @return lwIP error code, @see dhcp_start()
+ */
+err_t
+dhcp_start_lease(struct netif *netif, ip_addr_t *ipaddr)
 {
   struct dhcp *dhcp;
   err_t result = ERR_OK;
@@ -717,7 +746,12 @@ dhcp_start(struct netif *netif)
   LWIP_DEBUGF(DHCP_DEBUG | LWIP_DBG_TRACE, ("dhcp_start(): starting DHCP configuration\n"));
   /* (re)start the DHCP negotiation */
 //  puts("before dhcp_discover");
-  result = dhcp_discover(netif);
+  if ((ipaddr != NULL) && !ip_addr_isany(ipaddr)) {
+    ip_addr_copy(dhcp->offered_ip_addr, *ipaddr);
+    result = dhcp_reboot(netif);
+  } else {
+    result = dhcp_discover(netif);
+  }
   if (result != ERR_OK) {
     /* free resources allocated above */
     dhcp_stop(netif);
@@ -926,6 +960,9 @@ dhcp_discover(struct netif *netif)
     dhcp_option_byte(dhcp, DHCP_OPTION_BROADCAST);
     dhcp_option_byte(dhcp, DHCP_OPTION_DNS_SERVER);
 
+    /* accept an ACK in place of the OFFER, skipping the REQUEST */
+    dhcp_option(dhcp, DHCP_OPTION_RAPID_COMMIT, 0);
+
     dhcp_option_trailer(dhcp);
 
     LWIP_DEBUGF(DHCP_DEBUG | LWIP_DBG_TRACE, ("dhcp_discover: realloc()ing\n"));
@@ -1046,6 +1083,28 @@ dhcp_bind(struct netif *netif)
   netif_set_up(netif);
   /* netif is now bound to DHCP leased address */
   dhcp_set_state(dhcp, DHCP_BOUND);
+
+#if LWIP_ARP
+  /* The netif may have been up before binding, so announce the address
+     here. Then learn the sender of the ACK from the reply itself and
+     resolve the gateway and boot server now, not on first use. */
+  etharp_gratuitous(netif);
+  if (ip_addr_netcmp(&dhcp->reply_ip_addr, &dhcp->offered_ip_addr, &sn_mask)) {
+    etharp_add_entry(netif, &dhcp->reply_ip_addr, (struct eth_addr *)dhcp->reply_hwaddr);
+  }
+  if (!ip_addr_cmp(&gw_addr, &dhcp->reply_ip_addr)) {
+    etharp_query(netif, &gw_addr, NULL);
+  }
+#if LWIP_DHCP_BOOTP_FILE
+  if (!ip_addr_isany(&dhcp->offered_si_addr) &&
+      !ip_addr_cmp(&dhcp->offered_si_addr, &dhcp->reply_ip_addr) &&
+      !ip_addr_cmp(&dhcp->offered_si_addr, &gw_addr) &&
+      ip_addr_netcmp(&dhcp->offered_si_addr, &dhcp->offered_ip_addr, &sn_mask)) {
+    etharp_query(netif, &dhcp->offered_si_addr, NULL);
+  }
+#endif /* LWIP_DHCP_BOOTP_FILE */
+#endif /* LWIP_ARP */
+  DHCP_BOUND_HOOK(netif);
 }
 
 /**
@@ -1175,6 +1234,13 @@ dhcp_reboot(struct netif *netif)
     dhcp_option(dhcp, DHCP_OPTION_REQUESTED_IP, 4);
     dhcp_option_long(dhcp, ntohl(ip4_addr_get_u32(&dhcp->offered_ip_addr)));
 
+    /* the ACK configures the netif, so ask for the same as discovery */
+    dhcp_option(dhcp, DHCP_OPTION_PARAMETER_REQUEST_LIST, 4/*num options*/);
+    dhcp_option_byte(dhcp, DHCP_OPTION_SUBNET_MASK);
+    dhcp_option_byte(dhcp, DHCP_OPTION_ROUTER);
+    dhcp_option_byte(dhcp, DHCP_OPTION_BROADCAST);
+    dhcp_option_byte(dhcp, DHCP_OPTION_DNS_SERVER);
+
     dhcp_option_trailer(dhcp);
 
     pbuf_realloc(dhcp->p_out, sizeof(struct dhcp_msg) - DHCP_OPTIONS_LEN + dhcp->options_out_len);
@@ -1475,6 +1541,11 @@ again:
         LWIP_ERROR("len == 4", len == 4, return ERR_VAL;);
         decode_idx = DHCP_OPTION_IDX_T2;
         break;
+      case(DHCP_OPTION_RAPID_COMMIT):
+        /* no value, given or not */
+        LWIP_ERROR("len == 0", len == 0, return ERR_VAL;);
+        dhcp_got_option(dhcp, DHCP_OPTION_IDX_RAPID_COMMIT);
+        break;
       default:
         decode_len = 0;
         LWIP_DEBUGF(DHCP_DEBUG, ("skipping option %d in options\n", op));
@@ -1630,8 +1701,16 @@ dhcp_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, ip_addr_t *addr, u16_t
   /* message type is DHCP ACK? */
   if (msg_type == DHCP_ACK) {
     LWIP_DEBUGF(DHCP_DEBUG | LWIP_DBG_TRACE, ("DHCP_ACK received\n"));
-    /* in requesting state? */
-    if (dhcp->state == DHCP_REQUESTING) {
+#if LWIP_ARP
+    /* remember the sender, from the Ethernet frame the ACK arrived in */
+    ip_addr_copy(dhcp->reply_ip_addr, *addr);
+    SMEMCPY(dhcp->reply_hwaddr, current_ethhdr_src.addr, ETHARP_HWADDR_LEN);
+#endif /* LWIP_ARP */
+    /* in requesting state, or selecting and the server rapid commits? */
+    if ((dhcp->state == DHCP_REQUESTING) ||
+        ((dhcp->state == DHCP_SELECTING) &&
+         dhcp_option_given(dhcp, DHCP_OPTION_IDX_RAPID_COMMIT))) {
+      dhcp->request_timeout = 0;
       dhcp_handle_ack(netif);
 #if DHCP_DOES_ARP_CHECK
       /* check if the acknowledged lease address is already in use */
@@ -1643,6 +1722,10 @@ dhcp_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, ip_addr_t *addr, u16_t
     }
     /* already bound to the given lease address? */
     else if ((dhcp->state == DHCP_REBOOTING) || (dhcp->state == DHCP_REBINDING) || (dhcp->state == DHCP_RENEWING)) {
+      /* after INIT-REBOOT only the address is known, take the rest */
+      if (dhcp->state == DHCP_REBOOTING) {
+        dhcp_handle_ack(netif);
+      }
       dhcp_bind(netif);
     }
   }
@@ -133,7 +133,7 @@ lwip_standard_chksum(void *dataptr, u16_t len)
  * @return host order (!) lwip checksum (non-inverted Internet sum)
  */
 
-static u16_t
+u16_t
 lwip_standard_chksum(void *dataptr, int len)
 {
   u8_t *pb = (u8_t *)dataptr;
@@ -380,7 +380,9 @@ ip_input(struct pbuf *p, struct netif *inp)
   /* verify checksum */
 //  puts("before verify checksum");
 #if CHECKSUM_CHECK_IP
-  if (inet_chksum(iphdr, iphdr_hlen) != 0) {
+  if (((p->flags & PBUF_FLAG_IP_CHKSUM_OK) == 0) &&
+      NETIF_CHECKSUM_ENABLED(inp, NETIF_CHECKSUM_CHECK_IP) &&
+      (inet_chksum(iphdr, iphdr_hlen) != 0)) {
 
     LWIP_DEBUGF(IP_DEBUG | LWIP_DBG_LEVEL_SERIOUS,
       ("Checksum (0x%x) failed, IP packet dropped.\n", inet_chksum(iphdr, iphdr_hlen)));
@@ -541,6 +543,8 @@ ip_input(struct pbuf *p, struct netif *inp)
     if (p == NULL) {
       return ERR_OK;
     }
+    /* a hardware verdict on one fragment does not cover the datagram */
+    p->flags &= ~PBUF_FLAG_L4_CHKSUM_OK;
     iphdr = (struct ip_hdr *)p->payload;
 #else /* IP_REASSEMBLY == 0, no packet fragment reassembly code present */
     pbuf_free(p);
@@ -783,16 +787,22 @@ err_t ip_output_if_opt(struct pbuf *p, ip_addr_t *src, ip_addr_t *dest,
     }
 
 #if CHECKSUM_GEN_IP_INLINE
-    chk_sum += ip4_addr_get_u32(&iphdr->src) & 0xFFFF;
-    chk_sum += ip4_addr_get_u32(&iphdr->src) >> 16;
-    chk_sum = (chk_sum >> 16) + (chk_sum & 0xFFFF);
-    chk_sum = (chk_sum >> 16) + chk_sum;
-    chk_sum = ~chk_sum;
-    iphdr->_chksum = chk_sum; /* network order */
+    if (NETIF_CHECKSUM_ENABLED(netif, NETIF_CHECKSUM_GEN_IP)) {
+      chk_sum += ip4_addr_get_u32(&iphdr->src) & 0xFFFF;
+      chk_sum += ip4_addr_get_u32(&iphdr->src) >> 16;
+      chk_sum = (chk_sum >> 16) + (chk_sum & 0xFFFF);
+      chk_sum = (chk_sum >> 16) + chk_sum;
+      chk_sum = ~chk_sum;
+      iphdr->_chksum = chk_sum; /* network order */
+    } else {
+      IPH_CHKSUM_SET(iphdr, 0); /* inserted by the netif hardware */
+    }
 #else /* CHECKSUM_GEN_IP_INLINE */
     IPH_CHKSUM_SET(iphdr, 0);
 #if CHECKSUM_GEN_IP
-    IPH_CHKSUM_SET(iphdr, inet_chksum(iphdr, ip_hlen));
+    if (NETIF_CHECKSUM_ENABLED(netif, NETIF_CHECKSUM_GEN_IP)) {
+      IPH_CHKSUM_SET(iphdr, inet_chksum(iphdr, ip_hlen));
+    }
 #endif
 #endif /* CHECKSUM_GEN_IP_INLINE */
   } else {
@@ -653,6 +653,11 @@ tcp_write(struct tcp_pcb *pcb, const void *arg, u16_t len, u8_t apiflags)
     last_unsent->len += concat_p->tot_len;
 #if TCP_CHECKSUM_ON_COPY
     if (concat_chksummed) {
+      /* an odd length concatenation left its checksum swapped, swap it
+         back before adding it to the segment at its own offset */
+      if (concat_chksum_swapped) {
+        concat_chksum = SWAP_BYTES_IN_WORD(concat_chksum);
+      }
       tcp_seg_add_chksum(concat_chksum, concat_chksummed, &last_unsent->chksum,
         &last_unsent->chksum_swapped);
       last_unsent->flags |= TF_SEG_DATA_CHECKSUMMED;
@@ -1121,6 +1126,16 @@ tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb)
 
   seg->tcphdr->chksum = 0;
 #if CHECKSUM_GEN_TCP
+#if LWIP_CHECKSUM_CTRL_PER_NETIF
+  /* If the outgoing netif inserts the checksum, seed it with the
+     pseudo header sum only (segments never exceed the MTU). */
+  if (!NETIF_CHECKSUM_ENABLED(ip_route(&(pcb->remote_ip)),
+                              NETIF_CHECKSUM_GEN_TCP)) {
+    seg->tcphdr->chksum = (u16_t)~inet_chksum_pseudo_partial(seg->p,
+           &(pcb->local_ip), &(pcb->remote_ip),
+           IP_PROTO_TCP, seg->p->tot_len, 0);
+  } else
+#endif /* LWIP_CHECKSUM_CTRL_PER_NETIF */
 #if TCP_CHECKSUM_ON_COPY
   {
     u32_t acc;
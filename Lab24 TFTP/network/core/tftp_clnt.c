@@ -4,12 +4,14 @@
 #include <system.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #if ENABLE_UDP
 
 #include <opt.h>
 #include <lwip/tftp.h>
 #include <lwip/udp.h>
+#include <lwip/igmp.h>
 #include <lwip/ip_addr.h>
 #include <board.h>
 
@@ -20,6 +22,7 @@
 #define SYSERR -1
 #define TIMEOUT -2
 #define EOF -3
+#define BUSY -4
 
 /* Endian conversion macros*/
 #if BYTE_ORDER == LITTLE_ENDIAN
@@ -56,11 +59,67 @@ struct tftpcb
   struct tftpPkt *pkt;
   struct pbuf *out; /* outgoing buffer is recycled */
   char *destination;
+
+  /* Option negotiation (RFC 2347) and sliding window (RFC 7440) */
+  int options;        /* TRUE to request options in the RRQ */
+  int connected;      /* TRUE once the server transfer port is known */
+  u32 block_size;     /* negotiated blksize, TFTP_BLOCK_SIZE if none */
+  u32 window_size;    /* negotiated windowsize, one if none */
+  u32 window_count;   /* in order blocks received since the last ACK */
+  u32 stray_count;    /* out of order blocks since the last progress */
+  u32 transfer_size;  /* negotiated tsize, zero if unknown */
+  u32 bytes;          /* bytes of file data received */
+  u64 start;          /* TimerNow() when the first RRQ was sent */
+  u64 first;          /* TimerNow() when the first DATA was received */
+
+  /* Destination of the file data (sink) and its validation */
+  const struct tftpSink *sink;
+  u32 capacity;       /* largest file the sink can hold */
+  u32 window_map;     /* bit n set if block next + n was placed early */
+  u32 sink_bytes;     /* bytes written by a sequential sink */
+  u32 crc;            /* CRC32 of the file data, in order */
+  u32 crc_bytes;      /* bytes of file data included in the CRC32 */
+  u32 expect_crc;     /* CRC32 the file must match, if check_crc */
+  int check_crc;
+
+  /* Multicast transfer (RFC 2090), the blocks sent to the group may be
+   * received in any order so each is marked in the block map.  The
+   * next_block_number is the first block missing.  */
+  int multicast;      /* TRUE to request the multicast option */
+  int master;         /* TRUE if the server elected this client to ACK */
+  ip_addr_t group;    /* multicast group address, once acknowledged */
+  u16 group_port;
+  struct udp_pcb *group_udpdev; /* receives the DATA sent to the group */
+  u8 *block_map;      /* bit set for each block received */
+  u32 block_count;    /* blocks the block map can hold */
+  u32 last_block;     /* the short last block, zero until received */
+
+  int active;         /* TRUE while the session task runs */
+  int background;     /* TRUE if the shell does not wait for it */
+  struct shell_state *shell; /* the shell waiting for it, if any */
+};
+
+/* A sink consumes the downloaded file data.  Random access sinks may
+ * be given blocks ahead of a lost block, at their final offset, while
+ * sequential sinks are only given blocks in order.  A write returns OK,
+ * BUSY to drop the block so the server sends it again, or SYSERR. */
+struct tftpSink
+{
+  const char *name;
+  int random;
+  int (*open)(struct tftpcb *tftp);
+  int (*write)(struct tftpcb *tftp, u32 offset, const u8 *data, u32 len);
+  void (*close)(struct tftpcb *tftp);
 };
 
-struct tftpcb TFtpCB;
+/* Downloads run in parallel, each session is driven by its own task
+ * so that the round trips of one overlap the others.  */
+#define TFTP_MAX_SESSIONS  4
+#define TFTP_TASK_PRIORITY 4
+
+static struct tftpcb TftpSessions[TFTP_MAX_SESSIONS];
 extern struct netif Netif;
-void *Data = NULL;
+extern int NetUp;
 int Ip1 = 192, Ip2 = 168, Ip3 = 1, Ip4 = 3;
 
 void tftp_init(void)
@@ -69,22 +128,450 @@ void tftp_init(void)
   Ip2 = 168;
   Ip3 = 1;
   Ip4 = 3;
-  Data = NULL;
-  bzero(&TFtpCB, sizeof(struct tftpcb));
+  bzero(TftpSessions, sizeof(TftpSessions));
+}
+
+/* CRC32 (IEEE 802.3) lookup tables, one per byte of a word. */
+static u32 Crc32Table[4][256];
+
+static void crc32_init(void)
+{
+  u32 i, j, crc;
+
+  for (i = 0; i < 256; ++i)
+  {
+    for (crc = i, j = 0; j < 8; ++j)
+      crc = (crc >> 1) ^ ((crc & 1) ? 0xEDB88320 : 0);
+    Crc32Table[0][i] = crc;
+  }
+  for (i = 0; i < 256; ++i)
+    for (j = 1; j < 4; ++j)
+      Crc32Table[j][i] = (Crc32Table[j - 1][i] >> 8) ^
+                         Crc32Table[0][Crc32Table[j - 1][i] & 0xFF];
+}
+
+/* Update a CRC32 with the data, also copying it to dst unless NULL,
+ * so the data is read only once. */
+static u32 crc32_copy(u32 crc, u8 *dst, const u8 *src, u32 len)
+{
+  /* A byte at a time until the source is word aligned. */
+  for (; len && ((uintptr_t)src & 3); --len, ++src)
+  {
+    if (dst)
+      *dst++ = *src;
+    crc = Crc32Table[0][(crc ^ *src) & 0xFF] ^ (crc >> 8);
+  }
+
+#if BYTE_ORDER == LITTLE_ENDIAN
+  /* Then a word at a time, looking up all four bytes at once. */
+  for (; len >= 4; len -= 4, src += 4)
+  {
+    u32 word = *(const u32 *)src;
+
+    if (dst)
+    {
+      if (((uintptr_t)dst & 3) == 0)
+        *(u32 *)dst = word;
+      else
+      {
+        dst[0] = word;
+        dst[1] = word >> 8;
+        dst[2] = word >> 16;
+        dst[3] = word >> 24;
+      }
+      dst += 4;
+    }
+    crc ^= word;
+    crc = Crc32Table[3][crc & 0xFF] ^ Crc32Table[2][(crc >> 8) & 0xFF] ^
+          Crc32Table[1][(crc >> 16) & 0xFF] ^ Crc32Table[0][crc >> 24];
+  }
+#endif
+
+  /* The remaining bytes. */
+  for (; len; --len, ++src)
+  {
+    if (dst)
+      *dst++ = *src;
+    crc = Crc32Table[0][(crc ^ *src) & 0xFF] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+/* RAM sink, the run image location also used by xmodem. */
+static int ram_open(struct tftpcb *tftp)
+{
+  int i;
+
+  /* The run image location holds one download at a time. */
+  for (i = 0; i < TFTP_MAX_SESSIONS; ++i)
+    if (TftpSessions[i].active && TftpSessions[i].destination)
+      return SYSERR;
+  tftp->destination = (void *)_run_location();
+  tftp->capacity = _run_size();
+  return OK;
+}
+
+static int ram_write(struct tftpcb *tftp, u32 offset, const u8 *data,
+                     u32 len)
+{
+  if (offset + len > tftp->capacity)
+    return SYSERR;
+
+  /* Place a block received ahead of a lost block, checksum it later. */
+  if (offset != tftp->bytes)
+  {
+    memcpy(&tftp->destination[offset], data, len);
+    return OK;
+  }
+
+  /* Checksum any blocks placed early that are now in order, then copy
+   * and checksum this block in one pass. */
+  if (tftp->crc_bytes < offset)
+    tftp->crc = crc32_copy(tftp->crc, NULL,
+                           (u8 *)&tftp->destination[tftp->crc_bytes],
+                           offset - tftp->crc_bytes);
+  tftp->crc = crc32_copy(tftp->crc, (u8 *)&tftp->destination[offset],
+                         data, len);
+  tftp->crc_bytes = offset + len;
+  return OK;
+}
+
+/* Checksum only sink, to validate or benchmark without storing. */
+static int sum_open(struct tftpcb *tftp)
+{
+  tftp->capacity = 0xFFFFFFFF;
+  return OK;
+}
+
+static int sum_write(struct tftpcb *tftp, u32 offset, const u8 *data,
+                     u32 len)
+{
+  tftp->crc = crc32_copy(tftp->crc, NULL, data, len);
+  tftp->crc_bytes += len;
+  return OK;
+}
+
+/* Sinks selectable by name, the first is the default. */
+static const struct tftpSink TftpSinks[] =
+{
+  {"ram", TRUE, ram_open, ram_write, NULL},
+  {"sum", FALSE, sum_open, sum_write, NULL},
+  {NULL, FALSE, NULL, NULL, NULL}
+};
+
+/* Convert a hexadecimal string to a number. */
+static u32 tftp_hex(const char *string)
+{
+  u32 value = 0;
+
+  for (; *string; ++string)
+  {
+    if (*string >= '0' && *string <= '9')
+      value = (value << 4) | (*string - '0');
+    else if ((*string | 0x20) >= 'a' && (*string | 0x20) <= 'f')
+      value = (value << 4) | ((*string | 0x20) - 'a' + 10);
+    else
+      break;
+  }
+  return value;
+}
+
+/* Compare option names, which are case insensitive (RFC 2347). */
+int tftp_option_is(const char *option, const char *name)
+{
+  for (; *option && *name; ++option, ++name)
+    if ((*option | 0x20) != *name)
+      return FALSE;
+  return *option == *name;
+}
+
+/* Append a decimal option name and value pair to an RRQ or OACK. */
+u8 *tftp_option_add(u8 *p, const char *name, u32 value)
+{
+  char digits[10];
+  int i = 0;
+
+  memcpy(p, name, strlen(name) + 1);
+  p += strlen(name) + 1;
+  do
+  {
+    digits[i++] = '0' + (value % 10);
+    value /= 10;
+  } while (value);
+  while (i)
+    *p++ = digits[--i];
+  *p++ = '\0';
+  return p;
 }
 
 static void tftp_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p,
-    ip_addr_t *addr, u16_t port)
+    ip_addr_t *addr, u16_t port);
+
+/* Leave the multicast group, if joined. */
+static void tftp_mcast_leave(struct tftpcb *tftp)
+{
+  if (tftp->group_udpdev)
+  {
+    udp_remove(tftp->group_udpdev);
+    tftp->group_udpdev = NULL;
+    igmp_leavegroup(&Netif.ip_addr, &tftp->group);
+  }
+}
+
+/* Parse the multicast option value "address,port,mc" of an OACK.  The
+ * address and port may be empty in a later OACK, which only elects or
+ * un-elects this client as the master client.  */
+static int tftp_mcast_option(struct tftpcb *tftp, const char *value)
+{
+  char field[24], *port, *mc;
+  ip_addr_t group;
+
+  if (strlen(value) >= sizeof(field))
+    return SYSERR;
+  strcpy(field, value);
+  port = (char *)strchr(field, ',');
+  mc = port ? (char *)strchr(&port[1], ',') : NULL;
+  if (mc == NULL)
+    return SYSERR;
+  *port++ = '\0';
+  *mc++ = '\0';
+
+  if (field[0])
+  {
+    if (!ipaddr_aton(field, &group) || !ip_addr_ismulticast(&group) ||
+        atoi(port) < 1 || atoi(port) > 0xFFFF)
+      return SYSERR;
+
+    /* Leave the group joined before if the server moved the transfer. */
+    if (!ip_addr_cmp(&group, &tftp->group) || atoi(port) != tftp->group_port)
+      tftp_mcast_leave(tftp);
+    tftp->group = group;
+    tftp->group_port = atoi(port);
+  }
+  else if (tftp->group.addr == 0)
+    return SYSERR; /* the first OACK must name the group */
+  tftp->master = (atoi(mc) == 1);
+  return OK;
+}
+
+/**
+ * Apply the options acknowledged by the server in an OACK packet.  Only
+ * values equal to or less than those requested are accepted.
+ *
+ * @return
+ *      OK if the options are acceptable, otherwise the TFTP error code
+ *      to send back to the server.
+ */
+static int tftp_oack(struct tftpcb *tftp, struct tftpPkt *pkt, int len)
 {
-  static u16 bnum;
+  char *option = pkt->OACK.options, *value;
+  char *end = (char *)pkt + len;
+  u32 number;
 
-    struct tftpcb *tftp = &TFtpCB;
+  /* Once a multicast transfer started only the multicast option of a
+   * later OACK applies, which elects a new master client.  */
+  if (tftp->group_udpdev == NULL)
+  {
+    tftp->block_size = TFTP_BLOCK_SIZE;
+    tftp->window_size = 1;
+    tftp->transfer_size = 0;
+  }
 
-    if (tftp->next_block_number == 1)
+  /* Each option is a name and a value, both zero terminated. */
+  while (option < end)
+  {
+    value = memchr(option, '\0', end - option);
+    if (value == NULL || ++value >= end ||
+        memchr(value, '\0', end - value) == NULL)
+      return TFTP_ERROR_OPTION;
+    number = atoi(value);
+
+    if (tftp_option_is(option, "multicast"))
+    {
+      if (!tftp->multicast || tftp_mcast_option(tftp, value) != OK)
+        return TFTP_ERROR_OPTION;
+    }
+    else if (tftp->group_udpdev)
+      ; /* applied by the first OACK */
+    else if (tftp_option_is(option, "blksize"))
+    {
+      if (number < 8 || number > TFTP_MAX_BLOCK_SIZE)
+        return TFTP_ERROR_OPTION;
+      tftp->block_size = number;
+    }
+    else if (tftp_option_is(option, "windowsize"))
+    {
+      if (number < 1 || number > TFTP_WINDOW_SIZE)
+        return TFTP_ERROR_OPTION;
+      tftp->window_size = number;
+    }
+    else if (tftp_option_is(option, "tsize"))
+    {
+      /* Validate the file fits the sink before the transfer. */
+      if (number > tftp->capacity)
+        return TFTP_ERROR_DISK_FULL;
+      tftp->transfer_size = number;
+    }
+    else
+      return TFTP_ERROR_OPTION; /* never requested */
+
+    option = value + strlen(value) + 1;
+  }
+  return OK;
+}
+
+/* Join the multicast group acknowledged by the OACK, if not joined.
+ *
+ * @return
+ *      OK if joined, otherwise the TFTP error code to send back.  */
+static int tftp_mcast_join(struct tftpcb *tftp)
+{
+  u32 blocks;
+
+  if (tftp->group_udpdev)
+    return OK;
+
+  /* Size the block map for the file, or the sink if the size is not
+   * known.  Block numbers may not wrap as blocks arrive in any order.  */
+  if (tftp->block_map == NULL)
+  {
+    blocks = (tftp->transfer_size ? tftp->transfer_size : tftp->capacity) /
+             tftp->block_size + 1;
+    if (blocks > 0xFFFF)
+    {
+      if (tftp->transfer_size)
+        return TFTP_ERROR_DISK_FULL;
+      blocks = 0xFFFF;
+    }
+    tftp->block_map = malloc((blocks + 7) / 8);
+    if (tftp->block_map == NULL)
+      return TFTP_ERROR_DISK_FULL;
+    bzero(tftp->block_map, (blocks + 7) / 8);
+    tftp->block_count = blocks;
+  }
+
+  if (igmp_joingroup(&Netif.ip_addr, &tftp->group) != ERR_OK)
+    return TFTP_ERROR_NOT_DEFINED;
+  tftp->group_udpdev = udp_new();
+  if (tftp->group_udpdev == NULL ||
+      udp_bind(tftp->group_udpdev, IP_ADDR_ANY, tftp->group_port) != ERR_OK)
+  {
+    if (tftp->group_udpdev)
+      udp_remove(tftp->group_udpdev);
+    tftp->group_udpdev = NULL;
+    igmp_leavegroup(&Netif.ip_addr, &tftp->group);
+    return TFTP_ERROR_NOT_DEFINED;
+  }
+  udp_recv(tftp->group_udpdev, tftp_recv, tftp);
+  return OK;
+}
+
+/* Wait for the group to go quiet for a random time, so that clients
+ * missing blocks do not all request the file again at once.  */
+static u64 tftp_mcast_timeout(struct tftpcb *tftp)
+{
+  if (tftp->master)
+    return TFTP_ACK_TIMEOUT;
+  return TFTP_MCAST_TIMEOUT + (rand() % (TFTP_MCAST_TIMEOUT / 1000)) * 1000;
+}
+
+/**
+ * Receive a DATA packet of a multicast transfer.  The block is placed at
+ * its offset, whether it is the first missing block or not, and the
+ * master client ACKs the last block before the first missing one so the
+ * server continues from there.
+ *
+ * @return
+ *      OK to continue, EOF once all blocks are received, or SYSERR if the
+ *      sink failed.
+ */
+static int tftp_mcast_data(struct tftpcb *tftp, struct tftpPkt *pkt,
+                           int len)
+{
+  u32 block = net2hs(pkt->DATA.block_number);
+  u32 nbytes = len - 4, bit = block - 1;
+  int retval;
+
+  /* Ignore blocks out of range, re-ACK duplicates if the master.  */
+  if (block == 0 || block > tftp->block_count || nbytes > tftp->block_size ||
+      (tftp->last_block && block > tftp->last_block) ||
+      (nbytes < tftp->block_size && tftp->last_block &&
+       block != tftp->last_block))
+    return OK;
+  if (tftp->block_map[bit >> 3] & (1 << (bit & 7)))
+  {
+    if (tftp->master && (tftp->stray_count++ % tftp->window_size) == 0)
+    {
+      tftp->window_count = 0;
+      tftpSendACK(tftp, (u16)(tftp->next_block_number - 1));
+    }
+    return OK;
+  }
+
+  retval = tftp->sink->write(tftp, bit * tftp->block_size,
+                             pkt->DATA.data, nbytes);
+  if (retval == BUSY)
+    return OK;
+  else if (retval != OK)
+    return SYSERR;
+  tftp->block_map[bit >> 3] |= 1 << (bit & 7);
+  tftp->block_recv_tries = 0;
+  tftp->stray_count = 0;
+
+  /* The short block is the last, the file size is now known.  */
+  if (nbytes < tftp->block_size)
+  {
+    tftp->last_block = block;
+    tftp->transfer_size = bit * tftp->block_size + nbytes;
+  }
+
+  /* Advance past the blocks received in order.  */
+  for (bit = tftp->next_block_number - 1; bit < tftp->block_count &&
+       (tftp->block_map[bit >> 3] & (1 << (bit & 7))); ++bit)
+    tftp->next_block_number++;
+  tftp->bytes = (tftp->next_block_number - 1) * tftp->block_size;
+
+  /* Complete once the last block and all before it are received.  A
+   * zero length write at the end checksums the blocks placed early.
+   * ACK the last block even if not the master, so the server does not
+   * have to elect this client to learn that it is done.  */
+  if (tftp->last_block && tftp->next_block_number > tftp->last_block)
+  {
+    tftp->bytes = tftp->transfer_size;
+    tftp->sink->write(tftp, tftp->bytes, pkt->DATA.data, 0);
+    tftpSendACK(tftp, (u16)tftp->last_block);
+    return EOF;
+  }
+
+  if (tftp->master && ++tftp->window_count >= tftp->window_size)
+  {
+    tftp->window_count = 0;
+    tftpSendACK(tftp, (u16)(tftp->next_block_number - 1));
+  }
+  return OK;
+}
+
+static void tftp_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p,
+    ip_addr_t *addr, u16_t port)
+{
+    struct tftpcb *tftp = arg;
+
+    /* The server sends DATA to the multicast group from its transfer
+     * port, the same as to the unicast port of the master client.  */
+    if (pcb == tftp->group_udpdev)
+    {
+      if (tftp->server_ip.addr != addr->addr)
+      {
+        pbuf_free(p);
+        return;
+      }
+    }
+    else if (!tftp->connected)
     {
       if (tftp->server_ip.addr != addr->addr)
       {
         TFTP_TRACE("server ip is not equal to from address.");
+        pbuf_free(p);
         return;
       }
       TFTP_TRACE("Connect after first packet from port %d.", port);
@@ -93,23 +580,25 @@ static void tftp_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p,
       {
         TFTP_TRACE("Send port %d differs from recv port %d.",
                    tftp->recv_udpdev->remote_port, port);
+        pbuf_free(p);
         return;
       }
-      bnum = 0;
+      tftp->connected = TRUE;
     }
 
     /* Loop until file is fully downloaded or an error condition occurs.  The
      * basic idea is that the client receives DATA packets one-by-one, each of
      * which corresponds to the next block of file data, and the client ACK's
-     * each one before the server sends the next.  But the actual code below is
-     * a bit more complicated as it must handle timeouts, retries, invalid
-     * packets, etc.  */
+     * each one before the server sends the next.  When a window size was
+     * negotiated the server sends a window of blocks and the client ACK's
+     * only the last one.  But the actual code below is a bit more
+     * complicated as it must handle timeouts, retries, invalid packets,
+     * etc.  */
     {
       int retval;
         u16 opcode;
         u16 recv_block_number;
-        int wrong_source;
-        u16 block_nbytes;
+        u16 block_nbytes, ahead, skipped;
         struct tftpPkt *pkt = p->payload;
 
         retval = p->len;
@@ -119,32 +608,92 @@ static void tftp_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p,
         opcode = net2hs(pkt->opcode);
         recv_block_number = net2hs(pkt->DATA.block_number);
 
-        if (retval < 4 || TFTP_OPCODE_DATA != opcode ||
-            (recv_block_number != (u16)tftp->next_block_number &&
-             (tftp->next_block_number == 1 ||
-              recv_block_number != (u16)tftp->next_block_number - 1)))
+        /* Check for the option acknowledgement of the RRQ. */
+        if (retval >= 2 && TFTP_OPCODE_OACK == opcode)
+        {
+            if (!tftp->options || (tftp->next_block_number != 1 &&
+                                   tftp->group_udpdev == NULL))
+            {
+                pbuf_free(p);
+                return;
+            }
+
+            /* Reject the transfer if the options are not acceptable. */
+            retval = tftp_oack(tftp, pkt, retval);
+            if (retval != OK)
+            {
+                TFTP_TRACE("OACK rejected with error %d.", retval);
+                if (retval == TFTP_ERROR_DISK_FULL)
+                    printf("file larger than %u bytes...", tftp->capacity);
+                tftpSendError(tftp, retval, retval ==
+                   TFTP_ERROR_DISK_FULL ? "file too large" : "bad option");
+                tftp->status = SYSERR;
+                goto out_kill_recv_thread;
+            }
+
+            /* Join the multicast group if the server acknowledged it,
+             * otherwise the transfer continues with unicast.  */
+            if (tftp->group.addr)
+            {
+                retval = tftp_mcast_join(tftp);
+                if (retval != OK)
+                {
+                    tftpSendError(tftp, retval, "no group");
+                    tftp->status = SYSERR;
+                    goto out_kill_recv_thread;
+                }
+
+                /* Only the master client ACKs, the last block before the
+                 * first missing one so the server sends it next.  */
+                tftp->window_count = tftp->stray_count = 0;
+                if (tftp->master)
+                    tftpSendACK(tftp,
+                                (u16)(tftp->next_block_number - 1));
+                tftp->block_max_end_timer =
+                                 TimerRegister(tftp_mcast_timeout(tftp));
+                pbuf_free(p);
+                return;
+            }
+
+            /* Acknowledge the options with block zero. */
+            if (tftpSendACK(tftp, 0) == SYSERR)
+            {
+                tftp->status = SYSERR;
+                goto out_kill_recv_thread;
+            }
+            tftp->block_max_end_timer = TimerRegister(TFTP_ACK_TIMEOUT);
+            pbuf_free(p);
+            return;
+        }
+
+        if (retval < 4 || TFTP_OPCODE_DATA != opcode)
         {
             /* Check for TFTP ERROR packet  */
-            if (/*!wrong_source &&*/ (retval >= 2 && TFTP_OPCODE_ERROR == opcode))
+            if (retval >= 2 && TFTP_OPCODE_ERROR == opcode)
             {
+                /* Fall back to a legacy RRQ if the options are refused. */
+                if (tftp->options && tftp->next_block_number == 1 &&
+                    retval >= 4 &&
+                    net2hs(pkt->ERROR.error_code) == TFTP_ERROR_OPTION)
+                {
+                    TFTP_TRACE("Options refused, sending legacy RRQ.");
+                    tftp->options = FALSE;
+                    tftp->connected = FALSE;
+                    tftp->block_max_end_timer = TimerRegister(0);
+                    pbuf_free(p);
+                    return;
+                }
                 TFTP_TRACE("Received TFTP ERROR opcode packet; aborting.");
                 tftp->status = SYSERR;
                 goto out_kill_recv_thread;
             }
             TFTP_TRACE("Received invalid or unexpected packet.");
-            TFTP_TRACE("\n\t res %d, rblk %d, nblk %d, op %d\n",
-                retval, recv_block_number, tftp->next_block_number,
-                opcode);
 
             /* Ignore the bad packet and try receiving again.  */
             pbuf_free(p);
             return;// TASK_IDLE;//continue;
         }
 
-        /* Received packet is a valid TFTP DATA packet for either the next block
-         * or the previous block.  */
-
-
     #if TFTP_DROP_PACKET_PERCENT != 0
         /* Stress testing.  */
         if (rand() % 100 < TFTP_DROP_PACKET_PERCENT)
@@ -155,53 +704,134 @@ static void tftp_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p,
         }
     #endif
 
+        /* Time to the first byte, the round trips before any data. */
+        if (tftp->first == 0)
+            tftp->first = TimerNow();
+
+        /* Blocks of a multicast transfer are received in any order.  */
+        if (tftp->group_udpdev)
+        {
+            retval = tftp_mcast_data(tftp, pkt, retval);
+            if (retval == SYSERR)
+            {
+                printf("write to %s failed at block %u...", tftp->sink->name,
+                       recv_block_number);
+                tftpSendError(tftp, TFTP_ERROR_DISK_FULL,
+                              "disk full");
+            }
+            if (retval != OK)
+            {
+                tftp->status = retval;
+                goto out_kill_recv_thread;
+            }
+            tftp->block_max_end_timer =
+                             TimerRegister(tftp_mcast_timeout(tftp));
+            pbuf_free(p);
+            return;
+        }
+
+        block_nbytes = retval - 4;
+
+        /* Place a full block received ahead of a lost block in the window
+         * directly at its final offset, if the sink allows it.  Once the
+         * lost block arrives the transfer skips ahead over it.  */
+        ahead = (u16)(recv_block_number - tftp->next_block_number);
+        if (ahead > 0 && ahead < tftp->window_size && tftp->sink->random &&
+            block_nbytes == tftp->block_size &&
+            !(tftp->window_map & (1 << ahead)))
+        {
+            if (tftp->sink->write(tftp, tftp->bytes + ahead *
+                          tftp->block_size, pkt->DATA.data, block_nbytes) == OK)
+                tftp->window_map |= 1 << ahead;
+        }
+
+        /* Out of order or duplicate block, a block in the window was lost
+         * or the server did not receive the last ACK.  ACK the last block
+         * received in order so the server sends the window again from
+         * there (RFC 7440), but only once per window of stray blocks.  */
+        if (recv_block_number != (u16)tftp->next_block_number)
+        {
+            TFTP_TRACE("Received block %u, expected %u", recv_block_number,
+                       tftp->next_block_number);
+            if ((tftp->next_block_number > 1 || tftp->window_size > 1) &&
+                (tftp->stray_count++ % tftp->window_size) == 0)
+            {
+                tftp->window_count = 0;
+                tftpSendACK(tftp,
+                            (u16)(tftp->next_block_number - 1));
+            }
+            pbuf_free(p);
+            return;
+        }
+
         /* Handle receiving the next data block.  */
-        block_nbytes = TFTP_BLOCK_SIZE;
-        if (recv_block_number == (u16)tftp->next_block_number)
+        TFTP_TRACE("Received block %u (%u bytes)",
+                   recv_block_number, block_nbytes);
+
+        /* Pass the block to the sink, drop it if the sink is busy.  */
+        retval = tftp->sink->write(tftp, tftp->bytes, pkt->DATA.data,
+                                   block_nbytes);
+        if (retval == BUSY)
         {
-            block_nbytes = retval - 4;
-            TFTP_TRACE("Received block %u (%u bytes)",
-                       recv_block_number, block_nbytes);
-
-            if (++bnum != recv_block_number)
-              printf("TFTP OutOfSync %d != %d\n", bnum - 1,
-                     recv_block_number - 1);
-
-//            pkt->DATA.data[block_nbytes] = '\0';
-//            printf("%d: %s\r\n", recv_block_number, pkt->DATA.data);
-#if ENABLE_BOOTLOADER
-            /* Save the block to the memory location chosen */
-            memcpy(&tftp->destination[(recv_block_number - 1) *
-                   TFTP_BLOCK_SIZE], pkt->DATA.data, block_nbytes);
-#endif
+            pbuf_free(p);
+            return;
+        }
+        else if (retval != OK)
+        {
+            printf("write to %s failed at %u bytes...", tftp->sink->name,
+                   tftp->bytes);
+            tftpSendError(tftp, TFTP_ERROR_DISK_FULL,
+                          "disk full");
+            tftp->status = SYSERR;
+            goto out_kill_recv_thread;
+        }
+        tftp->bytes += block_nbytes;
+        tftp->next_block_number++;
+        tftp->window_map >>= 1;
+        tftp->block_recv_tries = 0;
+        tftp->stray_count = 0;
+
+        /* Skip ahead over the blocks placed early, if any.  */
+        for (skipped = 0; tftp->window_map & 1; ++skipped)
+        {
+            tftp->bytes += tftp->block_size;
             tftp->next_block_number++;
-            tftp->block_recv_tries = 0;
+            tftp->window_map >>= 1;
+        }
+        if (skipped)
+        {
+            recv_block_number = (u16)(tftp->next_block_number - 1);
+            tftp->window_count = tftp->window_size - 1;
         }
-
-        /* Acknowledge the block received.  */
-        retval = tftpSendACK(tftp->send_udpdev, recv_block_number);
 
         /* A TFTP Get transfer is complete when a short data block has been
          * received.   Note that it doesn't really matter from the client's
          * perspective whether the last data block is acknowledged or not;
          * however, the server would like to know so it doesn't keep re-sending
-         * the last block.  For this reason we did send the final ACK packet but
-         * will ignore failure to send it.  */
-        if (block_nbytes < TFTP_BLOCK_SIZE)
+         * the last block.  For this reason we do send the final ACK packet but
+         * ignore failure to send it.  */
+        if (block_nbytes < tftp->block_size)
         {
+            tftpSendACK(tftp, recv_block_number);
             tftp->status = EOF;
             goto out_kill_recv_thread;//break;
         }
 
-        /* Break if sending the ACK failed.  */
-        if (SYSERR == retval)
+        /* Acknowledge the last block of the window.  */
+        if (++tftp->window_count >= tftp->window_size)
         {
-            tftp->status = SYSERR;
-            goto out_kill_recv_thread;//break;
+            tftp->window_count = 0;
+
+            /* Break if sending the ACK failed.  */
+            if (SYSERR == tftpSendACK(tftp, recv_block_number))
+            {
+                tftp->status = SYSERR;
+                goto out_kill_recv_thread;//break;
+            }
         }
 
         /* Start the block timer again */
-        tftp->block_max_end_timer = TimerRegister(TFTP_BLOCK_TIMEOUT);
+        tftp->block_max_end_timer = TimerRegister(TFTP_ACK_TIMEOUT);
     }
 
     pbuf_free(p);
@@ -216,159 +846,326 @@ out_kill_recv_thread:
     tftp->block_max_end_timer = TimerRegister(0);
 }
 
-int Tftp(char *command)
+/* End a session, reporting the result of the transfer. */
+static void tftp_finish(struct tftpcb *tftp)
 {
-  static int first = 0;
-  int status;
-  int local_port;
-  char *fname, *arg1;
-  char *arg2, *ip;
-
-  if (first++ == 0)
-    Data = NULL;
-
-  if (Data == NULL)
+  if (tftp->recv_udpdev)
+    udp_remove(tftp->recv_udpdev);
+  else if (tftp->send_udpdev)
+    udp_remove(tftp->send_udpdev);
+  tftp->send_udpdev = tftp->recv_udpdev = NULL;
+  tftp_mcast_leave(tftp);
+  if (tftp->block_map)
+    free(tftp->block_map);
+  tftp->block_map = NULL;
+  if (tftp->sink->close)
+    tftp->sink->close(tftp);
+
+  if (tftp->status == EOF)
   {
+    u32 ms = (u32)(TimerNow() - tftp->start) / 1000;
+
+    /* Report the throughput, bytes per millisecond is KB/s. */
+    if (ms == 0)
+      ms = 1;
+    printf("%s: transfer complete, %u bytes in %u ms (%u KB/s), "
+           "blksize %u windowsize %u\n", tftp->filename, tftp->bytes, ms,
+           tftp->bytes / ms, tftp->block_size, tftp->window_size);
+    printf("first byte in %u ms, %u ms after network start\n",
+           (u32)(tftp->first - tftp->start) / 1000,
+           (u32)(tftp->first - NetStartTime) / 1000);
+    if (tftp->group.addr)
+      printf("multicast group %u.%u.%u.%u port %u\n",
+             ip4_addr1(&tftp->group), ip4_addr2(&tftp->group),
+             ip4_addr3(&tftp->group), ip4_addr4(&tftp->group),
+             tftp->group_port);
+
+    /* The CRC32 was computed as the data arrived, no second pass. */
+    tftp->crc = ~tftp->crc;
+    if (tftp->check_crc && tftp->crc != tftp->expect_crc)
+      printf("crc32 %08x does not match %08x, %s image invalid\n",
+             tftp->crc, tftp->expect_crc, tftp->sink->name);
+    else
     {
-      fname = NULL;
-      ip = NULL;
-      arg1 = strchr(command, ' ');
-      arg2 = NULL;
-
-      if (arg1)
-        arg2 = strchr(&arg1[1], ' ');
+      printf("crc32 %08x%s\n", tftp->crc,
+             tftp->check_crc ? " verified" : "");
 
-      if (arg1 && arg2)
-      {
-        ip = arg1;
-        fname = arg2;
-      }
-      else if (arg1)
-      {
-        fname = arg1;
-      }
-
-      /* initialize the tftp boot loader request */
-      bzero(&TFtpCB, sizeof(struct tftpcb));
-
-      if (fname)
-        strcpy(TFtpCB.filename, &fname[1]);
-      else
-        strcpy(TFtpCB.filename, "kernel7.img"); /* default app name */
-
-      if (ip)
-      {
-        char *ipnext;
+      /* Serve the image just received with the TFTP server. */
+      if (tftp->sink == &TftpSinks[0])
+        TftpdAddImage(tftp->filename, tftp->destination, tftp->bytes);
+    }
+  }
+  else if (tftp->status == TIMEOUT)
+    printf("%s: transfer timeout\n", tftp->filename);
+  else
+    printf("%s: transfer failed\n", tftp->filename);
+}
 
-        ip = &ip[1];
-        ipnext = strchr(ip, '.');
-        if (ipnext)
-        {
-          ipnext[0] = '\0';
-          Ip1 = atoi(ip);
-          ip = ipnext;
-        }
-        ip = &ip[1];
-        ipnext = strchr(ip, '.');
-        if (ipnext)
-        {
-          ipnext[0] = '\0';
-          Ip2 = atoi(ip);
-          ip = ipnext;
-        }
-        ip = &ip[1];
-        ipnext = strchr(ip, '.');
-        if (ipnext)
-        {
-          ipnext[0] = '\0';
-          Ip3 = atoi(ip);
-          ip = ipnext;
-        }
-        ip = &ip[1];
-        ipnext = strchr(ip, ' ');
-        if (ipnext)
-          ipnext[0] = '\0';
-        Ip4 = atoi(ip);
-      }
+/* Session task, polls the transfer until it finishes. */
+static int tftp_poll(void *data)
+{
+  struct tftpcb *tftp = data;
 
-      IP4_ADDR(&TFtpCB.server_ip, Ip1, Ip2, Ip3, Ip4); /* default app name */
-      TFtpCB.send_udpdev = NULL;
-      TFtpCB.recv_udpdev = NULL;
+  if (tftpGet(tftp) != TASK_FINISHED)
+    return TASK_IDLE;
 
-      TFtpCB.destination = (void *)_run_location();
+  tftp_finish(tftp);
+  tftp->active = FALSE;
+  return TASK_FINISHED;
+}
 
-      Data = &TFtpCB;
-      printf("Download image %s from TFTP server %d.%d.%d.%d...",
-             TFtpCB.filename, Ip1, Ip2, Ip3, Ip4);
-    }
+/* Send the first RRQ of a session and register the receive callback
+ * on the same local port. */
+static int tftp_start(struct tftpcb *tftp)
+{
+  int local_port;
 
 #ifdef ENABLE_TFTP_TRACE
-    TFTP_TRACE("Downloading %s from ", TFtpCB.filename);
+    TFTP_TRACE("Downloading %s from ", tftp->filename);
 //    netaddrprintf(&tftp->server_ip);
     TFTP_TRACE(" using local_ip = ");
 //    netaddrprintf(&tftp->local_ip);
     TFTP_TRACE("\n");
 #endif
 
-    TFtpCB.send_udpdev = udp_new();//netconn_new(NETCONN_UDP);
+    tftp->send_udpdev = udp_new();//netconn_new(NETCONN_UDP);
     LWIP_ASSERT("tftp->udpdev != NULL", tftp->send_udpdev != NULL);
 
     /* connect the outgoing UDP socket */
-    udp_connect(TFtpCB.send_udpdev, &TFtpCB.server_ip, PORT_TFTP);//    netconn_connect(conn, &tftp->server_ip, 69/*UDP_PORT_TFTP*/);
+    udp_connect(tftp->send_udpdev, &tftp->server_ip, PORT_TFTP);//    netconn_connect(conn, &tftp->server_ip, 69/*UDP_PORT_TFTP*/);
 
     /* Begin the download by requesting the file.  */
-    status = tftpSendRRQ(TFtpCB.send_udpdev, TFtpCB.filename);
-    if (status == SYSERR)
+    if (tftpSendRRQ(tftp) == SYSERR)
     {
-        TFtpCB.status = SYSERR;
-        udp_remove(TFtpCB.send_udpdev);
-        TFtpCB.send_udpdev = NULL;//(void *)-1;
-        TFtpCB.recv_udpdev = NULL;//(void *)-1;
-        Data = NULL;
-        return TASK_FINISHED;
+        udp_remove(tftp->send_udpdev);
+        tftp->send_udpdev = NULL;//(void *)-1;
+        tftp->recv_udpdev = NULL;//(void *)-1;
+        return SYSERR;
     }
-    TFtpCB.block_max_end_timer = TimerRegister(TFTP_INIT_BLOCK_TIMEOUT);
-    TFtpCB.num_rreqs_sent = 1;
-    TFtpCB.next_block_number = 1;
-    TFtpCB.block_recv_tries = 0;
+    tftp->block_max_end_timer = TimerRegister(TFTP_INIT_BLOCK_TIMEOUT);
+    tftp->num_rreqs_sent = 1;
+    tftp->next_block_number = 1;
+    tftp->block_recv_tries = 0;
 
-    local_port = TFtpCB.send_udpdev->local_port;
+    local_port = tftp->send_udpdev->local_port;
 
-    udp_remove(TFtpCB.send_udpdev);
-    TFtpCB.send_udpdev = NULL;
+    udp_remove(tftp->send_udpdev);
+    tftp->send_udpdev = NULL;
 
     /* register the tftp_recv function as callback for this socket */
-    TFtpCB.recv_udpdev = udp_new();
-    LWIP_ASSERT("tftp->recv_udpdev != NULL", TFtpCB.recv_udpdev != NULL);
+    tftp->recv_udpdev = udp_new();
+    LWIP_ASSERT("tftp->recv_udpdev != NULL", tftp->recv_udpdev != NULL);
     TFTP_TRACE("TFTP receiver on local port %d\n", local_port);
-    if (udp_bind(TFtpCB.recv_udpdev, IP_ADDR_ANY, local_port) != ERR_OK)
+    if (udp_bind(tftp->recv_udpdev, IP_ADDR_ANY, local_port) != ERR_OK)
     {
       TFTP_TRACE("udp bind failed for TFTP receiver\n");
-      TFtpCB.status = SYSERR;
-      udp_remove(TFtpCB.recv_udpdev);
-      TFtpCB.send_udpdev = NULL;//(void *)-1;
-      TFtpCB.recv_udpdev = NULL;//(void *)-1;
-      Data = NULL;
-      return TASK_FINISHED;
+      udp_remove(tftp->recv_udpdev);
+      tftp->send_udpdev = NULL;//(void *)-1;
+      tftp->recv_udpdev = NULL;//(void *)-1;
+      return SYSERR;
     }
 
     /* change to new socket for sending and register receive callback */
-    TFtpCB.send_udpdev = TFtpCB.recv_udpdev;
-    udp_recv(TFtpCB.recv_udpdev, tftp_recv, &Netif);
+    tftp->send_udpdev = tftp->recv_udpdev;
+    udp_recv(tftp->recv_udpdev, tftp_recv, tftp);
+    return OK;
+}
+
+int Tftp(char *command)
+{
+  struct tftpcb *tftp;
+  char *fname, *arg1;
+  char *arg2, *ip;
+  char *arg3, *sink, *crc;
+  int background = FALSE;
+  u32 length;
+
+  /* Wait for the download started by this shell, if any, as the
+   * UART and remote shells may each be waiting for their own. */
+  for (tftp = TftpSessions; tftp < &TftpSessions[TFTP_MAX_SESSIONS]; ++tftp)
+    if (tftp->shell && (tftp->shell == StdioState))
+    {
+      if (tftp->active)
+        return TASK_IDLE;
+      tftp->shell = NULL;
+      return TASK_FINISHED;
+    }
+
+  /* Allocate a session from the pool, once no shell waits for it. */
+  for (tftp = TftpSessions; tftp < &TftpSessions[TFTP_MAX_SESSIONS]; ++tftp)
+    if (!tftp->active && !tftp->shell)
+      break;
+  if (tftp == &TftpSessions[TFTP_MAX_SESSIONS])
+  {
+    puts("all TFTP sessions in use");
+    return TASK_FINISHED;
   }
 
-  status = tftpGet(Data);
-  if (status == TASK_FINISHED)
+  /* A trailing '&' runs the download in the background. */
+  length = strlen(command);
+  while (length && command[length - 1] == ' ')
+    command[--length] = '\0';
+  if (length && command[length - 1] == '&')
   {
-    if (TFtpCB.status == EOF)
-      puts("transfer complete");
-    else if (TFtpCB.status == TIMEOUT)
-      puts("transfer timeout");
-    else
-      puts("transfer failed");
-    Data = NULL;
+    background = TRUE;
+    command[--length] = '\0';
+    while (length && command[length - 1] == ' ')
+      command[--length] = '\0';
+  }
+
+  fname = NULL;
+  ip = NULL;
+  sink = NULL;
+  crc = NULL;
+  arg1 = strchr(command, ' ');
+  arg2 = arg3 = NULL;
+
+  if (arg1)
+    arg2 = strchr(&arg1[1], ' ');
+
+  /* Optional sink name after the file name, then the CRC32 the
+   * file must match.  */
+  if (arg2)
+    arg3 = (char *)strchr(&arg2[1], ' ');
+  if (arg3)
+  {
+    arg3[0] = '\0';
+    sink = &arg3[1];
+    arg3 = (char *)strchr(sink, ' ');
+    if (arg3)
+    {
+      arg3[0] = '\0';
+      crc = &arg3[1];
+    }
+  }
+
+  if (arg1 && arg2)
+  {
+    ip = arg1;
+    fname = arg2;
+  }
+  else if (arg1)
+  {
+    fname = arg1;
   }
-  return status;
+
+  /* initialize the tftp boot loader request */
+  bzero(tftp, sizeof(struct tftpcb));
+  tftp->background = background;
+
+  /* Select the sink by name, the RAM image by default. */
+  tftp->sink = &TftpSinks[0];
+  if (sink)
+  {
+    for (; tftp->sink->name; ++tftp->sink)
+      if (strcmp(tftp->sink->name, sink) == 0)
+        break;
+    if (tftp->sink->name == NULL)
+    {
+      printf("unknown sink %s, use", sink);
+      for (tftp->sink = TftpSinks; tftp->sink->name; ++tftp->sink)
+        printf(" %s", tftp->sink->name);
+      puts("");
+      return TASK_FINISHED;
+    }
+  }
+  if (crc)
+  {
+    tftp->check_crc = TRUE;
+    tftp->expect_crc = tftp_hex(crc);
+  }
+
+  /* The mtftp command requests a multicast transfer, the blocks
+   * may arrive in any order so the sink must be random access.  */
+  if (command[0] == 'm')
+  {
+    if (!tftp->sink->random)
+    {
+      printf("%s sink cannot receive multicast\n", tftp->sink->name);
+      return TASK_FINISHED;
+    }
+    tftp->multicast = TRUE;
+  }
+
+  if (fname)
+    strcpy(tftp->filename, &fname[1]);
+  else
+    strcpy(tftp->filename, "kernel7.img"); /* default app name */
+
+  if (ip)
+  {
+    char *ipnext;
+
+    ip = &ip[1];
+    ipnext = strchr(ip, '.');
+    if (ipnext)
+    {
+      ipnext[0] = '\0';
+      Ip1 = atoi(ip);
+      ip = ipnext;
+    }
+    ip = &ip[1];
+    ipnext = strchr(ip, '.');
+    if (ipnext)
+    {
+      ipnext[0] = '\0';
+      Ip2 = atoi(ip);
+      ip = ipnext;
+    }
+    ip = &ip[1];
+    ipnext = strchr(ip, '.');
+    if (ipnext)
+    {
+      ipnext[0] = '\0';
+      Ip3 = atoi(ip);
+      ip = ipnext;
+    }
+    ip = &ip[1];
+    ipnext = strchr(ip, ' ');
+    if (ipnext)
+      ipnext[0] = '\0';
+    Ip4 = atoi(ip);
+  }
+
+  IP4_ADDR(&tftp->server_ip, Ip1, Ip2, Ip3, Ip4); /* default app name */
+  tftp->send_udpdev = NULL;
+  tftp->recv_udpdev = NULL;
+
+  /* Open the sink, the CRC32 of the data starts with all ones. */
+  if (Crc32Table[0][1] == 0)
+    crc32_init();
+  if (tftp->sink->open(tftp) != OK)
+  {
+    printf("%s sink not available\n", tftp->sink->name);
+    return TASK_FINISHED;
+  }
+  tftp->crc = 0xFFFFFFFF;
+
+  /* Request options, legacy values are used until acknowledged. */
+  tftp->options = TRUE;
+  tftp->block_size = TFTP_BLOCK_SIZE;
+  tftp->window_size = 1;
+  tftp->start = TimerNow();
+
+  printf("Download image %s from TFTP server %d.%d.%d.%d to %s%s\n",
+         tftp->filename, Ip1, Ip2, Ip3, Ip4, tftp->sink->name,
+         background ? " in background" : "...");
+
+  /* Request the file and create the task driving the session. */
+  if (!NetUp || tftp_start(tftp) != OK ||
+      TaskNew(TFTP_TASK_PRIORITY, tftp_poll, tftp) == NULL)
+  {
+    tftp->status = SYSERR;
+    tftp_finish(tftp);
+    return TASK_FINISHED;
+  }
+  tftp->active = TRUE;
+
+  /* The shell waits for a download unless in the background. */
+  if (background)
+    return TASK_FINISHED;
+  tftp->shell = StdioState;
+  return TASK_IDLE;
 }
 
 /**
@@ -377,15 +1174,15 @@ int Tftp(char *command)
  * data packet (having a specific block number) has been received.  Not intended
  * to be used outside of the TFTP code.
  *
- * @param udpdev
- *      Device descriptor for the open UDP device.
+ * @param tftp
+ *      The client session, sent from its UDP device.
  * @param block_number
  *      Block number to acknowledge.
  *
  * @return
  *      OK if packet sent successfully; SYSERR otherwise.
  */
-int tftpSendACK(void *conn, u16 block_number)
+int tftpSendACK(struct tftpcb *tftp, u16 block_number)
 {
   struct tftpPkt *pkt;
   struct pbuf *buf;
@@ -401,8 +1198,46 @@ int tftpSendACK(void *conn, u16 block_number)
     pkt->opcode = hs2net(TFTP_OPCODE_ACK);
     pkt->ACK.block_number = hs2net(block_number);
     buf->len = 4;
-    udp_sendto_if(conn, buf, &TFtpCB.server_ip,
-                  TFtpCB.send_udpdev->remote_port, &Netif);
+    udp_sendto_if(tftp->send_udpdev, buf, &tftp->server_ip,
+                  tftp->send_udpdev->remote_port, &Netif);
+    pbuf_free(buf);
+    return OK;
+  }
+  return SYSERR;
+}
+
+/**
+ * Send a TFTP ERROR packet over a UDP connection to the TFTP server, for
+ * example to refuse an option acknowledgement.  Not intended to be used
+ * outside of the TFTP code.
+ *
+ * @param tftp
+ *      The client session, sent from its UDP device.
+ * @param error_code
+ *      TFTP error code.
+ * @param message
+ *      Error message for the server.
+ *
+ * @return
+ *      OK if packet sent successfully; SYSERR otherwise.
+ */
+int tftpSendError(struct tftpcb *tftp, u16 error_code, const char *message)
+{
+  struct tftpPkt *pkt;
+  struct pbuf *buf;
+  u32 pktlen = 4 + strlen(message) + 1;
+
+  TFTP_TRACE("ERROR %u %s", error_code, message);
+
+  buf = pbuf_alloc(PBUF_TRANSPORT, pktlen, PBUF_RAM);
+  if (buf)
+  {
+    pkt = (struct tftpPkt *)buf->payload;
+    pkt->opcode = hs2net(TFTP_OPCODE_ERROR);
+    pkt->ERROR.error_code = hs2net(error_code);
+    memcpy(pkt->ERROR.message, message, strlen(message) + 1);
+    udp_sendto_if(tftp->send_udpdev, buf, &tftp->server_ip,
+                  tftp->send_udpdev->remote_port, &Netif);
     pbuf_free(buf);
     return OK;
   }
@@ -412,18 +1247,19 @@ int tftpSendACK(void *conn, u16 block_number)
 /**
  * Send a TFTP RRQ (Read Request) packet over a UDP connection to the TFTP
  * server.  This instructs the TFTP server to begin sending the contents of the
- * specified file.  Not intended to be used outside of the TFTP code.
+ * specified file.  Unless falling back to a legacy request the blksize,
+ * windowsize and tsize options are appended.  Not intended to be used outside
+ * of the TFTP code.
  *
- * @param udpdev
- *      Device descriptor for the open UDP device.
- * @param filename
- *      Name of the file to request.
+ * @param tftp
+ *      The client session, sent from its UDP device to the TFTP port.
  *
  * @return
  *      OK if packet sent successfully; SYSERR otherwise.
  */
-int tftpSendRRQ(void *conn, const char *filename)
+int tftpSendRRQ(struct tftpcb *tftp)
 {
+  const char *filename = tftp->filename;
   u8 *p;
   u32 filenamelen;
   u32 pktlen;
@@ -441,9 +1277,10 @@ int tftpSendRRQ(void *conn, const char *filename)
   TFTP_TRACE("RRQ \"%s\" (mode: octet) fnamelen %d", filename,
              filenamelen);
 
-  /* Write the resulting packet to the UDP device.  */
-  pktlen = 2 + filenamelen + 1 + 6;//p - (u8 *)&pkt;
-
+  /* Allocate for the largest request, the length is set below.  */
+  pktlen = 2 + filenamelen + 1 + 6 + sizeof("blksize") + 5 +
+           sizeof("windowsize") + 4 + sizeof("tsize") + 2 +
+           sizeof("multicast") + 1;
 
   buf = pbuf_alloc(PBUF_TRANSPORT, pktlen, PBUF_RAM);
   if (buf)
@@ -454,27 +1291,42 @@ int tftpSendRRQ(void *conn, const char *filename)
     pkt->opcode = hs2net(TFTP_OPCODE_RRQ);
 
     /* Set up filename and mode.  */
-    p = pkt->RRQ.filename_and_mode;
+    p = (u8 *)pkt->RRQ.filename_and_mode;
     memcpy(p, filename, filenamelen + 1);
     TFTP_TRACE("p (fname) is: %s\n", p);
 
     memcpy(&p[filenamelen + 1], "octet", 6);
     TFTP_TRACE("p (type) is: %s\n", &p[filenamelen + 1]);
+    p += filenamelen + 1 + 6;
+
+    /* Request the options, the server acknowledges them with OACK.  */
+    if (tftp->options)
+    {
+      p = tftp_option_add(p, "blksize", TFTP_MAX_BLOCK_SIZE);
+      p = tftp_option_add(p, "windowsize", TFTP_WINDOW_SIZE);
+      p = tftp_option_add(p, "tsize", 0);
 
-    buf->len = pktlen;
-    udp_sendto_if(conn, buf/*TFtpCB.out*/, &TFtpCB.server_ip, PORT_TFTP,
-                  &Netif);
+      /* The multicast option has an empty value (RFC 2090).  */
+      if (tftp->multicast)
+      {
+        memcpy(p, "multicast", sizeof("multicast"));
+        p += sizeof("multicast");
+        *p++ = '\0';
+      }
+    }
+
+    /* Write the resulting packet to the UDP device.  */
+    buf->len = buf->tot_len = p - (u8 *)pkt;
+    udp_sendto_if(tftp->send_udpdev, buf/*tftp->out*/, &tftp->server_ip,
+                  PORT_TFTP, &Netif);
     pbuf_free(buf);
     return OK;
   }
   return SYSERR;
 }
 
-extern int NetUp;
-
-int tftpGet(void *t)
+int tftpGet(struct tftpcb *tftp)
 {
-  struct tftpcb *tftp = t;
   int retval, local_port;
 
   if (!NetUp)
@@ -498,13 +1350,50 @@ int tftpGet(void *t)
       udp_remove(tftp->send_udpdev);
       tftp->send_udpdev = NULL;
       tftp->recv_udpdev = NULL;
-      Data = NULL;
       return TASK_FINISHED;
     }
 
     /* Timeout was reached.  */
     TFTP_TRACE("Timeout on block %u", tftp->next_block_number);
 
+    /* A multicast client that is not the master requests the file again
+     * once the group is quiet, so the server elects it master to send
+     * the blocks it is missing.  */
+    if (tftp->group_udpdev && !tftp->master)
+    {
+      if (++tftp->block_recv_tries > TFTP_MCAST_MAX_RETRIES)
+      {
+        tftp->status = TIMEOUT;
+        tftp->block_max_end_timer = TimerRegister(0);
+        return TASK_IDLE;
+      }
+
+      /* The server may answer from a new transfer port.  */
+      TFTP_TRACE("Multicast group quiet, requesting block %u",
+                 tftp->next_block_number);
+      udp_disconnect(tftp->recv_udpdev);
+      tftp->connected = FALSE;
+      tftpSendRRQ(tftp);
+      tftp->block_max_end_timer = TimerRegister(tftp_mcast_timeout(tftp));
+      return TASK_IDLE;
+    }
+
+    /* Once the transfer started re-send the last ACK, which makes the
+     * server re-send the blocks after it, until too many retries.  */
+    if (tftp->connected)
+    {
+      if (++tftp->block_recv_tries > TFTP_ACK_MAX_RETRIES)
+      {
+        tftp->status = TIMEOUT;
+        tftp->block_max_end_timer = TimerRegister(0);
+        return TASK_IDLE;
+      }
+      tftp->window_count = tftp->stray_count = 0;
+      tftpSendACK(tftp, (u16)(tftp->next_block_number - 1));
+      tftp->block_max_end_timer = TimerRegister(TFTP_ACK_TIMEOUT);
+      return TASK_IDLE;
+    }
+
     /* If the client is still waiting for the very first reply from the
      * server, don't fail on the first timeout; instead wait until the
      * client has had the chance to re-send the RRQ a few times.  */
@@ -514,16 +1403,20 @@ int tftpGet(void *t)
       if (tftp->send_udpdev == NULL)
         tftp->send_udpdev = udp_new();
 
+      /* Fall back to a legacy request if the server never answers one
+       * with options.  */
+      if (tftp->num_rreqs_sent >= TFTP_OPTION_RRQ_RETRIES)
+        tftp->options = FALSE;
+
       TFTP_TRACE("Trying RRQ again (try %u of %u)",
                  tftp->num_rreqs_sent + 1, TFTP_INIT_BLOCK_MAX_RETRIES);
       udp_connect(tftp->send_udpdev, &tftp->server_ip, PORT_TFTP);
-      retval = tftpSendRRQ(tftp->send_udpdev, tftp->filename);
+      retval = tftpSendRRQ(tftp);
       if (retval == SYSERR)
       {
         udp_remove(tftp->send_udpdev);
         tftp->send_udpdev = NULL;
         tftp->recv_udpdev = NULL;
-        Data = NULL;
         return TASK_FINISHED;
       }
       tftp->block_recv_tries = 0;
@@ -532,6 +1425,8 @@ int tftpGet(void *t)
                                   TFTP_INIT_BLOCK_TIMEOUT);
       local_port = tftp->send_udpdev->local_port;
       udp_remove(tftp->send_udpdev);
+      if (tftp->recv_udpdev == tftp->send_udpdev)
+        tftp->recv_udpdev = NULL; /* the same pcb, already removed */
       tftp->send_udpdev = NULL;
 
       /* register the tftp_recv function as callback for this socket */
@@ -545,15 +1440,14 @@ int tftpGet(void *t)
       {
         TFTP_TRACE("udp bind failed for TFTP receiver\n");
         tftp->status = SYSERR;
-        udp_remove(TFtpCB.recv_udpdev);
+        udp_remove(tftp->recv_udpdev);
         tftp->send_udpdev = NULL;
         tftp->recv_udpdev = NULL;
-        Data = NULL;
         return TASK_FINISHED;
       }
 
       tftp->send_udpdev = tftp->recv_udpdev;
-      udp_recv(tftp->recv_udpdev, tftp_recv, &Netif);
+      udp_recv(tftp->recv_udpdev, tftp_recv, tftp);
       return TASK_IDLE;
     }
     else if (tftp->num_rreqs_sent >= TFTP_INIT_BLOCK_MAX_RETRIES)
@@ -0,0 +1,637 @@
+/*...................................................................*/
+/*                                                                   */
+/*   Module:  tftp_srv.c                                             */
+/*   Version: 2020.0                                                 */
+/*   Purpose: TFTP server for RAM images                             */
+/*                                                                   */
+/*...................................................................*/
+/*                                                                   */
+/*                   Copyright 2020, Sean Lawless                    */
+/*                                                                   */
+/*                      ALL RIGHTS RESERVED                          */
+/*                                                                   */
+/* Redistribution and use in source, binary or derived forms, with   */
+/* or without modification, are permitted provided that the          */
+/* following conditions are met:                                     */
+/*                                                                   */
+/*  1. Redistributions in any form, including but not limited to     */
+/*     source code, binary, or derived works, must include the above */
+/*     copyright notice, this list of conditions and the following   */
+/*     disclaimer.                                                   */
+/*                                                                   */
+/*  2. Any change or addition to this copyright notice requires the  */
+/*     prior written permission of the above copyright holder.       */
+/*                                                                   */
+/* THIS SOFTWARE IS PROVIDED ''AS IS''. ANY EXPRESS OR IMPLIED       */
+/* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES */
+/* OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE       */
+/* DISCLAIMED. IN NO EVENT SHALL ANY AUTHOR AND/OR COPYRIGHT HOLDER  */
+/* BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,          */
+/* EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED   */
+/* TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,     */
+/* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON */
+/* ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,   */
+/* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY    */
+/* OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE           */
+/* POSSIBILITY OF SUCH DAMAGE.                                       */
+/*...................................................................*/
+#include <system.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if ENABLE_UDP
+
+#include <lwip/tftp.h>
+#include <lwip/udp.h>
+#include <lwip/pbuf.h>
+
+/*...................................................................*/
+/* Symbol Definitions                                                */
+/*...................................................................*/
+#define PORT_TFTP           69
+#define TFTPD_MAX_SESSIONS  16
+#define TFTPD_MAX_IMAGES    4
+#define TFTPD_NAME_LENGTH   64
+#define TFTPD_TIMEOUT       (MICROS_PER_SECOND / 4) /* re-send window */
+#define TFTPD_MAX_RETRIES   20
+#define TFTPD_TASK_PRIORITY 4
+
+/* Options acknowledged in the OACK, if requested (RFC 2347) */
+#define TFTPD_OPTION_BLKSIZE    (1 << 0)
+#define TFTPD_OPTION_WINDOWSIZE (1 << 1)
+#define TFTPD_OPTION_TSIZE      (1 << 2)
+
+/* A file in RAM, served by name */
+struct tftpd_image
+{
+  char name[TFTPD_NAME_LENGTH];
+  const u8 *data;
+  u32 size;
+};
+
+/* A transfer to one client, free if pcb is NULL.  Block numbers are 32
+ * bits, the 16 bit block number sent rolls over for large files. */
+struct tftpd_session
+{
+  struct udp_pcb *pcb;  /* connected to the client transfer port */
+  const u8 *data;       /* the RAM image */
+  u32 size;             /* file size */
+  u32 block_size;       /* negotiated blksize */
+  u32 window_size;      /* negotiated windowsize */
+  u32 options;          /* options to acknowledge, zero if none */
+  u32 base;             /* oldest block not yet acknowledged */
+  u32 next;             /* next block to send */
+  u32 last;             /* final (short) block */
+  u32 retries;          /* timeouts since the last progress */
+  struct timer timeout;
+};
+
+/*...................................................................*/
+/* Global Variables                                                  */
+/*...................................................................*/
+extern int NetUp;
+static struct udp_pcb *TftpdPcb = NULL;
+static struct tftpd_image TftpdImages[TFTPD_MAX_IMAGES];
+static struct tftpd_session TftpdSessions[TFTPD_MAX_SESSIONS];
+static u32 TftpdServed, TftpdBytes;
+static int TftpdTask = FALSE;
+
+/*...................................................................*/
+/* Local function definitions                                        */
+/*...................................................................*/
+
+/*...................................................................*/
+/* tftpd_error: Send an ERROR packet, ending the transfer            */
+/*                                                                   */
+/*      Input: pcb - the UDP pcb to send from                        */
+/*             addr - the client address                             */
+/*             port - the client port                                */
+/*             code - the TFTP error code                            */
+/*             message - the error message                           */
+/*...................................................................*/
+static void tftpd_error(struct udp_pcb *pcb, ip_addr_t *addr, u16 port,
+                        u16 code, const char *message)
+{
+  struct pbuf *p;
+  struct tftpPkt *pkt;
+
+  p = pbuf_alloc(PBUF_TRANSPORT, 4 + strlen(message) + 1, PBUF_RAM);
+  if (p)
+  {
+    pkt = p->payload;
+    pkt->opcode = htons(TFTP_OPCODE_ERROR);
+    pkt->ERROR.error_code = htons(code);
+    memcpy(pkt->ERROR.message, message, strlen(message) + 1);
+    udp_sendto(pcb, p, addr, port);
+    pbuf_free(p);
+  }
+}
+
+/*...................................................................*/
+/* tftpd_close: End a session and free its resources                 */
+/*                                                                   */
+/*      Input: s - the session                                       */
+/*...................................................................*/
+static void tftpd_close(struct tftpd_session *s)
+{
+  if (s->pcb)
+    udp_remove(s->pcb);
+  s->pcb = NULL;
+}
+
+/*...................................................................*/
+/* tftpd_block: Find the data of a block                             */
+/*                                                                   */
+/*      Input: s - the session                                       */
+/*             block - the block number                              */
+/*             data - the resulting data pointer                     */
+/*                                                                   */
+/*    Returns: length of the block                                   */
+/*...................................................................*/
+static int tftpd_block(struct tftpd_session *s, u32 block, const u8 **data)
+{
+  u32 offset = (block - 1) * s->block_size;
+
+  *data = &s->data[offset];
+  return min(s->block_size, s->size - offset);
+}
+
+/*...................................................................*/
+/* tftpd_oack: Send the option acknowledgement                       */
+/*                                                                   */
+/*      Input: s - the session                                       */
+/*...................................................................*/
+static void tftpd_oack(struct tftpd_session *s)
+{
+  struct pbuf *p;
+  u8 oack[2 + sizeof("blksize") + 6 + sizeof("windowsize") + 6 +
+          sizeof("tsize") + 11], *end = &oack[2];
+
+  oack[0] = 0;
+  oack[1] = TFTP_OPCODE_OACK;
+  if (s->options & TFTPD_OPTION_BLKSIZE)
+    end = tftp_option_add(end, "blksize", s->block_size);
+  if (s->options & TFTPD_OPTION_WINDOWSIZE)
+    end = tftp_option_add(end, "windowsize", s->window_size);
+  if (s->options & TFTPD_OPTION_TSIZE)
+    end = tftp_option_add(end, "tsize", s->size);
+
+  p = pbuf_alloc(PBUF_TRANSPORT, end - oack, PBUF_RAM);
+  if (p)
+  {
+    memcpy(p->payload, oack, end - oack);
+    udp_send(s->pcb, p);
+    pbuf_free(p);
+  }
+  s->timeout = TimerRegister(TFTPD_TIMEOUT);
+}
+
+/*...................................................................*/
+/* tftpd_send: Send the blocks of the window not yet sent            */
+/*                                                                   */
+/*      Input: s - the session                                       */
+/*...................................................................*/
+static void tftpd_send(struct tftpd_session *s)
+{
+  struct pbuf *p, *ref;
+  const u8 *data;
+  int len, sent = FALSE;
+
+  /* Nothing to send until the options are acknowledged. */
+  if (s->options)
+    return;
+
+  while ((s->next <= s->last) && (s->next < s->base + s->window_size))
+  {
+    len = tftpd_block(s, s->next, &data);
+
+    /* Reference the file data rather than copy it, the Ethernet
+     * driver gathers the chain into the frame. */
+    p = pbuf_alloc(PBUF_TRANSPORT, 4, PBUF_RAM);
+    if (p == NULL)
+      break;
+    ((u16 *)p->payload)[0] = htons(TFTP_OPCODE_DATA);
+    ((u16 *)p->payload)[1] = htons((u16)s->next);
+    if (len > 0)
+    {
+      ref = pbuf_alloc(PBUF_RAW, len, PBUF_REF);
+      if (ref == NULL)
+      {
+        pbuf_free(p);
+        break;
+      }
+      ref->payload = (void *)data;
+      pbuf_cat(p, ref);
+    }
+
+    /* Try again from the task if the transmit ring is full. */
+    if (udp_send(s->pcb, p) != ERR_OK)
+    {
+      pbuf_free(p);
+      break;
+    }
+    pbuf_free(p);
+    TftpdBytes += len;
+    s->next++;
+    sent = TRUE;
+  }
+
+  if (sent)
+    s->timeout = TimerRegister(TFTPD_TIMEOUT);
+}
+
+/*...................................................................*/
+/* tftpd_ack: Handle an ACK, sending the next window                 */
+/*                                                                   */
+/*      Input: s - the session                                       */
+/*             block - the block number acknowledged                 */
+/*...................................................................*/
+static void tftpd_ack(struct tftpd_session *s, u16 block)
+{
+  u32 acked;
+
+  /* ACK of block zero acknowledges the options. */
+  if (s->options)
+  {
+    if (block == 0)
+    {
+      s->options = 0;
+      s->retries = 0;
+      tftpd_send(s);
+    }
+    return;
+  }
+
+  /* Extend the 16 bit block number, ignore if never sent. */
+  acked = s->base - 1 + (u16)(block - (u16)(s->base - 1));
+  if (acked >= s->next)
+    return;
+
+  /* The transfer is complete once the final block is acknowledged. */
+  if (acked == s->last)
+  {
+    ++TftpdServed;
+    tftpd_close(s);
+    return;
+  }
+
+  /* Send the window after the block acknowledged.  An ACK before the
+   * end of the window means blocks were lost, so also go back and
+   * send again from there (RFC 7440). */
+  if (acked >= s->base)
+    s->retries = 0;
+  s->base = acked + 1;
+  s->next = s->base;
+  tftpd_send(s);
+}
+
+/*...................................................................*/
+/* tftpd_recv: Receive an ACK or ERROR from a client                 */
+/*...................................................................*/
+static void tftpd_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p,
+                       ip_addr_t *addr, u16_t port)
+{
+  struct tftpd_session *s = arg;
+  u16 *pkt = p->payload;
+
+  if (p->len >= 4)
+  {
+    if (ntohs(pkt[0]) == TFTP_OPCODE_ACK)
+      tftpd_ack(s, ntohs(pkt[1]));
+    else if (ntohs(pkt[0]) == TFTP_OPCODE_ERROR)
+      tftpd_close(s);
+  }
+  pbuf_free(p);
+}
+
+/*...................................................................*/
+/* tftpd_start: Start sending the file, or acknowledge the options   */
+/*                                                                   */
+/*      Input: s - the session                                       */
+/*...................................................................*/
+static void tftpd_start(struct tftpd_session *s)
+{
+  s->timeout = TimerRegister(TFTPD_TIMEOUT);
+  if (s->options)
+    tftpd_oack(s);
+  else
+    tftpd_send(s);
+}
+
+/*...................................................................*/
+/* tftpd_request: Receive a request on the TFTP port                 */
+/*...................................................................*/
+static void tftpd_request(void *arg, struct udp_pcb *pcb, struct pbuf *p,
+                          ip_addr_t *addr, u16_t port)
+{
+  struct tftpd_session *s = NULL;
+  char *name, *mode, *option, *end;
+  u32 value;
+  int i;
+
+  /* Requests are small, and all strings must be terminated. */
+  end = (char *)p->payload + p->len;
+  if ((p->len < 4) || (p->len != p->tot_len) || end[-1] != '\0')
+  {
+    pbuf_free(p);
+    return;
+  }
+  if (ntohs(*(u16 *)p->payload) != TFTP_OPCODE_RRQ)
+  {
+    tftpd_error(pcb, addr, port, TFTP_ERROR_ILLEGAL, "read only");
+    pbuf_free(p);
+    return;
+  }
+  name = (char *)p->payload + 2;
+  mode = name + strlen(name) + 1;
+  if (mode >= end)
+  {
+    pbuf_free(p);
+    return;
+  }
+
+  /* Ignore a request again from the same client, the session sends
+   * again on timeout.  Otherwise find a free session. */
+  for (i = 0; i < TFTPD_MAX_SESSIONS; ++i)
+  {
+    if (TftpdSessions[i].pcb == NULL)
+    {
+      if (s == NULL)
+        s = &TftpdSessions[i];
+    }
+    else if ((TftpdSessions[i].pcb->remote_port == port) &&
+             ip_addr_cmp(&TftpdSessions[i].pcb->remote_ip, addr))
+    {
+      pbuf_free(p);
+      return;
+    }
+  }
+  if (s == NULL)
+  {
+    tftpd_error(pcb, addr, port, TFTP_ERROR_NOT_DEFINED, "server busy");
+    pbuf_free(p);
+    return;
+  }
+
+  /* Find the file in RAM. */
+  bzero(s, sizeof(struct tftpd_session));
+  for (i = 0; i < TFTPD_MAX_IMAGES; ++i)
+  {
+    if (TftpdImages[i].data && (strcmp(TftpdImages[i].name, name) == 0))
+    {
+      s->data = TftpdImages[i].data;
+      s->size = TftpdImages[i].size;
+      break;
+    }
+  }
+  if (s->data == NULL)
+  {
+    tftpd_error(pcb, addr, port, TFTP_ERROR_NOT_FOUND, "file not found");
+    pbuf_free(p);
+    return;
+  }
+
+  /* Apply the requested options, within what the client supports. */
+  s->block_size = TFTP_BLOCK_SIZE;
+  s->window_size = 1;
+  for (option = mode + strlen(mode) + 1; option < end;
+       option += strlen(option) + 1)
+  {
+    char *number = option + strlen(option) + 1;
+
+    if (number >= end)
+      break;
+    value = atoi(number);
+    if (tftp_option_is(option, "blksize") && (value >= 8))
+    {
+      s->block_size = min(value, TFTP_MAX_BLOCK_SIZE);
+      s->options |= TFTPD_OPTION_BLKSIZE;
+    }
+    else if (tftp_option_is(option, "windowsize") && (value >= 1))
+    {
+      s->window_size = min(value, TFTP_WINDOW_SIZE);
+      s->options |= TFTPD_OPTION_WINDOWSIZE;
+    }
+    else if (tftp_option_is(option, "tsize"))
+      s->options |= TFTPD_OPTION_TSIZE;
+    option = number;
+  }
+
+  /* Send from a new port connected to the client (RFC 1350). */
+  s->pcb = udp_new();
+  if (s->pcb == NULL)
+  {
+    tftpd_error(pcb, addr, port, TFTP_ERROR_NOT_DEFINED, "out of memory");
+    pbuf_free(p);
+    return;
+  }
+  if ((udp_bind(s->pcb, IP_ADDR_ANY, 0) != ERR_OK) ||
+      (udp_connect(s->pcb, addr, port) != ERR_OK))
+  {
+    tftpd_close(s);
+    pbuf_free(p);
+    return;
+  }
+  udp_recv(s->pcb, tftpd_recv, s);
+  s->base = s->next = 1;
+  s->last = s->size / s->block_size + 1;
+
+  pbuf_free(p);
+  tftpd_start(s);
+}
+
+/*...................................................................*/
+/* tftpd_poll: Re-send on timeout, and send what the ring refused    */
+/*                                                                   */
+/*      Input: data - unused                                         */
+/*                                                                   */
+/*    Returns: TASK_IDLE, or TASK_FINISHED once the server stops     */
+/*...................................................................*/
+static int tftpd_poll(void *data)
+{
+  struct tftpd_session *s;
+  int i;
+
+  for (i = 0; i < TFTPD_MAX_SESSIONS; ++i)
+  {
+    s = &TftpdSessions[i];
+    if (s->pcb == NULL)
+      continue;
+
+    /* End all sessions if the server stopped. */
+    if (TftpdPcb == NULL)
+    {
+      tftpd_close(s);
+      continue;
+    }
+
+    /* Send what the transmit ring could not take earlier. */
+    tftpd_send(s);
+
+    /* On timeout send the window (or OACK) again, or give up. */
+    if (TimerRemaining(&s->timeout) == 0)
+    {
+      if (++s->retries > TFTPD_MAX_RETRIES)
+        tftpd_close(s);
+      else if (s->options)
+        tftpd_oack(s);
+      else
+      {
+        s->next = s->base;
+        tftpd_send(s);
+        s->timeout = TimerRegister(TFTPD_TIMEOUT);
+      }
+    }
+  }
+
+  if (TftpdPcb == NULL)
+  {
+    TftpdTask = FALSE;
+    return TASK_FINISHED;
+  }
+  return TASK_IDLE;
+}
+
+/*...................................................................*/
+/* Global function definitions                                       */
+/*...................................................................*/
+
+/*...................................................................*/
+/* TftpdAddImage: Serve a file in RAM, replacing any image with the  */
+/*                same name or data                                  */
+/*                                                                   */
+/*      Input: name - the file name                                  */
+/*             data - the file data, which must remain valid         */
+/*             size - the file size in bytes                         */
+/*                                                                   */
+/*    Returns: zero (0) on success, or -1 if no room                 */
+/*...................................................................*/
+int TftpdAddImage(const char *name, const void *data, u32 size)
+{
+  struct tftpd_image *image = NULL;
+  int i;
+
+  if (strlen(name) >= TFTPD_NAME_LENGTH)
+    return -1;
+
+  /* Replace the image with the same name or data, or use a free one. */
+  for (i = 0; i < TFTPD_MAX_IMAGES; ++i)
+  {
+    if ((TftpdImages[i].data == data) ||
+        (strcmp(TftpdImages[i].name, name) == 0))
+    {
+      image = &TftpdImages[i];
+      break;
+    }
+    else if ((TftpdImages[i].data == NULL) && (image == NULL))
+      image = &TftpdImages[i];
+  }
+  if (image == NULL)
+    return -1;
+
+  strcpy(image->name, name);
+  image->data = data;
+  image->size = size;
+  return 0;
+}
+
+/*...................................................................*/
+/* TftpdImage: Find a file in RAM by name                            */
+/*                                                                   */
+/*      Input: name - the file name                                  */
+/*             size - the resulting file size in bytes               */
+/*                                                                   */
+/*    Returns: the file data, or NULL if not found                   */
+/*...................................................................*/
+const void *TftpdImage(const char *name, u32 *size)
+{
+  int i;
+
+  for (i = 0; i < TFTPD_MAX_IMAGES; ++i)
+  {
+    if (TftpdImages[i].data && (strcmp(TftpdImages[i].name, name) == 0))
+    {
+      *size = TftpdImages[i].size;
+      return TftpdImages[i].data;
+    }
+  }
+  return NULL;
+}
+
+/*...................................................................*/
+/*      Tftpd: Start, stop or report the TFTP server                 */
+/*                                                                   */
+/*      Input: command - "tftpd [off]"                               */
+/*                                                                   */
+/*    Returns: TASK_FINISHED                                         */
+/*...................................................................*/
+int Tftpd(const char *command)
+{
+  const char *arg = strchr(command, ' ');
+  int i, active = 0;
+
+  if (!NetUp)
+  {
+    puts("Network down, use 'net' command to enable.");
+    return TASK_FINISHED;
+  }
+
+  /* Stop the server, the task ends the sessions. */
+  if (arg && (strcmp(&arg[1], "off") == 0))
+  {
+    if (TftpdPcb)
+    {
+      udp_remove(TftpdPcb);
+      TftpdPcb = NULL;
+    }
+    printf("TFTP server stopped, %u files %u bytes served\n", TftpdServed,
+           TftpdBytes);
+    return TASK_FINISHED;
+  }
+
+  /* Otherwise start the server if not yet running. */
+  if (TftpdPcb == NULL)
+  {
+    TftpdPcb = udp_new();
+    if (TftpdPcb == NULL)
+    {
+      puts("TFTP server out of memory");
+      return TASK_FINISHED;
+    }
+    if (udp_bind(TftpdPcb, IP_ADDR_ANY, PORT_TFTP) != ERR_OK)
+    {
+      puts("TFTP port in use");
+      udp_remove(TftpdPcb);
+      TftpdPcb = NULL;
+      return TASK_FINISHED;
+    }
+
+    /* The task of a server just stopped may still be running. */
+    if (!TftpdTask)
+    {
+      if (TaskNew(TFTPD_TASK_PRIORITY, tftpd_poll, TftpdSessions) == NULL)
+      {
+        puts("TFTP server task failed");
+        udp_remove(TftpdPcb);
+        TftpdPcb = NULL;
+        return TASK_FINISHED;
+      }
+      TftpdTask = TRUE;
+    }
+    udp_recv(TftpdPcb, tftpd_request, NULL);
+    TftpdServed = TftpdBytes = 0;
+  }
+
+  for (i = 0; i < TFTPD_MAX_SESSIONS; ++i)
+    if (TftpdSessions[i].pcb)
+      ++active;
+  printf("TFTP server on port %u, %u sessions, %u files %u bytes served\n",
+         PORT_TFTP, active, TftpdServed, TftpdBytes);
+  for (i = 0; i < TFTPD_MAX_IMAGES; ++i)
+    if (TftpdImages[i].data)
+      printf("  %s %u bytes\n", TftpdImages[i].name, TftpdImages[i].size);
+  return TASK_FINISHED;
+}
+
+#endif /* ENABLE_UDP */
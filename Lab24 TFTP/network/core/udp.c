@@ -333,7 +333,9 @@ udp_input(struct pbuf *p, struct netif *inp)
 #endif /* LWIP_UDPLITE */
     {
 #if CHECKSUM_CHECK_UDP
-      if (udphdr->chksum != 0) {
+      if ((udphdr->chksum != 0) &&
+          ((p->flags & PBUF_FLAG_L4_CHKSUM_OK) == 0) &&
+          NETIF_CHECKSUM_ENABLED(inp, NETIF_CHECKSUM_CHECK_UDP)) {
         if (inet_chksum_pseudo(p, ip_current_src_addr(), ip_current_dest_addr(),
                                IP_PROTO_UDP, p->tot_len) != 0) {
           LWIP_DEBUGF(UDP_DEBUG | LWIP_DBG_LEVEL_SERIOUS,
@@ -708,7 +710,15 @@ udp_sendto_if_chksum(struct udp_pcb *pcb, struct pbuf *p, ip_addr_t *dst_ip,
     udphdr->len = htons(q->tot_len);
     /* calculate checksum */
 #if CHECKSUM_GEN_UDP
-    if ((pcb->flags & UDP_FLAGS_NOCHKSUM) == 0) {
+    /* The netif hardware cannot checksum a datagram that IP fragments, so
+       only offload if it fits in the MTU. The hardware expects the
+       checksum field seeded with the pseudo header sum. */
+    if (((pcb->flags & UDP_FLAGS_NOCHKSUM) == 0) &&
+        !NETIF_CHECKSUM_ENABLED(netif, NETIF_CHECKSUM_GEN_UDP) &&
+        (q->tot_len + IP_HLEN <= netif->mtu)) {
+      udphdr->chksum = (u16_t)~inet_chksum_pseudo_partial(q, src_ip, dst_ip,
+                                        IP_PROTO_UDP, q->tot_len, 0);
+    } else if ((pcb->flags & UDP_FLAGS_NOCHKSUM) == 0) {
       u16_t udpchksum;
 #if LWIP_CHECKSUM_ON_COPY
       if (have_chksum) {
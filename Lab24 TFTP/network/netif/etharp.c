@@ -64,6 +64,8 @@
 
 struct eth_addr ethbroadcast;// = {{0xff,0xff,0xff,0xff,0xff,0xff}};
 struct eth_addr ethzero;// = {{0,0,0,0,0,0}};
+/** Source address of the Ethernet frame of the IP packet being input */
+struct eth_addr current_ethhdr_src;
 
 /** The 24-bit IANA multicast OUI is 01-00-5e: */
 #define LL_MULTICAST_ADDR_0 0x01
@@ -615,6 +617,22 @@ void etharp_cleanup_netif(struct netif *netif)
   }
 }
 
+/**
+ * Add a dynamic entry to the ARP table for an address pair learned
+ * without ARP, such as the sender of a DHCP reply, so the first packet
+ * sent to it needs no ARP round trip. The entry ages as any other.
+ *
+ * @param netif points to the network interface the address is on
+ * @param ipaddr IP address of the entry
+ * @param ethaddr ethernet address of the entry
+ * @return @see return values of etharp_update_arp_entry
+ */
+err_t
+etharp_add_entry(struct netif *netif, ip_addr_t *ipaddr, struct eth_addr *ethaddr)
+{
+  return etharp_update_arp_entry(netif, ipaddr, ethaddr, ETHARP_FLAG_TRY_HARD);
+}
+
 /**
  * Finds (stable) ethernet/IP address pair from ARP table
  * using interface and IP address index.
@@ -1387,6 +1405,9 @@ ethernet_input(struct pbuf *p, struct netif *netif)
       /* update ARP table */
       etharp_ip_input(netif, p);
 #endif /* ETHARP_TRUST_IP_MAC */
+      /* remember the sender, the header is skipped and IP fragments
+         are reassembled into other pbufs before the upper layers */
+      ETHADDR16_COPY(&current_ethhdr_src, &ethhdr->src);
       /* skip Ethernet header */
       if(pbuf_header(p, -ip_hdr_offset)) {
         LWIP_ASSERT("Can't move over header in packet", 0);
@@ -10,15 +10,20 @@
 #include "lwip/def.h"
 #include "lwip/mem.h"
 #include "lwip/pbuf.h"
+#include "lwip/inet_chksum.h"
+#include "lwip/ip.h"
 #include <lwip/stats.h>
 #include <lwip/snmp.h>
 #include "netif/etharp.h"
 #include "netif/ppp_oe.h"
 
 #include <lwip/dhcp.h>
+#include <lwip/timers.h>
 #include <init.h>
+#include <board.h>
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #if ENABLE_ETHER
@@ -80,7 +85,17 @@ low_level_init(struct netif *netif)
 
   /* device capabilities */
   /* don't set NETIF_FLAG_ETHARP if this device is not an ethernet one */
-  netif->flags = NETIF_FLAG_BROADCAST | NETIF_FLAG_ETHARP | NETIF_FLAG_LINK_UP;
+  netif->flags = NETIF_FLAG_BROADCAST | NETIF_FLAG_ETHARP |
+                 NETIF_FLAG_LINK_UP | NETIF_FLAG_IGMP;
+
+  /* Let the hardware insert IP, UDP and TCP checksums if supported.
+     Received frames are still checked in software unless the device
+     passed a checksum verdict to NetIn(). */
+  if (LanChecksumOffload(TRUE))
+    NETIF_SET_CHECKSUM_CTRL(netif, NETIF_CHECKSUM_ENABLE_ALL &
+                                   ~(NETIF_CHECKSUM_GEN_IP |
+                                     NETIF_CHECKSUM_GEN_UDP |
+                                     NETIF_CHECKSUM_GEN_TCP));
 
   /* Do whatever else is needed to initialize interface. */
 }
@@ -104,22 +119,27 @@ low_level_init(struct netif *netif)
 static err_t
 low_level_output(struct netif *netif, struct pbuf *p)
 {
-  struct pbuf *q;
+  void *frame;
 
-//  initiate transfer();
 #if ETH_PAD_SIZE
   pbuf_header(p, -ETH_PAD_SIZE); /* drop the padding word */
 #endif
 
-  /* Send the data from the pbuf to the interface, one pbuf at a
-     time. The size of the data in each pbuf is kept in the ->len
-     variable. */
-  for(q = p; q != NULL; q = q->next)
+  /* Reserve the whole frame in the TX ring and gather the pbuf chain
+     into it, so a chained pbuf is sent as one Ethernet frame. */
+  frame = LanDeviceFrameAlloc(p->tot_len);
+  if (frame == NULL)
   {
-    LanDeviceSendFrame(q->payload, q->len);
+#if ETH_PAD_SIZE
+    pbuf_header(p, ETH_PAD_SIZE); /* reclaim the padding word */
+#endif
+    LINK_STATS_INC(link.drop);
+    return ERR_MEM;
   }
+  pbuf_copy_partial(p, frame, p->tot_len, 0);
 
-//  signal that packet should be sent();
+  /* Send now or aggregate with the next frames if TX ring is busy. */
+  LanDeviceFrameSend();
 
 #if ETH_PAD_SIZE
   pbuf_header(p, ETH_PAD_SIZE); /* reclaim the padding word */
@@ -187,7 +207,57 @@ ethernetif_init(struct netif *netif)
 
 #if ENABLE_NETWORK
 
-int NetIn(u8 *frame, int frameLength)
+/*
+ * Copy an IPv4 TCP or UDP frame into the pbuf, summing the transport
+ * header and data in the same pass. Returns TRUE if the transport
+ * checksum is verified, FALSE if software must check it later.
+ */
+static int net_copy_chksum(struct pbuf *p, u8 *frame, int frameLength)
+{
+  struct ip_hdr *iphdr;
+  u32 hlen, len, acc;
+  u8 *payload = p->payload;
+
+  /* Only unfragmented IPv4 TCP or UDP can be verified as copied. */
+  hlen = (frame[SIZEOF_ETH_HDR] & 0x0F) * 4;
+  len = (frame[SIZEOF_ETH_HDR + 2] << 8) | frame[SIZEOF_ETH_HDR + 3];
+  if ((frameLength < SIZEOF_ETH_HDR + IP_HLEN) ||
+      (frame[12] != 0x08) || (frame[13] != 0x00) ||
+      ((frame[SIZEOF_ETH_HDR] >> 4) != 4) || (hlen < IP_HLEN) ||
+      (len <= hlen) || (SIZEOF_ETH_HDR + len > frameLength) ||
+      (((frame[SIZEOF_ETH_HDR + 6] << 8) |
+        frame[SIZEOF_ETH_HDR + 7]) & 0x3FFF) ||
+      ((frame[SIZEOF_ETH_HDR + 9] != IP_PROTO_TCP) &&
+       (frame[SIZEOF_ETH_HDR + 9] != IP_PROTO_UDP)))
+  {
+    memcpy(payload, frame, frameLength);
+    return FALSE;
+  }
+
+  /* Copy the headers, then copy and sum the transport segment. */
+  memcpy(payload, frame, SIZEOF_ETH_HDR + hlen);
+  acc = LWIP_CHKSUM_COPY(&payload[SIZEOF_ETH_HDR + hlen],
+                         &frame[SIZEOF_ETH_HDR + hlen], len - hlen);
+  if (SIZEOF_ETH_HDR + len < frameLength)
+    memcpy(&payload[SIZEOF_ETH_HDR + len], &frame[SIZEOF_ETH_HDR + len],
+           frameLength - (SIZEOF_ETH_HDR + len));
+
+  /* Add the pseudo header, as inet_chksum_pseudo() does. */
+  iphdr = (struct ip_hdr *)&payload[SIZEOF_ETH_HDR];
+  acc += ip4_addr_get_u32(&iphdr->src) & 0xFFFF;
+  acc += ip4_addr_get_u32(&iphdr->src) >> 16;
+  acc += ip4_addr_get_u32(&iphdr->dest) & 0xFFFF;
+  acc += ip4_addr_get_u32(&iphdr->dest) >> 16;
+  acc += htons((u16_t)IPH_PROTO(iphdr));
+  acc += htons((u16_t)(len - hlen));
+  acc = FOLD_U32T(acc);
+  acc = FOLD_U32T(acc);
+
+  /* UDP without checksum (zero) fails, but udp_input() skips it too */
+  return acc == 0xFFFF;
+}
+
+int NetIn(u8 *frame, int frameLength, u32 checksum)
 {
   struct pbuf *p;
 
@@ -199,8 +269,13 @@ int NetIn(u8 *frame, int frameLength)
 
     p->payload += 2; // Move 2 bytes before 6 byte Ethernet header
                      // so IP packet will be 4 byte aligned
-    memcpy (p->payload, frame /*+ 10*/, frameLength); // copy to new buffer
-                                                    // skipping Rx status
+
+    // Copy to new buffer, checksumming in the same pass unless the
+    // hardware already verified the transport checksum
+    if (checksum & NET_CHECKSUM_L4)
+      memcpy(p->payload, frame, frameLength);
+    else if (net_copy_chksum(p, frame, frameLength))
+      checksum |= NET_CHECKSUM_L4;
 
     // Copy the (unaligned) Ethernet header from the payload
     memcpy(&ethhdr, p->payload, sizeof(struct eth_hdr));
@@ -208,7 +283,11 @@ int NetIn(u8 *frame, int frameLength)
     // Assign protocol buffer length
     p->len = p->tot_len = frameLength;
 
-    // TODO - put on a queue and create TCP/IP stack to process?
+    // Skip the software checksums already verified by the hardware
+    if (checksum & NET_CHECKSUM_IP)
+      p->flags |= PBUF_FLAG_IP_CHKSUM_OK;
+    if (checksum & NET_CHECKSUM_L4)
+      p->flags |= PBUF_FLAG_L4_CHKSUM_OK;
 
     //Process the Ethernet frame based on the Ethernet type field
     switch (htons(ethhdr.type))
@@ -247,26 +326,511 @@ int NetIn(u8 *frame, int frameLength)
   return 0;
 }
 
+/*
+ * Deferred RX ring. The LAN driver receives bulk in transfers directly
+ * into the ring slots from USB completion context (NetRxSlot() and
+ * NetRxPush()) and the network task passes at most the budget of
+ * frames to lwIP each scheduler tick (NetPoll()). There is one
+ * producer and one consumer, and head and tail are each written by
+ * only one side, so no lock is needed. When the ring is full the
+ * driver holds its receive URB until the network task frees a slot.
+ */
+#define NET_RX_RING_SIZE  8    /* must be a power of two */
+#define NET_RX_SLOT_SIZE  1600 /* FRAME_BUFFER_SIZE of LAN drivers */
+#define NET_RX_BUDGET     4    /* default frames per network task poll */
+
+struct net_rx_desc
+{
+  u8 *frame;
+  u32 length;
+  u32 checksum;
+  u64 time;       /* TimerNow() when received */
+  u8 buffer[NET_RX_SLOT_SIZE];
+};
+
+struct net_rx_ring
+{
+  struct net_rx_desc desc[NET_RX_RING_SIZE];
+  volatile u32 head;  /* next slot to receive into, producer only */
+  volatile u32 tail;  /* next slot to process, consumer only */
+  u32 budget;         /* maximum frames processed per poll */
+
+  /* Statistics since last 'rxstat' */
+  u32 frames, full, exhausted;
+  u32 latencySum, latencyMax, pollMax;
+};
+static struct net_rx_ring NetRx;
+struct net_cpu NetCpu;
+
+u8 *NetRxSlot(void)
+{
+  /* Return NULL if full so the driver holds the receive URB */
+  if (NetRx.head - NetRx.tail >= NET_RX_RING_SIZE)
+  {
+    ++NetRx.full;
+    return NULL;
+  }
+  return NetRx.desc[NetRx.head & (NET_RX_RING_SIZE - 1)].buffer;
+}
+
+void NetRxPush(u8 *frame, int frameLength, u32 checksum)
+{
+  struct net_rx_desc *desc;
+
+  desc = &NetRx.desc[NetRx.head & (NET_RX_RING_SIZE - 1)];
+  desc->frame = frame;
+  desc->length = frameLength;
+  desc->checksum = checksum;
+  desc->time = TimerNow();
+
+  /* Publish the descriptor to the network task, the barrier orders
+     the descriptor writes before the new head */
+  DataMemoryBarrier();
+  ++NetRx.head;
+}
+
+static int NetPoll(void *data)
+{
+  struct net_rx_ring *ring = data;
+  struct net_rx_desc *desc;
+  u32 count, latency;
+  u64 start;
+
+  /* Run the lwIP timers that are due, such as IGMP membership reports
+     and ARP expiry. */
+  sys_check_timeouts();
+
+  if (ring->head == ring->tail)
+    return TASK_IDLE;
+
+  /* Process up to the budget, leaving the rest for the next tick so
+     that other tasks, such as keyboard input, are not starved. */
+  start = TimerNow();
+  for (count = 0; (ring->tail != ring->head) && (count < ring->budget);
+       ++count)
+  {
+    desc = &ring->desc[ring->tail & (NET_RX_RING_SIZE - 1)];
+    latency = (u32)(start - desc->time);
+    ring->latencySum += latency;
+    if (latency > ring->latencyMax)
+      ring->latencyMax = latency;
+
+    NetIn(desc->frame, desc->length, desc->checksum);
+
+    /* Free the slot for the driver */
+    ++ring->tail;
+  }
+  ring->frames += count;
+  if (ring->tail != ring->head)
+    ++ring->exhausted;
+
+  latency = (u32)(TimerNow() - start);
+  if (latency > ring->pollMax)
+    ring->pollMax = latency;
+  NetCpu.input += latency;
+
+  /* Resume receiving if the driver held its URB while ring was full,
+     and submit frames the driver queued without a free URB */
+  LanReceiveResume();
+  LanDeviceTxResume();
+  return TASK_IDLE;
+}
+
+int NetRxStat(const char *command)
+{
+  const char *arg;
+  u32 budget;
+
+  if (!NetUp)
+  {
+    puts("Network down, use 'net' command to enable.");
+    return TASK_FINISHED;
+  }
+
+  /* Change the per poll budget if requested. */
+  arg = strchr(command, ' ');
+  if (arg)
+  {
+    budget = atoi((char *)&arg[1]);
+    if ((budget == 0) || (budget > NET_RX_RING_SIZE))
+    {
+      printf("usage: rxstat [budget 1 to %u]\n", NET_RX_RING_SIZE);
+      return TASK_FINISHED;
+    }
+    NetRx.budget = budget;
+  }
+
+  printf("RX %u frames, budget %u exhausted %u, ring full %u\n",
+         NetRx.frames, NetRx.budget, NetRx.exhausted, NetRx.full);
+  if (NetRx.frames)
+    printf("Latency average %u us, max %u us, longest poll %u us\n",
+           NetRx.latencySum / NetRx.frames, NetRx.latencyMax,
+           NetRx.pollMax);
+
+  /* Restart the statistics for the next measurement. */
+  NetRx.frames = NetRx.full = NetRx.exhausted = 0;
+  NetRx.latencySum = NetRx.latencyMax = NetRx.pollMax = 0;
+  return TASK_FINISHED;
+}
+
+/*
+ * TX benchmark sends raw broadcast frames as fast as the TX ring allows
+ */
+#define TX_BENCH_ETHTYPE   0x88B5 /* IEEE 802 local experimental */
+#define TX_BENCH_SECONDS   5      /* default duration of benchmark */
+#define TX_BENCH_MAX_SECONDS 30   /* avoids 32 bit counter overflow */
+#define TX_BENCH_BATCH     64     /* most frames queued per poll */
+
+struct tx_bench
+{
+  struct timer end;
+  u64 start;
+  u32 length, seconds, frames;
+  u32 txFrames, txTransfers, txDropped;
+  struct shell_state *shell;  /* the shell running the benchmark */
+};
+static struct tx_bench *TxBench = NULL;
+
+int NetTxBench(const char *command)
+{
+  static struct tx_bench bench;
+  u32 frames, transfers, dropped, ms, kbits, count;
+  const char *arg;
+  u8 *frame;
+
+  if (!NetUp)
+  {
+    puts("Network down, use 'net' command to enable.");
+    return TASK_FINISHED;
+  }
+
+  /* One benchmark at a time, polled by the shell that started it. */
+  if (TxBench && (TxBench->shell != StdioState))
+  {
+    puts("TX benchmark in progress");
+    return TASK_FINISHED;
+  }
+
+  /* Parse the optional frame length and duration on first call. */
+  if (TxBench == NULL)
+  {
+    TxBench = &bench;
+    bzero(TxBench, sizeof(struct tx_bench));
+    TxBench->shell = StdioState;
+    TxBench->length = ETHARP_HWADDR_LEN * 2 + 2 + 1500;
+    TxBench->seconds = TX_BENCH_SECONDS;
+    arg = strchr(command, ' ');
+    if (arg)
+    {
+      TxBench->length = atoi((char *)&arg[1]);
+      arg = strchr(&arg[1], ' ');
+      if (arg)
+        TxBench->seconds = atoi((char *)&arg[1]);
+    }
+    if (TxBench->length < 60)
+      TxBench->length = 60;
+    else if (TxBench->length > ETHARP_HWADDR_LEN * 2 + 2 + 1500)
+      TxBench->length = ETHARP_HWADDR_LEN * 2 + 2 + 1500;
+    if ((TxBench->seconds == 0) ||
+        (TxBench->seconds > TX_BENCH_MAX_SECONDS))
+      TxBench->seconds = TX_BENCH_SECONDS;
+
+    printf("TX benchmark %u byte frames for %u seconds...\n",
+           TxBench->length, TxBench->seconds);
+    LanDeviceTxStats(&TxBench->txFrames, &TxBench->txTransfers,
+                     &TxBench->txDropped);
+    TxBench->start = TimerNow();
+    TxBench->end = TimerRegister(TxBench->seconds * MICROS_PER_SECOND);
+  }
+
+  /* Fill the TX ring until full, then yield for completions.  A
+     device that sends synchronously, such as the host TAP, is never
+     full so a batch also yields to the other tasks. */
+  if (TimerRemaining(&TxBench->end))
+  {
+    for (count = 0; (count < TX_BENCH_BATCH) &&
+         ((frame = LanDeviceFrameAlloc(TxBench->length)) != NULL); ++count)
+    {
+      memset(frame, 0xFF, ETHARP_HWADDR_LEN);
+      memcpy(&frame[ETHARP_HWADDR_LEN], LanGetMAC(), ETHARP_HWADDR_LEN);
+      frame[ETHARP_HWADDR_LEN * 2] = TX_BENCH_ETHTYPE >> 8;
+      frame[ETHARP_HWADDR_LEN * 2 + 1] = TX_BENCH_ETHTYPE & 0xFF;
+      if (!LanDeviceFrameSend())
+        break;
+    }
+    return TASK_IDLE;
+  }
+
+  /* Wait for all queued frames to complete before reporting. */
+  LanDeviceTxResume();
+  if (LanDeviceTxPending())
+    return TASK_IDLE;
+
+  ms = (u32)(TimerNow() - TxBench->start) / MICROS_PER_MILLISECOND;
+  LanDeviceTxStats(&frames, &transfers, &dropped);
+  frames -= TxBench->txFrames;
+  transfers -= TxBench->txTransfers;
+  dropped -= TxBench->txDropped;
+  kbits = (frames * TxBench->length) / 125;
+
+  printf("%u frames in %u transfers, %u dropped, %u ms\n",
+         frames, transfers, dropped, ms);
+  if (ms)
+    printf("%u pps, %u.%u Mbit/s\n", (frames * 1000) / ms,
+           kbits / ms, ((kbits * 10) / ms) % 10);
+  TxBench = NULL;
+  return TASK_FINISHED;
+}
+
+/*
+ * Checksum offload control and the software checksum cost it saves
+ */
+#define CSUM_BENCH_LENGTH  1480 /* IP payload of a full size frame */
+#define CSUM_BENCH_PACKETS 1000
+
+/* Portable byte at a time checksum (lwIP version #1) as reference */
+static u16_t chksum_reference(u8 *data, int len)
+{
+  u32 acc = 0;
+
+  for (; len > 1; len -= 2, data += 2)
+    acc += (data[0] << 8) | data[1];
+  if (len > 0)
+    acc += data[0] << 8;
+  acc = FOLD_U32T(acc);
+  acc = FOLD_U32T(acc);
+  return htons((u16_t)acc);
+}
+
+/* Hundredths of a cycle per byte since start for the benchmark */
+static u32 chksum_cycles(u64 start, u32 mhz)
+{
+  u32 usec = (u32)(TimerNow() - start);
+
+  return (usec * mhz) / ((CSUM_BENCH_PACKETS * CSUM_BENCH_LENGTH) / 100);
+}
+
+/* Compare the checksums against the reference for every alignment */
+static void chksum_test(void)
+{
+  static u8 src[CSUM_BENCH_LENGTH + 4], dst[CSUM_BENCH_LENGTH + 8];
+  u32 i, len, s, d, tests = 0, errors = 0, mhz, cpb;
+  u16_t sum;
+  u64 start;
+
+  for (i = 0; i < sizeof(src); ++i)
+    src[i] = rand();
+
+  /* All lengths up to 64 bytes, then random steps to a full frame. */
+  for (len = 0; len <= CSUM_BENCH_LENGTH;
+       len += (len < 64) ? 1 : (rand() & 0x3F) + 1)
+  {
+    for (s = 0; s < 4; ++s)
+    {
+      sum = chksum_reference(&src[s], len);
+      ++tests;
+      if (LWIP_CHKSUM(&src[s], len) != sum)
+        ++errors;
+      for (d = 0; d < 4; ++d)
+      {
+        ++tests;
+        memset(dst, 0xA5, sizeof(dst));
+        if ((LWIP_CHKSUM_COPY(&dst[d + 4], &src[s], len) != sum) ||
+            memcmp(&dst[d + 4], &src[s], len) ||
+            (dst[d + 3] != 0xA5) || (dst[d + 4 + len] != 0xA5))
+          ++errors;
+      }
+    }
+  }
+  printf("Checksum test %u cases, %u errors\n", tests, errors);
+
+  mhz = GetArmClockRate() / 1000000;
+  if (mhz == 0)
+    return;
+
+  /* Report cycles per byte of full size, word aligned, packets. */
+  start = TimerNow();
+  for (i = 0; i < CSUM_BENCH_PACKETS; ++i)
+    chksum_reference(src, CSUM_BENCH_LENGTH);
+  cpb = chksum_cycles(start, mhz);
+  printf("reference %u.%u%u", cpb / 100, (cpb / 10) % 10, cpb % 10);
+  start = TimerNow();
+  for (i = 0; i < CSUM_BENCH_PACKETS; ++i)
+    LWIP_CHKSUM(src, CSUM_BENCH_LENGTH);
+  cpb = chksum_cycles(start, mhz);
+  printf(", checksum %u.%u%u", cpb / 100, (cpb / 10) % 10, cpb % 10);
+  start = TimerNow();
+  for (i = 0; i < CSUM_BENCH_PACKETS; ++i)
+    memcpy(dst, src, CSUM_BENCH_LENGTH);
+  cpb = chksum_cycles(start, mhz);
+  printf(", memcpy %u.%u%u", cpb / 100, (cpb / 10) % 10, cpb % 10);
+  start = TimerNow();
+  for (i = 0; i < CSUM_BENCH_PACKETS; ++i)
+    LWIP_CHKSUM_COPY(dst, src, CSUM_BENCH_LENGTH);
+  cpb = chksum_cycles(start, mhz);
+  printf(", copy+checksum %u.%u%u cycles/byte\n",
+         cpb / 100, (cpb / 10) % 10, cpb % 10);
+}
+
+int NetChecksum(const char *command)
+{
+  static u8 packet[CSUM_BENCH_LENGTH];
+  u32 rx, tx, i, ns, mhz;
+  u64 start;
+  const char *arg;
+
+  /* The checksum self test does not need the network. */
+  arg = strchr(command, ' ');
+  if (arg && (strcmp(&arg[1], "test") == 0))
+  {
+    chksum_test();
+    return TASK_FINISHED;
+  }
+
+  if (!NetUp)
+  {
+    puts("Network down, use 'net' command to enable.");
+    return TASK_FINISHED;
+  }
+
+  /* Enable or disable the offload if requested. */
+  if (arg)
+  {
+    if (strcmp(&arg[1], "on") == 0)
+    {
+      if (LanChecksumOffload(TRUE))
+        NETIF_SET_CHECKSUM_CTRL(&Netif, NETIF_CHECKSUM_ENABLE_ALL &
+                                        ~(NETIF_CHECKSUM_GEN_IP |
+                                          NETIF_CHECKSUM_GEN_UDP |
+                                          NETIF_CHECKSUM_GEN_TCP));
+      else
+        puts("Checksum offload not supported by Ethernet device");
+    }
+    else if (strcmp(&arg[1], "off") == 0)
+    {
+      LanChecksumOffload(FALSE);
+      NETIF_SET_CHECKSUM_CTRL(&Netif, NETIF_CHECKSUM_ENABLE_ALL);
+    }
+    else
+    {
+      puts("usage: csum [on|off|test]");
+      return TASK_FINISHED;
+    }
+  }
+
+  LanChecksumStats(&rx, &tx);
+  printf("Checksum offload %s, %u RX verified, %u TX inserted\n",
+         NETIF_CHECKSUM_ENABLED(&Netif, NETIF_CHECKSUM_GEN_UDP) ?
+         "off" : "on", rx, tx);
+
+  /* Time the software checksum of a full size packet payload. */
+  for (i = 0; i < CSUM_BENCH_LENGTH; ++i)
+    packet[i] = i;
+  start = TimerNow();
+  for (i = 0; i < CSUM_BENCH_PACKETS; ++i)
+    inet_chksum(packet, CSUM_BENCH_LENGTH);
+  ns = ((u32)(TimerNow() - start) * 1000) / CSUM_BENCH_PACKETS;
+  mhz = GetArmClockRate() / 1000000;
+  printf("Software checksum of %u bytes: %u ns, %u cycles per packet\n",
+         CSUM_BENCH_LENGTH, ns, (ns * mhz) / 1000);
+  return TASK_FINISHED;
+}
+
+u64 NetStartTime;
+
+#if LWIP_DHCP
+/* The DHCP lease is kept in persistent memory so that after a warm
+   reboot the address is requested again with INIT-REBOOT, and the
+   boot server is known before the DHCP server answers. */
+#define NET_LEASE_MAGIC   0x4C656173 /* "Leas" */
+
+struct net_lease
+{
+  u32 magic;
+  ip_addr_t ipaddr;   /* leased address */
+  ip_addr_t server;   /* boot (TFTP) server, siaddr of the ACK */
+  u32 check;          /* sum of the fields above */
+};
+
+extern int Ip1, Ip2, Ip3, Ip4;
+static int NetLeaseReboot, NetBoundReported;
+
+static u32 net_lease_check(struct net_lease *lease)
+{
+  return lease->magic + lease->ipaddr.addr + lease->server.addr;
+}
+
+/* Use a boot server as the default TFTP server. */
+static void net_boot_server(ip_addr_t *server)
+{
+  if (ip_addr_isany(server))
+    return;
+  Ip1 = ip4_addr1(server);
+  Ip2 = ip4_addr2(server);
+  Ip3 = ip4_addr3(server);
+  Ip4 = ip4_addr4(server);
+}
+
+/* DHCP_BOUND_HOOK, save the lease each time it is bound or renewed. */
+void NetBound(struct netif *netif)
+{
+  struct net_lease *lease = (struct net_lease *)MEM_PERSIST_START;
+  int reboot = NetLeaseReboot && ip_addr_cmp(&lease->ipaddr,
+                                             &netif->ip_addr);
+
+  lease->magic = NET_LEASE_MAGIC;
+  ip_addr_copy(lease->ipaddr, netif->ip_addr);
+  ip_addr_copy(lease->server, netif->dhcp->offered_si_addr);
+  lease->check = net_lease_check(lease);
+  net_boot_server(&lease->server);
+
+  if (!NetBoundReported)
+  {
+    NetBoundReported = TRUE;
+    printf("Network up: DHCP address %u.%u.%u.%u in %u ms (%s)",
+           ip4_addr1(&netif->ip_addr), ip4_addr2(&netif->ip_addr),
+           ip4_addr3(&netif->ip_addr), ip4_addr4(&netif->ip_addr),
+           (u32)(TimerNow() - NetStartTime) / 1000,
+           reboot ? "INIT-REBOOT" : "new lease");
+    if (!ip_addr_isany(&lease->server))
+      printf(", boot server %d.%d.%d.%d", Ip1, Ip2, Ip3, Ip4);
+    puts("");
+  }
+}
+#endif /* LWIP_DHCP */
+
 int NetStart(char *command)
 {
+#if !LWIP_DHCP
+  const char *arg;
+#else
+  struct net_lease *lease = (struct net_lease *)MEM_PERSIST_START;
+#endif
+
+#if ENABLE_USB
   if (!UsbUp)
   {
     puts("USB required for network, use 'usb' command to enable.");
     return TASK_FINISHED;
   }
+#endif
 
   if (!NetUp)
   {
     /* initialize the TCP/IP stack */
     puts("Ethernet detected, bringing up IPv4 network...");
+    NetStartTime = TimerNow();
     lwip_init();
 
     /*need delay/wait */
 #if !LWIP_DHCP
     puts("IPv4 stack initialize static. ");
 
-    /* Configure a static IP address */
-    IP4_ADDR(&Ipaddr, 192,168,1,202);
+    /* Configure a static IP address, 192.168.1.202 unless given. The
+       LAN drivers start the network without a command. */
+    arg = command ? strchr(command, ' ') : NULL;
+    if (!arg || !ipaddr_aton(&arg[1], &Ipaddr))
+      IP4_ADDR(&Ipaddr, 192,168,1,202);
     IP4_ADDR(&Nmask, 255,255,255,0);
     IP4_ADDR(&Gw, 192,168,1,1);
 
@@ -297,16 +861,42 @@ int NetStart(char *command)
     }
 #endif /* LWIP_DHCP */
 
+    /* Create the network task to process received frames */
+    bzero(&NetRx, sizeof(struct net_rx_ring));
+    NetRx.budget = NET_RX_BUDGET;
+    if (TaskNew(2, NetPoll, &NetRx) == NULL)
+    {
+      puts("Network task creation failed");
+      return TASK_FINISHED;
+    }
+
     /* Initialize asynchronous receive for inbound frames */
     if (LanReceiveAsync())
       return TASK_FINISHED;
 
-    /* Start DHCP and enable the network interface (Ethernet) */
+    /* Start DHCP and enable the network interface (Ethernet), with
+       the lease held before a warm reboot if it is intact */
 #if LWIP_DHCP
-    dhcp_start(&Netif);
-    puts("Network up: Asking DHCP server for address");
+    NetLeaseReboot = (lease->magic == NET_LEASE_MAGIC) &&
+                     (lease->check == net_lease_check(lease));
+    NetBoundReported = FALSE;
+    if (NetLeaseReboot)
+    {
+      net_boot_server(&lease->server);
+      dhcp_start_lease(&Netif, &lease->ipaddr);
+      printf("Network up: Asking DHCP server for %u.%u.%u.%u\n",
+             ip4_addr1(&lease->ipaddr), ip4_addr2(&lease->ipaddr),
+             ip4_addr3(&lease->ipaddr), ip4_addr4(&lease->ipaddr));
+    }
+    else
+    {
+      dhcp_start(&Netif);
+      puts("Network up: Asking DHCP server for address");
+    }
 #else
-    puts("Network up: Static IPv4 address 192.168.1.202");
+    printf("Network up: Static IPv4 address %u.%u.%u.%u\n",
+           ip4_addr1(&Ipaddr), ip4_addr2(&Ipaddr), ip4_addr3(&Ipaddr),
+           ip4_addr4(&Ipaddr));
 #endif
     NetUp = TRUE;
   }
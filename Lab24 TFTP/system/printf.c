@@ -156,7 +156,7 @@ kvprintf(char const *fmt, int (*func)(char), void *arg, int radix, va_list ap)
       if (ch == '\0')
         return retval;
       PCHAR(ch);
-      if (ch == '\n')
+      if ((ch == '\n') && func) /* console new line, not a string */
         PCHAR('\r');
     }
     percent = fmt - 1;
@@ -443,7 +443,7 @@ sprintf(char *buffer, const char *fmt, ...)
   va_list ap;
 
   va_start(ap, fmt);
-  kvprintf(fmt, NULL, (void *)buffer, 10, ap);
+  buffer[kvprintf(fmt, NULL, (void *)buffer, 10, ap)] = '\0';
   va_end(ap);
 }
 
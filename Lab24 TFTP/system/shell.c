@@ -50,7 +50,7 @@
 
 #if ENABLE_SHELL
 
-#define MAX_SHELL_COMMANDS     24
+#define MAX_SHELL_COMMANDS     40
 
 /*
 ** Shell Functions
@@ -67,6 +67,17 @@ extern int MouseUp(const char *command);
 //extern int Echo(char *command);
 extern int NetStart(const char *command);
 extern int Tftp(const char *command);
+extern int Tftpd(const char *command);
+extern int NetTxBench(const char *command);
+extern int NetChecksum(const char *command);
+extern int NetRxStat(const char *command);
+extern int UdpEcho(const char *command);
+extern int Iperf(const char *command);
+extern int NetLog(const char *command);
+extern int Rshell(const char *command);
+#if ENABLE_TCP
+extern int Httpd(const char *command);
+#endif
 #endif
 
 /* local commands */
@@ -198,6 +209,7 @@ static int echo(const char *command)
 /*...................................................................*/
 static int run(const char *command)
 {
+#ifdef __arm__
 #if RPI == 1
   u32 rpi = 0xc42; /* RPI1 hw id as required for Linux kernel boot */
 #elif RPI == 2
@@ -205,6 +217,7 @@ static int run(const char *command)
 #else
   u32 rpi = 0xc44; /* RPI3 hw id as required for Linux kernel boot */
 #endif
+#endif
 
 #if ENABLE_VIDEO
   if (ScreenUp)
@@ -224,7 +237,9 @@ static int run(const char *command)
 #endif
 
   /* assign the machine ID to register one (r1) for other kernels */
+#ifdef __arm__
   asm volatile("mov r1, %0" : : "r" (rpi));
+#endif
   /* what else? why does linux complain about memory size? */
   /* Maybe clear all the memory used by bootloader? */
 
@@ -356,10 +371,32 @@ int ShellInit(void)
   ShellCommands[i].function = MouseUp;
 #endif
 #if ENABLE_NETWORK
+  ShellCommands[++i].command = "netlog"; /* before net, a prefix */
+  ShellCommands[i].function = NetLog;
   ShellCommands[++i].command = "net";
   ShellCommands[i].function = NetStart;
+  ShellCommands[++i].command = "tftpd"; /* before tftp, a prefix */
+  ShellCommands[i].function = Tftpd;
   ShellCommands[++i].command = "tftp";
   ShellCommands[i].function = Tftp;
+  ShellCommands[++i].command = "mtftp"; /* multicast, RFC 2090 */
+  ShellCommands[i].function = Tftp;
+  ShellCommands[++i].command = "txbench";
+  ShellCommands[i].function = NetTxBench;
+  ShellCommands[++i].command = "csum";
+  ShellCommands[i].function = NetChecksum;
+  ShellCommands[++i].command = "rxstat";
+  ShellCommands[i].function = NetRxStat;
+  ShellCommands[++i].command = "udpecho";
+  ShellCommands[i].function = UdpEcho;
+  ShellCommands[++i].command = "iperf";
+  ShellCommands[i].function = Iperf;
+  ShellCommands[++i].command = "rshell";
+  ShellCommands[i].function = Rshell;
+#if ENABLE_TCP
+  ShellCommands[++i].command = "httpd";
+  ShellCommands[i].function = Httpd;
+#endif
 #endif
 #if ENABLE_VIDEO
   ShellCommands[++i].command = "screen";
@@ -544,6 +581,57 @@ int ShellPoll(void *data)
     return TASK_IDLE;
 }
 
+/*...................................................................*/
+/* ShellExecute: Execute the command line of a shell state, with no  */
+/*               echo or prompt, such as for a remote shell          */
+/*                                                                   */
+/*     Input: state = shell state with the command, cmd NULL to start*/
+/*                                                                   */
+/*    return: TASK_IDLE until executed, then TASK_FINISHED           */
+/*...................................................................*/
+int ShellExecute(struct shell_state *state)
+{
+#if ENABLE_OS
+  struct shell_state *std = StdioState;
+
+  /* Output of the command goes to this shell. */
+  StdioState = state;
+#endif
+
+  /* Look up the command when starting. */
+  if (state->cmd == NULL)
+  {
+    state->result = TASK_FINISHED;
+    if ((state->command[0] == '?') && (state->command[1] == '\0'))
+    {
+      int i;
+
+      state->puts("Available commands are:");
+      for (i = 0; ShellCommands[i].command; ++i)
+        state->puts(ShellCommands[i].command);
+    }
+    else if (state->command[0])
+    {
+      state->cmd = shell((char *)state->command);
+      if (state->cmd == NULL)
+        state->puts("command unknown");
+    }
+  }
+
+  /* Execute the command until finished. */
+  if (state->cmd)
+  {
+    state->result = state->cmd->function((char *)state->command);
+    if (state->result == TASK_FINISHED)
+      state->cmd = NULL;
+  }
+
+#if ENABLE_OS
+  StdioState = std;
+#endif
+  return (state->result == TASK_FINISHED) ? TASK_FINISHED : TASK_IDLE;
+}
+
 /*...................................................................*/
 /* SystemShell: system shell executs commands until 'quit'           */
 /*                                                                   */
@@ -222,6 +222,30 @@ void *memcpy(void *dst, const void *src, size_t length)
   return dst;
 }
 
+/*...................................................................*/
+/*   memmove: copy data between regions that may overlap             */
+/*                                                                   */
+/*      Inputs: dst - the destination data region                    */
+/*              src - the source data region                         */
+/*              length - the data length to copy                     */
+/*                                                                   */
+/*     Returns: the dst pointer to the newly copied data             */
+/*...................................................................*/
+void *memmove(void *dst, const void *src, size_t length)
+{
+  u8 *destination = dst;
+  const u8 *source = src;
+
+  // memcpy copies from the start, safe unless dst is within src
+  if ((destination <= source) || (destination >= source + length))
+    return memcpy(dst, src, length);
+
+  // Otherwise copy from the end
+  while (length--)
+    destination[length] = source[length];
+  return dst;
+}
+
 /*...................................................................*/
 /*    memset: assign a memory region to a value                      */
 /*                                                                   */
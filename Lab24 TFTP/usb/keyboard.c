@@ -69,6 +69,11 @@
 #define RIGHT_SHIFT_MODIFIER 0x20
 #define DEFAULT_MODIFIER     1
 
+// A failed report is retried after a delay that grows with each
+// consecutive failure, and the keyboard stops if they continue
+#define MAX_ERRORS           8
+#define ERROR_DELAY          (10 * MICROS_PER_MILLISECOND)
+
 
 /*...................................................................*/
 /* Type Definitions                                                  */
@@ -91,6 +96,7 @@ typedef struct KeyboardDevice
 
   u8 lastPhyCode;
   u32 tmr;
+  u32 errors; // consecutive failed reports
 
   int capsLock;
 }
@@ -434,6 +440,9 @@ static u8 get_key_code(KeyboardDevice *keyboard)
   return 0;
 }
 
+static void submit(KeyboardDevice *keyboard);
+static int retry(u32 id, void *data, void *context);
+
 /*...................................................................*/
 /*  completion: Keyboard URB completion parses keypress events       */
 /*                                                                   */
@@ -474,6 +483,35 @@ static void completion(void *urb, void *param, void *context)
     }
   }
 
+  // Back off after a failure, as a device that is gone or stalled
+  // fails again at once, and stop if the failures continue
+  if (request->status == 0)
+  {
+    if (++keyboard->errors >= MAX_ERRORS)
+    {
+      puts("USB keyboard stopped after repeated errors");
+      FreeRequest(keyboard->urb);
+      keyboard->urb = 0;
+      KeyboardEnabled = FALSE;
+      return;
+    }
+    if (TimerSchedule(keyboard->errors * ERROR_DELAY, retry, keyboard,
+                      NULL))
+      return;
+  }
+  else
+    keyboard->errors = 0;
+
+  submit(keyboard);
+}
+
+/*...................................................................*/
+/* submit: Reattach the URB and submit it for the next report        */
+/*                                                                   */
+/*       Input: keyboard is the keyboard device                      */
+/*...................................................................*/
+static void submit(KeyboardDevice *keyboard)
+{
   // Reuse the URB by releasing it
   RequestRelease(keyboard->urb);
 
@@ -490,6 +528,21 @@ static void completion(void *urb, void *param, void *context)
   HostSubmitAsyncRequest(keyboard->urb, keyboard->device.host, NULL);
 }
 
+/*...................................................................*/
+/* retry: Timer callback to submit the URB after a failed report     */
+/*                                                                   */
+/*       Input: id is unused                                         */
+/*              data is the keyboard device                          */
+/*              context is unused                                    */
+/*                                                                   */
+/*     Returns: TASK_FINISHED                                        */
+/*...................................................................*/
+static int retry(u32 id, void *data, void *context)
+{
+  submit(data);
+  return TASK_FINISHED;
+}
+
 /*...................................................................*/
 /* start_request: Initiate URB for keypress events                   */
 /*                                                                   */
@@ -509,6 +562,7 @@ static int start_request(KeyboardDevice *keyboard)
   keyboard->urb = NewRequest();
   assert(keyboard->urb != 0);
   bzero(keyboard->urb, sizeof(Request));
+  keyboard->errors = 0;
 
   /* Prefer the interrupt endpoint. */
   if (keyboard->interruptEndpoint)
@@ -66,6 +66,11 @@
 /*...................................................................*/
 #define MOUSE_REPORT_SIZE  3
 
+// A failed report is retried after a delay that grows with each
+// consecutive failure, and the mouse stops if they continue
+#define MAX_ERRORS         8
+#define ERROR_DELAY        (10 * MICROS_PER_MILLISECOND)
+
 /*...................................................................*/
 /* Type Definitions                                                  */
 /*...................................................................*/
@@ -88,6 +93,7 @@ typedef struct MouseDevice
 
   Request *urb;
   u8 reportBuffer[MOUSE_REPORT_SIZE];
+  u32 errors; // consecutive failed reports
 }
 MouseDevice;
 
@@ -270,6 +276,9 @@ static int configure(Device *device, void (complete)
   return TRUE;
 }
 
+static void submit(MouseDevice *mouse);
+static int retry(u32 id, void *data, void *context);
+
 /*...................................................................*/
 /*  completion: Mouse URB completion parses mouse events             */
 /*                                                                   */
@@ -301,6 +310,34 @@ static void completion(void *request, void *param, void *context)
               (int)mouse->reportBuffer[2]);
   }
 
+  // Back off after a failure, as a device that is gone or stalled
+  // fails again at once, and stop if the failures continue
+  if (urb->status == 0)
+  {
+    if (++mouse->errors >= MAX_ERRORS)
+    {
+      puts("USB mouse stopped after repeated errors");
+      FreeRequest(mouse->urb);
+      mouse->urb = 0;
+      MouseEnabled = FALSE;
+      return;
+    }
+    if (TimerSchedule(mouse->errors * ERROR_DELAY, retry, mouse, NULL))
+      return;
+  }
+  else
+    mouse->errors = 0;
+
+  submit(mouse);
+}
+
+/*...................................................................*/
+/* submit: Reattach the URB and submit it for the next report        */
+/*                                                                   */
+/*       Input: mouse is the mouse device                            */
+/*...................................................................*/
+static void submit(MouseDevice *mouse)
+{
   // Reuse the URB
   RequestRelease(mouse->urb);
 
@@ -319,6 +356,21 @@ static void completion(void *request, void *param, void *context)
   HostSubmitAsyncRequest(mouse->urb, mouse->device.host, NULL);
 }
 
+/*...................................................................*/
+/* retry: Timer callback to submit the URB after a failed report     */
+/*                                                                   */
+/*       Input: id is unused                                         */
+/*              data is the mouse device                             */
+/*              context is unused                                    */
+/*                                                                   */
+/*     Returns: TASK_FINISHED                                        */
+/*...................................................................*/
+static int retry(u32 id, void *data, void *context)
+{
+  submit(data);
+  return TASK_FINISHED;
+}
+
 /*...................................................................*/
 /* start_request: Initiate URB for mouse events                      */
 /*                                                                   */
@@ -335,6 +387,7 @@ static int start_request(MouseDevice *mouse)
   mouse->urb = NewRequest();
   assert(mouse->urb != 0);
   bzero(mouse->urb, sizeof(Request));
+  mouse->errors = 0;
 
   /* Attach URB to the device, preferring the interrupt endpoint. */
   if (mouse->interruptEndpoint)